@@ -21,15 +21,33 @@
 #define B2_CHAIN_SHAPE_H
 
 #include <Box2D/Collision/Shapes/b2Shape.h>
+#include <Box2D/Common/b2GrowableStack.h>
 
 class b2EdgeShape;
 
+/// A node of the tree over the edges of a chain that uses a single proxy.
+/// Nodes are stored in depth first order, so the first child of a node
+/// directly follows it.
+struct b2ChainTreeNode
+{
+	/// Bounds of the edges below the node, in the frame of the chain.
+	b2AABB aabb;
+
+	/// The edges below the node are begin to end - 1.
+	int32 begin, end;
+
+	/// Index of the second child, or -1 for a leaf.
+	int32 child2;
+};
+
 /// A chain shape is a free form sequence of line segments.
 /// The chain has two-sided collision, so you can use inside and outside collision.
 /// Therefore, you may use any winding order.
 /// Since there may be many vertices, they are allocated using b2Alloc.
 /// Connectivity information is used to create smooth collisions.
 /// WARNING: The chain will not collide properly if there are self-intersections.
+/// By default each edge is a child with its own broad-phase proxy and
+/// contacts. A chain can instead use a single proxy, see SetSingleProxy.
 class b2ChainShape : public b2Shape
 {
 public:
@@ -56,15 +74,36 @@ public:
 	/// Don't call this for loops.
 	void SetNextVertex(const b2Vec2& nextVertex);
 
+	/// Make the whole chain a single child, so that it has one broad-phase
+	/// proxy and one contact per shape it touches. Contacts then find the
+	/// edges they touch in a tree built over the edges, and merge their
+	/// manifolds. This is cheaper for chains with many edges, such as
+	/// terrain. Call this before the chain is added to a fixture.
+	void SetSingleProxy(bool flag);
+
+	/// Does the whole chain use a single broad-phase proxy?
+	bool IsSingleProxy() const;
+
 	/// Implement b2Shape. Vertices are cloned using b2Alloc.
 	b2Shape* Clone(b2BlockAllocator* allocator) const;
 
 	/// @see b2Shape::GetChildCount
 	int32 GetChildCount() const;
 
-	/// Get a child edge.
+	/// Get the number of edges.
+	int32 GetEdgeCount() const;
+
+	/// Get an edge. This is the child edge unless the chain uses a single
+	/// proxy.
 	void GetChildEdge(b2EdgeShape* edge, int32 index) const;
 
+	/// Query the edges of a chain that uses a single proxy for the ones whose
+	/// bounds overlap an AABB in the frame of the chain. Calls
+	/// T::QueryCallback(int32 edgeIndex) for each of them, which returns
+	/// false to end the query.
+	template <typename T>
+	void QueryEdges(T* callback, const b2AABB& aabb) const;
+
 	/// This always return false.
 	/// @see b2Shape::TestPoint
 	bool TestPoint(const b2Transform& transform, const b2Vec2& p) const;
@@ -91,6 +130,17 @@ public:
 
 	b2Vec2 m_prevVertex, m_nextVertex;
 	bool m_hasPrevVertex, m_hasNextVertex;
+
+private:
+
+	void BuildEdgeTree();
+	int32 BuildEdgeNode(int32 begin, int32 end);
+
+	/// The tree over the edges when the chain uses a single proxy,
+	/// otherwise NULL.
+	b2ChainTreeNode* m_edgeTree;
+	int32 m_edgeTreeCount;
+	bool m_singleProxy;
 };
 
 inline b2ChainShape::b2ChainShape()
@@ -101,6 +151,60 @@ inline b2ChainShape::b2ChainShape()
 	m_count = 0;
 	m_hasPrevVertex = false;
 	m_hasNextVertex = false;
+	m_edgeTree = NULL;
+	m_edgeTreeCount = 0;
+	m_singleProxy = false;
+}
+
+inline bool b2ChainShape::IsSingleProxy() const
+{
+	return m_singleProxy;
+}
+
+inline int32 b2ChainShape::GetEdgeCount() const
+{
+	// edge count = vertex count - 1
+	return m_count - 1;
+}
+
+template <typename T>
+inline void b2ChainShape::QueryEdges(T* callback, const b2AABB& aabb) const
+{
+	b2Assert(m_edgeTree != NULL);
+
+	b2GrowableStack<int32, 64> stack;
+	stack.Push(0);
+
+	while (stack.GetCount() > 0)
+	{
+		const b2ChainTreeNode* node = m_edgeTree + stack.Pop();
+		if (b2TestOverlap(node->aabb, aabb) == false)
+		{
+			continue;
+		}
+
+		if (node->child2 == -1)
+		{
+			for (int32 i = node->begin; i < node->end; ++i)
+			{
+				b2Vec2 v1 = m_vertices[i];
+				b2Vec2 v2 = m_vertices[i + 1];
+				b2AABB edgeAABB;
+				edgeAABB.lowerBound = b2Min(v1, v2);
+				edgeAABB.upperBound = b2Max(v1, v2);
+				if (b2TestOverlap(edgeAABB, aabb) &&
+					callback->QueryCallback(i) == false)
+				{
+					return;
+				}
+			}
+		}
+		else
+		{
+			stack.Push(node->child2);
+			stack.Push(int32(node - m_edgeTree) + 1);
+		}
+	}
 }
 
 #endif
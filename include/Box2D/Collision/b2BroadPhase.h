@@ -33,6 +33,9 @@ struct b2Pair
 /// The broad-phase is used for computing pairs and performing volume queries and ray casts.
 /// This broad-phase does not persist pairs. Instead, this reports potentially new pairs.
 /// It is up to the client to consume the new pairs and to track subsequent overlap.
+/// Static proxies are kept in a tree of their own, so moving proxies are not
+/// checked against a tree full of static geometry, and static proxies are
+/// never paired with each other.
 class b2BroadPhase
 {
 public:
@@ -46,8 +49,9 @@ public:
 	~b2BroadPhase();
 
 	/// Create a proxy with an initial AABB. Pairs are not reported until
-	/// UpdatePairs is called.
-	int32 CreateProxy(const b2AABB& aabb, void* userData);
+	/// UpdatePairs is called. Static proxies are not expected to move and
+	/// are never paired with other static proxies.
+	int32 CreateProxy(const b2AABB& aabb, void* userData, bool isStatic);
 
 	/// Destroy a proxy. It is up to the client to remove any pairs.
 	void DestroyProxy(int32 proxyId);
@@ -90,30 +94,128 @@ public:
 	template <typename T>
 	void RayCast(T* callback, const b2RayCastInput& input) const;
 
-	/// Get the height of the embedded tree.
+	/// Get the height of the taller of the embedded trees.
 	int32 GetTreeHeight() const;
 
-	/// Get the balance of the embedded tree.
+	/// Get the balance of the less balanced of the embedded trees.
 	int32 GetTreeBalance() const;
 
-	/// Get the quality metric of the embedded tree.
+	/// Get the quality metric of the worse of the embedded trees.
 	float32 GetTreeQuality() const;
 
+	/// Rebuild the embedded trees top down. This is worth doing after many
+	/// proxies were created at once.
+	void RebuildTrees();
+
+	/// Set the number of leaves of the tree of non-static proxies that each
+	/// call to UpdatePairs rebuilds. Zero, the default, turns this off.
+	void SetRebuildBudget(int32 leafBudget);
+
+	/// Get the number of leaves rebuilt by each call to UpdatePairs.
+	int32 GetRebuildBudget() const;
+
+	/// Set whether the trees refit moved proxies in place.
+	/// @see b2DynamicTree::SetRefitMode
+	void SetRefitMode(bool flag);
+
+	/// Get whether the trees refit moved proxies in place.
+	bool GetRefitMode() const;
+
+	/// Set whether queries and ray casts use wide copies of the trees.
+	/// UpdatePairs brings the copies up to date before it looks for pairs.
+	/// In refit mode the copy of a tree whose proxies only moved is refit
+	/// rather than built again.
+	void SetWideQueries(bool flag);
+
+	/// Get whether queries and ray casts use wide copies of the trees.
+	bool GetWideQueries() const;
+
+	/// Set whether the trees fatten AABBs by adaptive margins.
+	/// @see b2DynamicTree::SetAdaptiveMargins
+	void SetAdaptiveMargins(bool flag);
+
+	/// Get whether the trees fatten AABBs by adaptive margins.
+	bool GetAdaptiveMargins() const;
+
+	/// Get the number of times MoveProxy changed a fat AABB since the
+	/// counters were last reset.
+	int32 GetReinsertCount() const;
+
+	/// Get the number of pairs UpdatePairs reported since the counters were
+	/// last reset.
+	int32 GetReportedPairCount() const;
+
+	/// Reset the reinsert and pair counters.
+	void ResetCounters();
+
 	/// Shift the world origin. Useful for large worlds.
 	/// The shift formula is: position -= newOrigin
 	/// @param newOrigin the new origin with respect to the old origin
 	void ShiftOrigin(const b2Vec2& newOrigin);
 
+	/// Write the trees and the proxies waiting for UpdatePairs, so that
+	/// RestoreState can put the broad-phase back as it was.
+	void CaptureState(b2BinaryWriter* writer) const;
+
+	/// Read the state written by CaptureState.
+	void RestoreState(b2BinaryReader* reader);
+
 private:
 
 	friend class b2DynamicTree;
 
+	/// Forwards the proxies found in one of the trees to a query callback.
+	template <typename T>
+	struct QueryWrapper
+	{
+		bool QueryCallback(int32 treeProxyId)
+		{
+			proceed = callback->QueryCallback(GetProxyId(treeProxyId, isStatic));
+			return proceed;
+		}
+
+		T* callback;
+		bool isStatic;
+		bool proceed;
+	};
+
+	/// Forwards the proxies hit in one of the trees to a ray-cast callback,
+	/// keeping track of how far the ray was clipped.
+	template <typename T>
+	struct RayCastWrapper
+	{
+		float32 RayCastCallback(const b2RayCastInput& input, int32 treeProxyId)
+		{
+			float32 value = callback->RayCastCallback(input, GetProxyId(treeProxyId, isStatic));
+			if (value >= 0.0f)
+			{
+				maxFraction = value;
+			}
+			return value;
+		}
+
+		T* callback;
+		bool isStatic;
+		float32 maxFraction;
+	};
+
+	// Proxy ids hold the id of the proxy within its tree and a bit telling
+	// which tree that is.
+	static int32 GetProxyId(int32 treeProxyId, bool isStatic);
+	static int32 GetTreeProxyId(int32 proxyId);
+	static bool IsStaticProxy(int32 proxyId);
+	b2DynamicTree* GetTree(int32 proxyId);
+	const b2DynamicTree* GetTree(int32 proxyId) const;
+
 	void BufferMove(int32 proxyId);
 	void UnBufferMove(int32 proxyId);
 
-	bool QueryCallback(int32 proxyId);
+	bool QueryCallback(int32 treeProxyId);
+
+	void SortPairs();
 
 	b2DynamicTree m_tree;
+	b2DynamicTree m_staticTree;
 
 	int32 m_proxyCount;
 
@@ -125,7 +227,18 @@ private:
 	int32 m_pairCapacity;
 	int32 m_pairCount;
 
+	/// Scratch space for sorting m_pairBuffer.
+	b2Pair* m_sortBuffer;
+	int32 m_sortCapacity;
+
 	int32 m_queryProxyId;
+	bool m_queryStatic;
+
+	int32 m_rebuildBudget;
+	bool m_wideQueries;
+
+	int32 m_reinsertCount;
+	int32 m_reportedPairCount;
 };
 
 /// This is used to sort pairs.
@@ -144,21 +257,46 @@ inline bool b2PairLessThan(const b2Pair& pair1, const b2Pair& pair2)
 	return false;
 }
 
+inline int32 b2BroadPhase::GetProxyId(int32 treeProxyId, bool isStatic)
+{
+	return (treeProxyId << 1) | (isStatic ? 1 : 0);
+}
+
+inline int32 b2BroadPhase::GetTreeProxyId(int32 proxyId)
+{
+	return proxyId >> 1;
+}
+
+inline bool b2BroadPhase::IsStaticProxy(int32 proxyId)
+{
+	return (proxyId & 1) != 0;
+}
+
+inline b2DynamicTree* b2BroadPhase::GetTree(int32 proxyId)
+{
+	return IsStaticProxy(proxyId) ? &m_staticTree : &m_tree;
+}
+
+inline const b2DynamicTree* b2BroadPhase::GetTree(int32 proxyId) const
+{
+	return IsStaticProxy(proxyId) ? &m_staticTree : &m_tree;
+}
+
 inline void* b2BroadPhase::GetUserData(int32 proxyId) const
 {
-	return m_tree.GetUserData(proxyId);
+	return GetTree(proxyId)->GetUserData(GetTreeProxyId(proxyId));
 }
 
 inline bool b2BroadPhase::TestOverlap(int32 proxyIdA, int32 proxyIdB) const
 {
-	const b2AABB& aabbA = m_tree.GetFatAABB(proxyIdA);
-	const b2AABB& aabbB = m_tree.GetFatAABB(proxyIdB);
+	const b2AABB& aabbA = GetFatAABB(proxyIdA);
+	const b2AABB& aabbB = GetFatAABB(proxyIdB);
 	return b2TestOverlap(aabbA, aabbB);
 }
 
 inline const b2AABB& b2BroadPhase::GetFatAABB(int32 proxyId) const
 {
-	return m_tree.GetFatAABB(proxyId);
+	return GetTree(proxyId)->GetFatAABB(GetTreeProxyId(proxyId));
 }
 
 inline int32 b2BroadPhase::GetProxyCount() const
@@ -168,17 +306,17 @@ inline int32 b2BroadPhase::GetProxyCount() const
 
 inline int32 b2BroadPhase::GetTreeHeight() const
 {
-	return m_tree.GetHeight();
+	return b2Max(m_tree.GetHeight(), m_staticTree.GetHeight());
 }
 
 inline int32 b2BroadPhase::GetTreeBalance() const
 {
-	return m_tree.GetMaxBalance();
+	return b2Max(m_tree.GetMaxBalance(), m_staticTree.GetMaxBalance());
 }
 
 inline float32 b2BroadPhase::GetTreeQuality() const
 {
-	return m_tree.GetAreaRatio();
+	return b2Max(m_tree.GetAreaRatio(), m_staticTree.GetAreaRatio());
 }
 
 template <typename T>
@@ -187,6 +325,17 @@ void b2BroadPhase::UpdatePairs(T* callback)
 	// Reset pair buffer
 	m_pairCount = 0;
 
+	// Build or refit the wide copies before the queries of the moved
+	// proxies, which are most of the queries of a step.
+	if (m_wideQueries && m_staticTree.HasWideTree() == false)
+	{
+		m_staticTree.BuildWideTree();
+	}
+	if (m_wideQueries && m_tree.HasWideTree() == false)
+	{
+		m_tree.BuildWideTree();
+	}
+
 	// Perform tree queries for all moving proxies.
 	for (int32 i = 0; i < m_moveCount; ++i)
 	{
@@ -198,27 +347,36 @@ void b2BroadPhase::UpdatePairs(T* callback)
 
 		// We have to query the tree with the fat AABB so that
 		// we don't fail to create a pair that may touch later.
-		const b2AABB& fatAABB = m_tree.GetFatAABB(m_queryProxyId);
+		const b2AABB& fatAABB = GetFatAABB(m_queryProxyId);
 
-		// Query tree, create pairs and add them pair buffer.
+		// Query the trees, create pairs and add them pair buffer. Static
+		// proxies don't pair with each other, so only proxies that can
+		// move query the static tree.
+		m_queryStatic = false;
 		m_tree.Query(this, fatAABB);
+		if (IsStaticProxy(m_queryProxyId) == false)
+		{
+			m_queryStatic = true;
+			m_staticTree.Query(this, fatAABB);
+		}
 	}
 
 	// Reset move buffer
 	m_moveCount = 0;
 
 	// Sort the pair buffer to expose duplicates.
-	std::sort(m_pairBuffer, m_pairBuffer + m_pairCount, b2PairLessThan);
+	SortPairs();
 
 	// Send the pairs back to the client.
 	int32 i = 0;
 	while (i < m_pairCount)
 	{
 		b2Pair* primaryPair = m_pairBuffer + i;
-		void* userDataA = m_tree.GetUserData(primaryPair->proxyIdA);
-		void* userDataB = m_tree.GetUserData(primaryPair->proxyIdB);
+		void* userDataA = GetUserData(primaryPair->proxyIdA);
+		void* userDataB = GetUserData(primaryPair->proxyIdB);
 
 		callback->AddPair(userDataA, userDataB);
+		++m_reportedPairCount;
 		++i;
 
 		// Skip any duplicate pairs.
@@ -234,24 +392,112 @@ void b2BroadPhase::UpdatePairs(T* callback)
 	}
 
 	// Try to keep the tree balanced.
-	//m_tree.Rebalance(4);
+	if (m_rebuildBudget > 0)
+	{
+		m_tree.RebuildIncremental(m_rebuildBudget);
+	}
 }
 
 template <typename T>
 inline void b2BroadPhase::Query(T* callback, const b2AABB& aabb) const
 {
-	m_tree.Query(callback, aabb);
+	QueryWrapper<T> wrapper;
+	wrapper.callback = callback;
+	wrapper.isStatic = false;
+	wrapper.proceed = true;
+	m_tree.Query(&wrapper, aabb);
+	if (wrapper.proceed == false)
+	{
+		return;
+	}
+
+	wrapper.isStatic = true;
+	m_staticTree.Query(&wrapper, aabb);
 }
 
 template <typename T>
 inline void b2BroadPhase::RayCast(T* callback, const b2RayCastInput& input) const
 {
-	m_tree.RayCast(callback, input);
+	RayCastWrapper<T> wrapper;
+	wrapper.callback = callback;
+	wrapper.isStatic = false;
+	wrapper.maxFraction = input.maxFraction;
+	m_tree.RayCast(&wrapper, input);
+	if (wrapper.maxFraction == 0.0f)
+	{
+		return;
+	}
+
+	// Cast the part of the ray that wasn't clipped against the static tree.
+	b2RayCastInput staticInput = input;
+	staticInput.maxFraction = wrapper.maxFraction;
+	wrapper.isStatic = true;
+	m_staticTree.RayCast(&wrapper, staticInput);
+}
+
+inline void b2BroadPhase::RebuildTrees()
+{
+	m_tree.RebuildTopDown();
+	m_staticTree.RebuildTopDown();
+}
+
+inline void b2BroadPhase::SetRebuildBudget(int32 leafBudget)
+{
+	m_rebuildBudget = leafBudget;
+}
+
+inline int32 b2BroadPhase::GetRebuildBudget() const
+{
+	return m_rebuildBudget;
+}
+
+inline void b2BroadPhase::SetRefitMode(bool flag)
+{
+	m_tree.SetRefitMode(flag);
+	m_staticTree.SetRefitMode(flag);
+}
+
+inline bool b2BroadPhase::GetRefitMode() const
+{
+	return m_tree.GetRefitMode();
+}
+
+inline bool b2BroadPhase::GetWideQueries() const
+{
+	return m_wideQueries;
+}
+
+inline void b2BroadPhase::SetAdaptiveMargins(bool flag)
+{
+	m_tree.SetAdaptiveMargins(flag);
+	m_staticTree.SetAdaptiveMargins(flag);
+}
+
+inline bool b2BroadPhase::GetAdaptiveMargins() const
+{
+	return m_tree.GetAdaptiveMargins();
+}
+
+inline int32 b2BroadPhase::GetReinsertCount() const
+{
+	return m_reinsertCount;
+}
+
+inline int32 b2BroadPhase::GetReportedPairCount() const
+{
+	return m_reportedPairCount;
+}
+
+inline void b2BroadPhase::ResetCounters()
+{
+	m_reinsertCount = 0;
+	m_reportedPairCount = 0;
 }
 
 inline void b2BroadPhase::ShiftOrigin(const b2Vec2& newOrigin)
 {
 	m_tree.ShiftOrigin(newOrigin);
+	m_staticTree.ShiftOrigin(newOrigin);
 }
 
 #endif
@@ -28,6 +28,7 @@
 
 class b2Shape;
 class b2CircleShape;
+class b2ChainShape;
 class b2EdgeShape;
 class b2PolygonShape;
 
@@ -240,6 +241,14 @@ void b2CollideEdgeAndPolygon(b2Manifold* manifold,
 							   const b2EdgeShape* edgeA, const b2Transform& xfA,
 							   const b2PolygonShape* circleB, const b2Transform& xfB);
 
+/// Compute the collision manifold between a chain that uses a single proxy
+/// and a circle or polygon. The manifolds of the edges that touch the shape
+/// are merged into one, which keeps the deepest point and a point far from
+/// it with the same normal.
+void b2CollideChainEdges(b2Manifold* manifold,
+						 const b2ChainShape* chainA, const b2Transform& xfA,
+						 const b2Shape* shapeB, const b2Transform& xfB);
+
 /// Clipping for contact manifolds.
 int32 b2ClipSegmentToLine(b2ClipVertex vOut[2], const b2ClipVertex vIn[2],
 							const b2Vec2& normal, float32 offset, int32 vertexIndexA);
@@ -22,8 +22,24 @@
 #include <Box2D/Collision/b2Collision.h>
 #include <Box2D/Common/b2GrowableStack.h>
 
+// The children of a wide node are tested with SSE or NEON when there are
+// four of them.
+#if b2_wideTreeLanes == 4
+#if defined(LIQUIDFUN_SIMD_NEON)
+#include <arm_neon.h>
+#define B2_WIDE_TREE_NEON 1
+#elif defined(__SSE__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define B2_WIDE_TREE_SSE 1
+#endif
+#endif // b2_wideTreeLanes == 4
+
 #define b2_nullNode (-1)
 
+class b2BinaryReader;
+class b2BinaryWriter;
+
 /// A node in the dynamic tree. The client does not interact with this directly.
 struct b2TreeNode
 {
@@ -48,6 +64,23 @@ struct b2TreeNode
 
 	// leaf = 0, free node = -1
 	int32 height;
+
+	/// Recent displacement of a leaf, used by adaptive margins.
+	float32 motion;
+};
+
+/// A node in the wide layout of a dynamic tree. The AABBs of the children
+/// are stored by coordinate, so that all of them can be tested at once.
+struct b2WideTreeNode
+{
+	float32 lowerX[b2_wideTreeLanes];
+	float32 lowerY[b2_wideTreeLanes];
+	float32 upperX[b2_wideTreeLanes];
+	float32 upperY[b2_wideTreeLanes];
+
+	/// The index of a wide node, the proxy id of a leaf encoded by
+	/// b2DynamicTree, or b2_nullNode for an unused lane.
+	int32 children[b2_wideTreeLanes];
 };
 
 /// A dynamic AABB tree broad-phase, inspired by Nathanael Presson's btDbvt.
@@ -74,9 +107,9 @@ public:
 	void DestroyProxy(int32 proxyId);
 
 	/// Move a proxy with a swepted AABB. If the proxy has moved outside of its fattened AABB,
-	/// then the proxy is removed from the tree and re-inserted. Otherwise
-	/// the function returns immediately.
-	/// @return true if the proxy was re-inserted.
+	/// then the proxy is removed from the tree and re-inserted, or refit in
+	/// refit mode. Otherwise the function returns immediately.
+	/// @return true if the proxy's fat AABB was changed.
 	bool MoveProxy(int32 proxyId, const b2AABB& aabb1, const b2Vec2& displacement);
 
 	/// Get proxy user data.
@@ -118,11 +151,62 @@ public:
 	/// Build an optimal tree. Very expensive. For testing.
 	void RebuildBottomUp();
 
+	/// Rebuild the tree from its leaves, splitting the leaves of each node
+	/// where a binned surface area heuristic is lowest. This takes
+	/// O(n log n) time, so it can be used to bulk load the tree. Proxy ids
+	/// don't change.
+	void RebuildTopDown();
+
+	/// Rebuild a subtree of at most leafBudget leaves the way RebuildTopDown
+	/// does. Each call picks a different subtree, so calling this every time
+	/// step gradually rebuilds the whole tree.
+	/// @return the number of leaves in the rebuilt subtree.
+	int32 RebuildIncremental(int32 leafBudget);
+
+	/// In refit mode MoveProxy enlarges or shrinks the ancestors of a proxy
+	/// in place instead of re-inserting it. This is cheaper but the tree
+	/// gets worse as proxies move, so it should be rebuilt now and then.
+	void SetRefitMode(bool flag);
+
+	/// Get the refit mode.
+	bool GetRefitMode() const;
+
+	/// With adaptive margins MoveProxy fattens each AABB by a margin that
+	/// follows the recent displacement of the proxy, and looks further
+	/// ahead along the displacement. Proxies that keep moving are
+	/// re-inserted less often and slow ones get tighter AABBs, which create
+	/// fewer pairs.
+	void SetAdaptiveMargins(bool flag);
+
+	/// Are adaptive margins enabled?
+	bool GetAdaptiveMargins() const;
+
+	/// Build a copy of the tree whose nodes have up to b2_wideTreeLanes
+	/// children, for query heavy phases. Query and RayCast use the copy
+	/// until the proxies in the tree change. Rebuilding the tree doesn't
+	/// invalidate the copy. When the proxies were only moved in refit mode
+	/// since the copy was built, the copy is refit instead.
+	void BuildWideTree();
+
+	/// Stop using the wide copy of the tree.
+	void ClearWideTree();
+
+	/// Is there a wide copy of the tree that's up to date?
+	bool HasWideTree() const;
+
 	/// Shift the world origin. Useful for large worlds.
 	/// The shift formula is: position -= newOrigin
 	/// @param newOrigin the new origin with respect to the old origin
 	void ShiftOrigin(const b2Vec2& newOrigin);
 
+	/// Write the nodes of the tree, including its free list and its wide
+	/// copy, so that RestoreState can put the tree back as it was.
+	void CaptureState(b2BinaryWriter* writer) const;
+
+	/// Read the nodes written by CaptureState. Proxy user data is restored
+	/// as it was, so it must still be valid.
+	void RestoreState(b2BinaryReader* reader);
+
 private:
 
 	int32 AllocateNode();
@@ -133,6 +217,34 @@ private:
 
 	int32 Balance(int32 index);
 
+	template <typename T>
+	void QueryWide(T* callback, const b2AABB& aabb) const;
+
+	template <typename T>
+	void RayCastWide(T* callback, const b2RayCastInput& input) const;
+
+	int32 BuildWideNode(int32 index);
+	void RefitWideTree();
+
+	/// Get a mask of the children of node whose AABBs overlap aabb.
+	static uint32 TestWideOverlap(const b2WideTreeNode* node,
+								  const b2AABB& aabb);
+
+	/// Get a mask of the children of node whose AABBs overlap
+	/// segmentAABB and straddle the line through p1 normal to v.
+	static uint32 TestWideSegment(const b2WideTreeNode* node,
+								  const b2AABB& segmentAABB,
+								  const b2Vec2& p1, const b2Vec2& v,
+								  const b2Vec2& abs_v);
+
+	// Leaf children of wide nodes are told apart from wide nodes by sign.
+	static int32 GetWideLeaf(int32 proxyId);
+	static int32 GetWideLeafProxyId(int32 child);
+
+	int32 CollectLeaves(int32 index, int32* leaves);
+	int32 BuildTopDown(int32* leaves, int32 count);
+	void RefitAncestors(int32 index);
+
 	int32 ComputeHeight() const;
 	int32 ComputeHeight(int32 nodeId) const;
 
@@ -151,8 +263,59 @@ private:
 	uint32 m_path;
 
 	int32 m_insertionCount;
+
+	bool m_refitMode;
+	bool m_adaptiveMargins;
+
+	b2WideTreeNode* m_wideNodes;
+	int32 m_wideNodeCount;
+	int32 m_wideNodeCapacity;
+	int32 m_wideRoot;
+	/// Whether proxies were moved in refit mode since the wide copy was
+	/// built. The copy keeps its structure but needs a refit.
+	bool m_wideTreeStale;
 };
 
+inline void b2DynamicTree::SetRefitMode(bool flag)
+{
+	m_refitMode = flag;
+}
+
+inline bool b2DynamicTree::GetRefitMode() const
+{
+	return m_refitMode;
+}
+
+inline void b2DynamicTree::SetAdaptiveMargins(bool flag)
+{
+	m_adaptiveMargins = flag;
+}
+
+inline bool b2DynamicTree::GetAdaptiveMargins() const
+{
+	return m_adaptiveMargins;
+}
+
+inline void b2DynamicTree::ClearWideTree()
+{
+	m_wideRoot = b2_nullNode;
+}
+
+inline bool b2DynamicTree::HasWideTree() const
+{
+	return m_wideRoot != b2_nullNode && m_wideTreeStale == false;
+}
+
+inline int32 b2DynamicTree::GetWideLeaf(int32 proxyId)
+{
+	return -2 - proxyId;
+}
+
+inline int32 b2DynamicTree::GetWideLeafProxyId(int32 child)
+{
+	return -2 - child;
+}
+
 inline void* b2DynamicTree::GetUserData(int32 proxyId) const
 {
 	b2Assert(0 <= proxyId && proxyId < m_nodeCapacity);
@@ -168,6 +331,12 @@ inline const b2AABB& b2DynamicTree::GetFatAABB(int32 proxyId) const
 template <typename T>
 inline void b2DynamicTree::Query(T* callback, const b2AABB& aabb) const
 {
+	if (HasWideTree())
+	{
+		QueryWide(callback, aabb);
+		return;
+	}
+
 	b2GrowableStack<int32, 256> stack;
 	stack.Push(m_root);
 
@@ -203,6 +372,12 @@ inline void b2DynamicTree::Query(T* callback, const b2AABB& aabb) const
 template <typename T>
 inline void b2DynamicTree::RayCast(T* callback, const b2RayCastInput& input) const
 {
+	if (HasWideTree())
+	{
+		RayCastWide(callback, input);
+		return;
+	}
+
 	b2Vec2 p1 = input.p1;
 	b2Vec2 p2 = input.p2;
 	b2Vec2 r = p2 - p1;
@@ -286,4 +461,216 @@ inline void b2DynamicTree::RayCast(T* callback, const b2RayCastInput& input) con
 	}
 }
 
+inline uint32 b2DynamicTree::TestWideOverlap(const b2WideTreeNode* node,
+											 const b2AABB& aabb)
+{
+#if defined(B2_WIDE_TREE_SSE)
+	__m128 overlap = _mm_and_ps(
+		_mm_and_ps(
+			_mm_cmple_ps(_mm_set1_ps(aabb.lowerBound.x), _mm_loadu_ps(node->upperX)),
+			_mm_cmple_ps(_mm_set1_ps(aabb.lowerBound.y), _mm_loadu_ps(node->upperY))),
+		_mm_and_ps(
+			_mm_cmple_ps(_mm_loadu_ps(node->lowerX), _mm_set1_ps(aabb.upperBound.x)),
+			_mm_cmple_ps(_mm_loadu_ps(node->lowerY), _mm_set1_ps(aabb.upperBound.y))));
+	return (uint32)_mm_movemask_ps(overlap);
+#elif defined(B2_WIDE_TREE_NEON)
+	uint32x4_t overlap = vandq_u32(
+		vandq_u32(
+			vcleq_f32(vdupq_n_f32(aabb.lowerBound.x), vld1q_f32(node->upperX)),
+			vcleq_f32(vdupq_n_f32(aabb.lowerBound.y), vld1q_f32(node->upperY))),
+		vandq_u32(
+			vcleq_f32(vld1q_f32(node->lowerX), vdupq_n_f32(aabb.upperBound.x)),
+			vcleq_f32(vld1q_f32(node->lowerY), vdupq_n_f32(aabb.upperBound.y))));
+	static const uint32 bits[4] = {1, 2, 4, 8};
+	uint32x4_t mask = vandq_u32(overlap, vld1q_u32(bits));
+	return vgetq_lane_u32(mask, 0) | vgetq_lane_u32(mask, 1) |
+		   vgetq_lane_u32(mask, 2) | vgetq_lane_u32(mask, 3);
+#else
+	uint32 overlap = 0;
+	for (int32 i = 0; i < b2_wideTreeLanes; ++i)
+	{
+		uint32 lane = (aabb.lowerBound.x <= node->upperX[i]) &
+					  (aabb.lowerBound.y <= node->upperY[i]) &
+					  (node->lowerX[i] <= aabb.upperBound.x) &
+					  (node->lowerY[i] <= aabb.upperBound.y);
+		overlap |= lane << i;
+	}
+	return overlap;
+#endif
+}
+
+inline uint32 b2DynamicTree::TestWideSegment(const b2WideTreeNode* node,
+											 const b2AABB& segmentAABB,
+											 const b2Vec2& p1, const b2Vec2& v,
+											 const b2Vec2& abs_v)
+{
+	uint32 overlap = TestWideOverlap(node, segmentAABB);
+	if (overlap == 0)
+	{
+		return 0;
+	}
+
+#if defined(B2_WIDE_TREE_SSE)
+	__m128 lowerX = _mm_loadu_ps(node->lowerX);
+	__m128 lowerY = _mm_loadu_ps(node->lowerY);
+	__m128 upperX = _mm_loadu_ps(node->upperX);
+	__m128 upperY = _mm_loadu_ps(node->upperY);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 cx = _mm_mul_ps(half, _mm_add_ps(lowerX, upperX));
+	__m128 cy = _mm_mul_ps(half, _mm_add_ps(lowerY, upperY));
+	__m128 hx = _mm_mul_ps(half, _mm_sub_ps(upperX, lowerX));
+	__m128 hy = _mm_mul_ps(half, _mm_sub_ps(upperY, lowerY));
+	__m128 distance = _mm_add_ps(
+		_mm_mul_ps(_mm_set1_ps(v.x), _mm_sub_ps(_mm_set1_ps(p1.x), cx)),
+		_mm_mul_ps(_mm_set1_ps(v.y), _mm_sub_ps(_mm_set1_ps(p1.y), cy)));
+	__m128 extent = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(abs_v.x), hx),
+							   _mm_mul_ps(_mm_set1_ps(abs_v.y), hy));
+	__m128 separation = _mm_sub_ps(
+		_mm_andnot_ps(_mm_set1_ps(-0.0f), distance), extent);
+	uint32 straddle = (uint32)_mm_movemask_ps(
+		_mm_cmple_ps(separation, _mm_setzero_ps()));
+#elif defined(B2_WIDE_TREE_NEON)
+	float32x4_t lowerX = vld1q_f32(node->lowerX);
+	float32x4_t lowerY = vld1q_f32(node->lowerY);
+	float32x4_t upperX = vld1q_f32(node->upperX);
+	float32x4_t upperY = vld1q_f32(node->upperY);
+	float32x4_t half = vdupq_n_f32(0.5f);
+	float32x4_t cx = vmulq_f32(half, vaddq_f32(lowerX, upperX));
+	float32x4_t cy = vmulq_f32(half, vaddq_f32(lowerY, upperY));
+	float32x4_t hx = vmulq_f32(half, vsubq_f32(upperX, lowerX));
+	float32x4_t hy = vmulq_f32(half, vsubq_f32(upperY, lowerY));
+	float32x4_t distance = vaddq_f32(
+		vmulq_f32(vdupq_n_f32(v.x), vsubq_f32(vdupq_n_f32(p1.x), cx)),
+		vmulq_f32(vdupq_n_f32(v.y), vsubq_f32(vdupq_n_f32(p1.y), cy)));
+	float32x4_t extent = vaddq_f32(vmulq_f32(vdupq_n_f32(abs_v.x), hx),
+								   vmulq_f32(vdupq_n_f32(abs_v.y), hy));
+	float32x4_t separation = vsubq_f32(vabsq_f32(distance), extent);
+	static const uint32 bits[4] = {1, 2, 4, 8};
+	uint32x4_t mask = vandq_u32(vcleq_f32(separation, vdupq_n_f32(0.0f)),
+								vld1q_u32(bits));
+	uint32 straddle = vgetq_lane_u32(mask, 0) | vgetq_lane_u32(mask, 1) |
+					  vgetq_lane_u32(mask, 2) | vgetq_lane_u32(mask, 3);
+#else
+	uint32 straddle = 0;
+	for (int32 i = 0; i < b2_wideTreeLanes; ++i)
+	{
+		float32 cx = 0.5f * (node->lowerX[i] + node->upperX[i]);
+		float32 cy = 0.5f * (node->lowerY[i] + node->upperY[i]);
+		float32 hx = 0.5f * (node->upperX[i] - node->lowerX[i]);
+		float32 hy = 0.5f * (node->upperY[i] - node->lowerY[i]);
+		float32 separation = b2Abs(v.x * (p1.x - cx) + v.y * (p1.y - cy)) -
+							 (abs_v.x * hx + abs_v.y * hy);
+		straddle |= (uint32)(separation <= 0.0f) << i;
+	}
+#endif
+	return overlap & straddle;
+}
+
+template <typename T>
+inline void b2DynamicTree::QueryWide(T* callback, const b2AABB& aabb) const
+{
+	b2GrowableStack<int32, 256> stack;
+	stack.Push(m_wideRoot);
+
+	while (stack.GetCount() > 0)
+	{
+		const b2WideTreeNode* node = m_wideNodes + stack.Pop();
+
+		// Test all the children together. Unused lanes never overlap.
+		uint32 overlap = TestWideOverlap(node, aabb);
+		for (int32 i = 0; i < b2_wideTreeLanes; ++i)
+		{
+			if ((overlap & (1 << i)) == 0)
+			{
+				continue;
+			}
+
+			int32 child = node->children[i];
+			if (child >= 0)
+			{
+				stack.Push(child);
+				continue;
+			}
+
+			bool proceed = callback->QueryCallback(GetWideLeafProxyId(child));
+			if (proceed == false)
+			{
+				return;
+			}
+		}
+	}
+}
+
+template <typename T>
+inline void b2DynamicTree::RayCastWide(T* callback, const b2RayCastInput& input) const
+{
+	b2Vec2 p1 = input.p1;
+	b2Vec2 p2 = input.p2;
+	b2Vec2 r = p2 - p1;
+	b2Assert(r.LengthSquared() > 0.0f);
+	r.Normalize();
+
+	// v is perpendicular to the segment.
+	b2Vec2 v = b2Cross(1.0f, r);
+	b2Vec2 abs_v = b2Abs(v);
+
+	float32 maxFraction = input.maxFraction;
+
+	// Build a bounding box for the segment.
+	b2AABB segmentAABB;
+	{
+		b2Vec2 t = p1 + maxFraction * (p2 - p1);
+		segmentAABB.lowerBound = b2Min(p1, t);
+		segmentAABB.upperBound = b2Max(p1, t);
+	}
+
+	b2GrowableStack<int32, 256> stack;
+	stack.Push(m_wideRoot);
+
+	while (stack.GetCount() > 0)
+	{
+		const b2WideTreeNode* node = m_wideNodes + stack.Pop();
+
+		// Test the children against the segment bounding box and the
+		// separating axis of the segment together.
+		uint32 hit = TestWideSegment(node, segmentAABB, p1, v, abs_v);
+		for (int32 i = 0; i < b2_wideTreeLanes; ++i)
+		{
+			if ((hit & (1 << i)) == 0)
+			{
+				continue;
+			}
+
+			int32 child = node->children[i];
+			if (child >= 0)
+			{
+				stack.Push(child);
+				continue;
+			}
+
+			b2RayCastInput subInput;
+			subInput.p1 = input.p1;
+			subInput.p2 = input.p2;
+			subInput.maxFraction = maxFraction;
+
+			float32 value = callback->RayCastCallback(subInput, GetWideLeafProxyId(child));
+
+			if (value == 0.0f)
+			{
+				// The client has terminated the ray cast.
+				return;
+			}
+
+			if (value > 0.0f)
+			{
+				// Update segment bounding box.
+				maxFraction = value;
+				b2Vec2 t = p1 + maxFraction * (p2 - p1);
+				segmentAABB.lowerBound = b2Min(p1, t);
+				segmentAABB.upperBound = b2Max(p1, t);
+			}
+		}
+	}
+}
+
 #endif
@@ -0,0 +1,167 @@
+/*
+* Copyright (c) 2014 Google, Inc.
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef B2_BINARY_STREAM_H
+#define B2_BINARY_STREAM_H
+
+#include <Box2D/Common/b2Settings.h>
+#include <string.h>
+
+/// Appends values, in their in-memory representation, to a buffer owned by
+/// the caller. Values that don't fit are counted but not written, so that
+/// a writer over a NULL buffer measures the size of the data.
+class b2BinaryWriter
+{
+public:
+	b2BinaryWriter(void* data, int32 capacity) :
+		m_data((uint8*)data),
+		m_capacity(capacity),
+		m_size(0)
+	{
+	}
+
+	void Write(const void* data, int32 size)
+	{
+		if (size > 0 && m_size + size <= m_capacity)
+		{
+			memcpy(m_data + m_size, data, size);
+		}
+		m_size += size;
+	}
+
+	template <typename T>
+	void Write(const T& value)
+	{
+		Write(&value, sizeof(T));
+	}
+
+	template <typename T>
+	void WriteArray(const T* values, int32 count)
+	{
+		Write(values, count * sizeof(T));
+	}
+
+	/// Get the size of everything written so far, including what didn't fit.
+	int32 GetSize() const
+	{
+		return m_size;
+	}
+
+	/// Whether some of the data didn't fit in the buffer.
+	bool HasOverflowed() const
+	{
+		return m_size > m_capacity;
+	}
+
+private:
+	uint8* m_data;
+	int32 m_capacity;
+	int32 m_size;
+};
+
+/// Reads values written by b2BinaryWriter. Reading past the end of the data
+/// fails the reader; values read after that are zero.
+class b2BinaryReader
+{
+public:
+	b2BinaryReader(const void* data, int32 size) :
+		m_data((const uint8*)data),
+		m_size(size),
+		m_position(0),
+		m_failed(false)
+	{
+	}
+
+	/// Get a pointer to the next size bytes and skip them, so that large
+	/// arrays can be copied straight from the data, such as from a memory
+	/// mapped file. The pointer may not be aligned.
+	/// @return the bytes, or NULL if there aren't enough of them left.
+	const void* ReadBytes(int32 size)
+	{
+		if (m_failed || size < 0 || size > m_size - m_position)
+		{
+			m_failed = true;
+			return NULL;
+		}
+		const void* bytes = m_data + m_position;
+		m_position += size;
+		return bytes;
+	}
+
+	bool Read(void* data, int32 size)
+	{
+		const void* bytes = ReadBytes(size);
+		if (size > 0)
+		{
+			if (bytes)
+			{
+				memcpy(data, bytes, size);
+			}
+			else
+			{
+				memset(data, 0, size);
+			}
+		}
+		return bytes != NULL;
+	}
+
+	template <typename T>
+	bool Read(T* value)
+	{
+		return Read(value, sizeof(T));
+	}
+
+	template <typename T>
+	bool ReadArray(T* values, int32 count)
+	{
+		return Read(values, count * sizeof(T));
+	}
+
+	/// Read a count, which fails the reader if it's negative or larger than
+	/// the data left could hold with at least minSize bytes per item.
+	int32 ReadCount(int32 minSize)
+	{
+		int32 count = 0;
+		Read(&count);
+		if (count < 0 ||
+			(minSize > 0 && count > (m_size - m_position) / minSize))
+		{
+			m_failed = true;
+			return 0;
+		}
+		return count;
+	}
+
+	bool HasFailed() const
+	{
+		return m_failed;
+	}
+
+	/// Get the number of bytes read so far.
+	int32 GetPosition() const
+	{
+		return m_position;
+	}
+
+private:
+	const uint8* m_data;
+	int32 m_size;
+	int32 m_position;
+	bool m_failed;
+};
+
+#endif
@@ -106,6 +106,41 @@ typedef unsigned long long uint64;
 /// This is a dimensionless multiplier.
 #define b2_aabbMultiplier		2.0f
 
+/// With adaptive margins, see b2DynamicTree::SetAdaptiveMargins, AABBs are
+/// fattened by this multiple of the recent displacement of their proxy,
+/// between b2_aabbMinExtension and b2_aabbExtension.
+/// This is a dimensionless multiplier.
+#define b2_aabbMotionMargin		0.5f
+
+/// The smallest adaptive margin. This is in meters.
+#define b2_aabbMinExtension		(0.5f * b2_aabbExtension)
+
+/// With adaptive margins, the recent displacement of a proxy is the largest
+/// displacement it had, scaled down by this factor for each later move.
+#define b2_aabbMotionDecay		0.9f
+
+/// With adaptive margins, this replaces b2_aabbMultiplier.
+#define b2_aabbAdaptiveMultiplier	4.0f
+
+/// The number of bins the leaves of a dynamic tree node are sorted into
+/// when looking for the best split during a top down rebuild.
+#define b2_treeBinCount			16
+
+/// The number of children of a node in the wide layout of a dynamic tree.
+/// Their AABBs are tested together.
+#define b2_wideTreeLanes		4
+
+/// The largest number of edges in a leaf of the tree over the edges of a
+/// chain that uses a single proxy.
+#define b2_chainTreeLeafSize	4
+
+/// Contact ids of the edges of a chain that uses a single proxy include the
+/// edge index modulo this number, spread over the feature indices of a
+/// b2ContactFeature. Edges this many apart share ids, which is harmless
+/// unless a shape touches both of them at once or within consecutive time
+/// steps.
+#define b2_chainEdgeIdPeriod	1024
+
 /// A small length used as a collision and constraint tolerance. Usually it is
 /// chosen to be numerically significant, but visually insignificant.
 #define b2_linearSlop			0.005f
@@ -128,6 +163,27 @@ typedef unsigned long long uint64;
 /// Maximum number of contacts to be handled to solve a TOI impact.
 #define b2_maxTOIContacts			32
 
+/// Number of contacts solved together by the wide contact solver, see
+/// b2World::SetWideContactSolving(). Four 32-bit lanes fill an SSE or NEON
+/// register.
+#define b2_contactSolverLanes		4
+
+/// Number of joints solved together by the wide joint solver, see
+/// b2World::SetWideJointSolving().
+#define b2_jointSolverLanes			4
+
+/// Maximum number of colours the wide joint solver sorts joints into. Joints
+/// that don't fit in any colour are solved one at a time after the others.
+#define b2_maxJointColours			32
+
+/// A symbolic constant that stands for an id which references no contact.
+#define b2_invalidContactId			0xFFFFFFFF
+
+/// Number of bits of a contact id that select a slot of the id table. The
+/// remaining bits hold the generation of the slot.
+#define b2_contactIdSlotBits		22
+#define b2_contactIdSlotMask		((1 << b2_contactIdSlotBits) - 1)
+
 /// A velocity threshold for elastic collisions. Any collision with a relative linear
 /// velocity below this threshold will be treated as inelastic.
 #define b2_velocityThreshold		1.0f
@@ -167,8 +223,20 @@ typedef unsigned long long uint64;
 /// A symbolic constant that stands for particle allocation error.
 #define b2_invalidParticleIndex		(-1)
 
+/// A symbolic constant that stands for an id which references no particle.
+#define b2_invalidParticleId		0xFFFFFFFF
+
+/// Number of bits of a particle id that select a slot of the id table. The
+/// remaining bits hold the generation of the slot.
+#define b2_particleIdSlotBits		20
+#define b2_particleIdSlotMask		((1 << b2_particleIdSlotBits) - 1)
+
 #ifdef B2_USE_16_BIT_PARTICLE_INDICES
-#define b2_maxParticleIndex			0x7FFF
+/// b2ParticleContact stores the low 16 bits of each particle index. The high
+/// bits, the tile of 64k particles the index belongs to, are packed with the
+/// contact flags. See b2ParticleContact.
+#define b2_particleContactTileBits	4
+#define b2_maxParticleIndex			((1 << (15 + b2_particleContactTileBits)) - 1)
 #else
 #define b2_maxParticleIndex			0x7FFFFFFF
 #endif
@@ -224,6 +292,9 @@ typedef void (*b2FreeFunction)(void* mem, void* callbackData);
 /// malloc() and free() for dynamic memory allocation.
 /// Set allocCallback and freeCallback to NULL to restore the default
 /// allocator (malloc / free).
+/// When a world has a task executor, see b2World::SetTaskExecutor, the
+/// callbacks are also called from the executor's threads, possibly at the
+/// same time, so they must be thread-safe.
 void b2SetAllocFreeCallbacks(b2AllocFunction allocCallback,
 							 b2FreeFunction freeCallback,
 							 void* callbackData);
@@ -21,8 +21,8 @@
 
 #include <Box2D/Common/b2Settings.h>
 
-const int32 b2_stackSize = 100 * 1024;	// 100k
-const int32 b2_maxStackEntries = 32;
+const int32 b2_stackSize = 100 * 1024;	// 100k, grown in steps of this size
+const int32 b2_maxStackEntries = 32;	// initial entry capacity
 
 struct b2StackEntry
 {
@@ -34,6 +34,12 @@ struct b2StackEntry
 // This is a stack allocator used for fast per step allocations.
 // You must nest allocate/free pairs. The code will assert
 // if you try to interleave multiple allocate/free pairs.
+// Allocations that don't fit in the stack fall back to b2Alloc. Whenever
+// the stack is emptied, it grows to the largest allocation seen so far, so
+// that a steady workload stops calling b2Alloc after its first step. The
+// memory is kept until the allocator is destroyed. An allocator must only
+// be used by one thread at a time; give each thread of a parallel solver
+// its own.
 class b2StackAllocator
 {
 public:
@@ -51,14 +57,16 @@ public:
 
 private:
 
-	char m_data[b2_stackSize];
+	char* m_data;
+	int32 m_capacity;
 	int32 m_index;
 
 	int32 m_allocation;
 	int32 m_maxAllocation;
 
-	b2StackEntry m_entries[b2_maxStackEntries];
+	b2StackEntry* m_entries;
 	int32 m_entryCount;
+	int32 m_entryCapacity;
 };
 
 #endif
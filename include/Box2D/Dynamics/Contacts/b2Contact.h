@@ -58,6 +58,12 @@ struct b2ContactRegister
 	bool primary;
 };
 
+/// A contact id is a 32-bit value which holds a slot of the contact manager's
+/// id table and the generation of that slot. Unlike a b2Contact pointer, an id
+/// can be kept after the contact is destroyed: looking it up then returns
+/// NULL, see b2World::GetContact().
+typedef uint32 b2ContactId;
+
 /// A contact edge is used to connect bodies and contacts together
 /// in a contact graph where each body is a node and each contact
 /// is an edge. A contact edge belongs to a doubly linked list
@@ -101,6 +107,10 @@ public:
 	b2Contact* GetNext();
 	const b2Contact* GetNext() const;
 
+	/// Get the id of this contact, which is unique among the contacts of
+	/// the world until the contact is destroyed.
+	b2ContactId GetId() const;
+
 	/// Get fixture A in this contact.
 	b2Fixture* GetFixtureA();
 	const b2Fixture* GetFixtureA() const;
@@ -144,6 +154,13 @@ public:
 	/// Evaluate this contact with your own manifold and transforms.
 	virtual void Evaluate(b2Manifold* manifold, const b2Transform& xfA, const b2Transform& xfB) = 0;
 
+	/// Evaluate this contact at the current body transforms. When the shapes
+	/// don't touch but could do so within a time step of length dt, the
+	/// manifold gets a single point with a positive separation between the
+	/// closest features, so that the contact solver can stop the shapes
+	/// before they pass through each other.
+	void EvaluateSpeculative(b2Manifold* manifold, float32 dt);
+
 protected:
 	friend class b2ContactManager;
 	friend class b2World;
@@ -170,7 +187,10 @@ protected:
 		e_bulletHitFlag		= 0x0010,
 
 		// This contact has a valid TOI in m_toi
-		e_toiFlag			= 0x0020
+		e_toiFlag			= 0x0020,
+
+		// This contact connects the persistent islands of its bodies.
+		e_islandLinkFlag	= 0x0040
 	};
 
 	/// Flag this contact for filtering. Filtering will occur the next time step.
@@ -189,34 +209,53 @@ protected:
 
 	void Update(b2ContactListener* listener);
 
+	/// Update the contact using a manifold already computed by Evaluate from
+	/// the current body transforms. Not valid for sensor contacts, which
+	/// don't generate manifolds.
+	void Update(b2ContactListener* listener, const b2Manifold& manifold);
+
+	/// Shared implementation of Update. Evaluates the manifold when
+	/// evaluatedManifold is NULL.
+	void UpdateManifold(b2ContactListener* listener,
+						const b2Manifold* evaluatedManifold);
+
 	static b2ContactRegister s_registers[b2Shape::e_typeCount][b2Shape::e_typeCount];
 	static bool s_initialized;
 
+	// Members read every step by the narrow phase and the contact solver
+	// come first. The contact is still a separate allocation; this only
+	// orders its members.
 	uint32 m_flags;
 
-	// World pool and list pointers.
-	b2Contact* m_prev;
-	b2Contact* m_next;
-
-	// Nodes for connecting bodies.
-	b2ContactEdge m_nodeA;
-	b2ContactEdge m_nodeB;
-
 	b2Fixture* m_fixtureA;
 	b2Fixture* m_fixtureB;
 
 	int32 m_indexA;
 	int32 m_indexB;
 
+	float32 m_friction;
+	float32 m_restitution;
+
+	float32 m_tangentSpeed;
+
 	b2Manifold m_manifold;
 
+	// Data used by continuous collision, island building, and when
+	// contacts are created or destroyed.
 	int32 m_toiCount;
 	float32 m_toi;
 
-	float32 m_friction;
-	float32 m_restitution;
+	// Position in b2ContactManager::m_contactBuffer and id of this contact.
+	int32 m_bufferIndex;
+	b2ContactId m_id;
 
-	float32 m_tangentSpeed;
+	// World pool and list pointers.
+	b2Contact* m_prev;
+	b2Contact* m_next;
+
+	// Nodes for connecting bodies.
+	b2ContactEdge m_nodeA;
+	b2ContactEdge m_nodeB;
 };
 
 inline b2Manifold* b2Contact::GetManifold()
@@ -271,6 +310,11 @@ inline const b2Contact* b2Contact::GetNext() const
 	return m_next;
 }
 
+inline b2ContactId b2Contact::GetId() const
+{
+	return m_id;
+}
+
 inline b2Fixture* b2Contact::GetFixtureA()
 {
 	return m_fixtureA;
@@ -27,6 +27,7 @@ class b2Contact;
 class b2Body;
 class b2StackAllocator;
 struct b2ContactPositionConstraint;
+struct b2WideVelocityConstraint;
 
 struct b2VelocityConstraintPoint
 {
@@ -64,6 +65,9 @@ struct b2ContactSolverDef
 	b2Position* positions;
 	b2Velocity* velocities;
 	b2StackAllocator* allocator;
+	/// See b2SolverData::staticSlots.
+	const b2StaticSlot* staticSlots;
+	int32 staticSlotCount;
 };
 
 class b2ContactSolver
@@ -81,6 +85,16 @@ public:
 	bool SolvePositionConstraints();
 	bool SolveTOIPositionConstraints(int32 toiIndexA, int32 toiIndexB);
 
+	/// Sort the constraints into batches of b2_contactSolverLanes
+	/// constraints, none of which share a dynamic body, and copy them into
+	/// m_wideConstraints.
+	void InitializeWideConstraints();
+	void WarmStartWide();
+	void SolveWideVelocityConstraints();
+	/// Copy the impulses of m_wideConstraints to m_velocityConstraints.
+	void StoreWideImpulses();
+	bool SolveWidePositionConstraints();
+
 	b2TimeStep m_step;
 	b2Position* m_positions;
 	b2Velocity* m_velocities;
@@ -89,6 +103,11 @@ public:
 	b2ContactVelocityConstraint* m_velocityConstraints;
 	b2Contact** m_contacts;
 	int m_count;
+
+	/// Batch and lane of each velocity constraint, when solving wide.
+	int32* m_wideSlots;
+	b2WideVelocityConstraint* m_wideConstraints;
+	int32 m_wideCount;
 };
 
 #endif
@@ -84,6 +84,9 @@ protected:
 	void SolveVelocityConstraints(const b2SolverData& data);
 	bool SolvePositionConstraints(const b2SolverData& data);
 
+	void Serialize(b2BinaryWriter* writer) const;
+	void Deserialize(b2BinaryReader* reader);
+
 	b2Joint* m_joint1;
 	b2Joint* m_joint2;
 
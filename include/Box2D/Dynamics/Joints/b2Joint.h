@@ -25,6 +25,8 @@ class b2Body;
 class b2Joint;
 struct b2SolverData;
 class b2BlockAllocator;
+class b2BinaryReader;
+class b2BinaryWriter;
 
 enum b2JointType
 {
@@ -167,6 +169,13 @@ protected:
 	// This returns true if the position errors are within tolerance.
 	virtual bool SolvePositionConstraints(const b2SolverData& data) = 0;
 
+	/// Write the parameters of the joint and the impulses it warm starts
+	/// with. The type, bodies and connected joints are written by b2World.
+	virtual void Serialize(b2BinaryWriter* writer) const = 0;
+
+	/// Read the data written by Serialize into a joint of the same type.
+	virtual void Deserialize(b2BinaryReader* reader) = 0;
+
 	b2JointType m_type;
 	b2Joint* m_prev;
 	b2Joint* m_next;
@@ -177,6 +186,9 @@ protected:
 
 	int32 m_index;
 
+	/// See b2World::m_nextSerial.
+	uint32 m_serial;
+
 	bool m_islandFlag;
 	bool m_collideConnected;
 
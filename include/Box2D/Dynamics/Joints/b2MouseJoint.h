@@ -104,6 +104,9 @@ protected:
 	void SolveVelocityConstraints(const b2SolverData& data);
 	bool SolvePositionConstraints(const b2SolverData& data);
 
+	void Serialize(b2BinaryWriter* writer) const;
+	void Deserialize(b2BinaryReader* reader);
+
 	b2Vec2 m_localAnchorB;
 	b2Vec2 m_targetA;
 	float32 m_frequencyHz;
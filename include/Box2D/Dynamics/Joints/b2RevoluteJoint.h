@@ -21,6 +21,35 @@
 
 #include <Box2D/Dynamics/Joints/b2Joint.h>
 
+class b2RevoluteJoint;
+
+/// b2_jointSolverLanes revolute point-to-point constraints stored lane by
+/// lane, see b2World::SetWideJointSolving(). Lanes past count are padding
+/// with zero mass, which leaves velocities and positions unchanged.
+/// This is an internal structure.
+struct b2WideRevoluteConstraint
+{
+	int32 indexA[b2_jointSolverLanes];
+	int32 indexB[b2_jointSolverLanes];
+	float32 invMassA[b2_jointSolverLanes], invMassB[b2_jointSolverLanes];
+	float32 invIA[b2_jointSolverLanes], invIB[b2_jointSolverLanes];
+
+	// Velocity constraint.
+	float32 rAX[b2_jointSolverLanes], rAY[b2_jointSolverLanes];
+	float32 rBX[b2_jointSolverLanes], rBY[b2_jointSolverLanes];
+	float32 k11[b2_jointSolverLanes], k12[b2_jointSolverLanes];
+	float32 k21[b2_jointSolverLanes], k22[b2_jointSolverLanes];
+	float32 invDet[b2_jointSolverLanes];
+	float32 impulseX[b2_jointSolverLanes], impulseY[b2_jointSolverLanes];
+
+	// Anchors relative to the centers of mass, for the position constraint.
+	float32 localAX[b2_jointSolverLanes], localAY[b2_jointSolverLanes];
+	float32 localBX[b2_jointSolverLanes], localBY[b2_jointSolverLanes];
+
+	b2RevoluteJoint* joints[b2_jointSolverLanes];
+	int32 count;
+};
+
 /// Revolute joint definition. This requires defining an
 /// anchor point where the bodies are joined. The definition
 /// uses local anchor points so that the initial configuration
@@ -158,6 +187,7 @@ protected:
 	
 	friend class b2Joint;
 	friend class b2GearJoint;
+	friend class b2Island;
 
 	b2RevoluteJoint(const b2RevoluteJointDef* def);
 
@@ -165,6 +195,25 @@ protected:
 	void SolveVelocityConstraints(const b2SolverData& data);
 	bool SolvePositionConstraints(const b2SolverData& data);
 
+	void Serialize(b2BinaryWriter* writer) const;
+	void Deserialize(b2BinaryReader* reader);
+
+	/// Is only the point-to-point constraint solved this step? Valid after
+	/// InitVelocityConstraints.
+	bool IsPointConstraint() const;
+
+	/// Copy the point-to-point constraints of count joints, which must not
+	/// share a dynamic body, into the lanes of wc. Called after
+	/// InitVelocityConstraints.
+	static void InitializeWide(b2RevoluteJoint* const* joints, int32 count,
+							   b2WideRevoluteConstraint* wc);
+	static void SolveWideVelocityConstraints(b2WideRevoluteConstraint* wc,
+											 const b2SolverData& data);
+	/// Copy the impulses of the lanes back to the joints.
+	static void StoreWideImpulses(const b2WideRevoluteConstraint* wc);
+	static bool SolveWidePositionConstraints(const b2WideRevoluteConstraint* wc,
+											 const b2SolverData& data);
+
 	// Solver shared
 	b2Vec2 m_localAnchorA;
 	b2Vec2 m_localAnchorB;
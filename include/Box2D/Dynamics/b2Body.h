@@ -22,6 +22,8 @@
 
 #include <Box2D/Common/b2Math.h>
 #include <Box2D/Collision/Shapes/b2Shape.h>
+#include <Box2D/Dynamics/b2TimeStep.h>
+#include <functional>
 #include <memory>
 
 class b2Fixture;
@@ -32,6 +34,7 @@ class b2World;
 struct b2FixtureDef;
 struct b2JointEdge;
 struct b2ContactEdge;
+struct b2PersistentIsland;
 
 /// The body type.
 /// static: zero mass, zero velocity, may be manually moved
@@ -440,6 +443,12 @@ private:
 	~b2Body();
 
 	void SynchronizeFixtures();
+
+	/// Synchronize the fixtures so that their broad-phase proxies also
+	/// cover the motion expected in a coming time step of length dt, for
+	/// speculative contacts.
+	void SynchronizeFixtures(float32 dt);
+
 	void SynchronizeTransform();
 
 	// This is used to prevent connected bodies from colliding.
@@ -448,12 +457,25 @@ private:
 
 	void Advance(float32 t);
 
+	/// Called by SetAwake when the body wakes up.
+	void OnWake();
+
+	/// Get the index of the body in the solver buffers of an island. Static
+	/// bodies shared between islands solved at the same time have no island
+	/// index, so their slot is looked up in staticSlots.
+	int32 GetSolverIndex(const b2StaticSlot* staticSlots,
+						 int32 staticSlotCount) const;
+	int32 GetSolverIndex(const b2SolverData& data) const;
+
 	b2BodyType m_type;
 
 	uint16 m_flags;
 
 	int32 m_islandIndex;
 
+	/// See b2World::m_nextSerial.
+	uint32 m_serial;
+
 	b2Transform m_xf;		// the body origin transform
 	b2Transform m_xf0;		// the previous transform for particle simulation
 	b2Sweep m_sweep;		// the swept motion for CCD
@@ -468,6 +490,11 @@ private:
 	b2Body* m_prev;
 	b2Body* m_next;
 
+	// The persistent island of a non-static, active body.
+	b2PersistentIsland* m_island;
+	b2Body* m_islandPrev;
+	b2Body* m_islandNext;
+
 	b2Fixture* m_fixtureList;
 	int32 m_fixtureCount;
 
@@ -660,6 +687,7 @@ inline void b2Body::SetAwake(bool flag)
 		{
 			m_flags |= e_awakeFlag;
 			m_sleepTime = 0.0f;
+			OnWake();
 		}
 	}
 	else
@@ -891,4 +919,37 @@ inline void b2Body::SetTransform(float32 positionX, float32 positionY, float32 a
 }
 #endif // LIQUIDFUN_EXTERNAL_LANGUAGE_API
 
+inline int32 b2Body::GetSolverIndex(const b2StaticSlot* staticSlots,
+									int32 staticSlotCount) const
+{
+	if (m_islandIndex >= 0)
+	{
+		return m_islandIndex;
+	}
+
+	// Binary search.
+	std::less<const b2Body*> less;
+	int32 low = 0;
+	int32 high = staticSlotCount;
+	while (low < high)
+	{
+		int32 mid = (low + high) / 2;
+		if (less(staticSlots[mid].body, this))
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	b2Assert(low < staticSlotCount && staticSlots[low].body == this);
+	return staticSlots[low].index;
+}
+
+inline int32 b2Body::GetSolverIndex(const b2SolverData& data) const
+{
+	return GetSolverIndex(data.staticSlots, data.staticSlotCount);
+}
+
 #endif
@@ -20,11 +20,17 @@
 #define B2_CONTACT_MANAGER_H
 
 #include <Box2D/Collision/b2BroadPhase.h>
+#include <Box2D/Dynamics/Contacts/b2Contact.h>
 
+class b2BinaryReader;
+class b2BinaryWriter;
 class b2Contact;
+struct b2Manifold;
 class b2ContactFilter;
 class b2ContactListener;
 class b2BlockAllocator;
+class b2StackAllocator;
+class b2TaskExecutor;
 class b2ParticleSystem;
 
 // Delegate of b2World.
@@ -34,22 +40,104 @@ public:
 	friend class b2ParticleSystem;
 
 	b2ContactManager();
+	~b2ContactManager();
 
 	// Broad-phase callback.
 	void AddPair(void* proxyUserDataA, void* proxyUserDataB);
 
 	void FindNewContacts();
 
+	/// Create the contact between two fixture children and add it to the
+	/// world, without filtering it or waking the bodies.
+	/// @return the contact, or NULL if the shapes don't collide.
+	b2Contact* Create(b2Fixture* fixtureA, int32 indexA,
+					  b2Fixture* fixtureB, int32 indexB);
+
 	void Destroy(b2Contact* c);
 
 	void Collide();
-            
+
+	/// Filter, test and update the contact c, which may be destroyed.
+	/// The manifold of c is taken from evaluatedManifold when it's not NULL.
+	/// @return false if c was destroyed. The last contact of
+	/// m_contactBuffer then takes its place.
+	bool Collide(b2Contact* c, const b2Manifold* evaluatedManifold);
+
+	/// Compute the manifolds of awake contacts on m_taskExecutor, then
+	/// update the contacts in m_contactBuffer order, like Collide. That
+	/// order only depends on the sequence of creations and destructions:
+	/// new contacts are appended and the last contact takes the place of a
+	/// destroyed one.
+	void CollideConcurrently();
+
+	/// Get the contact referenced by id, or NULL if it was destroyed.
+	b2Contact* GetContact(b2ContactId id) const;
+
+	/// Write the broad-phase and the contacts, with their order in the
+	/// contact list, m_contactBuffer and the contact lists of the bodies,
+	/// for b2World::CaptureState. Fixtures are written as pointers.
+	void CaptureState(b2BinaryWriter* writer) const;
+
+	/// Replace the contacts by the ones written by CaptureState, without
+	/// calling listeners or touching the islands. The fixtures must still
+	/// exist.
+	void RestoreState(b2BinaryReader* reader);
+
+	/// Entry of the contact id table. Holds the position of a contact in
+	/// m_contactBuffer, or the next free slot while unused.
+	struct IdSlot
+	{
+		int32 index;
+		uint32 generation;
+	};
+
+	/// Add c to m_contactBuffer and give it an id.
+	void AddToBuffer(b2Contact* c);
+	/// Remove c from m_contactBuffer and release its id.
+	void RemoveFromBuffer(b2Contact* c);
+
+	/// Find the contact between two fixture children, in either order.
+	b2Contact* FindContact(const b2Fixture* fixtureA, int32 indexA,
+						   const b2Fixture* fixtureB, int32 indexB) const;
+	/// Add c to m_pairTable.
+	void AddToPairTable(b2Contact* c);
+	/// Remove c from m_pairTable.
+	void RemoveFromPairTable(b2Contact* c);
+	/// Store c in m_pairTable, which must have room for it.
+	void InsertIntoPairTable(b2Contact* c);
+
 	b2BroadPhase m_broadPhase;
 	b2Contact* m_contactList;
 	int32 m_contactCount;
+
+	/// Pointers to all m_contactCount contacts, indexed by
+	/// b2Contact::m_bufferIndex, so that per-step sweeps don't walk the
+	/// contact list. This is only an index: the contacts themselves are
+	/// allocated one by one from the block allocator. See
+	/// CollideConcurrently for the order of the contacts.
+	b2Contact** m_contactBuffer;
+	int32 m_contactCapacity;
+
+	IdSlot* m_idSlots;
+	int32 m_idSlotCount;
+	int32 m_idSlotCapacity;
+	int32 m_freeIdSlot;
+
+	/// Open addressing hash set of all contacts, keyed by their pair of
+	/// fixture children. Empty entries are NULL. The capacity is a power of
+	/// two and at least twice m_contactCount.
+	b2Contact** m_pairTable;
+	int32 m_pairTableCapacity;
+
+	/// Length of the coming time step when contacts get speculative points,
+	/// see b2Contact::EvaluateSpeculative. Zero when they don't.
+	float32 m_speculativeTimeStep;
+
 	b2ContactFilter* m_contactFilter;
 	b2ContactListener* m_contactListener;
 	b2BlockAllocator* m_allocator;
+	b2StackAllocator* m_stackAllocator;
+	b2TaskExecutor* m_taskExecutor;
 };
 
 #endif
@@ -233,6 +233,9 @@ protected:
 	b2FixtureProxy* m_proxies;
 	int32 m_proxyCount;
 
+	/// See b2World::m_nextSerial.
+	uint32 m_serial;
+
 	b2Filter m_filter;
 
 	bool m_isSensor;
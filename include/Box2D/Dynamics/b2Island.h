@@ -27,8 +27,48 @@ class b2Contact;
 class b2Joint;
 class b2StackAllocator;
 class b2ContactListener;
+struct b2ContactImpulse;
 struct b2ContactVelocityConstraint;
 struct b2Profile;
+struct b2SolverData;
+struct b2WideRevoluteConstraint;
+
+/// Location of one island within the body, contact and joint lists gathered
+/// by b2World when islands are solved on a task executor.
+struct b2IslandRange
+{
+	int32 bodyStart, bodyCount;
+	int32 contactStart, contactCount;
+	int32 jointStart, jointCount;
+};
+
+/// The joints of one colour of the wide joint solver, see
+/// b2World::SetWideJointSolving(). No two joints of a colour share a dynamic
+/// body, except in the last colour, which holds the joints that didn't fit
+/// in any other.
+struct b2JointColour
+{
+	int32 wideStart, wideCount;		// in b2Island::m_wideJoints
+	int32 jointStart, jointCount;	// in b2Island::m_jointOrder
+};
+
+/// A group of non-static bodies connected by touching contacts and joints.
+/// b2World keeps these between time steps. Islands are merged as soon as a
+/// contact or joint connects them, but are only split once they could go to
+/// sleep, so an island may hold bodies that are no longer connected.
+struct b2PersistentIsland
+{
+	/// Bodies linked through b2Body::m_islandNext.
+	b2Body* bodyList;
+	int32 bodyCount;
+
+	/// Number of contacts, joints and bodies removed since the island was
+	/// last split.
+	int32 removedCount;
+
+	b2PersistentIsland* prev;
+	b2PersistentIsland* next;
+};
 
 /// This is an internal class.
 class b2Island
@@ -36,6 +76,18 @@ class b2Island
 public:
 	b2Island(int32 bodyCapacity, int32 contactCapacity, int32 jointCapacity,
 			b2StackAllocator* allocator, b2ContactListener* listener);
+
+	/// Construct an island over lists owned by the caller. The island index
+	/// of each non-static body must be its position in bodies, and that of
+	/// each static body -1, since a static body may be in other islands
+	/// solved at the same time. Static bodies are found through
+	/// m_staticSlots instead. slotCount is either bodyCount, or zero for an
+	/// island that is never solved. Contact impulses are written to impulses,
+	/// when it's not NULL, instead of being reported to a listener.
+	b2Island(b2Body** bodies, int32 bodyCount, b2Contact** contacts,
+			int32 contactCount, b2Joint** joints, int32 jointCount,
+			int32 slotCount, b2StackAllocator* allocator,
+			b2ContactImpulse* impulses);
 	~b2Island();
 
 	void Clear()
@@ -49,6 +101,10 @@ public:
 
 	void SolveTOI(const b2TimeStep& subStep, int32 toiIndexA, int32 toiIndexB);
 
+	/// Integrate bodies that have no contacts or joints. Each body goes to
+	/// sleep on its own, as if it were an island of its own.
+	void SolveUnconnected(const b2TimeStep& step, const b2Vec2& gravity, bool allowSleep);
+
 	void Add(b2Body* body)
 	{
 		b2Assert(m_bodyCount < m_bodyCapacity);
@@ -71,8 +127,31 @@ public:
 
 	void Report(const b2ContactVelocityConstraint* constraints);
 
+	/// Copy the state of the bodies to the solver buffers and integrate the
+	/// velocities of the dynamic bodies.
+	void InitializeBodies(float32 h, const b2Vec2& gravity);
+
+	/// Integrate the positions of the bodies that can move.
+	void IntegratePositions(float32 h);
+
+	/// Copy the solver buffers back to the bodies and update their sleep
+	/// time when allowSleep is set.
+	/// @return the smallest sleep time of the bodies that can move.
+	float32 StoreBodies(float32 h, bool allowSleep);
+
+	/// Colour the joints and copy revolute joints that only solve their
+	/// point-to-point constraint into wide constraints. Called after
+	/// InitVelocityConstraints.
+	void InitializeJointBatches();
+	void SolveJointBatchVelocities(const b2SolverData& data);
+	/// Copy the impulses of the wide constraints back to the joints.
+	void StoreJointBatchImpulses();
+	bool SolveJointBatchPositions(const b2SolverData& data);
+	void FreeJointBatches();
+
 	b2StackAllocator* m_allocator;
 	b2ContactListener* m_listener;
+	b2ContactImpulse* m_impulses;
 
 	b2Body** m_bodies;
 	b2Contact** m_contacts;
@@ -81,6 +160,21 @@ public:
 	b2Position* m_positions;
 	b2Velocity* m_velocities;
 
+	/// Scratch space for the integration inputs of the bodies that can
+	/// move, stored by component. See b2Island::InitializeBodies.
+	int32* m_integrationSlots;
+	float32* m_integrationInputs;
+	int32 m_dynamicCount;
+	int32 m_kinematicCount;
+
+	/// Joints of the wide joint solver, valid during b2Island::Solve. See
+	/// InitializeJointBatches.
+	b2Joint** m_jointOrder;
+	b2JointColour* m_jointColours;
+	b2WideRevoluteConstraint* m_wideJoints;
+	int32 m_jointColourCount;
+	int32 m_wideJointCount;
+
 	int32 m_bodyCount;
 	int32 m_jointCount;
 	int32 m_contactCount;
@@ -88,6 +182,19 @@ public:
 	int32 m_bodyCapacity;
 	int32 m_contactCapacity;
 	int32 m_jointCapacity;
+
+	/// Number of position and velocity slots.
+	int32 m_slotCount;
+	/// Slots of the static bodies of an island that shares them, sorted by
+	/// body. See b2Body::GetSolverIndex.
+	b2StaticSlot* m_staticSlots;
+	int32 m_staticSlotCount;
+	/// Whether the body, contact and joint lists were allocated by the island.
+	bool m_ownsLists;
+	/// Whether static bodies may be in other islands solved at the same
+	/// time. If so the island only reads them, otherwise it stores their
+	/// state and puts them to sleep with the island.
+	bool m_sharesStaticBodies;
 };
 
 #endif
@@ -22,12 +22,20 @@
 
 #include <Box2D/Common/b2Math.h>
 
-/// Profiling data. Times are in milliseconds.
+class b2Body;
+
+/// Profiling data. Times are in milliseconds. The phases step, collide,
+/// solveParticle, solveRigid and solveTOI run one after another, so they
+/// make up the critical path of a step. Phases with a task executor report
+/// their wall time, while solveInit, solveVelocity and solvePosition add up
+/// the time of every island.
 struct b2Profile
 {
 	float32 step;
 	float32 collide;
 	float32 solve;
+	float32 solveParticle;	// particle systems solved before the bodies
+	float32 solveRigid;		// bodies, with the particle systems solved alongside
 	float32 solveInit;
 	float32 solveVelocity;
 	float32 solvePosition;
@@ -45,6 +53,9 @@ struct b2TimeStep
 	int32 positionIterations;
 	int32 particleIterations;
 	bool warmStarting;
+	bool wideContactSolving;	// solve contacts in batches, see b2ContactSolver
+	bool wideJointSolving;		// solve joints in batches, see b2Island
+	bool speculativeContacts;	// contact points may be separated, see b2World
 };
 
 /// This is an internal structure.
@@ -61,12 +72,24 @@ struct b2Velocity
 	float32 w;
 };
 
+/// This is an internal structure.
+/// The solver slot of a static body that may be in other islands solved at
+/// the same time. See b2Body::GetSolverIndex.
+struct b2StaticSlot
+{
+	const b2Body* body;
+	int32 index;
+};
+
 /// Solver Data
 struct b2SolverData
 {
 	b2TimeStep step;
 	b2Position* positions;
 	b2Velocity* velocities;
+	/// Slots of the shared static bodies of the island, sorted by body.
+	const b2StaticSlot* staticSlots;
+	int32 staticSlotCount;
 };
 
 #endif
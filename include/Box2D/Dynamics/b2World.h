@@ -27,17 +27,180 @@
 #include <Box2D/Dynamics/b2WorldCallbacks.h>
 #include <Box2D/Dynamics/b2TimeStep.h>
 #include <Box2D/Particle/b2ParticleSystem.h>
+#include <atomic>
 
 struct b2AABB;
 struct b2BodyDef;
 struct b2Color;
 struct b2JointDef;
 class b2Body;
+class b2Island;
+struct b2PersistentIsland;
+struct b2TOIEvent;
 class b2Draw;
 class b2Fixture;
 class b2Joint;
 class b2ParticleGroup;
 
+/// The closest fixture hit by a ray of a batch cast by b2World::RayCast.
+struct b2RayCastHit
+{
+	/// The fixture hit, or NULL if the ray missed every fixture.
+	b2Fixture* fixture;
+	b2Vec2 point;
+	b2Vec2 normal;
+	float32 fraction;
+};
+
+/// The state of a body at the end of a step, see b2WorldSnapshot.
+struct b2BodySnapshot
+{
+	/// Identifies the body. Don't use it to read the body from another
+	/// thread, since the body may be stepped or destroyed meanwhile.
+	const b2Body* body;
+	void* userData;
+	b2Transform transform;
+	b2Vec2 linearVelocity;
+	float32 angularVelocity;
+	bool awake;
+};
+
+/// The particles of a particle system at the end of a step, see
+/// b2WorldSnapshot. The buffers are indexed like those of the system.
+struct b2ParticleSystemSnapshot
+{
+	/// Identifies the particle system, like b2BodySnapshot::body.
+	const b2ParticleSystem* system;
+	int32 particleCount;
+	const b2Vec2* positions;
+	const b2Vec2* velocities;
+	/// NULL if the particle system has no color buffer.
+	const b2ParticleColor* colors;
+};
+
+/// An immutable copy of the bodies and particles of a world, in the order
+/// of the world's lists.
+struct b2WorldSnapshot
+{
+	/// Counts the snapshots published to a buffer, starting at 1.
+	uint32 sequence;
+	const b2BodySnapshot* bodies;
+	int32 bodyCount;
+	const b2ParticleSystemSnapshot* particleSystems;
+	int32 particleSystemCount;
+};
+
+/// Hands snapshots of a world from the thread that steps it to one other
+/// thread, such as a render thread, without locks. The world writes a
+/// snapshot to a free slot at the end of each step and swaps it in as the
+/// latest; the reader swaps the latest out when it wants a new one. With
+/// three slots, neither thread ever waits for the other, and a slow reader
+/// simply misses snapshots. Use one buffer for each reading thread.
+class b2WorldSnapshotBuffer
+{
+public:
+	b2WorldSnapshotBuffer();
+	~b2WorldSnapshotBuffer();
+
+	/// Get the latest snapshot published by the world. Call this from the
+	/// reading thread only. The snapshot stays valid and unchanged until the
+	/// next call to Acquire.
+	/// @return the snapshot, or NULL if none was published yet.
+	const b2WorldSnapshot* Acquire();
+
+private:
+	friend class b2World;
+
+	// m_middle
+	enum
+	{
+		e_slotMask	= 0x0003,
+		e_fresh		= 0x0004
+	};
+
+	void Write(const b2World* world);
+	void Publish();
+
+	b2WorldSnapshot m_snapshots[3];
+	void* m_memory[3];
+	int32 m_capacity[3];
+
+	/// The slot being written by the world and the slot being read.
+	int32 m_back;
+	int32 m_front;
+	/// The slot holding the latest snapshot, flagged with e_fresh until the
+	/// reader takes it.
+	std::atomic<int32> m_middle;
+
+	uint32 m_sequence;
+
+	b2World* m_world;
+	b2WorldSnapshotBuffer* m_next;
+};
+
+/// A copy of the state of a world, taken by b2World::CaptureState. The
+/// memory is kept and reused when the state is captured again.
+class b2WorldState
+{
+public:
+	b2WorldState();
+	~b2WorldState();
+
+	/// Get the size of the state in bytes, or 0 if it's empty.
+	int32 GetSize() const
+	{
+		return m_size;
+	}
+
+private:
+	friend class b2World;
+
+	void* m_data;
+	int32 m_size;
+	int32 m_capacity;
+};
+
+/// Keeps the states of the last steps of a world so that it can be rolled
+/// back and stepped again, such as to correct a prediction. Capture the
+/// world after each step; once the ring is full, capturing replaces the
+/// oldest state.
+class b2WorldStateRing
+{
+public:
+	b2WorldStateRing(int32 capacity);
+	~b2WorldStateRing();
+
+	/// Capture the state of world as the newest state.
+	void Capture(const b2World* world);
+
+	/// Restore the state captured stepsBack captures before the newest one,
+	/// and drop the states captured after it, so that it becomes the newest.
+	/// @return false if there's no such state or if it can't be restored,
+	/// see b2World::RestoreState.
+	bool Rewind(b2World* world, int32 stepsBack);
+
+	/// Get the number of states held.
+	int32 GetCount() const
+	{
+		return m_count;
+	}
+
+	int32 GetCapacity() const
+	{
+		return m_capacity;
+	}
+
+	/// Drop all states. Their memory is kept.
+	void Clear();
+
+private:
+	b2WorldState* m_states;
+	int32 m_capacity;
+	/// The slot of the newest state.
+	int32 m_newest;
+	int32 m_count;
+};
+
 /// The world class manages all physics entities, dynamic simulation,
 /// and asynchronous queries. The world also contains efficient memory
 /// management facilities.
@@ -64,6 +227,31 @@ public:
 	/// remain in scope.
 	void SetContactListener(b2ContactListener* listener);
 
+	/// Register a task executor used to compute contact manifolds and solve
+	/// independent islands concurrently. Contact listener callbacks are
+	/// still made on the calling thread, in the same order as without an
+	/// executor. Particle systems that don't touch the same non-static body
+	/// are also solved concurrently, and those that touch none are solved
+	/// alongside the islands. Results are the same as without an executor.
+	/// The executor is owned by you and must remain in scope.
+	/// Pass NULL to do all the work on the calling thread.
+	/// @warning This function is locked during callbacks.
+	void SetTaskExecutor(b2TaskExecutor* executor);
+
+	/// Get the registered task executor, or NULL.
+	b2TaskExecutor* GetTaskExecutor();
+
+	/// Publish a snapshot of the world to buffer now and at the end of
+	/// every step, so that another thread can read the state of the world
+	/// while the next step runs. The buffer is owned by you and must remain
+	/// in scope until it's removed or the world is destroyed.
+	/// @warning This function is locked during callbacks.
+	void AddSnapshotBuffer(b2WorldSnapshotBuffer* buffer);
+
+	/// Stop publishing snapshots to buffer.
+	/// @warning This function is locked during callbacks.
+	void RemoveSnapshotBuffer(b2WorldSnapshotBuffer* buffer);
+
 	/// Register a routine for debug drawing. The debug draw functions are called
 	/// inside with b2World::DrawDebugData method. The debug draw object is owned
 	/// by you and must remain in scope.
@@ -168,6 +356,24 @@ public:
 	/// @param point2 the ray ending point
 	void RayCast(b2RayCastCallback* callback, const b2Vec2& point1, const b2Vec2& point2) const;
 
+	/// Query the world with a batch of AABBs. The fixtures that potentially
+	/// overlap aabbs[i] are written to fixtures[i * maxFixtures] onward, and
+	/// their number to fixtureCounts[i]. Fixtures beyond maxFixtures are
+	/// dropped. Queries are run in an order that keeps nearby boxes
+	/// together, spread over the task executor if there is one. Particles
+	/// are not reported.
+	void QueryAABB(const b2AABB* aabbs, int32 count, int32 maxFixtures,
+				   b2Fixture** fixtures, int32* fixtureCounts) const;
+
+	/// Ray-cast the world with a batch of rays and write the closest
+	/// non-sensor fixture each ray hits to hits. The rays are cast in an
+	/// order that keeps nearby rays together, spread over the task executor
+	/// if there is one. Particles are not reported.
+	/// @param inputs the rays. Each ray extends from p1 to
+	/// p1 + maxFraction * (p2 - p1).
+	void RayCast(const b2RayCastInput* inputs, int32 count,
+				 b2RayCastHit* hits) const;
+
 	/// Get the world body list. With the returned body, use b2Body::GetNext to get
 	/// the next body in the world list. A NULL body indicates the end of the list.
 	/// @return the head of the world body list.
@@ -195,6 +401,11 @@ public:
 	b2Contact* GetContactList();
 	const b2Contact* GetContactList() const;
 
+	/// Get a contact from the id returned by b2Contact::GetId().
+	/// @return the contact, or NULL if it was destroyed.
+	b2Contact* GetContact(b2ContactId id);
+	const b2Contact* GetContact(b2ContactId id) const;
+
 	/// Enable/disable sleep.
 	void SetAllowSleeping(bool flag);
 	bool GetAllowSleeping() const { return m_allowSleep; }
@@ -203,10 +414,39 @@ public:
 	void SetWarmStarting(bool flag) { m_warmStarting = flag; }
 	bool GetWarmStarting() const { return m_warmStarting; }
 
+	/// Enable/disable the wide contact solver. Contacts of each island are
+	/// sorted into batches of b2_contactSolverLanes contacts which don't
+	/// share a dynamic body, and each batch is solved at once. This changes
+	/// the order contacts are solved in, so results differ slightly from the
+	/// default solver. Disabled by default.
+	void SetWideContactSolving(bool flag) { m_wideContactSolving = flag; }
+	bool GetWideContactSolving() const { return m_wideContactSolving; }
+
+	/// Enable/disable the wide joint solver. Joints of each island are
+	/// coloured so that joints of the same colour don't share a dynamic
+	/// body. Revolute joints without an active motor or limit are then
+	/// solved b2_jointSolverLanes at a time, and other joints one at a time,
+	/// colour by colour. This changes the order joints are solved in, so
+	/// results differ from the default solver, and long chains may need more
+	/// iterations to stay as stiff. Disabled by default.
+	void SetWideJointSolving(bool flag) { m_wideJointSolving = flag; }
+	bool GetWideJointSolving() const { return m_wideJointSolving; }
+
 	/// Enable/disable continuous physics. For testing.
 	void SetContinuousPhysics(bool flag) { m_continuousPhysics = flag; }
 	bool GetContinuousPhysics() const { return m_continuousPhysics; }
 
+	/// Enable/disable speculative contacts. Instead of solving time of
+	/// impact events after each step, contacts between shapes that are
+	/// about to touch get a separated contact point, and the contact solver
+	/// only lets the shapes close that gap within the step. This is cheaper
+	/// than continuous physics for many fast bodies, since it takes part in
+	/// the regular, wide and concurrent solvers, but such contacts are
+	/// reported as touching and impacts lose their restitution. Continuous
+	/// physics is skipped while this is enabled. Disabled by default.
+	void SetSpeculativeContacts(bool flag) { m_speculativeContacts = flag; }
+	bool GetSpeculativeContacts() const { return m_speculativeContacts; }
+
 	/// Enable/disable single stepped continuous physics. For testing.
 	void SetSubStepping(bool flag) { m_subStepping = flag; }
 	bool GetSubStepping() const { return m_subStepping; }
@@ -233,6 +473,55 @@ public:
 	/// The minimum is 1.
 	float32 GetTreeQuality() const;
 
+	/// Rebuild the broad-phase trees from scratch. This takes O(n log n)
+	/// time and is worth calling after many bodies were added at once,
+	/// such as when part of a level is loaded.
+	void RebuildTree();
+
+	/// Set how many proxies of moving bodies are rebuilt into the
+	/// broad-phase tree each time step, to keep its quality up. Zero, the
+	/// default, turns this off.
+	void SetTreeRebuildBudget(int32 proxyCount);
+
+	/// Get how many proxies are rebuilt into the broad-phase tree each time
+	/// step.
+	int32 GetTreeRebuildBudget() const;
+
+	/// Enable/disable refitting of the broad-phase trees. Moved proxies then
+	/// enlarge or shrink their ancestors in place instead of being
+	/// re-inserted, which is cheaper but lets the trees degrade, so combine
+	/// it with a rebuild budget or an occasional RebuildTree. Disabled by
+	/// default.
+	void SetTreeRefitMode(bool flag);
+
+	/// Are the broad-phase trees refitted in place?
+	bool GetTreeRefitMode() const;
+
+	/// Enable/disable wide copies of the broad-phase trees, which make ray
+	/// casts and AABB queries faster at the cost of copying the trees that
+	/// changed each time step.
+	void SetWideTreeQueries(bool flag);
+
+	/// Are wide copies of the broad-phase trees used for queries?
+	bool GetWideTreeQueries() const;
+
+	/// Enable/disable adaptive margins for the fat AABBs of broad-phase
+	/// proxies. Each margin then follows the recent motion of its proxy, so
+	/// fast bodies are re-inserted into the tree less often and slow bodies
+	/// create fewer pairs. Disabled by default.
+	void SetAdaptiveProxyMargins(bool flag);
+
+	/// Are adaptive margins used for broad-phase proxies?
+	bool GetAdaptiveProxyMargins() const;
+
+	/// Get the number of broad-phase proxies re-inserted because they moved
+	/// out of their fat AABB during the last time step.
+	int32 GetProxyReinsertCount() const;
+
+	/// Get the number of potential new contacts the broad-phase reported
+	/// during the last time step.
+	int32 GetProxyPairCount() const;
+
 	/// Change the global gravity vector.
 	void SetGravity(const b2Vec2& gravity);
 
@@ -263,6 +552,46 @@ public:
 	/// @warning this should be called outside of a time step.
 	void Dump();
 
+	/// Write the state of the world to data in a binary format: settings,
+	/// bodies, fixtures, joints, contacts with their warm starting impulses
+	/// and particle systems. User data, listeners and particle handles
+	/// aren't written. The data uses the byte order of this machine.
+	/// Call this with a NULL data and a capacity of 0 to measure it.
+	/// @warning this should be called outside of a time step.
+	/// @return the size of the data, which wasn't all written if it's
+	/// larger than capacity.
+	int32 Serialize(void* data, int32 capacity);
+
+	/// Read data written by Serialize into this world, which must be empty.
+	/// Arrays are copied straight from data, which may be a memory mapped
+	/// file. Stepping the world then carries on the simulation that was
+	/// written, although not bit for bit since the order of contacts and
+	/// proxies isn't kept.
+	/// @return false if the data isn't valid, in which case the world is
+	/// left empty, although the settings that were read are kept.
+	bool Deserialize(const void* data, int32 size);
+
+	/// Copy everything stepping depends on to state: the motion of bodies,
+	/// broad-phase trees, contacts with their manifolds and TOI data,
+	/// joint impulses, islands and particles, with the order of every list
+	/// and buffer. Pointers are kept, so the state only applies to this
+	/// world. Fixture and joint parameters, filters and world settings
+	/// aren't part of the state.
+	/// @warning this should be called outside of a time step.
+	void CaptureState(b2WorldState* state) const;
+
+	/// Put back the state copied by CaptureState, so that the following
+	/// steps are bit for bit those that followed the capture. Bodies,
+	/// fixtures, joints and particle systems can't have been created or
+	/// destroyed since, but particle groups can; groups that are restored
+	/// reuse the current ones, and the others are destroyed. Listeners
+	/// aren't called for contacts, and particle handles are released.
+	/// @warning this should be called outside of a time step.
+	/// @return false, without changing the world, if its bodies, fixtures,
+	/// joints or particle systems differ from those of the state, or if the
+	/// state is malformed.
+	bool RestoreState(const b2WorldState* state);
+
 	/// Get API version.
 	const b2Version* GetVersion() const {
 		return m_liquidFunVersion;
@@ -295,13 +624,40 @@ private:
 	friend class b2Body;
 	friend class b2Fixture;
 	friend class b2ContactManager;
+	friend class b2Contact;
 	friend class b2Controller;
 	friend class b2ParticleSystem;
 
 	void Init(const b2Vec2& gravity);
 
-	void Solve(const b2TimeStep& step);
+	int32 SolveParticleSystems(const b2TimeStep& step,
+							   b2ParticleSystem** detached);
+	void Solve(const b2TimeStep& step, b2ParticleSystem** particleSystems,
+			   int32 particleSystemCount);
+	void SolveIslands(const b2TimeStep& step);
+	void SolveIslandsConcurrently(const b2TimeStep& step,
+								  b2ParticleSystem** particleSystems,
+								  int32 particleSystemCount);
+	bool BuildIsland(b2PersistentIsland* source, b2Island* island);
 	void SolveTOI(const b2TimeStep& step);
+	float32 ComputeTOI(b2Contact* c);
+	void RequeueTOIs(b2GrowableBuffer<b2TOIEvent>* events,
+					 b2GrowableBuffer<int32>* pending,
+					 const b2GrowableBuffer<b2Body*>& woken);
+
+	b2PersistentIsland* CreateIsland();
+	void DestroyIsland(b2PersistentIsland* island);
+	void AddToIsland(b2PersistentIsland* island, b2Body* body);
+	void RemoveFromIsland(b2Body* body);
+	void UpdateIsland(b2Body* body);
+	void LinkIslands(b2Body* bodyA, b2Body* bodyB);
+	void UnlinkIslands(b2Body* bodyA, b2Body* bodyB);
+	void SplitIsland(b2PersistentIsland* island);
+
+	/// Read the objects written by Serialize. See Deserialize.
+	/// @return false if the data isn't valid, in which case the objects read
+	/// so far are left in the world.
+	bool DeserializeObjects(b2BinaryReader* reader);
 
 	void DrawJoint(b2Joint* joint);
 	void DrawShape(b2Fixture* shape, const b2Transform& xf, const b2Color& color);
@@ -318,9 +674,11 @@ private:
 	b2Body* m_bodyList;
 	b2Joint* m_jointList;
 	b2ParticleSystem* m_particleSystemList;
+	b2PersistentIsland* m_islandList;
 
 	int32 m_bodyCount;
 	int32 m_jointCount;
+	int32 m_islandCount;
 
 	b2Vec2 m_gravity;
 	bool m_allowSleep;
@@ -328,13 +686,32 @@ private:
 	b2DestructionListener* m_destructionListener;
 	b2Draw* m_debugDraw;
 
+	b2WorldSnapshotBuffer* m_snapshotBufferList;
+
+	/// Serial number of the next body, fixture, joint or particle system.
+	/// RestoreState compares serial numbers, since a new object may have
+	/// the address of a destroyed one.
+	uint32 m_nextSerial;
+
+	/// Bodies woken up while SolveTOI runs, by the solver, new contacts or
+	/// listeners, so that their contacts get TOIs. NULL outside SolveTOI.
+	b2GrowableBuffer<b2Body*>* m_wokenBodies;
+
+	b2TaskExecutor* m_taskExecutor;
+	/// Scratch allocators for each thread of m_taskExecutor.
+	b2StackAllocator* m_taskAllocators;
+	int32 m_taskAllocatorCount;
+
 	// This is used to compute the time step ratio to
 	// support a variable time step.
 	float32 m_inv_dt0;
 
 	// These are for debugging the solver.
 	bool m_warmStarting;
+	bool m_wideContactSolving;
+	bool m_wideJointSolving;
 	bool m_continuousPhysics;
+	bool m_speculativeContacts;
 	bool m_subStepping;
 
 	bool m_stepComplete;
@@ -347,6 +724,11 @@ private:
 	const char *m_liquidFunVersionString;
 };
 
+inline b2TaskExecutor* b2World::GetTaskExecutor()
+{
+	return m_taskExecutor;
+}
+
 inline b2Body* b2World::GetBodyList()
 {
 	return m_bodyList;
@@ -387,6 +769,16 @@ inline const b2Contact* b2World::GetContactList() const
 	return m_contactManager.m_contactList;
 }
 
+inline b2Contact* b2World::GetContact(b2ContactId id)
+{
+	return m_contactManager.GetContact(id);
+}
+
+inline const b2Contact* b2World::GetContact(b2ContactId id) const
+{
+	return m_contactManager.GetContact(id);
+}
+
 inline int32 b2World::GetBodyCount() const
 {
 	return m_bodyCount;
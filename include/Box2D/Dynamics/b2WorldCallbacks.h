@@ -124,6 +124,10 @@ struct b2ContactImpulse
 /// single time step.
 /// You should strive to make your callbacks efficient because there may be
 /// many callbacks per time step.
+/// The narrow phase updates contacts in the order of the contact manager's
+/// contact buffer rather than the order of b2World::GetContactList(), so
+/// the BeginContact, EndContact and PreSolve calls it makes come in that
+/// order.
 /// @warning You cannot create/destroy Box2D entities inside these callbacks.
 class b2ContactListener
 {
@@ -296,4 +300,37 @@ public:
 	}
 };
 
+/// A unit of work handed to a b2TaskExecutor. The work is split into items
+/// numbered [0, count) which may be executed in any order.
+class b2Task
+{
+public:
+	virtual ~b2Task() {}
+
+	/// Execute the items [begin, end).
+	/// @param threadIndex the index, in [0, b2TaskExecutor::GetThreadCount()),
+	/// of the thread executing the items. No two threads may use the same
+	/// index at the same time.
+	virtual void Execute(int32 begin, int32 end, int32 threadIndex) = 0;
+};
+
+/// Implement this class to let the world run work on your own threads.
+/// See b2World::SetTaskExecutor.
+class b2TaskExecutor
+{
+public:
+	virtual ~b2TaskExecutor() {}
+
+	/// Get the number of threads that may execute tasks, including the
+	/// thread that calls Run. This must not change while the executor is
+	/// registered with a world.
+	virtual int32 GetThreadCount() const = 0;
+
+	/// Execute every item of task and return once all of them are complete.
+	/// The items may be split into ranges and executed concurrently.
+	/// @param task the work to perform.
+	/// @param count the number of items in task.
+	virtual void Run(b2Task* task, int32 count) = 0;
+};
+
 #endif
@@ -351,6 +351,15 @@ private:
 	int32 m_index;
 };
 
+/// Compact alternative to b2ParticleHandle. A particle id is a 32-bit value
+/// which holds a slot of the particle system's id table and the generation of
+/// that slot. Ids of destroyed particles are detected by a generation
+/// mismatch, see #b2ParticleSystem::GetParticleIndexFromId(). Generations wrap
+/// after 2^(32 - b2_particleIdSlotBits) reuses of the same slot.
+/// Use #b2ParticleSystem::GetParticleIdFromIndex() to retrieve the id of a
+/// particle.
+typedef uint32 b2ParticleId;
+
 #if LIQUIDFUN_EXTERNAL_LANGUAGE_API
 inline void b2ParticleDef::SetPosition(float32 x, float32 y)
 {
@@ -204,8 +204,16 @@ public:
 	float32 GetMass() const;
 
 	/// Get the moment of inertia for the group.
+	/// For groups of rigid particles the moment of inertia is cached and only
+	/// recomputed when particles join or leave the group, when a position
+	/// buffer is set, or after ResetMassData.
 	float32 GetInertia() const;
 
+	/// Recompute the mass properties of the group. Call this after moving
+	/// particles of a rigid group relative to each other through
+	/// b2ParticleSystem::GetPositionBuffer.
+	void ResetMassData();
+
 	/// Get the center of gravity for the group.
 	b2Vec2 GetCenter() const;
 
@@ -278,11 +286,23 @@ private:
 	mutable float32 m_angularVelocity;
 	mutable b2Transform m_transform;
 
+	/// Sum of the squared distances of the particles from m_center.
+	/// Multiplied by the particle mass this is the moment of inertia. Only
+	/// used by rigid groups, for which it doesn't change as the group moves.
+	mutable float32 m_unitInertia;
+	/// Whether m_unitInertia must be recomputed because particles joined or
+	/// left the group or it has just become rigid.
+	mutable bool m_needsUpdateMass;
+	/// b2ParticleSystem::m_positionTimestamp when m_unitInertia was last
+	/// checked. The user has set a new position buffer when they differ.
+	mutable int32 m_positionTimestamp;
+
 	void* m_userData;
 
 	b2ParticleGroup();
 	~b2ParticleGroup();
 	void UpdateStatistics() const;
+	void UpdateRigidStatistics() const;
 
 };
 
@@ -37,6 +37,8 @@ class b2Shape;
 class b2ParticleGroup;
 class b2BlockAllocator;
 class b2StackAllocator;
+class b2BinaryReader;
+class b2BinaryWriter;
 class b2QueryCallback;
 class b2RayCastCallback;
 class b2Fixture;
@@ -58,8 +60,16 @@ private:
 	// b2ParticleSystem::Solve, so reducing the amount of data we churn
 	// through speeds things up. Also, FindContactsFromChecks_Simd takes
 	// advantage of the reduced size for specific optimizations.
+	// Systems with more than 64k particles are supported by storing the
+	// tile of each index, the bits above the low 16, in the top bits of
+	// 'flags' which are never used by particle flags.
 	#ifdef B2_USE_16_BIT_PARTICLE_INDICES
-		typedef int16 b2ParticleIndex;
+		typedef uint16 b2ParticleIndex;
+		static const uint32 k_tileMask =
+			(1u << b2_particleContactTileBits) - 1;
+		static const uint32 k_tileShiftA = 32 - 2 * b2_particleContactTileBits;
+		static const uint32 k_tileShiftB = 32 - b2_particleContactTileBits;
+		static const uint32 k_flagsMask = (1u << k_tileShiftA) - 1;
 	#else
 		typedef int32 b2ParticleIndex;
 	#endif
@@ -79,17 +89,21 @@ private:
 	/// See the b2ParticleFlag enum.
 	uint32 flags;
 
+	#ifdef B2_USE_16_BIT_PARTICLE_INDICES
+		int32 GetIndex(b2ParticleIndex low, uint32 tileShift) const;
+	#endif
+
 public:
 	void SetIndices(int32 a, int32 b);
 	void SetWeight(float32 w) { weight = w; }
 	void SetNormal(const b2Vec2& n) { normal = n; }
-	void SetFlags(uint32 f) { flags = f; }
+	void SetFlags(uint32 f);
 
-	int32 GetIndexA() const { return indexA; }
-	int32 GetIndexB() const { return indexB; }
+	int32 GetIndexA() const;
+	int32 GetIndexB() const;
 	float32 GetWeight() const { return weight; }
 	const b2Vec2& GetNormal() const { return normal; }
-	uint32 GetFlags() const { return flags; }
+	uint32 GetFlags() const;
 
 	bool operator==(const b2ParticleContact& rhs) const;
 	bool operator!=(const b2ParticleContact& rhs) const { return !operator==(rhs); }
@@ -178,6 +192,7 @@ struct b2ParticleSystemDef
 		colorMixingStrength = 0.5f;
 		destroyByAge = true;
 		lifetimeGranularity = 1.0f / 60.0f;
+		largeWorld = false;
 	}
 
 	/// Enable strict Particle/Body contact check.
@@ -275,6 +290,12 @@ struct b2ParticleSystemDef
 	/// With the value set to 1/60 the maximum lifetime or age of a particle is
 	/// 2.27 years.
 	float32 lifetimeGranularity;
+
+	/// Use 64-bit instead of 32-bit tags to sort particles for the contact
+	/// search. 32-bit tags only cover about 4096 particle diameters along each
+	/// axis, beyond that contacts are missed. 64-bit tags cover 2^28
+	/// diameters at the cost of twice the proxy memory and a slower sort.
+	bool largeWorld;
 };
 
 
@@ -294,6 +315,16 @@ public:
 	/// Please see #b2ParticleHandle for why you might want a handle.
 	const b2ParticleHandle* GetParticleHandleFromIndex(const int32 index);
 
+	/// Retrieve the id of the particle at the specified index, allocating a
+	/// slot in the id table if the particle doesn't have one yet.
+	/// Please see #b2ParticleId for how ids differ from handles.
+	b2ParticleId GetParticleIdFromIndex(int32 index);
+
+	/// Get the index of the particle referenced by an id.
+	/// @return the index of the particle or b2_invalidParticleIndex if the
+	/// particle has been destroyed.
+	int32 GetParticleIndexFromId(b2ParticleId id) const;
+
 	/// Destroy a particle.
 	/// The particle is removed after the next simulation step (see
 	/// b2World::Step()).
@@ -453,6 +484,8 @@ public:
 
 	/// Get the position of each particle
 	/// Array is length GetParticleCount()
+	/// After moving particles of a rigid group relative to each other, call
+	/// b2ParticleGroup::ResetMassData.
 	/// @return the pointer to the head of the particle positions array.
 	b2Vec2* GetPositionBuffer();
 	const b2Vec2* GetPositionBuffer() const;
@@ -743,6 +776,9 @@ private:
 	friend class b2ParticleGroup;
 	friend class b2ParticleBodyContactRemovePredicate;
 	friend class b2FixtureParticleQueryCallback;
+	friend class b2ParticleSolveTask;
+	friend class b2RigidGroupSolveTask;
+	friend class b2WorldSnapshotBuffer;
 #ifdef LIQUIDFUN_UNIT_TESTS
 	FRIEND_TEST(FunctionTests, GetParticleMass);
 	FRIEND_TEST(FunctionTests, AreProxyBuffersTheSame);
@@ -760,24 +796,39 @@ private:
 		int32 userSuppliedCapacity;
 	};
 
+	/// Entry of the particle id table.
+	struct IdSlot
+	{
+		/// Index of the particle while the slot is in use, otherwise the next
+		/// free slot.
+		int32 index;
+		/// Incremented each time the slot is freed.
+		uint32 generation;
+	};
+
 	/// Used for detecting particle contacts
-	struct Proxy
+	template <typename T>
+	struct TaggedProxy
 	{
 		int32 index;
-		uint32 tag;
-		friend inline bool operator<(const Proxy &a, const Proxy &b)
+		T tag;
+		friend inline bool operator<(const TaggedProxy &a,
+									 const TaggedProxy &b)
 		{
 			return a.tag < b.tag;
 		}
-		friend inline bool operator<(uint32 a, const Proxy &b)
+		friend inline bool operator<(T a, const TaggedProxy &b)
 		{
 			return a < b.tag;
 		}
-		friend inline bool operator<(const Proxy &a, uint32 b)
+		friend inline bool operator<(const TaggedProxy &a, T b)
 		{
 			return a.tag < b;
 		}
 	};
+	typedef TaggedProxy<uint32> Proxy;
+	/// Proxy used when b2ParticleSystemDef::largeWorld is set.
+	typedef TaggedProxy<uint64> WideProxy;
 
 	/// Class for filtering pairs or triads.
 	class ConnectionFilter
@@ -816,18 +867,29 @@ private:
 		InsideBoundsEnumerator(
 			uint32 lower, uint32 upper,
 			const Proxy* first, const Proxy* last);
+		/// Construct an enumerator with bounds of 64-bit tags and a range of
+		/// proxies of a large world system.
+		InsideBoundsEnumerator(
+			uint64 lower, uint64 upper,
+			const WideProxy* first, const WideProxy* last);
 
 		/// Get index of the next particle. Returns b2_invalidParticleIndex if
 		/// there are no more particles.
 		int32 GetNext();
 	private:
+		template <typename T> int32 GetNext(const TaggedProxy<T>** first,
+											const TaggedProxy<T>* last);
+
 		/// The lower and upper bound of x component in the tag.
-		uint32 m_xLower, m_xUpper;
+		uint64 m_xLower, m_xUpper;
 		/// The lower and upper bound of y component in the tag.
-		uint32 m_yLower, m_yUpper;
+		uint64 m_yLower, m_yUpper;
 		/// The range of proxies.
 		const Proxy* m_first;
 		const Proxy* m_last;
+		/// The range of proxies of a large world system.
+		const WideProxy* m_wideFirst;
+		const WideProxy* m_wideLast;
 	};
 
 	/// Node of linked lists of connected particles
@@ -878,6 +940,10 @@ private:
 	/// Reallocate the handle / index map and schedule the allocation of a new
 	/// pool for handle allocation.
 	void ReallocateHandleBuffers(int32 newCapacity);
+	/// Free the id slot of the particle at the specified index, if any.
+	void FreeParticleId(int32 index);
+	/// Point the id slots of the particles in [start, end) at their indices.
+	void UpdateParticleIdSlots(int32 start, int32 end);
 
 	void ReallocateInternalAllocatedBuffers(int32 capacity);
 	int32 CreateParticleForGroup(
@@ -928,6 +994,10 @@ private:
 	void ComputeDepth();
 
 	InsideBoundsEnumerator GetInsideBoundsEnumerator(const b2AABB& aabb) const;
+	template <typename T> void GetInsideBoundsProxies(
+		const b2GrowableBuffer<TaggedProxy<T> >& proxies, const b2AABB& aabb,
+		T* lowerTag, T* upperTag, const TaggedProxy<T>** first,
+		const TaggedProxy<T>** last) const;
 
 	void UpdateAllParticleFlags();
 	void UpdateAllGroupFlags();
@@ -935,6 +1005,9 @@ private:
 		b2GrowableBuffer<b2ParticleContact>& contacts) const;
 	void FindContacts_Reference(
 		b2GrowableBuffer<b2ParticleContact>& contacts) const;
+	template <typename T> void FindContactsInProxies(
+		const b2GrowableBuffer<TaggedProxy<T> >& proxies,
+		b2GrowableBuffer<b2ParticleContact>& contacts) const;
 	void ReorderForFindContact(FindContactInput* reordered,
 		                       int alignedCount) const;
 	void GatherChecksOneParticle(
@@ -957,10 +1030,19 @@ private:
 		const Proxy* const a, const Proxy* const b, int count);
 	static bool AreProxyBuffersTheSame(const b2GrowableBuffer<Proxy>& a,
 								   	   const b2GrowableBuffer<Proxy>& b);
-	void UpdateProxies_Reference(b2GrowableBuffer<Proxy>& proxies) const;
+	template <typename T> void UpdateProxies_Reference(
+		b2GrowableBuffer<TaggedProxy<T> >& proxies) const;
 	void UpdateProxies_Simd(b2GrowableBuffer<Proxy>& proxies) const;
 	void UpdateProxies(b2GrowableBuffer<Proxy>& proxies) const;
-	void SortProxies(b2GrowableBuffer<Proxy>& proxies) const;
+	void UpdateProxies(b2GrowableBuffer<WideProxy>& proxies) const;
+	template <typename T> void SortProxies(
+		b2GrowableBuffer<TaggedProxy<T> >& proxies) const;
+	template <typename T, typename IndexMap> static void RemapProxies(
+		b2GrowableBuffer<TaggedProxy<T> >& proxies,
+		const IndexMap& newIndices);
+	template <typename T> void QueryProxies(
+		const b2GrowableBuffer<TaggedProxy<T> >& proxies,
+		b2QueryCallback* callback, const b2AABB& aabb) const;
 	void FilterContacts(b2GrowableBuffer<b2ParticleContact>& contacts);
 	void NotifyContactListenerPreContact(
 		b2ParticlePairSet* particlePairs) const;
@@ -972,6 +1054,27 @@ private:
 	void UpdateBodyContacts();
 
 	void Solve(const b2TimeStep& step);
+	/// Can Solve call a listener or filter of the world? Such systems are
+	/// always solved on the thread that steps the world.
+	bool CallsListeners();
+
+	/// Write the particles, groups, pairs and triads of the system. The
+	/// definition of the system is written by b2World.
+	void Serialize(b2BinaryWriter* writer) const;
+	/// Read the data written by Serialize into this system, which must not
+	/// have any particles. Particle handles and user data aren't restored.
+	/// Groups are taken from reusableGroups, a list linked by m_next, while
+	/// it isn't empty. It may be NULL.
+	bool Deserialize(b2BinaryReader* reader, b2ParticleGroup** reusableGroups);
+	/// Write what Serialize writes, followed by the state that only lasts
+	/// between two time steps, such as the order of the proxies and the
+	/// contacts, for b2World::CaptureState.
+	void CaptureState(b2BinaryWriter* writer) const;
+	/// Read the state written by CaptureState back into this system.
+	/// Groups are reused in list order, so that they stay valid when the
+	/// system has the same groups as when the state was captured. Particle
+	/// handles are released.
+	void RestoreState(b2BinaryReader* reader);
 	void SolveCollision(const b2TimeStep& step);
 	void LimitVelocity(const b2TimeStep& step);
 	void SolveGravity(const b2TimeStep& step);
@@ -984,6 +1087,7 @@ private:
 	void SolveExtraDamping();
 	void SolveWall();
 	void SolveRigid(const b2TimeStep& step);
+	void SolveRigidGroup(b2ParticleGroup* group, const b2TimeStep& step);
 	void SolveElastic(const b2TimeStep& step);
 	void SolveSpring(const b2TimeStep& step);
 	void SolveTensile(const b2TimeStep& step);
@@ -1065,12 +1169,23 @@ private:
 		bool isRigidGroup, b2ParticleGroup* group, int32 particleIndex,
 		float32 impulse, const b2Vec2& normal);
 
+	/// Buffers are allocated from a block allocator of the system's own, so
+	/// that systems can be solved on different threads. Mutable because
+	/// const queries allocate scratch buffers from it.
+	mutable b2BlockAllocator m_blockAllocator;
+	/// Scratch allocator of the thread that solves the system, which is the
+	/// world's unless the system is solved on a b2TaskExecutor.
+	b2StackAllocator* m_stackAllocator;
+
 	bool m_paused;
 	int32 m_timestamp;
 	int32 m_allParticleFlags;
 	bool m_needsUpdateAllParticleFlags;
 	int32 m_allGroupFlags;
 	bool m_needsUpdateAllGroupFlags;
+	/// Incremented each time the user supplies a position buffer.
+	/// See b2ParticleGroup::m_positionTimestamp.
+	int32 m_positionTimestamp;
 	bool m_hasForce;
 	int32 m_iterationIndex;
 	float32 m_inverseDensity;
@@ -1084,6 +1199,9 @@ private:
 	b2SlabAllocator<b2ParticleHandle> m_handleAllocator;
 	/// Maps particle indicies to  handles.
 	UserOverridableBuffer<b2ParticleHandle*> m_handleIndexBuffer;
+	/// Maps particle indices to slots of m_idSlotBuffer. Allocated by the
+	/// first GetParticleIdFromIndex() call.
+	int32* m_idSlotIndexBuffer;
 	UserOverridableBuffer<uint32> m_flagsBuffer;
 	UserOverridableBuffer<b2Vec2> m_positionBuffer;
 	UserOverridableBuffer<b2Vec2> m_velocityBuffer;
@@ -1120,10 +1238,17 @@ private:
 	UserOverridableBuffer<int32> m_consecutiveContactStepsBuffer;
 	b2GrowableBuffer<int32> m_stuckParticleBuffer;
 	b2GrowableBuffer<Proxy> m_proxyBuffer;
+	/// Used instead of m_proxyBuffer when b2ParticleSystemDef::largeWorld is
+	/// set.
+	b2GrowableBuffer<WideProxy> m_wideProxyBuffer;
 	b2GrowableBuffer<b2ParticleContact> m_contactBuffer;
 	b2GrowableBuffer<b2ParticleBodyContact> m_bodyContactBuffer;
 	b2GrowableBuffer<b2ParticlePair> m_pairBuffer;
 	b2GrowableBuffer<b2ParticleTriad> m_triadBuffer;
+	/// Particle id table, see b2ParticleId.
+	b2GrowableBuffer<IdSlot> m_idSlotBuffer;
+	/// First free slot of m_idSlotBuffer or b2_invalidParticleIndex.
+	int32 m_freeIdSlot;
 
 	/// Time each particle should be destroyed relative to the last time
 	/// m_timeElapsed was initialized.  Each unit of time corresponds to
@@ -1146,14 +1271,81 @@ private:
 	b2World* m_world;
 	b2ParticleSystem* m_prev;
 	b2ParticleSystem* m_next;
+
+	/// See b2World::m_nextSerial.
+	uint32 m_serial;
 };
 
+#ifdef B2_USE_16_BIT_PARTICLE_INDICES
 inline void b2ParticleContact::SetIndices(int32 a, int32 b)
 {
 	b2Assert(a <= b2_maxParticleIndex && b <= b2_maxParticleIndex);
+	b2Assert(a >= b2_invalidParticleIndex && b >= b2_invalidParticleIndex);
 	indexA = (b2ParticleIndex)a;
 	indexB = (b2ParticleIndex)b;
+	// b2_invalidParticleIndex is stored as a tile and index of all ones.
+	flags = (flags & k_flagsMask) |
+		((((uint32)a >> 16) & k_tileMask) << k_tileShiftA) |
+		((((uint32)b >> 16) & k_tileMask) << k_tileShiftB);
+}
+
+inline int32 b2ParticleContact::GetIndex(
+	b2ParticleIndex low, uint32 tileShift) const
+{
+	// Sign extend so that b2_invalidParticleIndex is returned as -1.
+	static const uint32 unusedBits = 16 - b2_particleContactTileBits;
+	const uint32 tile = (flags >> tileShift) & k_tileMask;
+	return (int32)(((tile << 16) | low) << unusedBits) >> unusedBits;
+}
+
+inline int32 b2ParticleContact::GetIndexA() const
+{
+	return GetIndex(indexA, k_tileShiftA);
+}
+
+inline int32 b2ParticleContact::GetIndexB() const
+{
+	return GetIndex(indexB, k_tileShiftB);
+}
+
+inline void b2ParticleContact::SetFlags(uint32 f)
+{
+	b2Assert((f & ~k_flagsMask) == 0);
+	flags = (flags & ~k_flagsMask) | f;
+}
+
+inline uint32 b2ParticleContact::GetFlags() const
+{
+	return flags & k_flagsMask;
+}
+#else
+inline void b2ParticleContact::SetIndices(int32 a, int32 b)
+{
+	b2Assert(a <= b2_maxParticleIndex && b <= b2_maxParticleIndex);
+	indexA = (b2ParticleIndex)a;
+	indexB = (b2ParticleIndex)b;
+}
+
+inline int32 b2ParticleContact::GetIndexA() const
+{
+	return indexA;
+}
+
+inline int32 b2ParticleContact::GetIndexB() const
+{
+	return indexB;
+}
+
+inline void b2ParticleContact::SetFlags(uint32 f)
+{
+	flags = f;
+}
+
+inline uint32 b2ParticleContact::GetFlags() const
+{
+	return flags;
 }
+#endif // B2_USE_16_BIT_PARTICLE_INDICES
 
 
 inline bool b2ParticleContact::operator==(
@@ -419,6 +419,8 @@ void Test::Step(Settings* settings)
 		m_maxProfile.step = b2Max(m_maxProfile.step, p.step);
 		m_maxProfile.collide = b2Max(m_maxProfile.collide, p.collide);
 		m_maxProfile.solve = b2Max(m_maxProfile.solve, p.solve);
+		m_maxProfile.solveParticle = b2Max(m_maxProfile.solveParticle, p.solveParticle);
+		m_maxProfile.solveRigid = b2Max(m_maxProfile.solveRigid, p.solveRigid);
 		m_maxProfile.solveInit = b2Max(m_maxProfile.solveInit, p.solveInit);
 		m_maxProfile.solveVelocity = b2Max(m_maxProfile.solveVelocity, p.solveVelocity);
 		m_maxProfile.solvePosition = b2Max(m_maxProfile.solvePosition, p.solvePosition);
@@ -428,6 +430,8 @@ void Test::Step(Settings* settings)
 		m_totalProfile.step += p.step;
 		m_totalProfile.collide += p.collide;
 		m_totalProfile.solve += p.solve;
+		m_totalProfile.solveParticle += p.solveParticle;
+		m_totalProfile.solveRigid += p.solveRigid;
 		m_totalProfile.solveInit += p.solveInit;
 		m_totalProfile.solveVelocity += p.solveVelocity;
 		m_totalProfile.solvePosition += p.solvePosition;
@@ -447,6 +451,8 @@ void Test::Step(Settings* settings)
 			aveProfile.step = scale * m_totalProfile.step;
 			aveProfile.collide = scale * m_totalProfile.collide;
 			aveProfile.solve = scale * m_totalProfile.solve;
+			aveProfile.solveParticle = scale * m_totalProfile.solveParticle;
+			aveProfile.solveRigid = scale * m_totalProfile.solveRigid;
 			aveProfile.solveInit = scale * m_totalProfile.solveInit;
 			aveProfile.solveVelocity = scale * m_totalProfile.solveVelocity;
 			aveProfile.solvePosition = scale * m_totalProfile.solvePosition;
@@ -460,6 +466,10 @@ void Test::Step(Settings* settings)
 		m_textLine += DRAW_STRING_NEW_LINE;
 		m_debugDraw.DrawString(5, m_textLine, "solve [ave] (max) = %5.2f [%6.2f] (%6.2f)", p.solve, aveProfile.solve, m_maxProfile.solve);
 		m_textLine += DRAW_STRING_NEW_LINE;
+		m_debugDraw.DrawString(5, m_textLine, "solve particle [ave] (max) = %5.2f [%6.2f] (%6.2f)", p.solveParticle, aveProfile.solveParticle, m_maxProfile.solveParticle);
+		m_textLine += DRAW_STRING_NEW_LINE;
+		m_debugDraw.DrawString(5, m_textLine, "solve rigid [ave] (max) = %5.2f [%6.2f] (%6.2f)", p.solveRigid, aveProfile.solveRigid, m_maxProfile.solveRigid);
+		m_textLine += DRAW_STRING_NEW_LINE;
 		m_debugDraw.DrawString(5, m_textLine, "solve init [ave] (max) = %5.2f [%6.2f] (%6.2f)", p.solveInit, aveProfile.solveInit, m_maxProfile.solveInit);
 		m_textLine += DRAW_STRING_NEW_LINE;
 		m_debugDraw.DrawString(5, m_textLine, "solve velocity [ave] (max) = %5.2f [%6.2f] (%6.2f)", p.solveVelocity, aveProfile.solveVelocity, m_maxProfile.solveVelocity);
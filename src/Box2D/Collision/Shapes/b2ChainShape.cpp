@@ -23,11 +23,55 @@
 #include <memory.h>
 #include <string.h>
 
+namespace {
+
+/// Does the part of a ray up to its max fraction overlap an AABB?
+bool TestSegmentOverlap(const b2AABB& aabb, const b2RayCastInput& input)
+{
+	float32 tmin = 0.0f;
+	float32 tmax = input.maxFraction;
+
+	b2Vec2 p = input.p1;
+	b2Vec2 d = input.p2 - input.p1;
+	for (int32 i = 0; i < 2; ++i)
+	{
+		if (b2Abs(d(i)) < b2_epsilon)
+		{
+			// Parallel.
+			if (p(i) < aabb.lowerBound(i) || aabb.upperBound(i) < p(i))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		float32 inv_d = 1.0f / d(i);
+		float32 t1 = (aabb.lowerBound(i) - p(i)) * inv_d;
+		float32 t2 = (aabb.upperBound(i) - p(i)) * inv_d;
+		if (t1 > t2)
+		{
+			b2Swap(t1, t2);
+		}
+		tmin = b2Max(tmin, t1);
+		tmax = b2Min(tmax, t2);
+		if (tmin > tmax)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
 b2ChainShape::~b2ChainShape()
 {
 	b2Free(m_vertices);
 	m_vertices = NULL;
 	m_count = 0;
+	b2Free(m_edgeTree);
+	m_edgeTree = NULL;
+	m_edgeTreeCount = 0;
 }
 
 void b2ChainShape::CreateLoop(const b2Vec2* vertices, int32 count)
@@ -52,6 +96,11 @@ void b2ChainShape::CreateLoop(const b2Vec2* vertices, int32 count)
 	m_nextVertex = m_vertices[1];
 	m_hasPrevVertex = true;
 	m_hasNextVertex = true;
+
+	if (m_singleProxy)
+	{
+		BuildEdgeTree();
+	}
 }
 
 void b2ChainShape::CreateChain(const b2Vec2* vertices, int32 count)
@@ -77,6 +126,11 @@ void b2ChainShape::CreateChain(const b2Vec2* vertices, int32 count)
 
 	m_prevVertex.SetZero();
 	m_nextVertex.SetZero();
+
+	if (m_singleProxy)
+	{
+		BuildEdgeTree();
+	}
 }
 
 void b2ChainShape::SetPrevVertex(const b2Vec2& prevVertex)
@@ -91,10 +145,77 @@ void b2ChainShape::SetNextVertex(const b2Vec2& nextVertex)
 	m_hasNextVertex = true;
 }
 
+void b2ChainShape::SetSingleProxy(bool flag)
+{
+	if (flag == m_singleProxy)
+	{
+		return;
+	}
+
+	m_singleProxy = flag;
+	if (flag)
+	{
+		if (m_count > 0)
+		{
+			BuildEdgeTree();
+		}
+	}
+	else
+	{
+		b2Free(m_edgeTree);
+		m_edgeTree = NULL;
+		m_edgeTreeCount = 0;
+	}
+}
+
+void b2ChainShape::BuildEdgeTree()
+{
+	b2Assert(m_edgeTree == NULL && m_count >= 2);
+
+	// A tree over n edges split at the middle has at most 2n - 1 nodes.
+	int32 edgeCount = m_count - 1;
+	m_edgeTree = (b2ChainTreeNode*)b2Alloc((2 * edgeCount - 1) * sizeof(b2ChainTreeNode));
+	m_edgeTreeCount = 0;
+	BuildEdgeNode(0, edgeCount);
+}
+
+// Consecutive edges of a chain are close to each other, so the tree is
+// built by splitting the range of edges in half, without sorting them.
+int32 b2ChainShape::BuildEdgeNode(int32 begin, int32 end)
+{
+	int32 index = m_edgeTreeCount++;
+	b2ChainTreeNode* node = m_edgeTree + index;
+	node->begin = begin;
+	node->end = end;
+
+	if (end - begin <= b2_chainTreeLeafSize)
+	{
+		node->child2 = -1;
+		node->aabb.lowerBound = m_vertices[begin];
+		node->aabb.upperBound = m_vertices[begin];
+		for (int32 i = begin + 1; i <= end; ++i)
+		{
+			node->aabb.lowerBound = b2Min(node->aabb.lowerBound, m_vertices[i]);
+			node->aabb.upperBound = b2Max(node->aabb.upperBound, m_vertices[i]);
+		}
+		return index;
+	}
+
+	int32 middle = begin + (end - begin) / 2;
+	int32 child1 = BuildEdgeNode(begin, middle);
+	int32 child2 = BuildEdgeNode(middle, end);
+
+	// The array isn't reallocated, but node is kept by index for clarity.
+	m_edgeTree[index].child2 = child2;
+	m_edgeTree[index].aabb.Combine(m_edgeTree[child1].aabb, m_edgeTree[child2].aabb);
+	return index;
+}
+
 b2Shape* b2ChainShape::Clone(b2BlockAllocator* allocator) const
 {
 	void* mem = allocator->Allocate(sizeof(b2ChainShape));
 	b2ChainShape* clone = new (mem) b2ChainShape;
+	clone->m_singleProxy = m_singleProxy;
 	clone->CreateChain(m_vertices, m_count);
 	clone->m_prevVertex = m_prevVertex;
 	clone->m_nextVertex = m_nextVertex;
@@ -105,6 +226,11 @@ b2Shape* b2ChainShape::Clone(b2BlockAllocator* allocator) const
 
 int32 b2ChainShape::GetChildCount() const
 {
+	if (m_singleProxy)
+	{
+		return 1;
+	}
+
 	// edge count = vertex count - 1
 	return m_count - 1;
 }
@@ -144,8 +270,66 @@ void b2ChainShape::GetChildEdge(b2EdgeShape* edge, int32 index) const
 void b2ChainShape::ComputeDistance(const b2Transform& xf, const b2Vec2& p, float32* distance, b2Vec2* normal, int32 childIndex) const
 {
 	b2EdgeShape edge;
-	GetChildEdge(&edge, childIndex);
-	edge.ComputeDistance(xf, p, distance, normal, 0);
+	if (m_singleProxy == false)
+	{
+		GetChildEdge(&edge, childIndex);
+		edge.ComputeDistance(xf, p, distance, normal, 0);
+		return;
+	}
+
+	b2Assert(childIndex == 0);
+	b2Transform identity;
+	identity.SetIdentity();
+	b2Vec2 localP = b2MulT(xf, p);
+
+	// Find the closest edge, visiting the closer child of each node first
+	// and skipping nodes that are further away than the closest edge.
+	float32 bestDistance = b2_maxFloat;
+	b2Vec2 bestNormal = b2Vec2_zero;
+	b2GrowableStack<int32, 64> stack;
+	stack.Push(0);
+	while (stack.GetCount() > 0)
+	{
+		const b2ChainTreeNode* node = m_edgeTree + stack.Pop();
+		b2Vec2 d = b2Max(node->aabb.lowerBound - localP, localP - node->aabb.upperBound);
+		d = b2Max(d, b2Vec2_zero);
+		if (b2Dot(d, d) >= bestDistance * bestDistance)
+		{
+			continue;
+		}
+
+		if (node->child2 == -1)
+		{
+			for (int32 i = node->begin; i < node->end; ++i)
+			{
+				edge.m_vertex1 = m_vertices[i];
+				edge.m_vertex2 = m_vertices[i + 1];
+				float32 edgeDistance;
+				b2Vec2 edgeNormal;
+				edge.ComputeDistance(identity, localP, &edgeDistance, &edgeNormal, 0);
+				if (edgeDistance < bestDistance)
+				{
+					bestDistance = edgeDistance;
+					bestNormal = edgeNormal;
+				}
+			}
+			continue;
+		}
+
+		int32 child1 = int32(node - m_edgeTree) + 1;
+		int32 child2 = node->child2;
+		b2Vec2 c1 = m_edgeTree[child1].aabb.GetCenter() - localP;
+		b2Vec2 c2 = m_edgeTree[child2].aabb.GetCenter() - localP;
+		if (b2Dot(c1, c1) < b2Dot(c2, c2))
+		{
+			b2Swap(child1, child2);
+		}
+		stack.Push(child1);
+		stack.Push(child2);
+	}
+
+	*distance = bestDistance;
+	*normal = b2Mul(xf.q, bestNormal);
 }
 
 bool b2ChainShape::TestPoint(const b2Transform& xf, const b2Vec2& p) const
@@ -162,6 +346,53 @@ bool b2ChainShape::RayCast(b2RayCastOutput* output, const b2RayCastInput& input,
 
 	b2EdgeShape edgeShape;
 
+	if (m_singleProxy)
+	{
+		b2Assert(childIndex == 0);
+		b2Transform identity;
+		identity.SetIdentity();
+
+		// Cast the ray in the frame of the chain, shortening it at each hit.
+		b2RayCastInput localInput;
+		localInput.p1 = b2MulT(xf, input.p1);
+		localInput.p2 = b2MulT(xf, input.p2);
+		localInput.maxFraction = input.maxFraction;
+
+		bool hit = false;
+		b2GrowableStack<int32, 64> stack;
+		stack.Push(0);
+		while (stack.GetCount() > 0)
+		{
+			const b2ChainTreeNode* node = m_edgeTree + stack.Pop();
+			if (TestSegmentOverlap(node->aabb, localInput) == false)
+			{
+				continue;
+			}
+
+			if (node->child2 != -1)
+			{
+				stack.Push(node->child2);
+				stack.Push(int32(node - m_edgeTree) + 1);
+				continue;
+			}
+
+			for (int32 i = node->begin; i < node->end; ++i)
+			{
+				edgeShape.m_vertex1 = m_vertices[i];
+				edgeShape.m_vertex2 = m_vertices[i + 1];
+				b2RayCastOutput edgeOutput;
+				if (edgeShape.RayCast(&edgeOutput, localInput, identity, 0))
+				{
+					hit = true;
+					localInput.maxFraction = edgeOutput.fraction;
+					output->fraction = edgeOutput.fraction;
+					output->normal = b2Mul(xf.q, edgeOutput.normal);
+				}
+			}
+		}
+		return hit;
+	}
+
 	int32 i1 = childIndex;
 	int32 i2 = childIndex + 1;
 	if (i2 == m_count)
@@ -179,6 +410,20 @@ void b2ChainShape::ComputeAABB(b2AABB* aabb, const b2Transform& xf, int32 childI
 {
 	b2Assert(childIndex < m_count);
 
+	if (m_singleProxy)
+	{
+		// Bound the corners of the bounds of the whole chain.
+		b2Assert(childIndex == 0);
+		const b2AABB& bounds = m_edgeTree[0].aabb;
+		b2Vec2 v1 = b2Mul(xf, bounds.lowerBound);
+		b2Vec2 v2 = b2Mul(xf, bounds.upperBound);
+		b2Vec2 v3 = b2Mul(xf, b2Vec2(bounds.lowerBound.x, bounds.upperBound.y));
+		b2Vec2 v4 = b2Mul(xf, b2Vec2(bounds.upperBound.x, bounds.lowerBound.y));
+		aabb->lowerBound = b2Min(b2Min(v1, v2), b2Min(v3, v4));
+		aabb->upperBound = b2Max(b2Max(v1, v2), b2Max(v3, v4));
+		return;
+	}
+
 	int32 i1 = childIndex;
 	int32 i2 = childIndex + 1;
 	if (i2 == m_count)
@@ -17,6 +17,7 @@
 */
 
 #include <Box2D/Collision/b2BroadPhase.h>
+#include <Box2D/Common/b2BinaryStream.h>
 
 b2BroadPhase::b2BroadPhase()
 {
@@ -26,20 +27,49 @@ b2BroadPhase::b2BroadPhase()
 	m_pairCount = 0;
 	m_pairBuffer = (b2Pair*)b2Alloc(m_pairCapacity * sizeof(b2Pair));
 
+	m_sortCapacity = 0;
+	m_sortBuffer = NULL;
+
 	m_moveCapacity = 16;
 	m_moveCount = 0;
 	m_moveBuffer = (int32*)b2Alloc(m_moveCapacity * sizeof(int32));
+
+	m_queryProxyId = e_nullProxy;
+	m_queryStatic = false;
+
+	m_rebuildBudget = 0;
+	m_wideQueries = false;
+
+	m_reinsertCount = 0;
+	m_reportedPairCount = 0;
+}
+
+void b2BroadPhase::SetWideQueries(bool flag)
+{
+	m_wideQueries = flag;
+	if (flag)
+	{
+		m_tree.BuildWideTree();
+		m_staticTree.BuildWideTree();
+	}
+	else
+	{
+		m_tree.ClearWideTree();
+		m_staticTree.ClearWideTree();
+	}
 }
 
 b2BroadPhase::~b2BroadPhase()
 {
 	b2Free(m_moveBuffer);
 	b2Free(m_pairBuffer);
+	b2Free(m_sortBuffer);
 }
 
-int32 b2BroadPhase::CreateProxy(const b2AABB& aabb, void* userData)
+int32 b2BroadPhase::CreateProxy(const b2AABB& aabb, void* userData, bool isStatic)
 {
-	int32 proxyId = m_tree.CreateProxy(aabb, userData);
+	b2DynamicTree* tree = isStatic ? &m_staticTree : &m_tree;
+	int32 proxyId = GetProxyId(tree->CreateProxy(aabb, userData), isStatic);
 	++m_proxyCount;
 	BufferMove(proxyId);
 	return proxyId;
@@ -49,14 +79,15 @@ void b2BroadPhase::DestroyProxy(int32 proxyId)
 {
 	UnBufferMove(proxyId);
 	--m_proxyCount;
-	m_tree.DestroyProxy(proxyId);
+	GetTree(proxyId)->DestroyProxy(GetTreeProxyId(proxyId));
 }
 
 void b2BroadPhase::MoveProxy(int32 proxyId, const b2AABB& aabb, const b2Vec2& displacement)
 {
-	bool buffer = m_tree.MoveProxy(proxyId, aabb, displacement);
+	bool buffer = GetTree(proxyId)->MoveProxy(GetTreeProxyId(proxyId), aabb, displacement);
 	if (buffer)
 	{
+		++m_reinsertCount;
 		BufferMove(proxyId);
 	}
 }
@@ -93,8 +124,10 @@ void b2BroadPhase::UnBufferMove(int32 proxyId)
 }
 
 // This is called from b2DynamicTree::Query when we are gathering pairs.
-bool b2BroadPhase::QueryCallback(int32 proxyId)
+bool b2BroadPhase::QueryCallback(int32 treeProxyId)
 {
+	int32 proxyId = GetProxyId(treeProxyId, m_queryStatic);
+
 	// A proxy cannot form a pair with itself.
 	if (proxyId == m_queryProxyId)
 	{
@@ -117,3 +150,91 @@ bool b2BroadPhase::QueryCallback(int32 proxyId)
 
 	return true;
 }
+
+// Sort the pairs by proxyIdA, then proxyIdB. Larger buffers are radix
+// sorted a byte at a time on the 64-bit key formed by the two ids,
+// skipping the bytes that all pairs share.
+void b2BroadPhase::SortPairs()
+{
+	if (m_pairCount < 64)
+	{
+		std::sort(m_pairBuffer, m_pairBuffer + m_pairCount, b2PairLessThan);
+		return;
+	}
+
+	if (m_sortCapacity < m_pairCapacity)
+	{
+		b2Free(m_sortBuffer);
+		m_sortCapacity = m_pairCapacity;
+		m_sortBuffer = (b2Pair*)b2Alloc(m_sortCapacity * sizeof(b2Pair));
+	}
+
+	b2Pair* source = m_pairBuffer;
+	b2Pair* target = m_sortBuffer;
+	for (int32 pass = 0; pass < 8; ++pass)
+	{
+		// The low four bytes of the key come from proxyIdB.
+		int32 shift = (pass & 3) * 8;
+		bool sortA = pass >= 4;
+
+		int32 counts[256];
+		memset(counts, 0, sizeof(counts));
+		for (int32 i = 0; i < m_pairCount; ++i)
+		{
+			uint32 id = (uint32)(sortA ? source[i].proxyIdA : source[i].proxyIdB);
+			++counts[(id >> shift) & 0xFF];
+		}
+
+		uint32 firstId = (uint32)(sortA ? source[0].proxyIdA : source[0].proxyIdB);
+		if (counts[(firstId >> shift) & 0xFF] == m_pairCount)
+		{
+			continue;
+		}
+
+		int32 offset = 0;
+		for (int32 i = 0; i < 256; ++i)
+		{
+			int32 count = counts[i];
+			counts[i] = offset;
+			offset += count;
+		}
+
+		for (int32 i = 0; i < m_pairCount; ++i)
+		{
+			uint32 id = (uint32)(sortA ? source[i].proxyIdA : source[i].proxyIdB);
+			target[counts[(id >> shift) & 0xFF]++] = source[i];
+		}
+
+		b2Swap(source, target);
+	}
+
+	if (source != m_pairBuffer)
+	{
+		memcpy(m_pairBuffer, source, m_pairCount * sizeof(b2Pair));
+	}
+}
+
+void b2BroadPhase::CaptureState(b2BinaryWriter* writer) const
+{
+	m_tree.CaptureState(writer);
+	m_staticTree.CaptureState(writer);
+	writer->Write(m_proxyCount);
+	writer->Write(m_moveCount);
+	writer->WriteArray(m_moveBuffer, m_moveCount);
+}
+
+void b2BroadPhase::RestoreState(b2BinaryReader* reader)
+{
+	m_tree.RestoreState(reader);
+	m_staticTree.RestoreState(reader);
+	reader->Read(&m_proxyCount);
+	int32 moveCount = reader->ReadCount(sizeof(int32));
+	if (m_moveCapacity < moveCount)
+	{
+		b2Free(m_moveBuffer);
+		m_moveCapacity = moveCount;
+		m_moveBuffer = (int32*)b2Alloc(m_moveCapacity * sizeof(int32));
+	}
+	m_moveCount = moveCount;
+	reader->ReadArray(m_moveBuffer, m_moveCount);
+}
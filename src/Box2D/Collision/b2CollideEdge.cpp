@@ -17,6 +17,7 @@
  */
 
 #include <Box2D/Collision/b2Collision.h>
+#include <Box2D/Collision/Shapes/b2ChainShape.h>
 #include <Box2D/Collision/Shapes/b2CircleShape.h>
 #include <Box2D/Collision/Shapes/b2EdgeShape.h>
 #include <Box2D/Collision/Shapes/b2PolygonShape.h>
@@ -696,3 +697,158 @@ void b2CollideEdgeAndPolygon(	b2Manifold* manifold,
 	b2EPCollider collider;
 	collider.Collide(manifold, edgeA, xfA, polygonB, xfB);
 }
+
+namespace {
+
+/// Collides the edges of a chain found by b2ChainShape::QueryEdges with a
+/// circle or polygon, and keeps the manifolds that have points.
+class ChainEdgeCollider
+{
+public:
+	ChainEdgeCollider(const b2ChainShape* chainA, const b2Transform& xfA,
+					  const b2Shape* shapeB, const b2Transform& xfB) :
+		m_chainA(chainA), m_xfA(xfA), m_shapeB(shapeB), m_xfB(xfB)
+	{
+		m_deepestSeparation = b2_maxFloat;
+	}
+
+	bool QueryCallback(int32 index)
+	{
+		b2EdgeShape edge;
+		m_chainA->GetChildEdge(&edge, index);
+
+		b2Manifold manifold;
+		if (m_shapeB->GetType() == b2Shape::e_circle)
+		{
+			b2CollideEdgeAndCircle(&manifold, &edge, m_xfA,
+								   (const b2CircleShape*)m_shapeB, m_xfB);
+		}
+		else
+		{
+			b2Assert(m_shapeB->GetType() == b2Shape::e_polygon);
+			b2CollideEdgeAndPolygon(&manifold, &edge, m_xfA,
+									(const b2PolygonShape*)m_shapeB, m_xfB);
+		}
+
+		if (manifold.pointCount == 0)
+		{
+			return true;
+		}
+
+		// Keep the ids of points on nearby edges apart, so that warm
+		// starting doesn't match them. Feature indices are below
+		// b2_maxPolygonVertices, so each index byte has room for a factor
+		// of 256 / b2_maxPolygonVertices of the folded edge index.
+		const int32 digit = 256 / b2_maxPolygonVertices;
+		b2Assert(b2_chainEdgeIdPeriod <= digit * digit);
+		int32 edgeId = index % b2_chainEdgeIdPeriod;
+		for (int32 i = 0; i < manifold.pointCount; ++i)
+		{
+			b2ContactFeature& cf = manifold.points[i].id.cf;
+			b2Assert(cf.indexA < b2_maxPolygonVertices);
+			b2Assert(cf.indexB < b2_maxPolygonVertices);
+			cf.indexA = (uint8)(cf.indexA +
+				b2_maxPolygonVertices * (edgeId % digit));
+			cf.indexB = (uint8)(cf.indexB +
+				b2_maxPolygonVertices * (edgeId / digit));
+		}
+
+		b2WorldManifold worldManifold;
+		worldManifold.Initialize(&manifold, m_xfA, m_chainA->m_radius,
+								 m_xfB, m_shapeB->m_radius);
+		for (int32 i = 0; i < manifold.pointCount; ++i)
+		{
+			if (worldManifold.separations[i] < m_deepestSeparation)
+			{
+				m_deepestPoint = i;
+				m_deepestSeparation = worldManifold.separations[i];
+				m_reference = manifold;
+			}
+		}
+
+		m_manifolds.Push(manifold);
+		return true;
+	}
+
+	/// Merge the manifolds that have the normal of the deepest point.
+	void Merge(b2Manifold* manifold)
+	{
+		manifold->pointCount = 0;
+		if (m_manifolds.GetCount() == 0)
+		{
+			return;
+		}
+
+		*manifold = m_reference;
+		manifold->pointCount = 1;
+		manifold->points[0] = m_reference.points[m_deepestPoint];
+		if (m_reference.type == b2Manifold::e_circles)
+		{
+			return;
+		}
+
+		// Add the point furthest from the deepest one, out of the points of
+		// manifolds with the same type and normal. Their points are in the
+		// same frame.
+		const float32 minDot = 1.0f - 0.5f * b2_angularSlop * b2_angularSlop;
+		const b2Vec2 p0 = manifold->points[0].localPoint;
+		float32 maxDistanceSquared = b2_linearSlop * b2_linearSlop;
+		while (m_manifolds.GetCount() > 0)
+		{
+			b2Manifold m = m_manifolds.Pop();
+			if (m.type != m_reference.type ||
+				b2Dot(m.localNormal, m_reference.localNormal) < minDot)
+			{
+				continue;
+			}
+
+			for (int32 i = 0; i < m.pointCount; ++i)
+			{
+				AddFurthestPoint(manifold, m.points[i], p0, &maxDistanceSquared);
+			}
+		}
+	}
+
+private:
+	static void AddFurthestPoint(b2Manifold* manifold, const b2ManifoldPoint& point,
+								 const b2Vec2& p0, float32* maxDistanceSquared)
+	{
+		float32 distanceSquared = b2DistanceSquared(point.localPoint, p0);
+		if (distanceSquared > *maxDistanceSquared)
+		{
+			*maxDistanceSquared = distanceSquared;
+			manifold->points[1] = point;
+			manifold->pointCount = 2;
+		}
+	}
+
+	const b2ChainShape* m_chainA;
+	const b2Transform& m_xfA;
+	const b2Shape* m_shapeB;
+	const b2Transform& m_xfB;
+
+	b2GrowableStack<b2Manifold, 8> m_manifolds;
+	b2Manifold m_reference;
+	int32 m_deepestPoint;
+	float32 m_deepestSeparation;
+};
+
+} // namespace
+
+void b2CollideChainEdges(b2Manifold* manifold,
+						 const b2ChainShape* chainA, const b2Transform& xfA,
+						 const b2Shape* shapeB, const b2Transform& xfB)
+{
+	b2Assert(chainA->IsSingleProxy());
+
+	// Find the edges near shape B in the frame of the chain.
+	b2AABB aabb;
+	shapeB->ComputeAABB(&aabb, b2MulT(xfA, xfB), 0);
+	b2Vec2 r(chainA->m_radius + b2_linearSlop, chainA->m_radius + b2_linearSlop);
+	aabb.lowerBound -= r;
+	aabb.upperBound += r;
+
+	ChainEdgeCollider collider(chainA, xfA, shapeB, xfB);
+	chainA->QueryEdges(&collider, aabb);
+	collider.Merge(manifold);
+}
@@ -18,6 +18,7 @@
 */
 
 #include <Box2D/Collision/b2DynamicTree.h>
+#include <Box2D/Common/b2BinaryStream.h>
 #include <memory.h>
 #include <string.h>
 
@@ -43,12 +44,22 @@ b2DynamicTree::b2DynamicTree()
 	m_path = 0;
 
 	m_insertionCount = 0;
+
+	m_refitMode = false;
+	m_adaptiveMargins = false;
+
+	m_wideNodes = NULL;
+	m_wideNodeCount = 0;
+	m_wideNodeCapacity = 0;
+	m_wideRoot = b2_nullNode;
+	m_wideTreeStale = false;
 }
 
 b2DynamicTree::~b2DynamicTree()
 {
 	// This frees the entire tree in one shot.
 	b2Free(m_nodes);
+	b2Free(m_wideNodes);
 }
 
 // Allocate a node from the pool. Grow the pool if necessary.
@@ -114,6 +125,7 @@ int32 b2DynamicTree::CreateProxy(const b2AABB& aabb, void* userData)
 	m_nodes[proxyId].aabb.upperBound = aabb.upperBound + r;
 	m_nodes[proxyId].userData = userData;
 	m_nodes[proxyId].height = 0;
+	m_nodes[proxyId].motion = 0.0f;
 
 	InsertLeaf(proxyId);
 
@@ -135,21 +147,40 @@ bool b2DynamicTree::MoveProxy(int32 proxyId, const b2AABB& aabb, const b2Vec2& d
 
 	b2Assert(m_nodes[proxyId].IsLeaf());
 
-	if (m_nodes[proxyId].aabb.Contains(aabb))
+	// Track the recent displacement even while the AABB is kept.
+	b2TreeNode* node = m_nodes + proxyId;
+	if (m_adaptiveMargins)
+	{
+		node->motion = b2Max(displacement.Length(), b2_aabbMotionDecay * node->motion);
+	}
+
+	if (node->aabb.Contains(aabb))
 	{
 		return false;
 	}
 
-	RemoveLeaf(proxyId);
+	if (m_refitMode == false)
+	{
+		RemoveLeaf(proxyId);
+	}
+
+	float32 extension = b2_aabbExtension;
+	float32 multiplier = b2_aabbMultiplier;
+	if (m_adaptiveMargins)
+	{
+		extension = b2Clamp(b2_aabbMotionMargin * node->motion,
+							b2_aabbMinExtension, b2_aabbExtension);
+		multiplier = b2_aabbAdaptiveMultiplier;
+	}
 
 	// Extend AABB.
 	b2AABB b = aabb;
-	b2Vec2 r(b2_aabbExtension, b2_aabbExtension);
+	b2Vec2 r(extension, extension);
 	b.lowerBound = b.lowerBound - r;
 	b.upperBound = b.upperBound + r;
 
 	// Predict AABB displacement.
-	b2Vec2 d = b2_aabbMultiplier * displacement;
+	b2Vec2 d = multiplier * displacement;
 
 	if (d.x < 0.0f)
 	{
@@ -171,13 +202,45 @@ bool b2DynamicTree::MoveProxy(int32 proxyId, const b2AABB& aabb, const b2Vec2& d
 
 	m_nodes[proxyId].aabb = b;
 
-	InsertLeaf(proxyId);
+	if (m_refitMode)
+	{
+		// The proxies of the wide copy are still the same.
+		m_wideTreeStale = true;
+		RefitAncestors(m_nodes[proxyId].parent);
+	}
+	else
+	{
+		InsertLeaf(proxyId);
+	}
 	return true;
 }
 
+// Recompute the AABBs of index and its ancestors from their children,
+// stopping as soon as one doesn't change.
+void b2DynamicTree::RefitAncestors(int32 index)
+{
+	while (index != b2_nullNode)
+	{
+		int32 child1 = m_nodes[index].child1;
+		int32 child2 = m_nodes[index].child2;
+
+		b2AABB aabb;
+		aabb.Combine(m_nodes[child1].aabb, m_nodes[child2].aabb);
+		if (aabb.lowerBound == m_nodes[index].aabb.lowerBound &&
+			aabb.upperBound == m_nodes[index].aabb.upperBound)
+		{
+			break;
+		}
+
+		m_nodes[index].aabb = aabb;
+		index = m_nodes[index].parent;
+	}
+}
+
 void b2DynamicTree::InsertLeaf(int32 leaf)
 {
 	++m_insertionCount;
+	m_wideRoot = b2_nullNode;
 
 	if (m_root == b2_nullNode)
 	{
@@ -317,6 +380,8 @@ void b2DynamicTree::InsertLeaf(int32 leaf)
 
 void b2DynamicTree::RemoveLeaf(int32 leaf)
 {
+	m_wideRoot = b2_nullNode;
+
 	if (leaf == m_root)
 	{
 		m_root = b2_nullNode;
@@ -773,8 +838,413 @@ void b2DynamicTree::RebuildBottomUp()
 	B2_DEBUG_STATEMENT(Validate());
 }
 
+void b2DynamicTree::RebuildTopDown()
+{
+	if (m_root == b2_nullNode)
+	{
+		return;
+	}
+
+	int32* leaves = (int32*)b2Alloc(m_nodeCount * sizeof(int32));
+	int32 count = CollectLeaves(m_root, leaves);
+
+	m_root = BuildTopDown(leaves, count);
+	m_nodes[m_root].parent = b2_nullNode;
+	b2Free(leaves);
+
+	B2_DEBUG_STATEMENT(Validate());
+}
+
+int32 b2DynamicTree::RebuildIncremental(int32 leafBudget)
+{
+	if (m_root == b2_nullNode || leafBudget < 2)
+	{
+		return 0;
+	}
+
+	// A subtree can't have more leaves than two to the power of its height.
+	int32 maxHeight = 1;
+	while (maxHeight < 30 && (2 << maxHeight) <= leafBudget)
+	{
+		++maxHeight;
+	}
+
+	// Descend from the root, choosing children by the bits of m_path, so
+	// that successive calls rebuild different parts of the tree.
+	int32 index = m_root;
+	int32 bit = 0;
+	while (m_nodes[index].height > maxHeight)
+	{
+		if ((m_path >> bit) & 1)
+		{
+			index = m_nodes[index].child2;
+		}
+		else
+		{
+			index = m_nodes[index].child1;
+		}
+		bit = (bit + 1) & 31;
+	}
+	++m_path;
+
+	// A pair of leaves can't be improved.
+	if (m_nodes[index].height < 2)
+	{
+		return 0;
+	}
+
+	int32 parent = m_nodes[index].parent;
+	bool isChild1 = parent != b2_nullNode && m_nodes[parent].child1 == index;
+
+	int32* leaves = (int32*)b2Alloc((1 << maxHeight) * sizeof(int32));
+	int32 count = CollectLeaves(index, leaves);
+	int32 root = BuildTopDown(leaves, count);
+	b2Free(leaves);
+
+	m_nodes[root].parent = parent;
+	if (parent == b2_nullNode)
+	{
+		m_root = root;
+	}
+	else if (isChild1)
+	{
+		m_nodes[parent].child1 = root;
+	}
+	else
+	{
+		m_nodes[parent].child2 = root;
+	}
+
+	// The subtree covers the same leaves, so only the heights of its
+	// ancestors can change.
+	for (int32 i = parent; i != b2_nullNode; i = m_nodes[i].parent)
+	{
+		int32 child1 = m_nodes[i].child1;
+		int32 child2 = m_nodes[i].child2;
+		m_nodes[i].height = 1 + b2Max(m_nodes[child1].height, m_nodes[child2].height);
+	}
+
+	return count;
+}
+
+// Gather the leaves below index into leaves and free the internal nodes.
+int32 b2DynamicTree::CollectLeaves(int32 index, int32* leaves)
+{
+	int32 count = 0;
+	b2GrowableStack<int32, 256> stack;
+	stack.Push(index);
+	while (stack.GetCount() > 0)
+	{
+		int32 nodeId = stack.Pop();
+		b2TreeNode* node = m_nodes + nodeId;
+		if (node->IsLeaf())
+		{
+			node->parent = b2_nullNode;
+			leaves[count++] = nodeId;
+		}
+		else
+		{
+			stack.Push(node->child1);
+			stack.Push(node->child2);
+			FreeNode(nodeId);
+		}
+	}
+	return count;
+}
+
+// Build a subtree over the given leaves and return its root. The leaves
+// are reordered. A node takes its leaves from the free list, so enough
+// internal nodes must have been freed for the pool not to grow.
+int32 b2DynamicTree::BuildTopDown(int32* leaves, int32 count)
+{
+	b2Assert(count > 0);
+	if (count == 1)
+	{
+		return leaves[0];
+	}
+
+	// Find the longer axis of the bounds of the leaf centers.
+	b2AABB centerBounds;
+	centerBounds.lowerBound = m_nodes[leaves[0]].aabb.GetCenter();
+	centerBounds.upperBound = centerBounds.lowerBound;
+	for (int32 i = 1; i < count; ++i)
+	{
+		b2Vec2 c = m_nodes[leaves[i]].aabb.GetCenter();
+		centerBounds.lowerBound = b2Min(centerBounds.lowerBound, c);
+		centerBounds.upperBound = b2Max(centerBounds.upperBound, c);
+	}
+
+	b2Vec2 extents = centerBounds.upperBound - centerBounds.lowerBound;
+	int32 axis = extents.x >= extents.y ? 0 : 1;
+	float32 minCenter = centerBounds.lowerBound(axis);
+	float32 extent = extents(axis);
+
+	// Leaves with coincident centers are split in half.
+	int32 split = count / 2;
+	if (extent > 0.0f)
+	{
+		// Sort the leaves into bins by their centers.
+		int32 binCounts[b2_treeBinCount];
+		b2AABB binAABBs[b2_treeBinCount];
+		memset(binCounts, 0, sizeof(binCounts));
+		float32 scale = b2_treeBinCount / extent;
+		for (int32 i = 0; i < count; ++i)
+		{
+			const b2AABB& aabb = m_nodes[leaves[i]].aabb;
+			int32 bin = (int32)((aabb.GetCenter()(axis) - minCenter) * scale);
+			bin = b2Min(bin, b2_treeBinCount - 1);
+			if (binCounts[bin] == 0)
+			{
+				binAABBs[bin] = aabb;
+			}
+			else
+			{
+				binAABBs[bin].Combine(aabb);
+			}
+			++binCounts[bin];
+		}
+
+		// The cost of a split after bin i is the perimeter of each side
+		// weighted by its number of leaves.
+		float32 rightCosts[b2_treeBinCount];
+		b2AABB rightAABB = binAABBs[b2_treeBinCount - 1];
+		int32 rightCount = 0;
+		for (int32 i = b2_treeBinCount - 1; i > 0; --i)
+		{
+			if (binCounts[i] > 0)
+			{
+				if (rightCount == 0)
+				{
+					rightAABB = binAABBs[i];
+				}
+				else
+				{
+					rightAABB.Combine(binAABBs[i]);
+				}
+				rightCount += binCounts[i];
+			}
+			rightCosts[i - 1] = rightCount * rightAABB.GetPerimeter();
+		}
+
+		float32 minCost = b2_maxFloat;
+		int32 bestBin = -1;
+		b2AABB leftAABB = binAABBs[0];
+		int32 leftCount = 0;
+		for (int32 i = 0; i < b2_treeBinCount - 1; ++i)
+		{
+			if (binCounts[i] > 0)
+			{
+				if (leftCount == 0)
+				{
+					leftAABB = binAABBs[i];
+				}
+				else
+				{
+					leftAABB.Combine(binAABBs[i]);
+				}
+				leftCount += binCounts[i];
+			}
+
+			if (leftCount == 0 || leftCount == count)
+			{
+				continue;
+			}
+
+			float32 cost = leftCount * leftAABB.GetPerimeter() + rightCosts[i];
+			if (cost < minCost)
+			{
+				minCost = cost;
+				bestBin = i;
+			}
+		}
+
+		// Move the leaves on the left of the split to the front.
+		if (bestBin >= 0)
+		{
+			split = 0;
+			for (int32 i = 0; i < count; ++i)
+			{
+				const b2AABB& aabb = m_nodes[leaves[i]].aabb;
+				int32 bin = (int32)((aabb.GetCenter()(axis) - minCenter) * scale);
+				bin = b2Min(bin, b2_treeBinCount - 1);
+				if (bin <= bestBin)
+				{
+					b2Swap(leaves[i], leaves[split]);
+					++split;
+				}
+			}
+		}
+	}
+
+	int32 child1 = BuildTopDown(leaves, split);
+	int32 child2 = BuildTopDown(leaves + split, count - split);
+
+	int32 parentIndex = AllocateNode();
+	b2TreeNode* parent = m_nodes + parentIndex;
+	parent->child1 = child1;
+	parent->child2 = child2;
+	parent->height = 1 + b2Max(m_nodes[child1].height, m_nodes[child2].height);
+	parent->aabb.Combine(m_nodes[child1].aabb, m_nodes[child2].aabb);
+	parent->parent = b2_nullNode;
+
+	m_nodes[child1].parent = parentIndex;
+	m_nodes[child2].parent = parentIndex;
+
+	return parentIndex;
+}
+
+void b2DynamicTree::BuildWideTree()
+{
+	if (m_wideRoot != b2_nullNode && m_wideTreeStale)
+	{
+		RefitWideTree();
+		return;
+	}
+
+	m_wideRoot = b2_nullNode;
+	m_wideTreeStale = false;
+	m_wideNodeCount = 0;
+	if (m_root == b2_nullNode)
+	{
+		return;
+	}
+
+	// Every wide node but the root has at least two children, so there are
+	// no more wide nodes than leaves.
+	if (m_wideNodeCapacity < m_nodeCount)
+	{
+		b2Free(m_wideNodes);
+		m_wideNodeCapacity = m_nodeCount;
+		m_wideNodes = (b2WideTreeNode*)b2Alloc(m_wideNodeCapacity * sizeof(b2WideTreeNode));
+	}
+
+	m_wideRoot = BuildWideNode(m_root);
+}
+
+// Make a wide node from index and its descendants, collapsing the binary
+// nodes with the largest perimeters first.
+int32 b2DynamicTree::BuildWideNode(int32 index)
+{
+	int32 children[b2_wideTreeLanes];
+	int32 count = 0;
+	if (m_nodes[index].IsLeaf())
+	{
+		children[count++] = index;
+	}
+	else
+	{
+		children[count++] = m_nodes[index].child1;
+		children[count++] = m_nodes[index].child2;
+	}
+
+	while (count < b2_wideTreeLanes)
+	{
+		int32 best = -1;
+		float32 maxPerimeter = -1.0f;
+		for (int32 i = 0; i < count; ++i)
+		{
+			const b2TreeNode* node = m_nodes + children[i];
+			if (node->IsLeaf() == false && node->aabb.GetPerimeter() > maxPerimeter)
+			{
+				maxPerimeter = node->aabb.GetPerimeter();
+				best = i;
+			}
+		}
+
+		if (best < 0)
+		{
+			break;
+		}
+
+		int32 expanded = children[best];
+		children[best] = m_nodes[expanded].child1;
+		children[count++] = m_nodes[expanded].child2;
+	}
+
+	b2Assert(m_wideNodeCount < m_wideNodeCapacity);
+	int32 wideIndex = m_wideNodeCount++;
+	for (int32 i = 0; i < b2_wideTreeLanes; ++i)
+	{
+		b2WideTreeNode* wideNode = m_wideNodes + wideIndex;
+		if (i >= count)
+		{
+			// An empty box never overlaps anything.
+			wideNode->lowerX[i] = b2_maxFloat;
+			wideNode->lowerY[i] = b2_maxFloat;
+			wideNode->upperX[i] = -b2_maxFloat;
+			wideNode->upperY[i] = -b2_maxFloat;
+			wideNode->children[i] = b2_nullNode;
+			continue;
+		}
+
+		const b2TreeNode* node = m_nodes + children[i];
+		wideNode->lowerX[i] = node->aabb.lowerBound.x;
+		wideNode->lowerY[i] = node->aabb.lowerBound.y;
+		wideNode->upperX[i] = node->aabb.upperBound.x;
+		wideNode->upperY[i] = node->aabb.upperBound.y;
+		if (node->IsLeaf())
+		{
+			wideNode->children[i] = GetWideLeaf(children[i]);
+		}
+		else
+		{
+			wideNode->children[i] = BuildWideNode(children[i]);
+		}
+	}
+
+	return wideIndex;
+}
+
+// Recompute the AABBs of the children of the wide nodes. Children are built
+// after their parent, so they come later in m_wideNodes.
+void b2DynamicTree::RefitWideTree()
+{
+	for (int32 index = m_wideNodeCount - 1; index >= 0; --index)
+	{
+		b2WideTreeNode* wideNode = m_wideNodes + index;
+		for (int32 i = 0; i < b2_wideTreeLanes; ++i)
+		{
+			int32 child = wideNode->children[i];
+			if (child == b2_nullNode)
+			{
+				continue;
+			}
+
+			if (child < 0)
+			{
+				const b2AABB& aabb = m_nodes[GetWideLeafProxyId(child)].aabb;
+				wideNode->lowerX[i] = aabb.lowerBound.x;
+				wideNode->lowerY[i] = aabb.lowerBound.y;
+				wideNode->upperX[i] = aabb.upperBound.x;
+				wideNode->upperY[i] = aabb.upperBound.y;
+				continue;
+			}
+
+			const b2WideTreeNode* childNode = m_wideNodes + child;
+			float32 lowerX = childNode->lowerX[0];
+			float32 lowerY = childNode->lowerY[0];
+			float32 upperX = childNode->upperX[0];
+			float32 upperY = childNode->upperY[0];
+			for (int32 k = 1; k < b2_wideTreeLanes; ++k)
+			{
+				lowerX = b2Min(lowerX, childNode->lowerX[k]);
+				lowerY = b2Min(lowerY, childNode->lowerY[k]);
+				upperX = b2Max(upperX, childNode->upperX[k]);
+				upperY = b2Max(upperY, childNode->upperY[k]);
+			}
+			wideNode->lowerX[i] = lowerX;
+			wideNode->lowerY[i] = lowerY;
+			wideNode->upperX[i] = upperX;
+			wideNode->upperY[i] = upperY;
+		}
+	}
+	m_wideTreeStale = false;
+}
+
 void b2DynamicTree::ShiftOrigin(const b2Vec2& newOrigin)
 {
+	m_wideRoot = b2_nullNode;
+
 	// Build array of leaves. Free the rest.
 	for (int32 i = 0; i < m_nodeCapacity; ++i)
 	{
@@ -782,3 +1252,53 @@ void b2DynamicTree::ShiftOrigin(const b2Vec2& newOrigin)
 		m_nodes[i].aabb.upperBound -= newOrigin;
 	}
 }
+
+void b2DynamicTree::CaptureState(b2BinaryWriter* writer) const
+{
+	writer->Write(m_root);
+	writer->Write(m_nodeCount);
+	writer->Write(m_nodeCapacity);
+	writer->Write(m_freeList);
+	writer->Write(m_path);
+	writer->Write(m_insertionCount);
+	writer->WriteArray(m_nodes, m_nodeCapacity);
+
+	int32 wideNodeCount = m_wideRoot != b2_nullNode ? m_wideNodeCount : 0;
+	writer->Write(wideNodeCount);
+	writer->Write(m_wideRoot);
+	writer->Write(m_wideTreeStale);
+	writer->WriteArray(m_wideNodes, wideNodeCount);
+}
+
+void b2DynamicTree::RestoreState(b2BinaryReader* reader)
+{
+	reader->Read(&m_root);
+	reader->Read(&m_nodeCount);
+
+	// The capacity is restored too, since the pool grows once its free list
+	// runs out.
+	int32 nodeCapacity = reader->ReadCount(sizeof(b2TreeNode));
+	if (nodeCapacity != m_nodeCapacity)
+	{
+		b2Free(m_nodes);
+		m_nodeCapacity = nodeCapacity;
+		m_nodes = (b2TreeNode*)b2Alloc(m_nodeCapacity * sizeof(b2TreeNode));
+	}
+	reader->Read(&m_freeList);
+	reader->Read(&m_path);
+	reader->Read(&m_insertionCount);
+	reader->ReadArray(m_nodes, m_nodeCapacity);
+
+	int32 wideNodeCount = reader->ReadCount(sizeof(b2WideTreeNode));
+	if (m_wideNodeCapacity < wideNodeCount)
+	{
+		b2Free(m_wideNodes);
+		m_wideNodeCapacity = wideNodeCount;
+		m_wideNodes = (b2WideTreeNode*)b2Alloc(
+			m_wideNodeCapacity * sizeof(b2WideTreeNode));
+	}
+	m_wideNodeCount = wideNodeCount;
+	reader->Read(&m_wideRoot);
+	reader->Read(&m_wideTreeStale);
+	reader->ReadArray(m_wideNodes, wideNodeCount);
+}
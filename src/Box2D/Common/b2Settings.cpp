@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <atomic>
 
 b2Version b2_version = {2, 3, 0};
 
@@ -44,7 +45,8 @@ const char *b2_liquidFunVersionString =
 	LIQUIDFUN_STRING(LIQUIDFUN_VERSION_MINOR) "."
 	LIQUIDFUN_STRING(LIQUIDFUN_VERSION_REVISION);
 
-static int32 b2_numAllocs = 0;
+// Task executor threads allocate too, so the count is atomic.
+static std::atomic<int32> b2_numAllocs(0);
 
 // Initialize default allocator.
 static b2AllocFunction b2_allocCallback = b2AllocDefault;
@@ -92,24 +94,24 @@ void b2SetAllocFreeCallbacks(b2AllocFunction allocCallback,
 // Memory allocators. Modify these to use your own allocator.
 void* b2Alloc(int32 size)
 {
-	b2_numAllocs++;
+	b2_numAllocs.fetch_add(1, std::memory_order_relaxed);
 	return b2_allocCallback(size, b2_callbackData);
 }
 
 void b2Free(void* mem)
 {
-	b2_numAllocs--;
+	b2_numAllocs.fetch_sub(1, std::memory_order_relaxed);
 	b2_freeCallback(mem, b2_callbackData);
 }
 
 void b2SetNumAllocs(const int32 numAllocs)
 {
-	b2_numAllocs = numAllocs;
+	b2_numAllocs.store(numAllocs, std::memory_order_relaxed);
 }
 
 int32 b2GetNumAllocs()
 {
-	return b2_numAllocs;
+	return b2_numAllocs.load(std::memory_order_relaxed);
 }
 
 // You can modify this to use your logging facility.
@@ -22,9 +22,13 @@
 
 b2StackAllocator::b2StackAllocator()
 {
+	m_capacity = b2_stackSize;
+	m_data = (char*)b2Alloc(m_capacity);
 	m_index = 0;
 	m_allocation = 0;
 	m_maxAllocation = 0;
+	m_entryCapacity = b2_maxStackEntries;
+	m_entries = (b2StackEntry*)b2Alloc(m_entryCapacity * sizeof(b2StackEntry));
 	m_entryCount = 0;
 }
 
@@ -32,15 +36,25 @@ b2StackAllocator::~b2StackAllocator()
 {
 	b2Assert(m_index == 0);
 	b2Assert(m_entryCount == 0);
+	b2Free(m_entries);
+	b2Free(m_data);
 }
 
 void* b2StackAllocator::Allocate(int32 size)
 {
-	b2Assert(m_entryCount < b2_maxStackEntries);
+	if (m_entryCount == m_entryCapacity)
+	{
+		b2StackEntry* oldEntries = m_entries;
+		m_entryCapacity *= 2;
+		m_entries = (b2StackEntry*)b2Alloc(m_entryCapacity * sizeof(b2StackEntry));
+		memcpy(m_entries, oldEntries, m_entryCount * sizeof(b2StackEntry));
+		b2Free(oldEntries);
+	}
+
 	const int32 roundedSize = (size + ALIGN_MASK) & ~ALIGN_MASK;
 	b2StackEntry* entry = m_entries + m_entryCount;
 	entry->size = roundedSize;
-	if (m_index + roundedSize > b2_stackSize)
+	if (m_index + roundedSize > m_capacity)
 	{
 		entry->data = (char*)b2Alloc(roundedSize);
 		entry->usedMalloc = true;
@@ -65,6 +79,7 @@ void* b2StackAllocator::Reallocate(void* p, int32 size)
 	b2StackEntry* entry = m_entries + m_entryCount - 1;
 	b2Assert(p == entry->data);
 	B2_NOT_USED(p);
+	size = (size + ALIGN_MASK) & ~ALIGN_MASK;
 	int32 incrementSize = size - entry->size;
 	if (incrementSize > 0)
 	{
@@ -75,7 +90,7 @@ void* b2StackAllocator::Reallocate(void* p, int32 size)
 			b2Free(entry->data);
 			entry->data = (char*)data;
 		}
-		else if (m_index + incrementSize > b2_stackSize)
+		else if (m_index + incrementSize > m_capacity)
 		{
 			void* data = b2Alloc(size);
 			memcpy(data, entry->data, entry->size);
@@ -86,9 +101,9 @@ void* b2StackAllocator::Reallocate(void* p, int32 size)
 		else
 		{
 			m_index += incrementSize;
-			m_allocation += incrementSize;
-			m_maxAllocation = b2Max(m_maxAllocation, m_allocation);
 		}
+		m_allocation += incrementSize;
+		m_maxAllocation = b2Max(m_maxAllocation, m_allocation);
 		entry->size = size;
 	}
 
@@ -111,6 +126,17 @@ void b2StackAllocator::Free(void* p)
 	m_allocation -= entry->size;
 	--m_entryCount;
 
+	// Once empty, grow the stack so that the largest allocation seen so far
+	// fits without b2Alloc next time.
+	if (m_entryCount == 0 && m_maxAllocation > m_capacity)
+	{
+		b2Assert(m_index == 0);
+		b2Free(m_data);
+		m_capacity = ((m_maxAllocation + b2_stackSize - 1) / b2_stackSize) *
+			b2_stackSize;
+		m_data = (char*)b2Alloc(m_capacity);
+	}
+
 	p = NULL;
 }
 
@@ -46,6 +46,12 @@ b2ChainAndCircleContact::b2ChainAndCircleContact(b2Fixture* fixtureA, int32 inde
 void b2ChainAndCircleContact::Evaluate(b2Manifold* manifold, const b2Transform& xfA, const b2Transform& xfB)
 {
 	b2ChainShape* chain = (b2ChainShape*)m_fixtureA->GetShape();
+	if (chain->IsSingleProxy())
+	{
+		b2CollideChainEdges(manifold, chain, xfA, m_fixtureB->GetShape(), xfB);
+		return;
+	}
+
 	b2EdgeShape edge;
 	chain->GetChildEdge(&edge, m_indexA);
 	b2CollideEdgeAndCircle(	manifold, &edge, xfA,
@@ -46,6 +46,12 @@ b2ChainAndPolygonContact::b2ChainAndPolygonContact(b2Fixture* fixtureA, int32 in
 void b2ChainAndPolygonContact::Evaluate(b2Manifold* manifold, const b2Transform& xfA, const b2Transform& xfB)
 {
 	b2ChainShape* chain = (b2ChainShape*)m_fixtureA->GetShape();
+	if (chain->IsSingleProxy())
+	{
+		b2CollideChainEdges(manifold, chain, xfA, m_fixtureB->GetShape(), xfB);
+		return;
+	}
+
 	b2EdgeShape edge;
 	chain->GetChildEdge(&edge, m_indexA);
 	b2CollideEdgeAndPolygon(	manifold, &edge, xfA,
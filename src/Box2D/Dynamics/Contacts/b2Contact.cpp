@@ -27,7 +27,10 @@
 #include <Box2D/Dynamics/Contacts/b2ContactSolver.h>
 
 #include <Box2D/Collision/b2Collision.h>
+#include <Box2D/Collision/b2Distance.h>
 #include <Box2D/Collision/b2TimeOfImpact.h>
+#include <Box2D/Collision/Shapes/b2ChainShape.h>
+#include <Box2D/Collision/Shapes/b2EdgeShape.h>
 #include <Box2D/Collision/Shapes/b2Shape.h>
 #include <Box2D/Common/b2BlockAllocator.h>
 #include <Box2D/Dynamics/b2Body.h>
@@ -37,6 +40,88 @@
 b2ContactRegister b2Contact::s_registers[b2Shape::e_typeCount][b2Shape::e_typeCount];
 bool b2Contact::s_initialized = false;
 
+namespace {
+
+/// Largest distance between center and a point of the child of shape.
+float32 ComputeReach(const b2Shape* shape, int32 childIndex,
+					 const b2Transform& xf, const b2Vec2& center)
+{
+	b2AABB aabb;
+	shape->ComputeAABB(&aabb, xf, childIndex);
+	return b2Distance(aabb.GetCenter(), center) + aabb.GetExtents().Length();
+}
+
+/// Find the closest points of edge and the shape in proxyB, ignoring their
+/// radii.
+/// @return false if the closest point of B lies beyond a neighbouring
+/// vertex of the edge, in which case the neighbouring edge handles it.
+bool ComputeEdgeDistance(b2DistanceOutput* output, const b2EdgeShape& edge,
+						 const b2Transform& xfA, const b2DistanceProxy& proxyB,
+						 const b2Transform& xfB)
+{
+	b2DistanceInput input;
+	input.proxyA.Set(&edge, 0);
+	input.proxyB = proxyB;
+	input.transformA = xfA;
+	input.transformB = xfB;
+	input.useRadii = false;
+
+	b2SimplexCache cache;
+	cache.count = 0;
+	b2Distance(output, &cache, &input);
+
+	b2Vec2 e = edge.m_vertex2 - edge.m_vertex1;
+	b2Vec2 pB = b2MulT(xfA, output->pointB);
+	float32 u = b2Dot(pB - edge.m_vertex1, e);
+	if (edge.m_hasVertex0 && u < 0.0f)
+	{
+		b2Vec2 e0 = edge.m_vertex1 - edge.m_vertex0;
+		return b2Dot(pB - edge.m_vertex0, e0) > b2Dot(e0, e0);
+	}
+	if (edge.m_hasVertex3 && u > b2Dot(e, e))
+	{
+		b2Vec2 e3 = edge.m_vertex3 - edge.m_vertex2;
+		return b2Dot(pB - edge.m_vertex2, e3) < 0.0f;
+	}
+	return true;
+}
+
+/// Finds the edge of a chain closest to a shape.
+class ChainDistanceCallback
+{
+public:
+	ChainDistanceCallback(const b2ChainShape* chain, const b2Transform& xfA,
+						  const b2DistanceProxy& proxyB, const b2Transform& xfB) :
+		m_chain(chain), m_xfA(xfA), m_proxyB(proxyB), m_xfB(xfB), m_found(false)
+	{
+		m_output.distance = b2_maxFloat;
+	}
+
+	bool QueryCallback(int32 edgeIndex)
+	{
+		b2EdgeShape edge;
+		m_chain->GetChildEdge(&edge, edgeIndex);
+
+		b2DistanceOutput output;
+		if (ComputeEdgeDistance(&output, edge, m_xfA, m_proxyB, m_xfB) &&
+			output.distance < m_output.distance)
+		{
+			m_output = output;
+			m_found = true;
+		}
+		return true;
+	}
+
+	const b2ChainShape* m_chain;
+	const b2Transform& m_xfA;
+	const b2DistanceProxy& m_proxyB;
+	const b2Transform& m_xfB;
+	b2DistanceOutput m_output;
+	bool m_found;
+};
+
+} // namespace
+
 void b2Contact::InitializeRegisters()
 {
 	AddType(b2CircleContact::Create, b2CircleContact::Destroy, b2Shape::e_circle, b2Shape::e_circle);
@@ -150,6 +235,9 @@ b2Contact::b2Contact(b2Fixture* fA, int32 indexA, b2Fixture* fB, int32 indexB)
 
 	m_toiCount = 0;
 
+	m_bufferIndex = -1;
+	m_id = b2_invalidContactId;
+
 	m_friction = b2MixFriction(m_fixtureA->m_friction, m_fixtureB->m_friction);
 	m_restitution = b2MixRestitution(m_fixtureA->m_restitution, m_fixtureB->m_restitution);
 
@@ -159,6 +247,18 @@ b2Contact::b2Contact(b2Fixture* fA, int32 indexA, b2Fixture* fB, int32 indexB)
 // Update the contact manifold and touching status.
 // Note: do not assume the fixture AABBs are overlapping or are valid.
 void b2Contact::Update(b2ContactListener* listener)
+{
+	UpdateManifold(listener, NULL);
+}
+
+void b2Contact::Update(b2ContactListener* listener, const b2Manifold& manifold)
+{
+	b2Assert(m_fixtureA->IsSensor() == false && m_fixtureB->IsSensor() == false);
+	UpdateManifold(listener, &manifold);
+}
+
+void b2Contact::UpdateManifold(b2ContactListener* listener,
+							   const b2Manifold* evaluatedManifold)
 {
 	b2Manifold oldManifold = m_manifold;
 
@@ -189,7 +289,14 @@ void b2Contact::Update(b2ContactListener* listener)
 	}
 	else
 	{
-		Evaluate(&m_manifold, xfA, xfB);
+		if (evaluatedManifold)
+		{
+			m_manifold = *evaluatedManifold;
+		}
+		else
+		{
+			Evaluate(&m_manifold, xfA, xfB);
+		}
 		touching = m_manifold.pointCount > 0;
 
 		// Match old contact ids to new contact ids and copy the
@@ -230,6 +337,20 @@ void b2Contact::Update(b2ContactListener* listener)
 		m_flags &= ~e_touchingFlag;
 	}
 
+	// Solid touching contacts keep the islands of their bodies together.
+	bool linked = touching && sensor == false;
+	bool wasLinked = (m_flags & e_islandLinkFlag) == e_islandLinkFlag;
+	if (linked && wasLinked == false)
+	{
+		m_flags |= e_islandLinkFlag;
+		bodyA->m_world->LinkIslands(bodyA, bodyB);
+	}
+	else if (linked == false && wasLinked)
+	{
+		m_flags &= ~e_islandLinkFlag;
+		bodyA->m_world->UnlinkIslands(bodyA, bodyB);
+	}
+
 	if (wasTouching == false && touching == true && listener)
 	{
 		listener->BeginContact(this);
@@ -245,3 +366,125 @@ void b2Contact::Update(b2ContactListener* listener)
 		listener->PreSolve(this, &oldManifold);
 	}
 }
+
+void b2Contact::EvaluateSpeculative(b2Manifold* manifold, float32 dt)
+{
+	const b2Body* bodyA = m_fixtureA->GetBody();
+	const b2Body* bodyB = m_fixtureB->GetBody();
+	const b2Transform& xfA = bodyA->GetTransform();
+	const b2Transform& xfB = bodyB->GetTransform();
+
+	Evaluate(manifold, xfA, xfB);
+	if (manifold->pointCount > 0)
+	{
+		return;
+	}
+
+	const b2Shape* shapeA = m_fixtureA->GetShape();
+	const b2Shape* shapeB = m_fixtureB->GetShape();
+
+	// Bound how far the shapes can move towards each other in the step.
+	b2Vec2 dv = bodyB->GetLinearVelocity() - bodyA->GetLinearVelocity();
+	float32 spinA = b2Abs(bodyA->GetAngularVelocity());
+	float32 spinB = b2Abs(bodyB->GetAngularVelocity());
+	float32 rotation = 0.0f;
+	if (spinA > 0.0f)
+	{
+		rotation += spinA * ComputeReach(shapeA, m_indexA, xfA, bodyA->GetWorldCenter());
+	}
+	if (spinB > 0.0f)
+	{
+		rotation += spinB * ComputeReach(shapeB, m_indexB, xfB, bodyB->GetWorldCenter());
+	}
+	float32 margin = dt * (dv.Length() + rotation);
+	if (margin < b2_linearSlop)
+	{
+		return;
+	}
+
+	// Find the closest features without the radii.
+	b2DistanceProxy proxyB;
+	proxyB.Set(shapeB, m_indexB);
+	b2DistanceOutput output;
+	if (shapeA->GetType() == b2Shape::e_chain)
+	{
+		const b2ChainShape* chain = (const b2ChainShape*)shapeA;
+		if (chain->IsSingleProxy())
+		{
+			b2AABB aabb;
+			shapeB->ComputeAABB(&aabb, b2MulT(xfA, xfB), m_indexB);
+			float32 extension = margin + shapeA->m_radius;
+			aabb.lowerBound -= b2Vec2(extension, extension);
+			aabb.upperBound += b2Vec2(extension, extension);
+
+			ChainDistanceCallback callback(chain, xfA, proxyB, xfB);
+			chain->QueryEdges(&callback, aabb);
+			if (callback.m_found == false)
+			{
+				return;
+			}
+			output = callback.m_output;
+		}
+		else
+		{
+			b2EdgeShape edge;
+			chain->GetChildEdge(&edge, m_indexA);
+			if (ComputeEdgeDistance(&output, edge, xfA, proxyB, xfB) == false)
+			{
+				return;
+			}
+		}
+	}
+	else if (shapeA->GetType() == b2Shape::e_edge)
+	{
+		if (ComputeEdgeDistance(&output, *(const b2EdgeShape*)shapeA, xfA,
+								proxyB, xfB) == false)
+		{
+			return;
+		}
+	}
+	else
+	{
+		b2DistanceInput input;
+		input.proxyA.Set(shapeA, m_indexA);
+		input.proxyB = proxyB;
+		input.transformA = xfA;
+		input.transformB = xfB;
+		input.useRadii = false;
+
+		b2SimplexCache cache;
+		cache.count = 0;
+		b2Distance(&output, &cache, &input);
+	}
+
+	if (output.distance < b2_epsilon)
+	{
+		return;
+	}
+
+	// Only the approach along the normal can close the gap.
+	b2Vec2 normal = (1.0f / output.distance) * (output.pointB - output.pointA);
+	float32 approach = b2Max(-b2Dot(dv, normal), 0.0f);
+	float32 separation = output.distance - shapeA->m_radius - shapeB->m_radius;
+	if (separation >= dt * (approach + rotation))
+	{
+		return;
+	}
+
+	// The world manifold of a circles manifold keeps the separation of the
+	// closest features.
+	manifold->type = b2Manifold::e_circles;
+	manifold->localPoint = b2MulT(xfA, output.pointA);
+	manifold->localNormal.SetZero();
+	manifold->pointCount = 1;
+
+	b2ManifoldPoint* mp = manifold->points + 0;
+	mp->localPoint = b2MulT(xfB, output.pointB);
+	mp->normalImpulse = 0.0f;
+	mp->tangentImpulse = 0.0f;
+	// Match no feature of a regular manifold.
+	mp->id.cf.indexA = 0xFF;
+	mp->id.cf.indexB = 0xFF;
+	mp->id.cf.typeA = 0xFF;
+	mp->id.cf.typeB = 0xFF;
+}
@@ -25,6 +25,8 @@
 #include <Box2D/Dynamics/b2World.h>
 #include <Box2D/Common/b2StackAllocator.h>
 
+#include <memory.h>
+
 #define B2_DEBUG_SOLVER 0
 
 struct b2ContactPositionConstraint
@@ -42,6 +44,42 @@ struct b2ContactPositionConstraint
 	int32 pointCount;
 };
 
+/// b2_contactSolverLanes velocity constraints stored lane by lane, so that
+/// each step of the solver can run on all lanes at once. Lanes past count
+/// are padding with zero mass, which leaves velocities unchanged.
+struct b2WideVelocityConstraint
+{
+	int32 indexA[b2_contactSolverLanes];
+	int32 indexB[b2_contactSolverLanes];
+	float32 invMassA[b2_contactSolverLanes], invMassB[b2_contactSolverLanes];
+	float32 invIA[b2_contactSolverLanes], invIB[b2_contactSolverLanes];
+	float32 normalX[b2_contactSolverLanes], normalY[b2_contactSolverLanes];
+	float32 friction[b2_contactSolverLanes];
+	float32 tangentSpeed[b2_contactSolverLanes];
+
+	// Per manifold point. The second point is zero for single point lanes.
+	float32 rAX[b2_maxManifoldPoints][b2_contactSolverLanes];
+	float32 rAY[b2_maxManifoldPoints][b2_contactSolverLanes];
+	float32 rBX[b2_maxManifoldPoints][b2_contactSolverLanes];
+	float32 rBY[b2_maxManifoldPoints][b2_contactSolverLanes];
+	float32 normalImpulse[b2_maxManifoldPoints][b2_contactSolverLanes];
+	float32 tangentImpulse[b2_maxManifoldPoints][b2_contactSolverLanes];
+	float32 normalMass[b2_maxManifoldPoints][b2_contactSolverLanes];
+	float32 tangentMass[b2_maxManifoldPoints][b2_contactSolverLanes];
+	float32 velocityBias[b2_maxManifoldPoints][b2_contactSolverLanes];
+
+	// Block solver, used by lanes where blockSolve is set.
+	int32 blockSolve[b2_contactSolverLanes];
+	float32 k11[b2_contactSolverLanes], k12[b2_contactSolverLanes];
+	float32 k21[b2_contactSolverLanes], k22[b2_contactSolverLanes];
+	float32 invK11[b2_contactSolverLanes], invK12[b2_contactSolverLanes];
+	float32 invK21[b2_contactSolverLanes], invK22[b2_contactSolverLanes];
+
+	// Index in m_velocityConstraints of each lane.
+	int32 constraintIndex[b2_contactSolverLanes];
+	int32 count;
+};
+
 b2ContactSolver::b2ContactSolver(b2ContactSolverDef* def)
 {
 	m_step = def->step;
@@ -52,6 +90,9 @@ b2ContactSolver::b2ContactSolver(b2ContactSolverDef* def)
 	m_positions = def->positions;
 	m_velocities = def->velocities;
 	m_contacts = def->contacts;
+	m_wideSlots = NULL;
+	m_wideConstraints = NULL;
+	m_wideCount = 0;
 
 	// Initialize position independent portions of the constraints.
 	for (int32 i = 0; i < m_count; ++i)
@@ -75,8 +116,8 @@ b2ContactSolver::b2ContactSolver(b2ContactSolverDef* def)
 		vc->friction = contact->m_friction;
 		vc->restitution = contact->m_restitution;
 		vc->tangentSpeed = contact->m_tangentSpeed;
-		vc->indexA = bodyA->m_islandIndex;
-		vc->indexB = bodyB->m_islandIndex;
+		vc->indexA = bodyA->GetSolverIndex(def->staticSlots, def->staticSlotCount);
+		vc->indexB = bodyB->GetSolverIndex(def->staticSlots, def->staticSlotCount);
 		vc->invMassA = bodyA->m_invMass;
 		vc->invMassB = bodyB->m_invMass;
 		vc->invIA = bodyA->m_invI;
@@ -87,8 +128,8 @@ b2ContactSolver::b2ContactSolver(b2ContactSolverDef* def)
 		vc->normalMass.SetZero();
 
 		b2ContactPositionConstraint* pc = m_positionConstraints + i;
-		pc->indexA = bodyA->m_islandIndex;
-		pc->indexB = bodyB->m_islandIndex;
+		pc->indexA = bodyA->GetSolverIndex(def->staticSlots, def->staticSlotCount);
+		pc->indexB = bodyB->GetSolverIndex(def->staticSlots, def->staticSlotCount);
 		pc->invMassA = bodyA->m_invMass;
 		pc->invMassB = bodyB->m_invMass;
 		pc->localCenterA = bodyA->m_sweep.localCenter;
@@ -131,6 +172,11 @@ b2ContactSolver::b2ContactSolver(b2ContactSolverDef* def)
 
 b2ContactSolver::~b2ContactSolver()
 {
+	if (m_wideConstraints)
+	{
+		m_allocator->Free(m_wideConstraints);
+		m_allocator->Free(m_wideSlots);
+	}
 	m_allocator->Free(m_velocityConstraints);
 	m_allocator->Free(m_positionConstraints);
 }
@@ -211,6 +257,13 @@ void b2ContactSolver::InitializeVelocityConstraints()
 			{
 				vcp->velocityBias = -vc->restitution * vRel;
 			}
+
+			// A speculative point only lets the shapes close the gap
+			// between them, see b2Contact::EvaluateSpeculative.
+			if (m_step.speculativeContacts && worldManifold.separations[j] > 0.0f)
+			{
+				vcp->velocityBias = -m_step.inv_dt * worldManifold.separations[j];
+			}
 		}
 
 		// If we have two points, then prepare the block solver.
@@ -245,10 +298,21 @@ void b2ContactSolver::InitializeVelocityConstraints()
 			}
 		}
 	}
+
+	if (m_step.wideContactSolving)
+	{
+		InitializeWideConstraints();
+	}
 }
 
 void b2ContactSolver::WarmStart()
 {
+	if (m_wideConstraints)
+	{
+		WarmStartWide();
+		return;
+	}
+
 	// Warm start.
 	for (int32 i = 0; i < m_count; ++i)
 	{
@@ -289,6 +353,12 @@ void b2ContactSolver::WarmStart()
 
 void b2ContactSolver::SolveVelocityConstraints()
 {
+	if (m_wideConstraints)
+	{
+		SolveWideVelocityConstraints();
+		return;
+	}
+
 	for (int32 i = 0; i < m_count; ++i)
 	{
 		b2ContactVelocityConstraint* vc = m_velocityConstraints + i;
@@ -597,6 +667,11 @@ void b2ContactSolver::SolveVelocityConstraints()
 
 void b2ContactSolver::StoreImpulses()
 {
+	if (m_wideConstraints)
+	{
+		StoreWideImpulses();
+	}
+
 	for (int32 i = 0; i < m_count; ++i)
 	{
 		b2ContactVelocityConstraint* vc = m_velocityConstraints + i;
@@ -673,6 +748,11 @@ struct b2PositionSolverManifold
 // Sequential solver.
 bool b2ContactSolver::SolvePositionConstraints()
 {
+	if (m_wideConstraints)
+	{
+		return SolveWidePositionConstraints();
+	}
+
 	float32 minSeparation = 0.0f;
 
 	for (int32 i = 0; i < m_count; ++i)
@@ -839,3 +919,442 @@ bool b2ContactSolver::SolveTOIPositionConstraints(int32 toiIndexA, int32 toiInde
 	// push the separation above -b2_linearSlop.
 	return minSeparation >= -1.5f * b2_linearSlop;
 }
+
+void b2ContactSolver::InitializeWideConstraints()
+{
+	const int32 lanes = b2_contactSolverLanes;
+
+	int32 bodyCount = 0;
+	for (int32 i = 0; i < m_count; ++i)
+	{
+		const b2ContactVelocityConstraint* vc = m_velocityConstraints + i;
+		bodyCount = b2Max(bodyCount, b2Max(vc->indexA, vc->indexB) + 1);
+	}
+
+	// Greedy colouring. A constraint goes into the first batch with a free
+	// lane that comes after every batch holding one of its dynamic bodies,
+	// so constraints sharing a body are still solved in their original
+	// order. Static and kinematic bodies have no mass and are never written,
+	// so any number of lanes may share them.
+	m_wideSlots = (int32*)m_allocator->Allocate(m_count * sizeof(int32));
+	int32* lastBatch = (int32*)m_allocator->Allocate(bodyCount * sizeof(int32));
+	int32* batchFill = (int32*)m_allocator->Allocate(m_count * sizeof(int32));
+	for (int32 i = 0; i < bodyCount; ++i)
+	{
+		lastBatch[i] = -1;
+	}
+	int32 batchCount = 0;
+	int32 firstOpenBatch = 0;
+	for (int32 i = 0; i < m_count; ++i)
+	{
+		const b2ContactVelocityConstraint* vc = m_velocityConstraints + i;
+		bool dynamicA = vc->invMassA > 0.0f || vc->invIA > 0.0f;
+		bool dynamicB = vc->invMassB > 0.0f || vc->invIB > 0.0f;
+
+		int32 batch = firstOpenBatch;
+		if (dynamicA)
+		{
+			batch = b2Max(batch, lastBatch[vc->indexA] + 1);
+		}
+		if (dynamicB)
+		{
+			batch = b2Max(batch, lastBatch[vc->indexB] + 1);
+		}
+		while (batch < batchCount && batchFill[batch] == lanes)
+		{
+			++batch;
+		}
+		if (batch == batchCount)
+		{
+			batchFill[batchCount++] = 0;
+		}
+
+		m_wideSlots[i] = batch * lanes + batchFill[batch]++;
+		if (dynamicA)
+		{
+			lastBatch[vc->indexA] = batch;
+		}
+		if (dynamicB)
+		{
+			lastBatch[vc->indexB] = batch;
+		}
+		while (firstOpenBatch < batchCount &&
+			   batchFill[firstOpenBatch] == lanes)
+		{
+			++firstOpenBatch;
+		}
+	}
+	m_allocator->Free(batchFill);
+	m_allocator->Free(lastBatch);
+
+	m_wideCount = batchCount;
+	m_wideConstraints = (b2WideVelocityConstraint*)m_allocator->Allocate(
+		batchCount * sizeof(b2WideVelocityConstraint));
+	memset(m_wideConstraints, 0, batchCount * sizeof(b2WideVelocityConstraint));
+
+	for (int32 i = 0; i < m_count; ++i)
+	{
+		const b2ContactVelocityConstraint* vc = m_velocityConstraints + i;
+		b2WideVelocityConstraint* wc = m_wideConstraints + m_wideSlots[i] / lanes;
+		int32 l = m_wideSlots[i] % lanes;
+		wc->count = b2Max(wc->count, l + 1);
+		wc->constraintIndex[l] = i;
+		wc->indexA[l] = vc->indexA;
+		wc->indexB[l] = vc->indexB;
+		wc->invMassA[l] = vc->invMassA;
+		wc->invMassB[l] = vc->invMassB;
+		wc->invIA[l] = vc->invIA;
+		wc->invIB[l] = vc->invIB;
+		wc->normalX[l] = vc->normal.x;
+		wc->normalY[l] = vc->normal.y;
+		wc->friction[l] = vc->friction;
+		wc->tangentSpeed[l] = vc->tangentSpeed;
+		for (int32 j = 0; j < vc->pointCount; ++j)
+		{
+			const b2VelocityConstraintPoint* vcp = vc->points + j;
+			wc->rAX[j][l] = vcp->rA.x;
+			wc->rAY[j][l] = vcp->rA.y;
+			wc->rBX[j][l] = vcp->rB.x;
+			wc->rBY[j][l] = vcp->rB.y;
+			wc->normalImpulse[j][l] = vcp->normalImpulse;
+			wc->tangentImpulse[j][l] = vcp->tangentImpulse;
+			wc->normalMass[j][l] = vcp->normalMass;
+			wc->tangentMass[j][l] = vcp->tangentMass;
+			wc->velocityBias[j][l] = vcp->velocityBias;
+		}
+		wc->blockSolve[l] = vc->pointCount == 2;
+		wc->k11[l] = vc->K.ex.x;
+		wc->k12[l] = vc->K.ey.x;
+		wc->k21[l] = vc->K.ex.y;
+		wc->k22[l] = vc->K.ey.y;
+		wc->invK11[l] = vc->normalMass.ex.x;
+		wc->invK12[l] = vc->normalMass.ey.x;
+		wc->invK21[l] = vc->normalMass.ex.y;
+		wc->invK22[l] = vc->normalMass.ey.y;
+	}
+
+	// Padding lanes read the bodies of the first lane, but are never
+	// written back.
+	for (int32 i = 0; i < m_wideCount; ++i)
+	{
+		b2WideVelocityConstraint* wc = m_wideConstraints + i;
+		for (int32 l = wc->count; l < lanes; ++l)
+		{
+			wc->indexA[l] = wc->indexA[0];
+			wc->indexB[l] = wc->indexB[0];
+			wc->constraintIndex[l] = -1;
+		}
+	}
+}
+
+namespace {
+
+/// Velocities of the bodies of a b2WideVelocityConstraint, one lane each.
+struct WideVelocities
+{
+	void Gather(const b2WideVelocityConstraint* wc,
+				const b2Velocity* velocities)
+	{
+		for (int32 l = 0; l < b2_contactSolverLanes; ++l)
+		{
+			const b2Velocity& a = velocities[wc->indexA[l]];
+			const b2Velocity& b = velocities[wc->indexB[l]];
+			vAX[l] = a.v.x;
+			vAY[l] = a.v.y;
+			wA[l] = a.w;
+			vBX[l] = b.v.x;
+			vBY[l] = b.v.y;
+			wB[l] = b.w;
+		}
+	}
+
+	// Lanes are written in order, so a static body shared by several lanes
+	// gets back its unchanged velocity.
+	void Scatter(const b2WideVelocityConstraint* wc,
+				 b2Velocity* velocities) const
+	{
+		for (int32 l = 0; l < wc->count; ++l)
+		{
+			b2Velocity& a = velocities[wc->indexA[l]];
+			b2Velocity& b = velocities[wc->indexB[l]];
+			a.v.Set(vAX[l], vAY[l]);
+			a.w = wA[l];
+			b.v.Set(vBX[l], vBY[l]);
+			b.w = wB[l];
+		}
+	}
+
+	// Apply the impulses (pX, pY) at points rA and rB of every lane.
+	void Apply(const b2WideVelocityConstraint* wc,
+			   const float32* rAX, const float32* rAY,
+			   const float32* rBX, const float32* rBY,
+			   const float32* pX, const float32* pY)
+	{
+		for (int32 l = 0; l < b2_contactSolverLanes; ++l)
+		{
+			vAX[l] -= wc->invMassA[l] * pX[l];
+			vAY[l] -= wc->invMassA[l] * pY[l];
+			wA[l] -= wc->invIA[l] * (rAX[l] * pY[l] - rAY[l] * pX[l]);
+			vBX[l] += wc->invMassB[l] * pX[l];
+			vBY[l] += wc->invMassB[l] * pY[l];
+			wB[l] += wc->invIB[l] * (rBX[l] * pY[l] - rBY[l] * pX[l]);
+		}
+	}
+
+	// Relative velocity along (dirX, dirY) at point j of every lane.
+	void RelativeVelocity(const b2WideVelocityConstraint* wc, int32 j,
+						  const float32* dirX, const float32* dirY,
+						  float32* out) const
+	{
+		for (int32 l = 0; l < b2_contactSolverLanes; ++l)
+		{
+			float32 dvX = vBX[l] - wB[l] * wc->rBY[j][l] - vAX[l] + wA[l] * wc->rAY[j][l];
+			float32 dvY = vBY[l] + wB[l] * wc->rBX[j][l] - vAY[l] - wA[l] * wc->rAX[j][l];
+			out[l] = dvX * dirX[l] + dvY * dirY[l];
+		}
+	}
+
+	float32 vAX[b2_contactSolverLanes], vAY[b2_contactSolverLanes];
+	float32 wA[b2_contactSolverLanes];
+	float32 vBX[b2_contactSolverLanes], vBY[b2_contactSolverLanes];
+	float32 wB[b2_contactSolverLanes];
+};
+
+} // namespace
+
+void b2ContactSolver::WarmStartWide()
+{
+	const int32 lanes = b2_contactSolverLanes;
+	for (int32 i = 0; i < m_wideCount; ++i)
+	{
+		const b2WideVelocityConstraint* wc = m_wideConstraints + i;
+		WideVelocities v;
+		v.Gather(wc, m_velocities);
+
+		for (int32 j = 0; j < b2_maxManifoldPoints; ++j)
+		{
+			// P = normalImpulse * normal + tangentImpulse * tangent, where
+			// tangent = b2Cross(normal, 1.0f).
+			float32 pX[lanes], pY[lanes];
+			for (int32 l = 0; l < lanes; ++l)
+			{
+				float32 n = wc->normalImpulse[j][l];
+				float32 t = wc->tangentImpulse[j][l];
+				pX[l] = n * wc->normalX[l] + t * wc->normalY[l];
+				pY[l] = n * wc->normalY[l] - t * wc->normalX[l];
+			}
+			v.Apply(wc, wc->rAX[j], wc->rAY[j], wc->rBX[j], wc->rBY[j], pX, pY);
+		}
+
+		v.Scatter(wc, m_velocities);
+	}
+}
+
+void b2ContactSolver::SolveWideVelocityConstraints()
+{
+	const int32 lanes = b2_contactSolverLanes;
+	for (int32 i = 0; i < m_wideCount; ++i)
+	{
+		b2WideVelocityConstraint* wc = m_wideConstraints + i;
+		WideVelocities v;
+		v.Gather(wc, m_velocities);
+
+		float32 tangentX[lanes], tangentY[lanes];
+		for (int32 l = 0; l < lanes; ++l)
+		{
+			tangentX[l] = wc->normalY[l];
+			tangentY[l] = -wc->normalX[l];
+		}
+
+		// Solve tangent constraints first because non-penetration is more
+		// important than friction. The second point of single point lanes
+		// has no mass, so its impulse stays zero.
+		for (int32 j = 0; j < b2_maxManifoldPoints; ++j)
+		{
+			float32 vt[lanes], pX[lanes], pY[lanes];
+			v.RelativeVelocity(wc, j, tangentX, tangentY, vt);
+			for (int32 l = 0; l < lanes; ++l)
+			{
+				float32 lambda = wc->tangentMass[j][l] * (-(vt[l] - wc->tangentSpeed[l]));
+				float32 maxFriction = wc->friction[l] * wc->normalImpulse[j][l];
+				float32 newImpulse = b2Clamp(wc->tangentImpulse[j][l] + lambda, -maxFriction, maxFriction);
+				lambda = newImpulse - wc->tangentImpulse[j][l];
+				wc->tangentImpulse[j][l] = newImpulse;
+				pX[l] = lambda * tangentX[l];
+				pY[l] = lambda * tangentY[l];
+			}
+			v.Apply(wc, wc->rAX[j], wc->rAY[j], wc->rBX[j], wc->rBY[j], pX, pY);
+		}
+
+		// Solve normal constraints. Single point lanes clamp the accumulated
+		// impulse of their point. Two point lanes run the block solver of
+		// SolveVelocityConstraints(), evaluating all of its cases and
+		// keeping the first valid one.
+		float32 vn1[lanes], vn2[lanes];
+		v.RelativeVelocity(wc, 0, wc->normalX, wc->normalY, vn1);
+		v.RelativeVelocity(wc, 1, wc->normalX, wc->normalY, vn2);
+		float32 d1[lanes], d2[lanes];
+		for (int32 l = 0; l < lanes; ++l)
+		{
+			float32 a1 = wc->normalImpulse[0][l];
+			float32 a2 = wc->normalImpulse[1][l];
+
+			// Single point.
+			float32 single = b2Max(a1 - wc->normalMass[0][l] * (vn1[l] - wc->velocityBias[0][l]), 0.0f);
+
+			// b' = vn - velocityBias - K * a
+			float32 bX = vn1[l] - wc->velocityBias[0][l];
+			float32 bY = vn2[l] - wc->velocityBias[1][l];
+			bX -= wc->k11[l] * a1 + wc->k12[l] * a2;
+			bY -= wc->k21[l] * a1 + wc->k22[l] * a2;
+
+			// Case 1: vn = 0
+			float32 x1 = -(wc->invK11[l] * bX + wc->invK12[l] * bY);
+			float32 x2 = -(wc->invK21[l] * bX + wc->invK22[l] * bY);
+			bool case1 = x1 >= 0.0f && x2 >= 0.0f;
+
+			// Case 2: vn1 = 0 and x2 = 0
+			float32 y1 = -wc->normalMass[0][l] * bX;
+			bool case2 = y1 >= 0.0f && wc->k21[l] * y1 + bY >= 0.0f;
+
+			// Case 3: vn2 = 0 and x1 = 0
+			float32 z2 = -wc->normalMass[1][l] * bY;
+			bool case3 = z2 >= 0.0f && wc->k12[l] * z2 + bX >= 0.0f;
+
+			// Case 4: x1 = 0 and x2 = 0
+			bool case4 = bX >= 0.0f && bY >= 0.0f;
+
+			// Otherwise there's no solution, leave the impulses unchanged.
+			float32 block1 = case1 ? x1 : case2 ? y1 : case3 || case4 ? 0.0f : a1;
+			float32 block2 = case1 ? x2 : case2 ? 0.0f : case3 ? z2 : case4 ? 0.0f : a2;
+
+			float32 new1 = wc->blockSolve[l] ? block1 : single;
+			float32 new2 = wc->blockSolve[l] ? block2 : a2;
+			d1[l] = new1 - a1;
+			d2[l] = new2 - a2;
+			wc->normalImpulse[0][l] = new1;
+			wc->normalImpulse[1][l] = new2;
+		}
+
+		float32 pX[lanes], pY[lanes];
+		for (int32 l = 0; l < lanes; ++l)
+		{
+			pX[l] = d1[l] * wc->normalX[l];
+			pY[l] = d1[l] * wc->normalY[l];
+		}
+		v.Apply(wc, wc->rAX[0], wc->rAY[0], wc->rBX[0], wc->rBY[0], pX, pY);
+		for (int32 l = 0; l < lanes; ++l)
+		{
+			pX[l] = d2[l] * wc->normalX[l];
+			pY[l] = d2[l] * wc->normalY[l];
+		}
+		v.Apply(wc, wc->rAX[1], wc->rAY[1], wc->rBX[1], wc->rBY[1], pX, pY);
+
+		v.Scatter(wc, m_velocities);
+	}
+}
+
+void b2ContactSolver::StoreWideImpulses()
+{
+	for (int32 i = 0; i < m_wideCount; ++i)
+	{
+		const b2WideVelocityConstraint* wc = m_wideConstraints + i;
+		for (int32 l = 0; l < wc->count; ++l)
+		{
+			b2ContactVelocityConstraint* vc = m_velocityConstraints + wc->constraintIndex[l];
+			for (int32 j = 0; j < vc->pointCount; ++j)
+			{
+				vc->points[j].normalImpulse = wc->normalImpulse[j][l];
+				vc->points[j].tangentImpulse = wc->tangentImpulse[j][l];
+			}
+		}
+	}
+}
+
+// Solves the position constraints in the batches built for the velocity
+// constraints, so that lanes can be gathered and solved together.
+bool b2ContactSolver::SolveWidePositionConstraints()
+{
+	const int32 lanes = b2_contactSolverLanes;
+	float32 minSeparation = 0.0f;
+
+	for (int32 i = 0; i < m_wideCount; ++i)
+	{
+		const b2WideVelocityConstraint* wc = m_wideConstraints + i;
+		const int32 count = wc->count;
+
+		b2Vec2 cA[lanes], cB[lanes];
+		float32 aA[lanes], aB[lanes];
+		for (int32 l = 0; l < count; ++l)
+		{
+			cA[l] = m_positions[wc->indexA[l]].c;
+			aA[l] = m_positions[wc->indexA[l]].a;
+			cB[l] = m_positions[wc->indexB[l]].c;
+			aB[l] = m_positions[wc->indexB[l]].a;
+		}
+
+		for (int32 j = 0; j < b2_maxManifoldPoints; ++j)
+		{
+			for (int32 l = 0; l < count; ++l)
+			{
+				b2ContactPositionConstraint* pc = m_positionConstraints + wc->constraintIndex[l];
+				if (j >= pc->pointCount)
+				{
+					continue;
+				}
+
+				float32 mA = pc->invMassA;
+				float32 iA = pc->invIA;
+				float32 mB = pc->invMassB;
+				float32 iB = pc->invIB;
+
+				b2Transform xfA, xfB;
+				xfA.q.Set(aA[l]);
+				xfB.q.Set(aB[l]);
+				xfA.p = cA[l] - b2Mul(xfA.q, pc->localCenterA);
+				xfB.p = cB[l] - b2Mul(xfB.q, pc->localCenterB);
+
+				b2PositionSolverManifold psm;
+				psm.Initialize(pc, xfA, xfB, j);
+				b2Vec2 normal = psm.normal;
+
+				b2Vec2 rA = psm.point - cA[l];
+				b2Vec2 rB = psm.point - cB[l];
+
+				// Track max constraint error.
+				minSeparation = b2Min(minSeparation, psm.separation);
+
+				// Prevent large corrections and allow slop.
+				float32 C = b2Clamp(b2_baumgarte * (psm.separation + b2_linearSlop), -b2_maxLinearCorrection, 0.0f);
+
+				// Compute the effective mass.
+				float32 rnA = b2Cross(rA, normal);
+				float32 rnB = b2Cross(rB, normal);
+				float32 K = mA + mB + iA * rnA * rnA + iB * rnB * rnB;
+
+				// Compute normal impulse
+				float32 impulse = K > 0.0f ? - C / K : 0.0f;
+
+				b2Vec2 P = impulse * normal;
+
+				cA[l] -= mA * P;
+				aA[l] -= iA * b2Cross(rA, P);
+
+				cB[l] += mB * P;
+				aB[l] += iB * b2Cross(rB, P);
+			}
+		}
+
+		for (int32 l = 0; l < count; ++l)
+		{
+			m_positions[wc->indexA[l]].c = cA[l];
+			m_positions[wc->indexA[l]].a = aA[l];
+			m_positions[wc->indexB[l]].c = cB[l];
+			m_positions[wc->indexB[l]].a = aB[l];
+		}
+	}
+
+	// We can't expect minSpeparation >= -b2_linearSlop because we don't
+	// push the separation above -b2_linearSlop.
+	return minSeparation >= -3.0f * b2_linearSlop;
+}
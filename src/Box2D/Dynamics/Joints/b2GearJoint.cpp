@@ -21,6 +21,7 @@
 #include <Box2D/Dynamics/Joints/b2PrismaticJoint.h>
 #include <Box2D/Dynamics/b2Body.h>
 #include <Box2D/Dynamics/b2TimeStep.h>
+#include <Box2D/Common/b2BinaryStream.h>
 
 // Gear Joint:
 // C0 = (coordinate1 + ratio * coordinate2)_initial
@@ -130,10 +131,10 @@ b2GearJoint::b2GearJoint(const b2GearJointDef* def)
 
 void b2GearJoint::InitVelocityConstraints(const b2SolverData& data)
 {
-	m_indexA = m_bodyA->m_islandIndex;
-	m_indexB = m_bodyB->m_islandIndex;
-	m_indexC = m_bodyC->m_islandIndex;
-	m_indexD = m_bodyD->m_islandIndex;
+	m_indexA = m_bodyA->GetSolverIndex(data);
+	m_indexB = m_bodyB->GetSolverIndex(data);
+	m_indexC = m_bodyC->GetSolverIndex(data);
+	m_indexD = m_bodyD->GetSolverIndex(data);
 	m_lcA = m_bodyA->m_sweep.localCenter;
 	m_lcB = m_bodyB->m_sweep.localCenter;
 	m_lcC = m_bodyC->m_sweep.localCenter;
@@ -417,3 +418,17 @@ void b2GearJoint::Dump()
 	b2Log("  jd.ratio = %.15lef;\n", m_ratio);
 	b2Log("  joints[%d] = m_world->CreateJoint(&jd);\n", m_index);
 }
+
+void b2GearJoint::Serialize(b2BinaryWriter* writer) const
+{
+	writer->Write(m_ratio);
+	writer->Write(m_constant);
+	writer->Write(m_impulse);
+}
+
+void b2GearJoint::Deserialize(b2BinaryReader* reader)
+{
+	reader->Read(&m_ratio);
+	reader->Read(&m_constant);
+	reader->Read(&m_impulse);
+}
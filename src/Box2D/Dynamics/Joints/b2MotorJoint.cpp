@@ -19,6 +19,7 @@
 #include <Box2D/Dynamics/Joints/b2MotorJoint.h>
 #include <Box2D/Dynamics/b2Body.h>
 #include <Box2D/Dynamics/b2TimeStep.h>
+#include <Box2D/Common/b2BinaryStream.h>
 
 // Point-to-point constraint
 // Cdot = v2 - v1
@@ -60,8 +61,8 @@ b2MotorJoint::b2MotorJoint(const b2MotorJointDef* def)
 
 void b2MotorJoint::InitVelocityConstraints(const b2SolverData& data)
 {
-	m_indexA = m_bodyA->m_islandIndex;
-	m_indexB = m_bodyB->m_islandIndex;
+	m_indexA = m_bodyA->GetSolverIndex(data);
+	m_indexB = m_bodyB->GetSolverIndex(data);
 	m_localCenterA = m_bodyA->m_sweep.localCenter;
 	m_localCenterB = m_bodyB->m_sweep.localCenter;
 	m_invMassA = m_bodyA->m_invMass;
@@ -302,3 +303,25 @@ void b2MotorJoint::Dump()
 	b2Log("  jd.correctionFactor = %.15lef;\n", m_correctionFactor);
 	b2Log("  joints[%d] = m_world->CreateJoint(&jd);\n", m_index);
 }
+
+void b2MotorJoint::Serialize(b2BinaryWriter* writer) const
+{
+	writer->Write(m_linearOffset);
+	writer->Write(m_angularOffset);
+	writer->Write(m_maxForce);
+	writer->Write(m_maxTorque);
+	writer->Write(m_correctionFactor);
+	writer->Write(m_linearImpulse);
+	writer->Write(m_angularImpulse);
+}
+
+void b2MotorJoint::Deserialize(b2BinaryReader* reader)
+{
+	reader->Read(&m_linearOffset);
+	reader->Read(&m_angularOffset);
+	reader->Read(&m_maxForce);
+	reader->Read(&m_maxTorque);
+	reader->Read(&m_correctionFactor);
+	reader->Read(&m_linearImpulse);
+	reader->Read(&m_angularImpulse);
+}
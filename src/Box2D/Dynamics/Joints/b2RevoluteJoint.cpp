@@ -19,6 +19,7 @@
 #include <Box2D/Dynamics/Joints/b2RevoluteJoint.h>
 #include <Box2D/Dynamics/b2Body.h>
 #include <Box2D/Dynamics/b2TimeStep.h>
+#include <Box2D/Common/b2BinaryStream.h>
 
 // Point-to-point constraint
 // C = p2 - p1
@@ -63,8 +64,8 @@ b2RevoluteJoint::b2RevoluteJoint(const b2RevoluteJointDef* def)
 
 void b2RevoluteJoint::InitVelocityConstraints(const b2SolverData& data)
 {
-	m_indexA = m_bodyA->m_islandIndex;
-	m_indexB = m_bodyB->m_islandIndex;
+	m_indexA = m_bodyA->GetSolverIndex(data);
+	m_indexB = m_bodyB->GetSolverIndex(data);
 	m_localCenterA = m_bodyA->m_sweep.localCenter;
 	m_localCenterB = m_bodyB->m_sweep.localCenter;
 	m_invMassA = m_bodyA->m_invMass;
@@ -374,6 +375,225 @@ bool b2RevoluteJoint::SolvePositionConstraints(const b2SolverData& data)
 	return positionError <= b2_linearSlop && angularError <= b2_angularSlop;
 }
 
+bool b2RevoluteJoint::IsPointConstraint() const
+{
+	bool fixedRotation = (m_invIA + m_invIB == 0.0f);
+	bool motor = m_enableMotor && m_limitState != e_equalLimits;
+	bool limit = m_enableLimit && m_limitState != e_inactiveLimit;
+	return fixedRotation || (motor == false && limit == false);
+}
+
+void b2RevoluteJoint::InitializeWide(b2RevoluteJoint* const* joints, int32 count,
+									 b2WideRevoluteConstraint* wc)
+{
+	b2Assert(0 < count && count <= b2_jointSolverLanes);
+
+	wc->count = count;
+	for (int32 l = 0; l < count; ++l)
+	{
+		b2RevoluteJoint* joint = joints[l];
+		b2Assert(joint->IsPointConstraint());
+		wc->joints[l] = joint;
+		wc->indexA[l] = joint->m_indexA;
+		wc->indexB[l] = joint->m_indexB;
+		wc->invMassA[l] = joint->m_invMassA;
+		wc->invMassB[l] = joint->m_invMassB;
+		wc->invIA[l] = joint->m_invIA;
+		wc->invIB[l] = joint->m_invIB;
+		wc->rAX[l] = joint->m_rA.x;
+		wc->rAY[l] = joint->m_rA.y;
+		wc->rBX[l] = joint->m_rB.x;
+		wc->rBY[l] = joint->m_rB.y;
+		wc->k11[l] = joint->m_mass.ex.x;
+		wc->k12[l] = joint->m_mass.ey.x;
+		wc->k21[l] = joint->m_mass.ex.y;
+		wc->k22[l] = joint->m_mass.ey.y;
+		wc->impulseX[l] = joint->m_impulse.x;
+		wc->impulseY[l] = joint->m_impulse.y;
+
+		b2Vec2 localA = joint->m_localAnchorA - joint->m_localCenterA;
+		b2Vec2 localB = joint->m_localAnchorB - joint->m_localCenterB;
+		wc->localAX[l] = localA.x;
+		wc->localAY[l] = localA.y;
+		wc->localBX[l] = localB.x;
+		wc->localBY[l] = localB.y;
+	}
+
+	// Padding lanes read the bodies of the first lane, but are never
+	// written back.
+	for (int32 l = count; l < b2_jointSolverLanes; ++l)
+	{
+		wc->joints[l] = NULL;
+		wc->indexA[l] = wc->indexA[0];
+		wc->indexB[l] = wc->indexB[0];
+		wc->invMassA[l] = 0.0f;
+		wc->invMassB[l] = 0.0f;
+		wc->invIA[l] = 0.0f;
+		wc->invIB[l] = 0.0f;
+		wc->rAX[l] = 0.0f;
+		wc->rAY[l] = 0.0f;
+		wc->rBX[l] = 0.0f;
+		wc->rBY[l] = 0.0f;
+		wc->k11[l] = 0.0f;
+		wc->k12[l] = 0.0f;
+		wc->k21[l] = 0.0f;
+		wc->k22[l] = 0.0f;
+		wc->impulseX[l] = 0.0f;
+		wc->impulseY[l] = 0.0f;
+		wc->localAX[l] = 0.0f;
+		wc->localAY[l] = 0.0f;
+		wc->localBX[l] = 0.0f;
+		wc->localBY[l] = 0.0f;
+	}
+
+	// The inverse determinant of b2Mat33::Solve22.
+	for (int32 l = 0; l < b2_jointSolverLanes; ++l)
+	{
+		float32 det = wc->k11[l] * wc->k22[l] - wc->k12[l] * wc->k21[l];
+		wc->invDet[l] = det != 0.0f ? 1.0f / det : 0.0f;
+	}
+}
+
+void b2RevoluteJoint::SolveWideVelocityConstraints(b2WideRevoluteConstraint* wc,
+												   const b2SolverData& data)
+{
+	const int32 lanes = b2_jointSolverLanes;
+	b2Velocity* velocities = data.velocities;
+
+	float32 vAX[lanes], vAY[lanes], wA[lanes];
+	float32 vBX[lanes], vBY[lanes], wB[lanes];
+	for (int32 l = 0; l < lanes; ++l)
+	{
+		const b2Velocity& a = velocities[wc->indexA[l]];
+		const b2Velocity& b = velocities[wc->indexB[l]];
+		vAX[l] = a.v.x;
+		vAY[l] = a.v.y;
+		wA[l] = a.w;
+		vBX[l] = b.v.x;
+		vBY[l] = b.v.y;
+		wB[l] = b.w;
+	}
+
+	// Solve point-to-point constraint, as SolveVelocityConstraints does.
+	for (int32 l = 0; l < lanes; ++l)
+	{
+		float32 cdotX = vBX[l] - wB[l] * wc->rBY[l] - vAX[l] + wA[l] * wc->rAY[l];
+		float32 cdotY = vBY[l] + wB[l] * wc->rBX[l] - vAY[l] - wA[l] * wc->rAX[l];
+
+		float32 pX = wc->invDet[l] * (wc->k22[l] * -cdotX - wc->k12[l] * -cdotY);
+		float32 pY = wc->invDet[l] * (wc->k11[l] * -cdotY - wc->k21[l] * -cdotX);
+
+		wc->impulseX[l] += pX;
+		wc->impulseY[l] += pY;
+
+		vAX[l] -= wc->invMassA[l] * pX;
+		vAY[l] -= wc->invMassA[l] * pY;
+		wA[l] -= wc->invIA[l] * (wc->rAX[l] * pY - wc->rAY[l] * pX);
+
+		vBX[l] += wc->invMassB[l] * pX;
+		vBY[l] += wc->invMassB[l] * pY;
+		wB[l] += wc->invIB[l] * (wc->rBX[l] * pY - wc->rBY[l] * pX);
+	}
+
+	// Lanes are written in order, so a static body shared by several lanes
+	// gets back its unchanged velocity.
+	for (int32 l = 0; l < wc->count; ++l)
+	{
+		b2Velocity& a = velocities[wc->indexA[l]];
+		b2Velocity& b = velocities[wc->indexB[l]];
+		a.v.Set(vAX[l], vAY[l]);
+		a.w = wA[l];
+		b.v.Set(vBX[l], vBY[l]);
+		b.w = wB[l];
+	}
+}
+
+void b2RevoluteJoint::StoreWideImpulses(const b2WideRevoluteConstraint* wc)
+{
+	for (int32 l = 0; l < wc->count; ++l)
+	{
+		b2RevoluteJoint* joint = wc->joints[l];
+		joint->m_impulse.x = wc->impulseX[l];
+		joint->m_impulse.y = wc->impulseY[l];
+	}
+}
+
+bool b2RevoluteJoint::SolveWidePositionConstraints(const b2WideRevoluteConstraint* wc,
+												   const b2SolverData& data)
+{
+	const int32 lanes = b2_jointSolverLanes;
+	b2Position* positions = data.positions;
+
+	float32 cAX[lanes], cAY[lanes], aA[lanes];
+	float32 cBX[lanes], cBY[lanes], aB[lanes];
+	float32 sA[lanes], cosA[lanes], sB[lanes], cosB[lanes];
+	for (int32 l = 0; l < lanes; ++l)
+	{
+		const b2Position& a = positions[wc->indexA[l]];
+		const b2Position& b = positions[wc->indexB[l]];
+		cAX[l] = a.c.x;
+		cAY[l] = a.c.y;
+		aA[l] = a.a;
+		cBX[l] = b.c.x;
+		cBY[l] = b.c.y;
+		aB[l] = b.a;
+
+		b2Rot qA(aA[l]), qB(aB[l]);
+		sA[l] = qA.s;
+		cosA[l] = qA.c;
+		sB[l] = qB.s;
+		cosB[l] = qB.c;
+	}
+
+	// Solve point-to-point constraint, as SolvePositionConstraints does.
+	float32 positionError[lanes];
+	for (int32 l = 0; l < lanes; ++l)
+	{
+		float32 rAX = cosA[l] * wc->localAX[l] - sA[l] * wc->localAY[l];
+		float32 rAY = sA[l] * wc->localAX[l] + cosA[l] * wc->localAY[l];
+		float32 rBX = cosB[l] * wc->localBX[l] - sB[l] * wc->localBY[l];
+		float32 rBY = sB[l] * wc->localBX[l] + cosB[l] * wc->localBY[l];
+
+		float32 CX = cBX[l] + rBX - cAX[l] - rAX;
+		float32 CY = cBY[l] + rBY - cAY[l] - rAY;
+		positionError[l] = b2Sqrt(CX * CX + CY * CY);
+
+		float32 mA = wc->invMassA[l], mB = wc->invMassB[l];
+		float32 iA = wc->invIA[l], iB = wc->invIB[l];
+
+		float32 k11 = mA + mB + iA * rAY * rAY + iB * rBY * rBY;
+		float32 k12 = -iA * rAX * rAY - iB * rBX * rBY;
+		float32 k22 = mA + mB + iA * rAX * rAX + iB * rBX * rBX;
+		float32 det = k11 * k22 - k12 * k12;
+		det = det != 0.0f ? 1.0f / det : 0.0f;
+
+		float32 pX = -(det * (k22 * CX - k12 * CY));
+		float32 pY = -(det * (k11 * CY - k12 * CX));
+
+		cAX[l] -= mA * pX;
+		cAY[l] -= mA * pY;
+		aA[l] -= iA * (rAX * pY - rAY * pX);
+
+		cBX[l] += mB * pX;
+		cBY[l] += mB * pY;
+		aB[l] += iB * (rBX * pY - rBY * pX);
+	}
+
+	bool solved = true;
+	for (int32 l = 0; l < wc->count; ++l)
+	{
+		b2Position& a = positions[wc->indexA[l]];
+		b2Position& b = positions[wc->indexB[l]];
+		a.c.Set(cAX[l], cAY[l]);
+		a.a = aA[l];
+		b.c.Set(cBX[l], cBY[l]);
+		b.a = aB[l];
+		solved = solved && positionError[l] <= b2_linearSlop;
+	}
+
+	return solved;
+}
+
 b2Vec2 b2RevoluteJoint::GetAnchorA() const
 {
 	return m_bodyA->GetWorldPoint(m_localAnchorA);
@@ -500,3 +720,37 @@ void b2RevoluteJoint::Dump()
 	b2Log("  jd.maxMotorTorque = %.15lef;\n", m_maxMotorTorque);
 	b2Log("  joints[%d] = m_world->CreateJoint(&jd);\n", m_index);
 }
+
+void b2RevoluteJoint::Serialize(b2BinaryWriter* writer) const
+{
+	writer->Write(m_localAnchorA);
+	writer->Write(m_localAnchorB);
+	writer->Write(m_referenceAngle);
+	writer->Write(m_enableLimit);
+	writer->Write(m_lowerAngle);
+	writer->Write(m_upperAngle);
+	writer->Write(m_enableMotor);
+	writer->Write(m_maxMotorTorque);
+	writer->Write(m_motorSpeed);
+	writer->Write(m_impulse);
+	writer->Write(m_motorImpulse);
+	writer->Write((int32)m_limitState);
+}
+
+void b2RevoluteJoint::Deserialize(b2BinaryReader* reader)
+{
+	reader->Read(&m_localAnchorA);
+	reader->Read(&m_localAnchorB);
+	reader->Read(&m_referenceAngle);
+	reader->Read(&m_enableLimit);
+	reader->Read(&m_lowerAngle);
+	reader->Read(&m_upperAngle);
+	reader->Read(&m_enableMotor);
+	reader->Read(&m_maxMotorTorque);
+	reader->Read(&m_motorSpeed);
+	reader->Read(&m_impulse);
+	reader->Read(&m_motorImpulse);
+	int32 limitState;
+	reader->Read(&limitState);
+	m_limitState = (b2LimitState)limitState;
+}
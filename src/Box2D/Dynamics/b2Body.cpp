@@ -73,6 +73,10 @@ b2Body::b2Body(const b2BodyDef* bd, b2World* world)
 	m_prev = NULL;
 	m_next = NULL;
 
+	m_island = NULL;
+	m_islandPrev = NULL;
+	m_islandNext = NULL;
+
 	m_linearVelocity = bd->linearVelocity;
 	m_angularVelocity = bd->angularVelocity;
 
@@ -125,6 +129,7 @@ void b2Body::SetType(b2BodyType type)
 		return;
 	}
 
+	bool wasStatic = m_type == b2_staticBody;
 	m_type = type;
 
 	ResetMassData();
@@ -153,10 +158,22 @@ void b2Body::SetType(b2BodyType type)
 	}
 	m_contactList = NULL;
 
+	m_world->UpdateIsland(this);
+
 	// Touch the proxies so that new contacts will be created (when appropriate)
 	b2BroadPhase* broadPhase = &m_world->m_contactManager.m_broadPhase;
+	bool moveProxies = wasStatic != (m_type == b2_staticBody);
 	for (b2Fixture* f = m_fixtureList; f; f = f->m_next)
 	{
+		// Static proxies are kept apart from the others in the broad-phase,
+		// so recreate them. New proxies are reported like moved ones.
+		if (moveProxies && f->m_proxyCount > 0)
+		{
+			f->DestroyProxies(broadPhase);
+			f->CreateProxies(broadPhase, m_xf);
+			continue;
+		}
+
 		int32 proxyCount = f->m_proxyCount;
 		for (int32 i = 0; i < proxyCount; ++i)
 		{
@@ -178,6 +195,7 @@ b2Fixture* b2Body::CreateFixture(const b2FixtureDef* def)
 	void* memory = allocator->Allocate(sizeof(b2Fixture));
 	b2Fixture* fixture = new (memory) b2Fixture;
 	fixture->Create(allocator, this, def);
+	fixture->m_serial = m_world->m_nextSerial++;
 
 	if (m_flags & e_activeFlag)
 	{
@@ -458,6 +476,29 @@ void b2Body::SynchronizeFixtures()
 	}
 }
 
+void b2Body::SynchronizeFixtures(float32 dt)
+{
+	// Predict the motion from the current velocity, limited like b2Island
+	// limits it.
+	b2Vec2 translation = dt * m_linearVelocity;
+	if (b2Dot(translation, translation) > b2_maxTranslationSquared)
+	{
+		translation *= b2_maxTranslation / translation.Length();
+	}
+
+	float32 rotation = b2Clamp(dt * m_angularVelocity, -b2_maxRotation, b2_maxRotation);
+
+	b2Transform xf2;
+	xf2.q.Set(m_sweep.a + rotation);
+	xf2.p = m_sweep.c + translation - b2Mul(xf2.q, m_sweep.localCenter);
+
+	b2BroadPhase* broadPhase = &m_world->m_contactManager.m_broadPhase;
+	for (b2Fixture* f = m_fixtureList; f; f = f->m_next)
+	{
+		f->Synchronize(broadPhase, m_xf, xf2);
+	}
+}
+
 void b2Body::SetActive(bool flag)
 {
 	b2Assert(m_world->IsLocked() == false);
@@ -478,6 +519,8 @@ void b2Body::SetActive(bool flag)
 			f->CreateProxies(broadPhase, m_xf);
 		}
 
+		m_world->UpdateIsland(this);
+
 		// Contacts are created the next time step.
 	}
 	else
@@ -500,6 +543,8 @@ void b2Body::SetActive(bool flag)
 			m_world->m_contactManager.Destroy(ce0->contact);
 		}
 		m_contactList = NULL;
+
+		m_world->UpdateIsland(this);
 	}
 }
 
@@ -554,3 +599,12 @@ void b2Body::Dump()
 	}
 	b2Log("}\n");
 }
+
+void b2Body::OnWake()
+{
+	// Let SolveTOI find the contacts of the body again.
+	if (m_world->m_wokenBodies && m_type != b2_staticBody)
+	{
+		m_world->m_wokenBodies->Append() = this;
+	}
+}
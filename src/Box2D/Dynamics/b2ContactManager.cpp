@@ -18,14 +18,75 @@
 */
 
 #include <Box2D/Dynamics/b2ContactManager.h>
+#include <Box2D/Common/b2BinaryStream.h>
+#include <Box2D/Common/b2StackAllocator.h>
 #include <Box2D/Dynamics/b2Body.h>
 #include <Box2D/Dynamics/b2Fixture.h>
+#include <Box2D/Dynamics/b2World.h>
 #include <Box2D/Dynamics/b2WorldCallbacks.h>
 #include <Box2D/Dynamics/Contacts/b2Contact.h>
+#include <memory.h>
 
 b2ContactFilter b2_defaultFilter;
 b2ContactListener b2_defaultListener;
 
+namespace {
+
+/// Computes the manifolds of a list of contacts. Evaluate only reads the
+/// shapes and body transforms, so contacts can be evaluated in any order.
+class ContactEvaluateTask : public b2Task
+{
+public:
+	ContactEvaluateTask(b2Contact** contacts, b2Manifold* manifolds,
+						float32 speculativeTimeStep) :
+		m_contacts(contacts), m_manifolds(manifolds),
+		m_speculativeTimeStep(speculativeTimeStep)
+	{
+	}
+
+	virtual void Execute(int32 begin, int32 end, int32 threadIndex)
+	{
+		B2_NOT_USED(threadIndex);
+		for (int32 i = begin; i < end; ++i)
+		{
+			b2Contact* c = m_contacts[i];
+			if (m_speculativeTimeStep > 0.0f)
+			{
+				c->EvaluateSpeculative(&m_manifolds[i], m_speculativeTimeStep);
+				continue;
+			}
+			const b2Transform& xfA = c->GetFixtureA()->GetBody()->GetTransform();
+			const b2Transform& xfB = c->GetFixtureB()->GetBody()->GetTransform();
+			c->Evaluate(&m_manifolds[i], xfA, xfB);
+		}
+	}
+
+	b2Contact** m_contacts;
+	b2Manifold* m_manifolds;
+	float32 m_speculativeTimeStep;
+};
+
+/// Hash of one side of a contact. The hash of a contact is the sum of the
+/// hashes of its two sides, so it doesn't depend on their order.
+inline uint32 HashFixtureChild(const b2Fixture* fixture, int32 childIndex)
+{
+	uint64 key = (uint64)(size_t)fixture ^ ((uint64)(uint32)childIndex << 48);
+	key ^= key >> 33;
+	key *= 0xFF51AFD7ED558CCDULL;
+	key ^= key >> 33;
+	key *= 0xC4CEB9FE1A85EC53ULL;
+	key ^= key >> 33;
+	return (uint32)key;
+}
+
+inline uint32 HashContact(const b2Contact* c)
+{
+	return HashFixtureChild(c->GetFixtureA(), c->GetChildIndexA()) +
+		HashFixtureChild(c->GetFixtureB(), c->GetChildIndexB());
+}
+
+} // namespace
+
 b2ContactManager::b2ContactManager()
 {
 	m_contactList = NULL;
@@ -33,6 +94,197 @@ b2ContactManager::b2ContactManager()
 	m_contactFilter = &b2_defaultFilter;
 	m_contactListener = &b2_defaultListener;
 	m_allocator = NULL;
+	m_stackAllocator = NULL;
+	m_taskExecutor = NULL;
+	m_speculativeTimeStep = 0.0f;
+
+	m_contactCapacity = 16;
+	m_contactBuffer = (b2Contact**)b2Alloc(m_contactCapacity * sizeof(b2Contact*));
+
+	m_idSlotCapacity = 16;
+	m_idSlotCount = 0;
+	m_idSlots = (IdSlot*)b2Alloc(m_idSlotCapacity * sizeof(IdSlot));
+	m_freeIdSlot = -1;
+
+	m_pairTableCapacity = 32;
+	m_pairTable = (b2Contact**)b2Alloc(m_pairTableCapacity * sizeof(b2Contact*));
+	memset(m_pairTable, 0, m_pairTableCapacity * sizeof(b2Contact*));
+}
+
+b2ContactManager::~b2ContactManager()
+{
+	b2Free(m_idSlots);
+	b2Free(m_contactBuffer);
+	b2Free(m_pairTable);
+}
+
+void b2ContactManager::AddToBuffer(b2Contact* c)
+{
+	// m_contactCount is incremented by the caller.
+	if (m_contactCount == m_contactCapacity)
+	{
+		b2Contact** oldBuffer = m_contactBuffer;
+		m_contactCapacity *= 2;
+		m_contactBuffer = (b2Contact**)b2Alloc(m_contactCapacity * sizeof(b2Contact*));
+		memcpy(m_contactBuffer, oldBuffer, m_contactCount * sizeof(b2Contact*));
+		b2Free(oldBuffer);
+	}
+	c->m_bufferIndex = m_contactCount;
+	m_contactBuffer[m_contactCount] = c;
+
+	// Reuse a free id slot, or append a new one.
+	int32 slot = m_freeIdSlot;
+	if (slot >= 0)
+	{
+		m_freeIdSlot = m_idSlots[slot].index;
+	}
+	else
+	{
+		if (m_idSlotCount == m_idSlotCapacity)
+		{
+			IdSlot* oldSlots = m_idSlots;
+			m_idSlotCapacity *= 2;
+			m_idSlots = (IdSlot*)b2Alloc(m_idSlotCapacity * sizeof(IdSlot));
+			memcpy(m_idSlots, oldSlots, m_idSlotCount * sizeof(IdSlot));
+			b2Free(oldSlots);
+		}
+		// The last slot is never used so that no id equals
+		// b2_invalidContactId.
+		slot = m_idSlotCount++;
+		b2Assert(slot < b2_contactIdSlotMask);
+		m_idSlots[slot].generation = 0;
+	}
+	IdSlot& idSlot = m_idSlots[slot];
+	idSlot.index = m_contactCount;
+	c->m_id = ((idSlot.generation << b2_contactIdSlotBits) | slot);
+}
+
+void b2ContactManager::RemoveFromBuffer(b2Contact* c)
+{
+	// m_contactCount is decremented by the caller.
+	int32 index = c->m_bufferIndex;
+	b2Assert(0 <= index && index < m_contactCount && m_contactBuffer[index] == c);
+	b2Contact* last = m_contactBuffer[m_contactCount - 1];
+	m_contactBuffer[index] = last;
+	last->m_bufferIndex = index;
+	m_idSlots[last->m_id & b2_contactIdSlotMask].index = index;
+
+	// Bump the generation so that ids of the destroyed contact go stale.
+	int32 slot = c->m_id & b2_contactIdSlotMask;
+	IdSlot& idSlot = m_idSlots[slot];
+	idSlot.generation = (idSlot.generation + 1) &
+		(0xFFFFFFFF >> b2_contactIdSlotBits);
+	idSlot.index = m_freeIdSlot;
+	m_freeIdSlot = slot;
+	c->m_bufferIndex = -1;
+	c->m_id = b2_invalidContactId;
+}
+
+b2Contact* b2ContactManager::FindContact(
+	const b2Fixture* fixtureA, int32 indexA,
+	const b2Fixture* fixtureB, int32 indexB) const
+{
+	uint32 mask = m_pairTableCapacity - 1;
+	uint32 i = (HashFixtureChild(fixtureA, indexA) +
+				HashFixtureChild(fixtureB, indexB)) & mask;
+	for (b2Contact* c = m_pairTable[i]; c; c = m_pairTable[i])
+	{
+		const b2Fixture* fA = c->GetFixtureA();
+		const b2Fixture* fB = c->GetFixtureB();
+		int32 iA = c->GetChildIndexA();
+		int32 iB = c->GetChildIndexB();
+
+		if (fA == fixtureA && fB == fixtureB && iA == indexA && iB == indexB)
+		{
+			return c;
+		}
+
+		if (fA == fixtureB && fB == fixtureA && iA == indexB && iB == indexA)
+		{
+			return c;
+		}
+
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+void b2ContactManager::InsertIntoPairTable(b2Contact* c)
+{
+	uint32 mask = m_pairTableCapacity - 1;
+	uint32 i = HashContact(c) & mask;
+	while (m_pairTable[i])
+	{
+		i = (i + 1) & mask;
+	}
+	m_pairTable[i] = c;
+}
+
+void b2ContactManager::AddToPairTable(b2Contact* c)
+{
+	// m_contactCount is incremented by the caller.
+	if (2 * (m_contactCount + 1) > m_pairTableCapacity)
+	{
+		b2Contact** oldTable = m_pairTable;
+		int32 oldCapacity = m_pairTableCapacity;
+		m_pairTableCapacity *= 2;
+		m_pairTable = (b2Contact**)b2Alloc(m_pairTableCapacity * sizeof(b2Contact*));
+		memset(m_pairTable, 0, m_pairTableCapacity * sizeof(b2Contact*));
+		for (int32 i = 0; i < oldCapacity; ++i)
+		{
+			if (oldTable[i])
+			{
+				InsertIntoPairTable(oldTable[i]);
+			}
+		}
+		b2Free(oldTable);
+	}
+
+	InsertIntoPairTable(c);
+}
+
+void b2ContactManager::RemoveFromPairTable(b2Contact* c)
+{
+	uint32 mask = m_pairTableCapacity - 1;
+	uint32 i = HashContact(c) & mask;
+	while (m_pairTable[i] != c)
+	{
+		b2Assert(m_pairTable[i] != NULL);
+		i = (i + 1) & mask;
+	}
+
+	// Shift later entries of the probe sequence back into the hole, so
+	// that lookups never stop early.
+	uint32 hole = i;
+	for (i = (i + 1) & mask; m_pairTable[i]; i = (i + 1) & mask)
+	{
+		uint32 home = HashContact(m_pairTable[i]) & mask;
+		if (((i - home) & mask) >= ((i - hole) & mask))
+		{
+			m_pairTable[hole] = m_pairTable[i];
+			hole = i;
+		}
+	}
+	m_pairTable[hole] = NULL;
+}
+
+b2Contact* b2ContactManager::GetContact(b2ContactId id) const
+{
+	if (id == b2_invalidContactId)
+	{
+		return NULL;
+	}
+	int32 slot = id & b2_contactIdSlotMask;
+	if (slot >= m_idSlotCount)
+	{
+		return NULL;
+	}
+	const IdSlot& idSlot = m_idSlots[slot];
+	if (idSlot.generation != (id >> b2_contactIdSlotBits))
+	{
+		return NULL;
+	}
+	return m_contactBuffer[idSlot.index];
 }
 
 void b2ContactManager::Destroy(b2Contact* c)
@@ -47,6 +299,11 @@ void b2ContactManager::Destroy(b2Contact* c)
 		m_contactListener->EndContact(c);
 	}
 
+	if (c->m_flags & b2Contact::e_islandLinkFlag)
+	{
+		bodyA->m_world->UnlinkIslands(bodyA, bodyB);
+	}
+
 	// Remove from the world.
 	if (c->m_prev)
 	{
@@ -63,6 +320,9 @@ void b2ContactManager::Destroy(b2Contact* c)
 		m_contactList = c->m_next;
 	}
 
+	RemoveFromBuffer(c);
+	RemoveFromPairTable(c);
+
 	// Remove from body 1
 	if (c->m_nodeA.prev)
 	{
@@ -105,69 +365,170 @@ void b2ContactManager::Destroy(b2Contact* c)
 // contact list.
 void b2ContactManager::Collide()
 {
-	// Update awake contacts.
-	b2Contact* c = m_contactList;
-	while (c)
+	if (m_taskExecutor)
 	{
-		b2Fixture* fixtureA = c->GetFixtureA();
-		b2Fixture* fixtureB = c->GetFixtureB();
-		int32 indexA = c->GetChildIndexA();
-		int32 indexB = c->GetChildIndexB();
-		b2Body* bodyA = fixtureA->GetBody();
-		b2Body* bodyB = fixtureB->GetBody();
-		 
-		// Is this contact flagged for filtering?
-		if (c->m_flags & b2Contact::e_filterFlag)
+		CollideConcurrently();
+		return;
+	}
+
+	// Update awake contacts. Destroying a contact moves the last contact
+	// of the buffer into its place, so that slot is visited again.
+	int32 i = 0;
+	while (i < m_contactCount)
+	{
+		if (Collide(m_contactBuffer[i], NULL))
 		{
-			// Should these bodies collide?
-			if (bodyB->ShouldCollide(bodyA) == false)
-			{
-				b2Contact* cNuke = c;
-				c = cNuke->GetNext();
-				Destroy(cNuke);
-				continue;
-			}
+			++i;
+		}
+	}
+}
 
-			// Check user filtering.
-			if (m_contactFilter && m_contactFilter->ShouldCollide(fixtureA, fixtureB) == false)
-			{
-				b2Contact* cNuke = c;
-				c = cNuke->GetNext();
-				Destroy(cNuke);
-				continue;
-			}
+bool b2ContactManager::Collide(b2Contact* c,
+									 const b2Manifold* evaluatedManifold)
+{
+	b2Fixture* fixtureA = c->GetFixtureA();
+	b2Fixture* fixtureB = c->GetFixtureB();
+	int32 indexA = c->GetChildIndexA();
+	int32 indexB = c->GetChildIndexB();
+	b2Body* bodyA = fixtureA->GetBody();
+	b2Body* bodyB = fixtureB->GetBody();
+
+	// Is this contact flagged for filtering?
+	if (c->m_flags & b2Contact::e_filterFlag)
+	{
+		// Should these bodies collide?
+		if (bodyB->ShouldCollide(bodyA) == false)
+		{
+			Destroy(c);
+			return false;
+		}
+
+		// Check user filtering.
+		if (m_contactFilter && m_contactFilter->ShouldCollide(fixtureA, fixtureB) == false)
+		{
+			Destroy(c);
+			return false;
+		}
+
+		// Clear the filtering flag.
+		c->m_flags &= ~b2Contact::e_filterFlag;
+	}
+
+	bool activeA = bodyA->IsAwake() && bodyA->m_type != b2_staticBody;
+	bool activeB = bodyB->IsAwake() && bodyB->m_type != b2_staticBody;
+
+	// At least one body must be awake and it must be dynamic or kinematic.
+	if (activeA == false && activeB == false)
+	{
+		return true;
+	}
+
+	int32 proxyIdA = fixtureA->m_proxies[indexA].proxyId;
+	int32 proxyIdB = fixtureB->m_proxies[indexB].proxyId;
+	bool overlap = m_broadPhase.TestOverlap(proxyIdA, proxyIdB);
+
+	// Here we destroy contacts that cease to overlap in the broad-phase.
+	if (overlap == false)
+	{
+		Destroy(c);
+		return false;
+	}
 
-			// Clear the filtering flag.
-			c->m_flags &= ~b2Contact::e_filterFlag;
+	// The contact persists.
+	if (evaluatedManifold)
+	{
+		c->Update(m_contactListener, *evaluatedManifold);
+	}
+	else if (m_speculativeTimeStep > 0.0f &&
+			 fixtureA->IsSensor() == false && fixtureB->IsSensor() == false)
+	{
+		b2Manifold manifold;
+		c->EvaluateSpeculative(&manifold, m_speculativeTimeStep);
+		c->Update(m_contactListener, manifold);
+	}
+	else
+	{
+		c->Update(m_contactListener);
+	}
+	return true;
+}
+
+void b2ContactManager::CollideConcurrently()
+{
+	// Gather the contacts Collide() is going to update without running
+	// any callbacks first. Contacts that need filtering and sensors are
+	// left to the serial pass.
+	b2Contact** contacts = (b2Contact**)m_stackAllocator->Allocate(
+		m_contactCount * sizeof(b2Contact*));
+	int32* evaluated = (int32*)m_stackAllocator->Allocate(
+		m_contactCount * sizeof(int32));
+	int32 count = 0;
+	for (int32 i = 0; i < m_contactCount; ++i)
+	{
+		b2Contact* c = m_contactBuffer[i];
+		evaluated[i] = -1;
+		if (c->m_flags & b2Contact::e_filterFlag)
+		{
+			continue;
 		}
 
+		b2Fixture* fixtureA = c->GetFixtureA();
+		b2Fixture* fixtureB = c->GetFixtureB();
+		if (fixtureA->IsSensor() || fixtureB->IsSensor())
+		{
+			continue;
+		}
+
+		b2Body* bodyA = fixtureA->GetBody();
+		b2Body* bodyB = fixtureB->GetBody();
 		bool activeA = bodyA->IsAwake() && bodyA->m_type != b2_staticBody;
 		bool activeB = bodyB->IsAwake() && bodyB->m_type != b2_staticBody;
-
-		// At least one body must be awake and it must be dynamic or kinematic.
 		if (activeA == false && activeB == false)
 		{
-			c = c->GetNext();
 			continue;
 		}
 
-		int32 proxyIdA = fixtureA->m_proxies[indexA].proxyId;
-		int32 proxyIdB = fixtureB->m_proxies[indexB].proxyId;
-		bool overlap = m_broadPhase.TestOverlap(proxyIdA, proxyIdB);
-
-		// Here we destroy contacts that cease to overlap in the broad-phase.
-		if (overlap == false)
+		int32 proxyIdA = fixtureA->m_proxies[c->GetChildIndexA()].proxyId;
+		int32 proxyIdB = fixtureB->m_proxies[c->GetChildIndexB()].proxyId;
+		if (m_broadPhase.TestOverlap(proxyIdA, proxyIdB) == false)
 		{
-			b2Contact* cNuke = c;
-			c = cNuke->GetNext();
-			Destroy(cNuke);
 			continue;
 		}
 
-		// The contact persists.
-		c->Update(m_contactListener);
-		c = c->GetNext();
+		evaluated[i] = count;
+		contacts[count++] = c;
+	}
+
+	b2Manifold* manifolds = (b2Manifold*)m_stackAllocator->Allocate(
+		count * sizeof(b2Manifold));
+	ContactEvaluateTask task(contacts, manifolds, m_speculativeTimeStep);
+	m_taskExecutor->Run(&task, count);
+
+	// Apply the results in buffer order so callbacks happen exactly as they
+	// would without an executor. Contacts woken or filtered by earlier
+	// callbacks are still handled here, and evaluated if needed.
+	int32 i = 0;
+	while (i < m_contactCount)
+	{
+		const b2Manifold* manifold = NULL;
+		if (evaluated[i] >= 0)
+		{
+			manifold = &manifolds[evaluated[i]];
+		}
+		if (Collide(m_contactBuffer[i], manifold))
+		{
+			++i;
+		}
+		else
+		{
+			// Follow the contact moved into slot i.
+			evaluated[i] = evaluated[m_contactCount];
+		}
 	}
+
+	m_stackAllocator->Free(manifolds);
+	m_stackAllocator->Free(evaluated);
+	m_stackAllocator->Free(contacts);
 }
 
 void b2ContactManager::FindNewContacts()
@@ -195,33 +556,10 @@ void b2ContactManager::AddPair(void* proxyUserDataA, void* proxyUserDataB)
 		return;
 	}
 
-	// TODO_ERIN use a hash table to remove a potential bottleneck when both
-	// bodies have a lot of contacts.
 	// Does a contact already exist?
-	b2ContactEdge* edge = bodyB->GetContactList();
-	while (edge)
+	if (FindContact(fixtureA, indexA, fixtureB, indexB))
 	{
-		if (edge->other == bodyA)
-		{
-			b2Fixture* fA = edge->contact->GetFixtureA();
-			b2Fixture* fB = edge->contact->GetFixtureB();
-			int32 iA = edge->contact->GetChildIndexA();
-			int32 iB = edge->contact->GetChildIndexB();
-
-			if (fA == fixtureA && fB == fixtureB && iA == indexA && iB == indexB)
-			{
-				// A contact already exists.
-				return;
-			}
-
-			if (fA == fixtureB && fB == fixtureA && iA == indexB && iB == indexA)
-			{
-				// A contact already exists.
-				return;
-			}
-		}
-
-		edge = edge->next;
+		return;
 	}
 
 	// Does a joint override collision? Is at least one body dynamic?
@@ -236,18 +574,35 @@ void b2ContactManager::AddPair(void* proxyUserDataA, void* proxyUserDataB)
 		return;
 	}
 
+	b2Contact* c = Create(fixtureA, indexA, fixtureB, indexB);
+	if (c == NULL)
+	{
+		return;
+	}
+
+	// Wake up the bodies
+	if (fixtureA->IsSensor() == false && fixtureB->IsSensor() == false)
+	{
+		bodyA->SetAwake(true);
+		bodyB->SetAwake(true);
+	}
+}
+
+b2Contact* b2ContactManager::Create(b2Fixture* fixtureA, int32 indexA,
+									b2Fixture* fixtureB, int32 indexB)
+{
 	// Call the factory.
 	b2Contact* c = b2Contact::Create(fixtureA, indexA, fixtureB, indexB, m_allocator);
 	if (c == NULL)
 	{
-		return;
+		return NULL;
 	}
 
 	// Contact creation may swap fixtures.
 	fixtureA = c->GetFixtureA();
 	fixtureB = c->GetFixtureB();
-	bodyA = fixtureA->GetBody();
-	bodyB = fixtureB->GetBody();
+	b2Body* bodyA = fixtureA->GetBody();
+	b2Body* bodyB = fixtureB->GetBody();
 
 	// Insert into the world.
 	c->m_prev = NULL;
@@ -257,6 +612,8 @@ void b2ContactManager::AddPair(void* proxyUserDataA, void* proxyUserDataB)
 		m_contactList->m_prev = c;
 	}
 	m_contactList = c;
+	AddToBuffer(c);
+	AddToPairTable(c);
 
 	// Connect to island graph.
 
@@ -284,12 +641,201 @@ void b2ContactManager::AddPair(void* proxyUserDataA, void* proxyUserDataB)
 	}
 	bodyB->m_contactList = &c->m_nodeB;
 
-	// Wake up the bodies
-	if (fixtureA->IsSensor() == false && fixtureB->IsSensor() == false)
+	++m_contactCount;
+	return c;
+}
+
+void b2ContactManager::CaptureState(b2BinaryWriter* writer) const
+{
+	m_broadPhase.CaptureState(writer);
+	writer->Write(m_idSlotCount);
+	writer->WriteArray(m_idSlots, m_idSlotCount);
+	writer->Write(m_freeIdSlot);
+
+	writer->Write(m_contactCount);
+	for (int32 i = 0; i < m_contactCount; ++i)
 	{
-		bodyA->SetAwake(true);
-		bodyB->SetAwake(true);
+		const b2Contact* c = m_contactBuffer[i];
+		writer->Write(c->m_fixtureA);
+		writer->Write(c->m_indexA);
+		writer->Write(c->m_fixtureB);
+		writer->Write(c->m_indexB);
+		writer->Write(c->m_flags);
+		writer->Write(c->m_friction);
+		writer->Write(c->m_restitution);
+		writer->Write(c->m_tangentSpeed);
+		writer->Write(c->m_manifold);
+		writer->Write(c->m_toiCount);
+		writer->Write(c->m_toi);
+		writer->Write(c->m_id);
 	}
 
-	++m_contactCount;
+	// The order of the lists decides the order in which islands are
+	// built and solved, so it's part of the state.
+	for (const b2Contact* c = m_contactList; c; c = c->m_next)
+	{
+		writer->Write(c->m_bufferIndex);
+	}
+	for (int32 i = 0; i < m_contactCount; ++i)
+	{
+		const b2Contact* c = m_contactBuffer[i];
+		const b2ContactEdge* nexts[2] = { c->m_nodeA.next, c->m_nodeB.next };
+		for (int32 j = 0; j < 2; ++j)
+		{
+			writer->Write(nexts[j] ? nexts[j]->contact->m_bufferIndex : -1);
+		}
+	}
+}
+
+void b2ContactManager::RestoreState(b2BinaryReader* reader)
+{
+	// Free the current contacts. The bodies' contact lists are cleared
+	// first, since all their edges go away.
+	for (int32 i = 0; i < m_contactCount; ++i)
+	{
+		b2Contact* c = m_contactBuffer[i];
+		c->m_fixtureA->m_body->m_contactList = NULL;
+		c->m_fixtureB->m_body->m_contactList = NULL;
+	}
+	for (int32 i = 0; i < m_contactCount; ++i)
+	{
+		b2Contact::Destroy(m_contactBuffer[i], m_allocator);
+	}
+	m_contactList = NULL;
+	m_contactCount = 0;
+
+	m_broadPhase.RestoreState(reader);
+
+	int32 idSlotCount = reader->ReadCount(sizeof(IdSlot));
+	if (m_idSlotCapacity < idSlotCount)
+	{
+		b2Free(m_idSlots);
+		m_idSlotCapacity = idSlotCount;
+		m_idSlots = (IdSlot*)b2Alloc(m_idSlotCapacity * sizeof(IdSlot));
+	}
+	m_idSlotCount = idSlotCount;
+	reader->ReadArray(m_idSlots, m_idSlotCount);
+	reader->Read(&m_freeIdSlot);
+
+	int32 contactCount = reader->ReadCount(sizeof(b2Fixture*));
+	if (m_contactCapacity < contactCount)
+	{
+		b2Free(m_contactBuffer);
+		while (m_contactCapacity < contactCount)
+		{
+			m_contactCapacity *= 2;
+		}
+		m_contactBuffer = (b2Contact**)b2Alloc(m_contactCapacity * sizeof(b2Contact*));
+	}
+	if (m_pairTableCapacity < 2 * contactCount)
+	{
+		b2Free(m_pairTable);
+		while (m_pairTableCapacity < 2 * contactCount)
+		{
+			m_pairTableCapacity *= 2;
+		}
+		m_pairTable = (b2Contact**)b2Alloc(m_pairTableCapacity * sizeof(b2Contact*));
+	}
+	memset(m_pairTable, 0, m_pairTableCapacity * sizeof(b2Contact*));
+
+	for (int32 i = 0; i < contactCount; ++i)
+	{
+		b2Fixture* fixtureA;
+		b2Fixture* fixtureB;
+		int32 indexA;
+		int32 indexB;
+		reader->Read(&fixtureA);
+		reader->Read(&indexA);
+		reader->Read(&fixtureB);
+		reader->Read(&indexB);
+		b2Assert(reader->HasFailed() == false);
+		b2Contact* c = b2Contact::Create(fixtureA, indexA, fixtureB, indexB,
+										 m_allocator);
+		b2Assert(c && c->m_fixtureA == fixtureA);
+		reader->Read(&c->m_flags);
+		reader->Read(&c->m_friction);
+		reader->Read(&c->m_restitution);
+		reader->Read(&c->m_tangentSpeed);
+		reader->Read(&c->m_manifold);
+		reader->Read(&c->m_toiCount);
+		reader->Read(&c->m_toi);
+		reader->Read(&c->m_id);
+		c->m_bufferIndex = i;
+		c->m_nodeA.contact = c;
+		c->m_nodeA.other = fixtureB->m_body;
+		c->m_nodeB.contact = c;
+		c->m_nodeB.other = fixtureA->m_body;
+		m_contactBuffer[i] = c;
+		InsertIntoPairTable(c);
+	}
+	m_contactCount = contactCount;
+
+	b2Contact* prev = NULL;
+	for (int32 i = 0; i < m_contactCount; ++i)
+	{
+		int32 index = 0;
+		reader->Read(&index);
+		b2Assert(0 <= index && index < m_contactCount);
+		b2Contact* c = m_contactBuffer[index];
+		c->m_prev = prev;
+		c->m_next = NULL;
+		if (prev)
+		{
+			prev->m_next = c;
+		}
+		else
+		{
+			m_contactList = c;
+		}
+		prev = c;
+	}
+
+	// Link the edges forward, then fill in the backward links and the
+	// heads of the bodies' lists.
+	for (int32 i = 0; i < m_contactCount; ++i)
+	{
+		b2Contact* c = m_contactBuffer[i];
+		b2ContactEdge* edges[2] = { &c->m_nodeA, &c->m_nodeB };
+		b2Body* bodies[2] = { c->m_fixtureA->m_body, c->m_fixtureB->m_body };
+		for (int32 j = 0; j < 2; ++j)
+		{
+			int32 index = -1;
+			reader->Read(&index);
+			b2Assert(-1 <= index && index < m_contactCount);
+			edges[j]->next = NULL;
+			edges[j]->prev = NULL;
+			if (index >= 0)
+			{
+				// Take the edge of the body in the next contact.
+				b2Contact* next = m_contactBuffer[index];
+				edges[j]->next = next->m_fixtureA->m_body == bodies[j] ?
+					&next->m_nodeA : &next->m_nodeB;
+			}
+		}
+	}
+	for (int32 i = 0; i < m_contactCount; ++i)
+	{
+		b2Contact* c = m_contactBuffer[i];
+		b2ContactEdge* edges[2] = { &c->m_nodeA, &c->m_nodeB };
+		for (int32 j = 0; j < 2; ++j)
+		{
+			if (edges[j]->next)
+			{
+				edges[j]->next->prev = edges[j];
+			}
+		}
+	}
+	for (int32 i = 0; i < m_contactCount; ++i)
+	{
+		b2Contact* c = m_contactBuffer[i];
+		b2ContactEdge* edges[2] = { &c->m_nodeA, &c->m_nodeB };
+		b2Body* bodies[2] = { c->m_fixtureA->m_body, c->m_fixtureB->m_body };
+		for (int32 j = 0; j < 2; ++j)
+		{
+			if (edges[j]->prev == NULL)
+			{
+				bodies[j]->m_contactList = edges[j];
+			}
+		}
+	}
 }
@@ -24,9 +24,13 @@
 #include <Box2D/Dynamics/Contacts/b2Contact.h>
 #include <Box2D/Dynamics/Contacts/b2ContactSolver.h>
 #include <Box2D/Dynamics/Joints/b2Joint.h>
+#include <Box2D/Dynamics/Joints/b2RevoluteJoint.h>
 #include <Box2D/Common/b2StackAllocator.h>
 #include <Box2D/Common/b2Timer.h>
 
+#include <algorithm>
+#include <functional>
+
 /*
 Position Correction Notes
 =========================
@@ -145,6 +149,95 @@ This might be faster than computing sin+cos.
 However, we can compute sin+cos of the same angle fast.
 */
 
+namespace {
+
+inline bool StaticSlotLess(const b2StaticSlot& a, const b2StaticSlot& b)
+{
+	return std::less<const b2Body*>()(a.body, b.body);
+}
+
+/// Integration inputs of the bodies of an island that can move, stored by
+/// component so that the integration loops don't touch the bodies. Dynamic
+/// bodies come first and kinematic bodies after them.
+struct BodyIntegrationData
+{
+	int32* slots;
+	float32* gravityScale;
+	float32* invMass;
+	float32* invI;
+	float32* linearDamping;
+	float32* angularDamping;
+	float32* forceX;
+	float32* forceY;
+	float32* torque;
+};
+
+// Integrate the velocities of count dynamic bodies and apply damping.
+void IntegrateBodyVelocities(const BodyIntegrationData& data, int32 count,
+						 b2Velocity* velocities, float32 h, const b2Vec2& gravity)
+{
+	for (int32 i = 0; i < count; ++i)
+	{
+		b2Velocity* velocity = velocities + data.slots[i];
+		float32 vx = velocity->v.x;
+		float32 vy = velocity->v.y;
+		float32 w = velocity->w;
+
+		vx += h * (data.gravityScale[i] * gravity.x + data.invMass[i] * data.forceX[i]);
+		vy += h * (data.gravityScale[i] * gravity.y + data.invMass[i] * data.forceY[i]);
+		w += h * data.invI[i] * data.torque[i];
+
+		// Apply damping.
+		// ODE: dv/dt + c * v = 0
+		// Solution: v(t) = v0 * exp(-c * t)
+		// Time step: v(t + dt) = v0 * exp(-c * (t + dt)) = v0 * exp(-c * t) * exp(-c * dt) = v * exp(-c * dt)
+		// v2 = exp(-c * dt) * v1
+		// Pade approximation:
+		// v2 = v1 * 1 / (1 + c * dt)
+		float32 linearScale = 1.0f / (1.0f + h * data.linearDamping[i]);
+		float32 angularScale = 1.0f / (1.0f + h * data.angularDamping[i]);
+		velocity->v.x = vx * linearScale;
+		velocity->v.y = vy * linearScale;
+		velocity->w = w * angularScale;
+	}
+}
+
+// Integrate the positions of the bodies in the given slots.
+void IntegrateBodyPositions(const int32* slots, int32 count, b2Position* positions,
+						b2Velocity* velocities, float32 h)
+{
+	for (int32 i = 0; i < count; ++i)
+	{
+		b2Position* position = positions + slots[i];
+		b2Velocity* velocity = velocities + slots[i];
+		b2Vec2 v = velocity->v;
+		float32 w = velocity->w;
+
+		// Check for large velocities
+		b2Vec2 translation = h * v;
+		if (b2Dot(translation, translation) > b2_maxTranslationSquared)
+		{
+			float32 ratio = b2_maxTranslation / translation.Length();
+			v *= ratio;
+		}
+
+		float32 rotation = h * w;
+		if (rotation * rotation > b2_maxRotationSquared)
+		{
+			float32 ratio = b2_maxRotation / b2Abs(rotation);
+			w *= ratio;
+		}
+
+		// Integrate
+		position->c += h * v;
+		position->a += h * w;
+		velocity->v = v;
+		velocity->w = w;
+	}
+}
+
+} // namespace
+
 b2Island::b2Island(
 	int32 bodyCapacity,
 	int32 contactCapacity,
@@ -161,23 +254,110 @@ b2Island::b2Island(
 
 	m_allocator = allocator;
 	m_listener = listener;
+	m_impulses = NULL;
 
 	m_bodies = (b2Body**)m_allocator->Allocate(bodyCapacity * sizeof(b2Body*));
 	m_contacts = (b2Contact**)m_allocator->Allocate(contactCapacity	 * sizeof(b2Contact*));
 	m_joints = (b2Joint**)m_allocator->Allocate(jointCapacity * sizeof(b2Joint*));
+	m_ownsLists = true;
+	m_sharesStaticBodies = false;
+
+	m_slotCount = bodyCapacity;
+	m_velocities = (b2Velocity*)m_allocator->Allocate(m_slotCount * sizeof(b2Velocity));
+	m_positions = (b2Position*)m_allocator->Allocate(m_slotCount * sizeof(b2Position));
+	m_integrationSlots = (int32*)m_allocator->Allocate(bodyCapacity * sizeof(int32));
+	m_integrationInputs = (float32*)m_allocator->Allocate(8 * bodyCapacity * sizeof(float32));
+	m_staticSlots = NULL;
+	m_staticSlotCount = 0;
+}
+
+b2Island::b2Island(
+	b2Body** bodies,
+	int32 bodyCount,
+	b2Contact** contacts,
+	int32 contactCount,
+	b2Joint** joints,
+	int32 jointCount,
+	int32 slotCount,
+	b2StackAllocator* allocator,
+	b2ContactImpulse* impulses)
+{
+	m_bodyCapacity = bodyCount;
+	m_contactCapacity = contactCount;
+	m_jointCapacity = jointCount;
+	m_bodyCount = bodyCount;
+	m_contactCount = contactCount;
+	m_jointCount = jointCount;
 
-	m_velocities = (b2Velocity*)m_allocator->Allocate(m_bodyCapacity * sizeof(b2Velocity));
-	m_positions = (b2Position*)m_allocator->Allocate(m_bodyCapacity * sizeof(b2Position));
+	m_allocator = allocator;
+	m_listener = NULL;
+	m_impulses = impulses;
+
+	m_bodies = bodies;
+	m_contacts = contacts;
+	m_joints = joints;
+	m_ownsLists = false;
+	m_sharesStaticBodies = true;
+
+	m_slotCount = slotCount;
+	m_velocities = NULL;
+	m_positions = NULL;
+	m_integrationSlots = NULL;
+	m_integrationInputs = NULL;
+	m_staticSlots = NULL;
+	m_staticSlotCount = 0;
+	if (m_slotCount > 0)
+	{
+		b2Assert(m_slotCount == bodyCount);
+		m_velocities = (b2Velocity*)m_allocator->Allocate(m_slotCount * sizeof(b2Velocity));
+		m_positions = (b2Position*)m_allocator->Allocate(m_slotCount * sizeof(b2Position));
+		m_integrationSlots = (int32*)m_allocator->Allocate(bodyCount * sizeof(int32));
+		m_integrationInputs = (float32*)m_allocator->Allocate(8 * bodyCount * sizeof(float32));
+
+		// Each static body the island touches is in bodies once.
+		for (int32 i = 0; i < bodyCount; ++i)
+		{
+			if (bodies[i]->m_type == b2_staticBody)
+			{
+				++m_staticSlotCount;
+			}
+		}
+		m_staticSlots = (b2StaticSlot*)m_allocator->Allocate(m_staticSlotCount * sizeof(b2StaticSlot));
+		int32 k = 0;
+		for (int32 i = 0; i < bodyCount; ++i)
+		{
+			if (bodies[i]->m_type == b2_staticBody)
+			{
+				b2Assert(bodies[i]->m_islandIndex == -1);
+				m_staticSlots[k].body = bodies[i];
+				m_staticSlots[k].index = i;
+				++k;
+			}
+		}
+		std::sort(m_staticSlots, m_staticSlots + m_staticSlotCount, StaticSlotLess);
+	}
 }
 
 b2Island::~b2Island()
 {
 	// Warning: the order should reverse the constructor order.
-	m_allocator->Free(m_positions);
-	m_allocator->Free(m_velocities);
-	m_allocator->Free(m_joints);
-	m_allocator->Free(m_contacts);
-	m_allocator->Free(m_bodies);
+	if (m_slotCount > 0)
+	{
+		if (m_sharesStaticBodies)
+		{
+			m_allocator->Free(m_staticSlots);
+		}
+		m_allocator->Free(m_integrationInputs);
+		m_allocator->Free(m_integrationSlots);
+		m_allocator->Free(m_positions);
+		m_allocator->Free(m_velocities);
+	}
+	if (m_ownsLists)
+	{
+		m_allocator->Free(m_joints);
+		m_allocator->Free(m_contacts);
+		m_allocator->Free(m_bodies);
+	}
 }
 
 void b2Island::Solve(b2Profile* profile, const b2TimeStep& step, const b2Vec2& gravity, bool allowSleep)
@@ -186,42 +366,8 @@ void b2Island::Solve(b2Profile* profile, const b2TimeStep& step, const b2Vec2& g
 
 	float32 h = step.dt;
 
-	// Integrate velocities and apply damping. Initialize the body state.
-	for (int32 i = 0; i < m_bodyCount; ++i)
-	{
-		b2Body* b = m_bodies[i];
-
-		b2Vec2 c = b->m_sweep.c;
-		float32 a = b->m_sweep.a;
-		b2Vec2 v = b->m_linearVelocity;
-		float32 w = b->m_angularVelocity;
-
-		// Store positions for continuous collision.
-		b->m_sweep.c0 = b->m_sweep.c;
-		b->m_sweep.a0 = b->m_sweep.a;
-
-		if (b->m_type == b2_dynamicBody)
-		{
-			// Integrate velocities.
-			v += h * (b->m_gravityScale * gravity + b->m_invMass * b->m_force);
-			w += h * b->m_invI * b->m_torque;
-
-			// Apply damping.
-			// ODE: dv/dt + c * v = 0
-			// Solution: v(t) = v0 * exp(-c * t)
-			// Time step: v(t + dt) = v0 * exp(-c * (t + dt)) = v0 * exp(-c * t) * exp(-c * dt) = v * exp(-c * dt)
-			// v2 = exp(-c * dt) * v1
-			// Pade approximation:
-			// v2 = v1 * 1 / (1 + c * dt)
-			v *= 1.0f / (1.0f + h * b->m_linearDamping);
-			w *= 1.0f / (1.0f + h * b->m_angularDamping);
-		}
-
-		m_positions[i].c = c;
-		m_positions[i].a = a;
-		m_velocities[i].v = v;
-		m_velocities[i].w = w;
-	}
+	// Initialize the body state and integrate velocities.
+	InitializeBodies(h, gravity);
 
 	timer.Reset();
 
@@ -230,6 +376,8 @@ void b2Island::Solve(b2Profile* profile, const b2TimeStep& step, const b2Vec2& g
 	solverData.step = step;
 	solverData.positions = m_positions;
 	solverData.velocities = m_velocities;
+	solverData.staticSlots = m_staticSlots;
+	solverData.staticSlotCount = m_staticSlotCount;
 
 	// Initialize velocity constraints.
 	b2ContactSolverDef contactSolverDef;
@@ -239,6 +387,8 @@ void b2Island::Solve(b2Profile* profile, const b2TimeStep& step, const b2Vec2& g
 	contactSolverDef.positions = m_positions;
 	contactSolverDef.velocities = m_velocities;
 	contactSolverDef.allocator = m_allocator;
+	contactSolverDef.staticSlots = m_staticSlots;
+	contactSolverDef.staticSlotCount = m_staticSlotCount;
 
 	b2ContactSolver contactSolver(&contactSolverDef);
 	contactSolver.InitializeVelocityConstraints();
@@ -253,15 +403,28 @@ void b2Island::Solve(b2Profile* profile, const b2TimeStep& step, const b2Vec2& g
 		m_joints[i]->InitVelocityConstraints(solverData);
 	}
 
+	bool wideJoints = step.wideJointSolving && m_jointCount > 0;
+	if (wideJoints)
+	{
+		InitializeJointBatches();
+	}
+
 	profile->solveInit = timer.GetMilliseconds();
 
 	// Solve velocity constraints
 	timer.Reset();
 	for (int32 i = 0; i < step.velocityIterations; ++i)
 	{
-		for (int32 j = 0; j < m_jointCount; ++j)
+		if (wideJoints)
 		{
-			m_joints[j]->SolveVelocityConstraints(solverData);
+			SolveJointBatchVelocities(solverData);
+		}
+		else
+		{
+			for (int32 j = 0; j < m_jointCount; ++j)
+			{
+				m_joints[j]->SolveVelocityConstraints(solverData);
+			}
 		}
 
 		contactSolver.SolveVelocityConstraints();
@@ -269,40 +432,14 @@ void b2Island::Solve(b2Profile* profile, const b2TimeStep& step, const b2Vec2& g
 
 	// Store impulses for warm starting
 	contactSolver.StoreImpulses();
+	if (wideJoints)
+	{
+		StoreJointBatchImpulses();
+	}
 	profile->solveVelocity = timer.GetMilliseconds();
 
 	// Integrate positions
-	for (int32 i = 0; i < m_bodyCount; ++i)
-	{
-		b2Vec2 c = m_positions[i].c;
-		float32 a = m_positions[i].a;
-		b2Vec2 v = m_velocities[i].v;
-		float32 w = m_velocities[i].w;
-
-		// Check for large velocities
-		b2Vec2 translation = h * v;
-		if (b2Dot(translation, translation) > b2_maxTranslationSquared)
-		{
-			float32 ratio = b2_maxTranslation / translation.Length();
-			v *= ratio;
-		}
-
-		float32 rotation = h * w;
-		if (rotation * rotation > b2_maxRotationSquared)
-		{
-			float32 ratio = b2_maxRotation / b2Abs(rotation);
-			w *= ratio;
-		}
-
-		// Integrate
-		c += h * v;
-		a += h * w;
-
-		m_positions[i].c = c;
-		m_positions[i].a = a;
-		m_velocities[i].v = v;
-		m_velocities[i].w = w;
-	}
+	IntegratePositions(h);
 
 	// Solve position constraints
 	timer.Reset();
@@ -312,10 +449,17 @@ void b2Island::Solve(b2Profile* profile, const b2TimeStep& step, const b2Vec2& g
 		bool contactsOkay = contactSolver.SolvePositionConstraints();
 
 		bool jointsOkay = true;
-		for (int32 i = 0; i < m_jointCount; ++i)
+		if (wideJoints)
 		{
-			bool jointOkay = m_joints[i]->SolvePositionConstraints(solverData);
-			jointsOkay = jointsOkay && jointOkay;
+			jointsOkay = SolveJointBatchPositions(solverData);
+		}
+		else
+		{
+			for (int32 i = 0; i < m_jointCount; ++i)
+			{
+				bool jointOkay = m_joints[i]->SolvePositionConstraints(solverData);
+				jointsOkay = jointsOkay && jointOkay;
+			}
 		}
 
 		if (contactsOkay && jointsOkay)
@@ -326,55 +470,380 @@ void b2Island::Solve(b2Profile* profile, const b2TimeStep& step, const b2Vec2& g
 		}
 	}
 
-	// Copy state buffers back to the bodies
-	for (int32 i = 0; i < m_bodyCount; ++i)
+	if (wideJoints)
 	{
-		b2Body* body = m_bodies[i];
-		body->m_sweep.c = m_positions[i].c;
-		body->m_sweep.a = m_positions[i].a;
-		body->m_linearVelocity = m_velocities[i].v;
-		body->m_angularVelocity = m_velocities[i].w;
-		body->SynchronizeTransform();
+		FreeJointBatches();
 	}
 
+	// Copy state buffers back to the bodies.
+	float32 minSleepTime = StoreBodies(h, allowSleep);
+
 	profile->solvePosition = timer.GetMilliseconds();
 
 	Report(contactSolver.m_velocityConstraints);
 
 	if (allowSleep)
 	{
-		float32 minSleepTime = b2_maxFloat;
+		if (minSleepTime >= b2_timeToSleep && positionSolved)
+		{
+			for (int32 i = 0; i < m_bodyCount; ++i)
+			{
+				b2Body* b = m_bodies[i];
+				if (b->GetType() != b2_staticBody || m_sharesStaticBodies == false)
+				{
+					b->SetAwake(false);
+				}
+			}
+		}
+	}
+}
 
-		const float32 linTolSqr = b2_linearSleepTolerance * b2_linearSleepTolerance;
-		const float32 angTolSqr = b2_angularSleepTolerance * b2_angularSleepTolerance;
+void b2Island::InitializeBodies(float32 h, const b2Vec2& gravity)
+{
+	// Bodies are addressed through their island index because static
+	// bodies may share a slot with other islands. Such static bodies may be
+	// read by several islands at once, so they are only read here.
+	BodyIntegrationData data;
+	data.slots = m_integrationSlots;
+	float32* inputs = m_integrationInputs;
+	data.gravityScale = inputs;
+	data.invMass = inputs + m_bodyCount;
+	data.invI = inputs + 2 * m_bodyCount;
+	data.linearDamping = inputs + 3 * m_bodyCount;
+	data.angularDamping = inputs + 4 * m_bodyCount;
+	data.forceX = inputs + 5 * m_bodyCount;
+	data.forceY = inputs + 6 * m_bodyCount;
+	data.torque = inputs + 7 * m_bodyCount;
+
+	m_dynamicCount = 0;
+	m_kinematicCount = 0;
+	for (int32 i = 0; i < m_bodyCount; ++i)
+	{
+		b2Body* b = m_bodies[i];
+		int32 index = i;
+		b2Assert(index < m_slotCount);
 
-		for (int32 i = 0; i < m_bodyCount; ++i)
+		m_positions[index].c = b->m_sweep.c;
+		m_positions[index].a = b->m_sweep.a;
+		m_velocities[index].v = b->m_linearVelocity;
+		m_velocities[index].w = b->m_angularVelocity;
+
+		if (b->m_type == b2_staticBody && m_sharesStaticBodies)
 		{
-			b2Body* b = m_bodies[i];
-			if (b->GetType() == b2_staticBody)
+			continue;
+		}
+
+		// Store positions for continuous collision.
+		b->m_sweep.c0 = b->m_sweep.c;
+		b->m_sweep.a0 = b->m_sweep.a;
+
+		if (b->m_type == b2_staticBody)
+		{
+			continue;
+		}
+
+		if (b->m_type == b2_kinematicBody)
+		{
+			++m_kinematicCount;
+			data.slots[m_bodyCount - m_kinematicCount] = index;
+			continue;
+		}
+
+		int32 k = m_dynamicCount++;
+		data.slots[k] = index;
+		data.gravityScale[k] = b->m_gravityScale;
+		data.invMass[k] = b->m_invMass;
+		data.invI[k] = b->m_invI;
+		data.linearDamping[k] = b->m_linearDamping;
+		data.angularDamping[k] = b->m_angularDamping;
+		data.forceX[k] = b->m_force.x;
+		data.forceY[k] = b->m_force.y;
+		data.torque[k] = b->m_torque;
+	}
+
+	// Integrate velocities and apply damping.
+	IntegrateBodyVelocities(data, m_dynamicCount, m_velocities, h, gravity);
+}
+
+void b2Island::IntegratePositions(float32 h)
+{
+	const int32* slots = m_integrationSlots;
+	IntegrateBodyPositions(slots, m_dynamicCount, m_positions, m_velocities, h);
+	IntegrateBodyPositions(slots + m_bodyCount - m_kinematicCount, m_kinematicCount,
+						   m_positions, m_velocities, h);
+}
+
+float32 b2Island::StoreBodies(float32 h, bool allowSleep)
+{
+	float32 minSleepTime = b2_maxFloat;
+	const float32 linTolSqr = b2_linearSleepTolerance * b2_linearSleepTolerance;
+	const float32 angTolSqr = b2_angularSleepTolerance * b2_angularSleepTolerance;
+	for (int32 i = 0; i < m_bodyCount; ++i)
+	{
+		b2Body* body = m_bodies[i];
+		if (body->m_type == b2_staticBody && m_sharesStaticBodies)
+		{
+			continue;
+		}
+		int32 index = i;
+		body->m_sweep.c = m_positions[index].c;
+		body->m_sweep.a = m_positions[index].a;
+		body->m_linearVelocity = m_velocities[index].v;
+		body->m_angularVelocity = m_velocities[index].w;
+		body->SynchronizeTransform();
+
+		if (allowSleep == false || body->m_type == b2_staticBody)
+		{
+			continue;
+		}
+
+		if ((body->m_flags & b2Body::e_autoSleepFlag) == 0 ||
+			body->m_angularVelocity * body->m_angularVelocity > angTolSqr ||
+			b2Dot(body->m_linearVelocity, body->m_linearVelocity) > linTolSqr)
+		{
+			body->m_sleepTime = 0.0f;
+			minSleepTime = 0.0f;
+		}
+		else
+		{
+			body->m_sleepTime += h;
+			minSleepTime = b2Min(minSleepTime, body->m_sleepTime);
+		}
+	}
+
+	return minSleepTime;
+}
+
+void b2Island::InitializeJointBatches()
+{
+	const int32 lanes = b2_jointSolverLanes;
+	const int32 overflow = b2_maxJointColours;
+
+	m_jointOrder = (b2Joint**)m_allocator->Allocate(m_jointCount * sizeof(b2Joint*));
+	m_jointColours = (b2JointColour*)m_allocator->Allocate((overflow + 1) * sizeof(b2JointColour));
+	int32* jointColour = (int32*)m_allocator->Allocate(m_jointCount * sizeof(int32));
+	uint32* bodyColours = (uint32*)m_allocator->Allocate(m_slotCount * sizeof(uint32));
+
+	// Greedy colouring. Each joint takes the first colour not yet used by
+	// one of its dynamic bodies. Static and kinematic bodies are never
+	// moved by a joint, so any number of joints of a colour may share them.
+	// Gear joints act on four bodies, so they are always solved last.
+	for (int32 i = 0; i < m_jointCount; ++i)
+	{
+		b2Joint* j = m_joints[i];
+		bodyColours[j->m_bodyA->GetSolverIndex(m_staticSlots, m_staticSlotCount)] = 0;
+		bodyColours[j->m_bodyB->GetSolverIndex(m_staticSlots, m_staticSlotCount)] = 0;
+	}
+
+	int32 jointCounts[overflow + 1], wideCounts[overflow + 1];
+	for (int32 c = 0; c <= overflow; ++c)
+	{
+		jointCounts[c] = 0;
+		wideCounts[c] = 0;
+	}
+
+	for (int32 i = 0; i < m_jointCount; ++i)
+	{
+		b2Joint* j = m_joints[i];
+		int32 indexA = j->m_bodyA->GetSolverIndex(m_staticSlots, m_staticSlotCount);
+		int32 indexB = j->m_bodyB->GetSolverIndex(m_staticSlots, m_staticSlotCount);
+		bool dynamicA = j->m_bodyA->m_type == b2_dynamicBody;
+		bool dynamicB = j->m_bodyB->m_type == b2_dynamicBody;
+
+		uint32 used = 0;
+		if (dynamicA)
+		{
+			used |= bodyColours[indexA];
+		}
+		if (dynamicB)
+		{
+			used |= bodyColours[indexB];
+		}
+
+		int32 colour = 0;
+		if (j->m_type == e_gearJoint)
+		{
+			colour = overflow;
+		}
+		else
+		{
+			while (colour < overflow && (used & (1u << colour)))
 			{
-				continue;
+				++colour;
 			}
+		}
 
-			if ((b->m_flags & b2Body::e_autoSleepFlag) == 0 ||
-				b->m_angularVelocity * b->m_angularVelocity > angTolSqr ||
-				b2Dot(b->m_linearVelocity, b->m_linearVelocity) > linTolSqr)
+		if (colour < overflow)
+		{
+			if (dynamicA)
+			{
+				bodyColours[indexA] |= 1u << colour;
+			}
+			if (dynamicB)
 			{
-				b->m_sleepTime = 0.0f;
-				minSleepTime = 0.0f;
+				bodyColours[indexB] |= 1u << colour;
 			}
-			else
+
+			if (j->m_type == e_revoluteJoint &&
+				static_cast<b2RevoluteJoint*>(j)->IsPointConstraint())
 			{
-				b->m_sleepTime += h;
-				minSleepTime = b2Min(minSleepTime, b->m_sleepTime);
+				++wideCounts[colour];
 			}
 		}
 
-		if (minSleepTime >= b2_timeToSleep && positionSolved)
+		jointColour[i] = colour;
+		++jointCounts[colour];
+	}
+
+	// Lay out the colours in order, skipping empty ones. The revolute
+	// joints solved wide come first within each colour.
+	m_jointColourCount = 0;
+	m_wideJointCount = 0;
+	int32 jointStart = 0;
+	int32 colourIndex[overflow + 1];
+	int32 wideFill[overflow + 1], otherFill[overflow + 1];
+	for (int32 c = 0; c <= overflow; ++c)
+	{
+		colourIndex[c] = -1;
+		if (jointCounts[c] == 0)
 		{
-			for (int32 i = 0; i < m_bodyCount; ++i)
+			continue;
+		}
+
+		colourIndex[c] = m_jointColourCount;
+		b2JointColour* colour = m_jointColours + m_jointColourCount++;
+		colour->jointStart = jointStart;
+		colour->jointCount = jointCounts[c];
+		colour->wideStart = m_wideJointCount;
+		colour->wideCount = (wideCounts[c] + lanes - 1) / lanes;
+		m_wideJointCount += colour->wideCount;
+
+		// Wide joints go first, then the others, in their original order.
+		wideFill[c] = jointStart;
+		otherFill[c] = jointStart + wideCounts[c];
+		jointStart += jointCounts[c];
+	}
+
+	for (int32 i = 0; i < m_jointCount; ++i)
+	{
+		b2Joint* j = m_joints[i];
+		int32 c = jointColour[i];
+		if (c < overflow && j->m_type == e_revoluteJoint &&
+			static_cast<b2RevoluteJoint*>(j)->IsPointConstraint())
+		{
+			m_jointOrder[wideFill[c]++] = j;
+		}
+		else
+		{
+			m_jointOrder[otherFill[c]++] = j;
+		}
+	}
+
+	m_allocator->Free(bodyColours);
+	m_allocator->Free(jointColour);
+
+	m_wideJoints = (b2WideRevoluteConstraint*)m_allocator->Allocate(
+		m_wideJointCount * sizeof(b2WideRevoluteConstraint));
+	for (int32 c = 0; c <= overflow; ++c)
+	{
+		if (wideCounts[c] == 0)
+		{
+			continue;
+		}
+
+		b2JointColour* colour = m_jointColours + colourIndex[c];
+		b2Joint** joints = m_jointOrder + colour->jointStart;
+		for (int32 i = 0; i < colour->wideCount; ++i)
+		{
+			int32 start = i * lanes;
+			int32 count = b2Min(lanes, wideCounts[c] - start);
+			b2RevoluteJoint* revoluteJoints[lanes];
+			for (int32 l = 0; l < count; ++l)
+			{
+				revoluteJoints[l] = static_cast<b2RevoluteJoint*>(joints[start + l]);
+			}
+			b2RevoluteJoint::InitializeWide(revoluteJoints, count,
+											m_wideJoints + colour->wideStart + i);
+		}
+
+		// The wide joints are no longer solved through the joint order.
+		colour->jointStart += wideCounts[c];
+		colour->jointCount -= wideCounts[c];
+	}
+}
+
+void b2Island::SolveJointBatchVelocities(const b2SolverData& data)
+{
+	for (int32 c = 0; c < m_jointColourCount; ++c)
+	{
+		const b2JointColour* colour = m_jointColours + c;
+		for (int32 i = 0; i < colour->wideCount; ++i)
+		{
+			b2RevoluteJoint::SolveWideVelocityConstraints(
+				m_wideJoints + colour->wideStart + i, data);
+		}
+		for (int32 i = 0; i < colour->jointCount; ++i)
+		{
+			m_jointOrder[colour->jointStart + i]->SolveVelocityConstraints(data);
+		}
+	}
+}
+
+void b2Island::StoreJointBatchImpulses()
+{
+	for (int32 i = 0; i < m_wideJointCount; ++i)
+	{
+		b2RevoluteJoint::StoreWideImpulses(m_wideJoints + i);
+	}
+}
+
+bool b2Island::SolveJointBatchPositions(const b2SolverData& data)
+{
+	bool jointsOkay = true;
+	for (int32 c = 0; c < m_jointColourCount; ++c)
+	{
+		const b2JointColour* colour = m_jointColours + c;
+		for (int32 i = 0; i < colour->wideCount; ++i)
+		{
+			bool jointOkay = b2RevoluteJoint::SolveWidePositionConstraints(
+				m_wideJoints + colour->wideStart + i, data);
+			jointsOkay = jointsOkay && jointOkay;
+		}
+		for (int32 i = 0; i < colour->jointCount; ++i)
+		{
+			bool jointOkay = m_jointOrder[colour->jointStart + i]->SolvePositionConstraints(data);
+			jointsOkay = jointsOkay && jointOkay;
+		}
+	}
+	return jointsOkay;
+}
+
+void b2Island::FreeJointBatches()
+{
+	// Warning: the order should reverse InitializeJointBatches.
+	m_allocator->Free(m_wideJoints);
+	m_allocator->Free(m_jointColours);
+	m_allocator->Free(m_jointOrder);
+}
+
+void b2Island::SolveUnconnected(const b2TimeStep& step, const b2Vec2& gravity, bool allowSleep)
+{
+	b2Assert(m_contactCount == 0 && m_jointCount == 0);
+
+	float32 h = step.dt;
+	InitializeBodies(h, gravity);
+	IntegratePositions(h);
+	StoreBodies(h, allowSleep);
+
+	// Without constraints the position solver succeeds on its first
+	// iteration, so it only has to run once.
+	if (allowSleep && step.positionIterations > 0)
+	{
+		for (int32 i = 0; i < m_bodyCount; ++i)
+		{
+			b2Body* b = m_bodies[i];
+			if (b->GetType() != b2_staticBody && b->m_sleepTime >= b2_timeToSleep)
 			{
-				b2Body* b = m_bodies[i];
 				b->SetAwake(false);
 			}
 		}
@@ -400,6 +869,8 @@ void b2Island::SolveTOI(const b2TimeStep& subStep, int32 toiIndexA, int32 toiInd
 	contactSolverDef.contacts = m_contacts;
 	contactSolverDef.count = m_contactCount;
 	contactSolverDef.allocator = m_allocator;
+	contactSolverDef.staticSlots = m_staticSlots;
+	contactSolverDef.staticSlotCount = m_staticSlotCount;
 	contactSolverDef.step = subStep;
 	contactSolverDef.positions = m_positions;
 	contactSolverDef.velocities = m_velocities;
@@ -515,7 +986,7 @@ void b2Island::SolveTOI(const b2TimeStep& subStep, int32 toiIndexA, int32 toiInd
 
 void b2Island::Report(const b2ContactVelocityConstraint* constraints)
 {
-	if (m_listener == NULL)
+	if (m_listener == NULL && m_impulses == NULL)
 	{
 		return;
 	}
@@ -534,6 +1005,13 @@ void b2Island::Report(const b2ContactVelocityConstraint* constraints)
 			impulse.tangentImpulses[j] = vc->points[j].tangentImpulse;
 		}
 
-		m_listener->PostSolve(c, &impulse);
+		if (m_impulses)
+		{
+			m_impulses[i] = impulse;
+		}
+		else
+		{
+			m_listener->PostSolve(c, &impulse);
+		}
 	}
 }
@@ -21,7 +21,17 @@
 #include <Box2D/Dynamics/b2Body.h>
 #include <Box2D/Dynamics/b2Fixture.h>
 #include <Box2D/Dynamics/b2Island.h>
+#include <Box2D/Dynamics/Joints/b2DistanceJoint.h>
+#include <Box2D/Dynamics/Joints/b2FrictionJoint.h>
+#include <Box2D/Dynamics/Joints/b2GearJoint.h>
+#include <Box2D/Dynamics/Joints/b2MotorJoint.h>
+#include <Box2D/Dynamics/Joints/b2MouseJoint.h>
+#include <Box2D/Dynamics/Joints/b2PrismaticJoint.h>
 #include <Box2D/Dynamics/Joints/b2PulleyJoint.h>
+#include <Box2D/Dynamics/Joints/b2RevoluteJoint.h>
+#include <Box2D/Dynamics/Joints/b2RopeJoint.h>
+#include <Box2D/Dynamics/Joints/b2WeldJoint.h>
+#include <Box2D/Dynamics/Joints/b2WheelJoint.h>
 #include <Box2D/Dynamics/Contacts/b2Contact.h>
 #include <Box2D/Dynamics/Contacts/b2ContactSolver.h>
 #include <Box2D/Collision/b2Collision.h>
@@ -31,10 +41,247 @@
 #include <Box2D/Collision/Shapes/b2ChainShape.h>
 #include <Box2D/Collision/Shapes/b2PolygonShape.h>
 #include <Box2D/Collision/b2TimeOfImpact.h>
+#include <Box2D/Common/b2BinaryStream.h>
 #include <Box2D/Common/b2Draw.h>
+#include <Box2D/Common/b2GrowableBuffer.h>
 #include <Box2D/Common/b2Timer.h>
+#include <algorithm>
+#include <functional>
 #include <new>
 
+/// A contact with a TOI event in b2World::SolveTOI.
+struct b2TOIEvent
+{
+	float32 alpha;
+	/// Position of the contact in b2ContactManager::m_contactBuffer.
+	int32 index;
+};
+
+/// Solves groups of particle systems, using the scratch allocator of the
+/// executing thread. Systems of a group may touch the same bodies, so they
+/// are solved one after another in the order of the world's list.
+class b2ParticleSolveTask : public b2Task
+{
+public:
+	b2ParticleSolveTask(const b2TimeStep& step) : m_step(step)
+	{
+	}
+
+	virtual void Execute(int32 begin, int32 end, int32 threadIndex)
+	{
+		b2Assert(0 <= threadIndex && threadIndex < m_allocatorCount);
+		b2StackAllocator* allocator = &m_allocators[threadIndex];
+		for (int32 k = begin; k < end; ++k)
+		{
+			for (int32 i = m_groupStarts[k]; i < m_groupStarts[k + 1]; ++i)
+			{
+				b2ParticleSystem* system = m_systems[i];
+				b2StackAllocator* previous = system->m_stackAllocator;
+				system->m_stackAllocator = allocator;
+				system->Solve(m_step);
+				system->m_stackAllocator = previous;
+			}
+		}
+	}
+
+	const b2TimeStep& m_step;
+	b2ParticleSystem** m_systems;
+	/// Group k holds m_systems[m_groupStarts[k], m_groupStarts[k + 1]).
+	const int32* m_groupStarts;
+	b2StackAllocator* m_allocators;
+	int32 m_allocatorCount;
+};
+
+namespace {
+
+/// Solves a range of the islands gathered by
+/// b2World::SolveIslandsConcurrently, using the scratch allocator of the
+/// executing thread. The first items solve the particle systems of
+/// m_particleTask, if any, so that they start as early as possible.
+class IslandSolveTask : public b2Task
+{
+public:
+	IslandSolveTask(const b2TimeStep& step, const b2Vec2& gravity,
+					bool allowSleep) :
+		m_step(step), m_gravity(gravity), m_allowSleep(allowSleep)
+	{
+	}
+
+	virtual void Execute(int32 begin, int32 end, int32 threadIndex)
+	{
+		b2Assert(0 <= threadIndex && threadIndex < m_allocatorCount);
+		b2StackAllocator* allocator = &m_allocators[threadIndex];
+		for (int32 k = begin; k < end; ++k)
+		{
+			if (k < m_particleGroupCount)
+			{
+				m_particleTask->Execute(k, k + 1, threadIndex);
+				continue;
+			}
+
+			const b2IslandRange& range = m_ranges[k - m_particleGroupCount];
+			b2Island island(m_bodies + range.bodyStart, range.bodyCount,
+							m_contacts + range.contactStart, range.contactCount,
+							m_joints + range.jointStart, range.jointCount,
+							range.bodyCount, allocator,
+							m_impulses ? m_impulses + range.contactStart : NULL);
+			island.Solve(&m_profiles[k - m_particleGroupCount], m_step,
+						 m_gravity, m_allowSleep);
+		}
+	}
+
+	const b2TimeStep& m_step;
+	const b2Vec2& m_gravity;
+	bool m_allowSleep;
+	b2Task* m_particleTask;
+	int32 m_particleGroupCount;
+	const b2IslandRange* m_ranges;
+	b2Body** m_bodies;
+	b2Contact** m_contacts;
+	b2Joint** m_joints;
+	b2ContactImpulse* m_impulses;
+	b2Profile* m_profiles;
+	b2StackAllocator* m_allocators;
+	int32 m_allocatorCount;
+};
+
+/// A non-static body that a particle system may touch during a step.
+struct ParticleBodyRef
+{
+	b2Body* body;
+	int32 system;
+};
+
+inline bool ParticleBodyRefLess(const ParticleBodyRef& a,
+								const ParticleBodyRef& b)
+{
+	if (a.body != b.body)
+	{
+		return a.body < b.body;
+	}
+	return a.system < b.system;
+}
+
+/// Collects the non-static bodies with a fixture in an AABB.
+class ParticleBodyQueryCallback
+{
+public:
+	bool QueryCallback(int32 proxyId)
+	{
+		b2FixtureProxy* proxy = (b2FixtureProxy*)m_broadPhase->GetUserData(proxyId);
+		b2Body* body = proxy->fixture->GetBody();
+		if (body->GetType() != b2_staticBody)
+		{
+			ParticleBodyRef& ref = m_refs->Append();
+			ref.body = body;
+			ref.system = m_system;
+		}
+		return true;
+	}
+
+	const b2BroadPhase* m_broadPhase;
+	b2GrowableBuffer<ParticleBodyRef>* m_refs;
+	int32 m_system;
+};
+
+inline int32 FindGroup(int32* parents, int32 i)
+{
+	while (parents[i] != i)
+	{
+		parents[i] = parents[parents[i]];
+		i = parents[i];
+	}
+	return i;
+}
+
+/// Orders the TOI heap by alpha, then by buffer position, so that events
+/// are solved in the same order as by a linear search of the buffer.
+inline bool TOIEventGreater(const b2TOIEvent& a, const b2TOIEvent& b)
+{
+	if (a.alpha != b.alpha)
+	{
+		return a.alpha > b.alpha;
+	}
+	return a.index > b.index;
+}
+
+/// Finds the earliest time of impact between the edges of a chain and a
+/// shape.
+class ChainTOICallback
+{
+public:
+	ChainTOICallback(b2TOIOutput* output, b2TOIInput* input,
+					 const b2ChainShape* chain) :
+		m_output(output), m_input(input), m_chain(chain)
+	{
+	}
+
+	bool QueryCallback(int32 index)
+	{
+		m_input->proxyA.Set(m_chain, index);
+		b2TOIOutput output;
+		b2TimeOfImpact(&output, m_input);
+		if (output.state == b2TOIOutput::e_touching)
+		{
+			// Later edges only need to be checked up to this time.
+			*m_output = output;
+			m_input->tMax = output.t;
+		}
+		return true;
+	}
+
+	b2TOIOutput* m_output;
+	b2TOIInput* m_input;
+	const b2ChainShape* m_chain;
+};
+
+/// Compute the time of impact of a chain that uses a single proxy and a
+/// child of another shape, over the edges near the path of the shape.
+/// input->proxyA is ignored and input->tMax is modified.
+void ChainTimeOfImpact(b2TOIOutput* output, b2TOIInput* input,
+					   const b2ChainShape* chain,
+					   const b2Shape* shape, int32 childIndex)
+{
+	// Bound the shape at the start and end of the sweeps, in the frame of
+	// the chain.
+	b2Transform xfA0, xfA1, xfB0, xfB1;
+	input->sweepA.GetTransform(&xfA0, 0.0f);
+	input->sweepA.GetTransform(&xfA1, 1.0f);
+	input->sweepB.GetTransform(&xfB0, 0.0f);
+	input->sweepB.GetTransform(&xfB1, 1.0f);
+
+	b2AABB aabb, box;
+	shape->ComputeAABB(&aabb, b2MulT(xfA0, xfB0), childIndex);
+	shape->ComputeAABB(&box, b2MulT(xfA0, xfB1), childIndex);
+	aabb.Combine(box);
+	shape->ComputeAABB(&box, b2MulT(xfA1, xfB0), childIndex);
+	aabb.Combine(box);
+	shape->ComputeAABB(&box, b2MulT(xfA1, xfB1), childIndex);
+	aabb.Combine(box);
+	b2Vec2 r(chain->m_radius + b2_linearSlop, chain->m_radius + b2_linearSlop);
+	aabb.lowerBound -= r;
+	aabb.upperBound += r;
+
+	output->state = b2TOIOutput::e_separated;
+	output->t = input->tMax;
+	ChainTOICallback callback(output, input, chain);
+	chain->QueryEdges(&callback, aabb);
+}
+
+/// Add an event to the TOI heap, unless the contact has no TOI in the step.
+inline void PushTOIEvent(b2GrowableBuffer<b2TOIEvent>* events, float32 alpha, int32 index)
+{
+	if (alpha < 1.0f)
+	{
+		b2TOIEvent& event = events->Append();
+		event.alpha = alpha;
+		event.index = index;
+		std::push_heap(events->Begin(), events->End(), TOIEventGreater);
+	}
+}
+
+} // namespace
+
 b2World::b2World(const b2Vec2& gravity)
 {
 	Init(gravity);
@@ -65,6 +312,13 @@ b2World::~b2World()
 		DestroyParticleSystem(m_particleSystemList);
 	}
 
+	SetTaskExecutor(NULL);
+
+	while (m_snapshotBufferList)
+	{
+		RemoveSnapshotBuffer(m_snapshotBufferList);
+	}
+
 	// Even though the block allocator frees them for us, for safety,
 	// we should ensure that all buffers have been freed.
 	b2Assert(m_blockAllocator.GetNumGiantAllocations() == 0);
@@ -75,6 +329,76 @@ void b2World::SetDestructionListener(b2DestructionListener* listener)
 	m_destructionListener = listener;
 }
 
+void b2World::SetTaskExecutor(b2TaskExecutor* executor)
+{
+	b2Assert(IsLocked() == false);
+	if (IsLocked())
+	{
+		return;
+	}
+
+	if (m_taskAllocators)
+	{
+		for (int32 i = m_taskAllocatorCount - 1; i >= 0; --i)
+		{
+			m_taskAllocators[i].~b2StackAllocator();
+		}
+		b2Free(m_taskAllocators);
+		m_taskAllocators = NULL;
+		m_taskAllocatorCount = 0;
+	}
+
+	m_taskExecutor = executor;
+	m_contactManager.m_taskExecutor = executor;
+	if (m_taskExecutor)
+	{
+		m_taskAllocatorCount = m_taskExecutor->GetThreadCount();
+		b2Assert(m_taskAllocatorCount > 0);
+		m_taskAllocators = (b2StackAllocator*)b2Alloc(
+			m_taskAllocatorCount * sizeof(b2StackAllocator));
+		for (int32 i = 0; i < m_taskAllocatorCount; ++i)
+		{
+			new (&m_taskAllocators[i]) b2StackAllocator;
+		}
+	}
+}
+
+void b2World::AddSnapshotBuffer(b2WorldSnapshotBuffer* buffer)
+{
+	b2Assert(IsLocked() == false);
+	if (IsLocked())
+	{
+		return;
+	}
+
+	b2Assert(buffer->m_world == NULL);
+	buffer->m_world = this;
+	buffer->m_next = m_snapshotBufferList;
+	m_snapshotBufferList = buffer;
+
+	buffer->Write(this);
+	buffer->Publish();
+}
+
+void b2World::RemoveSnapshotBuffer(b2WorldSnapshotBuffer* buffer)
+{
+	b2Assert(IsLocked() == false);
+	if (IsLocked())
+	{
+		return;
+	}
+
+	b2Assert(buffer->m_world == this);
+	b2WorldSnapshotBuffer** link = &m_snapshotBufferList;
+	while (*link != buffer)
+	{
+		link = &(*link)->m_next;
+	}
+	*link = buffer->m_next;
+	buffer->m_world = NULL;
+	buffer->m_next = NULL;
+}
+
 void b2World::SetContactFilter(b2ContactFilter* filter)
 {
 	m_contactManager.m_contactFilter = filter;
@@ -100,6 +424,7 @@ b2Body* b2World::CreateBody(const b2BodyDef* def)
 
 	void* mem = m_blockAllocator.Allocate(sizeof(b2Body));
 	b2Body* b = new (mem) b2Body(def, this);
+	b->m_serial = m_nextSerial++;
 
 	// Add to world doubly linked list.
 	b->m_prev = NULL;
@@ -111,6 +436,8 @@ b2Body* b2World::CreateBody(const b2BodyDef* def)
 	m_bodyList = b;
 	++m_bodyCount;
 
+	UpdateIsland(b);
+
 	return b;
 }
 
@@ -151,6 +478,11 @@ void b2World::DestroyBody(b2Body* b)
 	}
 	b->m_contactList = NULL;
 
+	if (b->m_island)
+	{
+		RemoveFromIsland(b);
+	}
+
 	// Delete the attached fixtures. This destroys broad-phase proxies.
 	b2Fixture* f = b->m_fixtureList;
 	while (f)
@@ -204,6 +536,7 @@ b2Joint* b2World::CreateJoint(const b2JointDef* def)
 	}
 
 	b2Joint* j = b2Joint::Create(def, &m_blockAllocator);
+	j->m_serial = m_nextSerial++;
 
 	// Connect to the world list.
 	j->m_prev = NULL;
@@ -250,6 +583,8 @@ b2Joint* b2World::CreateJoint(const b2JointDef* def)
 		}
 	}
 
+	LinkIslands(bodyA, bodyB);
+
 	// Note: creating a joint doesn't wake the bodies.
 
 	return j;
@@ -284,6 +619,7 @@ void b2World::DestroyJoint(b2Joint* j)
 	// Disconnect from island graph.
 	b2Body* bodyA = j->m_bodyA;
 	b2Body* bodyB = j->m_bodyB;
+	UnlinkIslands(bodyA, bodyB);
 
 	// Wake up connected bodies.
 	bodyA->SetAwake(true);
@@ -360,6 +696,7 @@ b2ParticleSystem* b2World::CreateParticleSystem(const b2ParticleSystemDef* def)
 
 	void* mem = m_blockAllocator.Allocate(sizeof(b2ParticleSystem));
 	b2ParticleSystem* p = new (mem) b2ParticleSystem(def, this);
+	p->m_serial = m_nextSerial++;
 
 	// Add to world doubly linked list.
 	p->m_prev = NULL;
@@ -426,15 +763,28 @@ void b2World::Init(const b2Vec2& gravity)
 	m_destructionListener = NULL;
 	m_debugDraw = NULL;
 
+	m_snapshotBufferList = NULL;
+	m_nextSerial = 0;
+	m_wokenBodies = NULL;
+
+	m_taskExecutor = NULL;
+	m_taskAllocators = NULL;
+	m_taskAllocatorCount = 0;
+
 	m_bodyList = NULL;
 	m_jointList = NULL;
 	m_particleSystemList = NULL;
+	m_islandList = NULL;
 
 	m_bodyCount = 0;
 	m_jointCount = 0;
+	m_islandCount = 0;
 
 	m_warmStarting = true;
+	m_wideContactSolving = false;
+	m_wideJointSolving = false;
 	m_continuousPhysics = true;
+	m_speculativeContacts = false;
 	m_subStepping = false;
 
 	m_stepComplete = true;
@@ -447,6 +797,7 @@ void b2World::Init(const b2Vec2& gravity)
 	m_inv_dt0 = 0.0f;
 
 	m_contactManager.m_allocator = &m_blockAllocator;
+	m_contactManager.m_stackAllocator = &m_stackAllocator;
 
 	m_liquidFunVersion = &b2_liquidFunVersion;
 	m_liquidFunVersionString = b2_liquidFunVersionString;
@@ -454,165 +805,281 @@ void b2World::Init(const b2Vec2& gravity)
 	memset(&m_profile, 0, sizeof(b2Profile));
 }
 
-// Find islands, integrate and solve constraints, solve position constraints
-void b2World::Solve(const b2TimeStep& step)
+// Solve the particle systems that touch non-static bodies, before the
+// bodies are solved. With a task executor, systems that can't touch the same
+// body are solved concurrently. Systems that can't touch any non-static
+// body are copied to detached instead, to be solved alongside the islands.
+// Returns the number of detached systems.
+int32 b2World::SolveParticleSystems(const b2TimeStep& step,
+									b2ParticleSystem** detached)
 {
-	// update previous transforms
-	for (b2Body* b = m_bodyList; b; b = b->m_next)
+	int32 count = 0;
+	bool callsListeners = false;
+	for (b2ParticleSystem* p = m_particleSystemList; p; p = p->GetNext())
 	{
-		b->m_xf0 = b->m_xf;
+		++count;
+		callsListeners = callsListeners || p->CallsListeners();
 	}
 
-	m_profile.solveInit = 0.0f;
-	m_profile.solveVelocity = 0.0f;
-	m_profile.solvePosition = 0.0f;
-
-	// Size the island for the worst case.
-	b2Island island(m_bodyCount,
-					m_contactManager.m_contactCount,
-					m_jointCount,
-					&m_stackAllocator,
-					m_contactManager.m_contactListener);
-
-	// Clear all the island flags.
-	for (b2Body* b = m_bodyList; b; b = b->m_next)
+	// Listeners are called on this thread only.
+	if (m_taskExecutor == NULL || count == 0 || callsListeners)
+	{
+		for (b2ParticleSystem* p = m_particleSystemList; p; p = p->GetNext())
+		{
+			p->Solve(step); // Particle Simulation
+		}
+		return 0;
+	}
+
+	b2ParticleSystem** systems = (b2ParticleSystem**)m_stackAllocator.Allocate(count * sizeof(b2ParticleSystem*));
+	int32* parents = (int32*)m_stackAllocator.Allocate(count * sizeof(int32));
+	int32* groupStarts = (int32*)m_stackAllocator.Allocate((count + 1) * sizeof(int32));
+
+	// Find the non-static bodies each system may reach this step. The world
+	// doesn't move while particles are solved, and particles move at most
+	// one diameter per iteration, so the fat AABBs of the broad-phase are
+	// checked against the particles' bounds grown by that distance.
+	b2GrowableBuffer<ParticleBodyRef> refs(m_blockAllocator);
+	ParticleBodyQueryCallback callback;
+	callback.m_broadPhase = &m_contactManager.m_broadPhase;
+	callback.m_refs = &refs;
+	int32 index = 0;
+	for (b2ParticleSystem* p = m_particleSystemList; p; p = p->GetNext())
 	{
-		b->m_flags &= ~b2Body::e_islandFlag;
+		systems[index] = p;
+		parents[index] = index;
+		if (p->GetParticleCount() > 0)
+		{
+			b2AABB aabb;
+			p->ComputeAABB(&aabb);
+			float32 margin = 2.0f * (step.particleIterations + 1) * p->m_particleDiameter;
+			aabb.lowerBound -= b2Vec2(margin, margin);
+			aabb.upperBound += b2Vec2(margin, margin);
+			callback.m_system = index;
+			m_contactManager.m_broadPhase.Query(&callback, aabb);
+		}
+		++index;
 	}
-	for (b2Contact* c = m_contactManager.m_contactList; c; c = c->m_next)
+
+	// Systems that may touch the same body are solved in the same group.
+	// Each group is named after its first system.
+	std::sort(refs.Begin(), refs.End(), ParticleBodyRefLess);
+	bool* attached = (bool*)m_stackAllocator.Allocate(count * sizeof(bool));
+	for (int32 i = 0; i < count; ++i)
 	{
-		c->m_flags &= ~b2Contact::e_islandFlag;
+		attached[i] = false;
 	}
-	for (b2Joint* j = m_jointList; j; j = j->m_next)
+	for (int32 i = 0; i < refs.GetCount(); ++i)
 	{
-		j->m_islandFlag = false;
+		attached[refs[i].system] = true;
+		if (i > 0 && refs[i].body == refs[i - 1].body)
+		{
+			int32 a = FindGroup(parents, refs[i - 1].system);
+			int32 b = FindGroup(parents, refs[i].system);
+			parents[b2Max(a, b)] = b2Min(a, b);
+		}
 	}
 
-	// Build and simulate all awake islands.
-	int32 stackSize = m_bodyCount;
-	b2Body** stack = (b2Body**)m_stackAllocator.Allocate(stackSize * sizeof(b2Body*));
-	for (b2Body* seed = m_bodyList; seed; seed = seed->m_next)
+	int32 detachedCount = 0;
+	int32 groupCount = 0;
+	int32 attachedCount = 0;
+	for (int32 i = 0; i < count; ++i)
 	{
-		if (seed->m_flags & b2Body::e_islandFlag)
+		if (attached[i] == false)
 		{
-			continue;
+			detached[detachedCount++] = systems[i];
 		}
-
-		if (seed->IsAwake() == false || seed->IsActive() == false)
+		else if (FindGroup(parents, i) == i)
 		{
-			continue;
+			++groupCount;
 		}
+	}
 
-		// The seed can be dynamic or kinematic.
-		if (seed->GetType() == b2_staticBody)
+	// Lay out the attached systems group by group, in list order.
+	b2ParticleSystem** ordered = systems;
+	if (groupCount > 0)
+	{
+		int32* groupOf = (int32*)m_stackAllocator.Allocate(count * sizeof(int32));
+		int32 group = 0;
+		for (int32 i = 0; i < count; ++i)
 		{
-			continue;
+			if (attached[i] && FindGroup(parents, i) == i)
+			{
+				groupOf[i] = group;
+				groupStarts[group++] = 0;
+			}
 		}
-
-		// Reset island and stack.
-		island.Clear();
-		int32 stackCount = 0;
-		stack[stackCount++] = seed;
-		seed->m_flags |= b2Body::e_islandFlag;
-
-		// Perform a depth first search (DFS) on the constraint graph.
-		while (stackCount > 0)
+		for (int32 i = 0; i < count; ++i)
 		{
-			// Grab the next body off the stack and add it to the island.
-			b2Body* b = stack[--stackCount];
-			b2Assert(b->IsActive() == true);
-			island.Add(b);
-
-			// Make sure the body is awake.
-			b->SetAwake(true);
-
-			// To keep islands as small as possible, we don't
-			// propagate islands across static bodies.
-			if (b->GetType() == b2_staticBody)
+			if (attached[i])
 			{
-				continue;
+				groupOf[i] = groupOf[FindGroup(parents, i)];
+				++groupStarts[groupOf[i]];
+				++attachedCount;
 			}
+		}
+		int32 start = 0;
+		for (int32 k = 0; k < groupCount; ++k)
+		{
+			int32 size = groupStarts[k];
+			groupStarts[k] = start;
+			start += size;
+		}
+		groupStarts[groupCount] = start;
 
-			// Search all contacts connected to this body.
-			for (b2ContactEdge* ce = b->m_contactList; ce; ce = ce->next)
+		// systems is reused for the ordered list; parents is no longer
+		// needed, so it tracks the fill position of each group.
+		b2ParticleSystem** source = (b2ParticleSystem**)m_stackAllocator.Allocate(count * sizeof(b2ParticleSystem*));
+		memcpy(source, systems, count * sizeof(b2ParticleSystem*));
+		for (int32 k = 0; k < groupCount; ++k)
+		{
+			parents[k] = groupStarts[k];
+		}
+		for (int32 i = 0; i < count; ++i)
+		{
+			if (attached[i])
 			{
-				b2Contact* contact = ce->contact;
-
-				// Has this contact already been added to an island?
-				if (contact->m_flags & b2Contact::e_islandFlag)
-				{
-					continue;
-				}
+				ordered[parents[groupOf[i]]++] = source[i];
+			}
+		}
+		m_stackAllocator.Free(source);
+		m_stackAllocator.Free(groupOf);
+	}
 
-				// Is this contact solid and touching?
-				if (contact->IsEnabled() == false ||
-					contact->IsTouching() == false)
-				{
-					continue;
-				}
+	if (groupCount == 1)
+	{
+		for (int32 i = 0; i < attachedCount; ++i)
+		{
+			ordered[i]->Solve(step);
+		}
+	}
+	else if (groupCount > 1)
+	{
+		b2ParticleSolveTask task(step);
+		task.m_systems = ordered;
+		task.m_groupStarts = groupStarts;
+		task.m_allocators = m_taskAllocators;
+		task.m_allocatorCount = m_taskAllocatorCount;
+		m_taskExecutor->Run(&task, groupCount);
+	}
 
-				// Skip sensors.
-				bool sensorA = contact->m_fixtureA->m_isSensor;
-				bool sensorB = contact->m_fixtureB->m_isSensor;
-				if (sensorA || sensorB)
-				{
-					continue;
-				}
+	m_stackAllocator.Free(attached);
+	m_stackAllocator.Free(groupStarts);
+	m_stackAllocator.Free(parents);
+	m_stackAllocator.Free(systems);
+	return detachedCount;
+}
 
-				island.Add(contact);
-				contact->m_flags |= b2Contact::e_islandFlag;
+// Find islands, integrate and solve constraints, solve position constraints
+void b2World::Solve(const b2TimeStep& step, b2ParticleSystem** particleSystems,
+					int32 particleSystemCount)
+{
+	// update previous transforms
+	for (b2Body* b = m_bodyList; b; b = b->m_next)
+	{
+		b->m_xf0 = b->m_xf;
+	}
 
-				b2Body* other = ce->other;
+	m_profile.solveInit = 0.0f;
+	m_profile.solveVelocity = 0.0f;
+	m_profile.solvePosition = 0.0f;
 
-				// Was the other body already added to this island?
-				if (other->m_flags & b2Body::e_islandFlag)
-				{
-					continue;
-				}
+	// Build and simulate all awake islands.
+	if (m_taskExecutor)
+	{
+		SolveIslandsConcurrently(step, particleSystems, particleSystemCount);
+	}
+	else
+	{
+		b2Assert(particleSystemCount == 0);
+		SolveIslands(step);
+	}
 
-				b2Assert(stackCount < stackSize);
-				stack[stackCount++] = other;
-				other->m_flags |= b2Body::e_islandFlag;
-			}
+	{
+		b2Timer timer;
+		// Synchronize the fixtures of the bodies that moved. Islands that
+		// lost a contact or joint are split once they could go to sleep.
+		b2PersistentIsland* source = m_islandList;
+		while (source)
+		{
+			b2PersistentIsland* next = source->next;
 
-			// Search all joints connect to this body.
-			for (b2JointEdge* je = b->m_jointList; je; je = je->next)
+			// Islands are solved whole, so if the first body was not
+			// solved then none of them moved.
+			if (source->bodyList->m_flags & b2Body::e_islandFlag)
 			{
-				if (je->joint->m_islandFlag == true)
+				float32 maxSleepTime = 0.0f;
+				for (b2Body* b = source->bodyList; b; b = b->m_islandNext)
 				{
-					continue;
-				}
-
-				b2Body* other = je->other;
+					b->m_flags &= ~b2Body::e_islandFlag;
+					maxSleepTime = b2Max(maxSleepTime, b->m_sleepTime);
 
-				// Don't simulate joints connected to inactive bodies.
-				if (other->IsActive() == false)
-				{
-					continue;
+					// Update fixtures (for broad-phase). Speculative
+					// contacts need pairs for the coming step.
+					if (step.speculativeContacts)
+					{
+						b->SynchronizeFixtures(step.dt);
+					}
+					else
+					{
+						b->SynchronizeFixtures();
+					}
 				}
 
-				island.Add(je->joint);
-				je->joint->m_islandFlag = true;
-
-				if (other->m_flags & b2Body::e_islandFlag)
+				if (source->removedCount > 0 &&
+					(m_allowSleep == false || maxSleepTime >= b2_timeToSleep))
 				{
-					continue;
+					SplitIsland(source);
 				}
-
-				b2Assert(stackCount < stackSize);
-				stack[stackCount++] = other;
-				other->m_flags |= b2Body::e_islandFlag;
 			}
-		}
 
-		b2Profile profile;
-		island.Solve(&profile, step, m_gravity, m_allowSleep);
-		m_profile.solveInit += profile.solveInit;
-		m_profile.solveVelocity += profile.solveVelocity;
-		m_profile.solvePosition += profile.solvePosition;
+			source = next;
+		}
 
-		// Post solve cleanup.
-		for (int32 i = 0; i < island.m_bodyCount; ++i)
+		// Look for new contacts.
+		m_contactManager.FindNewContacts();
+		m_profile.broadphase = timer.GetMilliseconds();
+	}
+}
+
+// Build each awake island and solve it before building the next one.
+void b2World::SolveIslands(const b2TimeStep& step)
+{
+	// Size the island for the worst case.
+	b2Island island(m_bodyCount,
+					m_contactManager.m_contactCount,
+					m_jointCount,
+					&m_stackAllocator,
+					m_contactManager.m_contactListener);
+
+	// Bodies without contacts or joints don't need the constraint solver,
+	// so they are integrated together once every island has been built.
+	b2Island unconnected(m_bodyCount, 0, 0, &m_stackAllocator, NULL);
+
+	for (b2PersistentIsland* source = m_islandList; source;
+		 source = source->next)
+	{
+		island.Clear();
+		if (BuildIsland(source, &island) == false)
+		{
+			continue;
+		}
+
+		if (island.m_bodyCount == 1 && island.m_contactCount == 0 &&
+			island.m_jointCount == 0)
+		{
+			unconnected.Add(island.m_bodies[0]);
+			continue;
+		}
+
+		b2Profile profile;
+		island.Solve(&profile, step, m_gravity, m_allowSleep);
+		m_profile.solveInit += profile.solveInit;
+		m_profile.solveVelocity += profile.solveVelocity;
+		m_profile.solvePosition += profile.solvePosition;
+
+		// Post solve cleanup.
+		for (int32 i = 0; i < island.m_bodyCount; ++i)
 		{
 			// Allow static bodies to participate in other islands.
 			b2Body* b = island.m_bodies[i];
@@ -621,244 +1088,787 @@ void b2World::Solve(const b2TimeStep& step)
 				b->m_flags &= ~b2Body::e_islandFlag;
 			}
 		}
+		for (int32 i = 0; i < island.m_contactCount; ++i)
+		{
+			island.m_contacts[i]->m_flags &= ~b2Contact::e_islandFlag;
+		}
+		for (int32 i = 0; i < island.m_jointCount; ++i)
+		{
+			island.m_joints[i]->m_islandFlag = false;
+		}
 	}
 
-	m_stackAllocator.Free(stack);
-
+	if (unconnected.m_bodyCount > 0)
 	{
 		b2Timer timer;
-		// Synchronize fixtures, check for out of range bodies.
-		for (b2Body* b = m_bodyList; b; b = b->GetNext())
+		unconnected.SolveUnconnected(step, m_gravity, m_allowSleep);
+		m_profile.solveVelocity += timer.GetMilliseconds();
+	}
+}
+
+// Build every awake island first, then solve the islands on the task
+// executor, each thread with its own scratch allocator. The given particle
+// systems, which don't touch any non-static body, are solved at the same
+// time.
+void b2World::SolveIslandsConcurrently(const b2TimeStep& step,
+									   b2ParticleSystem** particleSystems,
+									   int32 particleSystemCount)
+{
+	// Gather the islands into one set of lists. Static bodies are added
+	// through a contact or a joint, once for each island they touch.
+	int32 contactCapacity = m_contactManager.m_contactCount;
+	int32 bodyCapacity = m_bodyCount + contactCapacity + m_jointCount;
+	b2Body** bodies = (b2Body**)m_stackAllocator.Allocate(bodyCapacity * sizeof(b2Body*));
+	b2Contact** contacts = (b2Contact**)m_stackAllocator.Allocate(contactCapacity * sizeof(b2Contact*));
+	b2Joint** joints = (b2Joint**)m_stackAllocator.Allocate(m_jointCount * sizeof(b2Joint*));
+	b2IslandRange* ranges = (b2IslandRange*)m_stackAllocator.Allocate(m_islandCount * sizeof(b2IslandRange));
+	b2Island island(bodies, bodyCapacity, contacts, contactCapacity,
+					joints, m_jointCount, 0, &m_stackAllocator, NULL);
+	island.Clear();
+
+	int32 islandCount = 0;
+	for (b2PersistentIsland* source = m_islandList; source;
+		 source = source->next)
+	{
+		b2IslandRange* range = &ranges[islandCount];
+		range->bodyStart = island.m_bodyCount;
+		range->contactStart = island.m_contactCount;
+		range->jointStart = island.m_jointCount;
+		if (BuildIsland(source, &island) == false)
 		{
-			// If a body was not in an island then it did not move.
-			if ((b->m_flags & b2Body::e_islandFlag) == 0)
-			{
-				continue;
-			}
+			continue;
+		}
+		++islandCount;
+		range->bodyCount = island.m_bodyCount - range->bodyStart;
+		range->contactCount = island.m_contactCount - range->contactStart;
+		range->jointCount = island.m_jointCount - range->jointStart;
 
+		// Allow static bodies to participate in other islands.
+		for (int32 i = range->bodyStart; i < island.m_bodyCount; ++i)
+		{
+			b2Body* b = bodies[i];
 			if (b->GetType() == b2_staticBody)
 			{
-				continue;
+				b->m_flags &= ~b2Body::e_islandFlag;
 			}
+		}
+	}
+	for (int32 i = 0; i < island.m_contactCount; ++i)
+	{
+		contacts[i]->m_flags &= ~b2Contact::e_islandFlag;
+	}
+	for (int32 i = 0; i < island.m_jointCount; ++i)
+	{
+		joints[i]->m_islandFlag = false;
+	}
 
-			// Update fixtures (for broad-phase).
-			b->SynchronizeFixtures();
+	// A static body may be in several islands solved at the same time, so
+	// it has no island index. Each island finds the slots of the static
+	// bodies it touches through b2Island::m_staticSlots instead.
+	for (int32 k = 0; k < islandCount; ++k)
+	{
+		const b2IslandRange& range = ranges[k];
+		for (int32 i = 0; i < range.bodyCount; ++i)
+		{
+			b2Body* b = bodies[range.bodyStart + i];
+			b->m_islandIndex = b->GetType() == b2_staticBody ? -1 : i;
 		}
+	}
 
-		// Look for new contacts.
-		m_contactManager.FindNewContacts();
-		m_profile.broadphase = timer.GetMilliseconds();
+	// Impulses are reported once every island is solved, in the order the
+	// islands were built, so listeners see the same sequence of PostSolve
+	// calls regardless of how the executor schedules the islands.
+	b2ContactListener* listener = m_contactManager.m_contactListener;
+	b2ContactImpulse* impulses = NULL;
+	if (listener)
+	{
+		impulses = (b2ContactImpulse*)m_stackAllocator.Allocate(
+			island.m_contactCount * sizeof(b2ContactImpulse));
 	}
-}
+	b2Profile* profiles = (b2Profile*)m_stackAllocator.Allocate(
+		islandCount * sizeof(b2Profile));
 
-// Find TOI contacts and solve them.
-void b2World::SolveTOI(const b2TimeStep& step)
-{
-	b2Island island(2 * b2_maxTOIContacts, b2_maxTOIContacts, 0, &m_stackAllocator, m_contactManager.m_contactListener);
+	IslandSolveTask task(step, m_gravity, m_allowSleep);
+	task.m_ranges = ranges;
+	task.m_bodies = bodies;
+	task.m_contacts = contacts;
+	task.m_joints = joints;
+	task.m_impulses = impulses;
+	task.m_profiles = profiles;
+	task.m_allocators = m_taskAllocators;
+	task.m_allocatorCount = m_taskAllocatorCount;
 
-	if (m_stepComplete)
+	// Each detached particle system is a group of its own.
+	int32* groupStarts = (int32*)m_stackAllocator.Allocate(
+		(particleSystemCount + 1) * sizeof(int32));
+	for (int32 i = 0; i <= particleSystemCount; ++i)
 	{
-		for (b2Body* b = m_bodyList; b; b = b->m_next)
+		groupStarts[i] = i;
+	}
+	b2ParticleSolveTask particleTask(step);
+	particleTask.m_systems = particleSystems;
+	particleTask.m_groupStarts = groupStarts;
+	particleTask.m_allocators = m_taskAllocators;
+	particleTask.m_allocatorCount = m_taskAllocatorCount;
+	task.m_particleTask = &particleTask;
+	task.m_particleGroupCount = particleSystemCount;
+
+	m_taskExecutor->Run(&task, particleSystemCount + islandCount);
+	m_stackAllocator.Free(groupStarts);
+
+	for (int32 k = 0; k < islandCount; ++k)
+	{
+		const b2Profile& profile = profiles[k];
+		m_profile.solveInit += profile.solveInit;
+		m_profile.solveVelocity += profile.solveVelocity;
+		m_profile.solvePosition += profile.solvePosition;
+
+		if (listener)
 		{
-			b->m_flags &= ~b2Body::e_islandFlag;
-			b->m_sweep.alpha0 = 0.0f;
+			const b2IslandRange& range = ranges[k];
+			for (int32 i = 0; i < range.contactCount; ++i)
+			{
+				int32 index = range.contactStart + i;
+				listener->PostSolve(contacts[index], &impulses[index]);
+			}
 		}
+	}
+
+	m_stackAllocator.Free(profiles);
+	if (impulses)
+	{
+		m_stackAllocator.Free(impulses);
+	}
+	m_stackAllocator.Free(ranges);
+	m_stackAllocator.Free(joints);
+	m_stackAllocator.Free(contacts);
+	m_stackAllocator.Free(bodies);
+}
 
-		for (b2Contact* c = m_contactManager.m_contactList; c; c = c->m_next)
+// Add the bodies of source, the static bodies they touch and the contacts
+// and joints between them to island. Returns false, without adding
+// anything, when every body of source is asleep.
+bool b2World::BuildIsland(b2PersistentIsland* source, b2Island* island)
+{
+	bool awake = false;
+	for (b2Body* b = source->bodyList; b; b = b->m_islandNext)
+	{
+		if (b->IsAwake())
 		{
-			// Invalidate TOI
-			c->m_flags &= ~(b2Contact::e_toiFlag | b2Contact::e_islandFlag);
-			c->m_toiCount = 0;
-			c->m_toi = 1.0f;
+			awake = true;
+			break;
 		}
 	}
 
-	// Find TOI events and solve them.
-	for (;;)
+	if (awake == false)
 	{
-		// Find the first TOI.
-		b2Contact* minContact = NULL;
-		float32 minAlpha = 1.0f;
+		return false;
+	}
+
+	for (b2Body* b = source->bodyList; b; b = b->m_islandNext)
+	{
+		b2Assert(b->IsActive() == true);
+		b2Assert((b->m_flags & b2Body::e_islandFlag) == 0);
+		island->Add(b);
+		b->m_flags |= b2Body::e_islandFlag;
+
+		// Make sure the body is awake.
+		b->SetAwake(true);
+	}
 
-		for (b2Contact* c = m_contactManager.m_contactList; c; c = c->m_next)
+	for (b2Body* b = source->bodyList; b; b = b->m_islandNext)
+	{
+		// Search all contacts connected to this body.
+		for (b2ContactEdge* ce = b->m_contactList; ce; ce = ce->next)
 		{
-			// Is this contact disabled?
-			if (c->IsEnabled() == false)
+			b2Contact* contact = ce->contact;
+
+			// Has this contact already been added to the island?
+			if (contact->m_flags & b2Contact::e_islandFlag)
 			{
 				continue;
 			}
 
-			// Prevent excessive sub-stepping.
-			if (c->m_toiCount > b2_maxSubSteps)
+			// Is this contact enabled and touching? Only contacts that were
+			// touching when last updated link bodies into the island.
+			if (contact->IsEnabled() == false ||
+				(contact->m_flags & b2Contact::e_islandLinkFlag) == 0)
 			{
 				continue;
 			}
 
-			float32 alpha = 1.0f;
-			if (c->m_flags & b2Contact::e_toiFlag)
+			// Skip sensors.
+			bool sensorA = contact->m_fixtureA->m_isSensor;
+			bool sensorB = contact->m_fixtureB->m_isSensor;
+			if (sensorA || sensorB)
 			{
-				// This contact has a valid cached TOI.
-				alpha = c->m_toi;
+				continue;
 			}
-			else
+
+			island->Add(contact);
+			contact->m_flags |= b2Contact::e_islandFlag;
+
+			// Any body the island doesn't hold yet is a static body.
+			b2Body* other = ce->other;
+			if (other->m_flags & b2Body::e_islandFlag)
 			{
-				b2Fixture* fA = c->GetFixtureA();
-				b2Fixture* fB = c->GetFixtureB();
+				continue;
+			}
 
-				// Is there a sensor?
-				if (fA->IsSensor() || fB->IsSensor())
-				{
-					continue;
-				}
+			b2Assert(other->GetType() == b2_staticBody);
+			island->Add(other);
+			other->m_flags |= b2Body::e_islandFlag;
+			other->SetAwake(true);
+		}
 
-				b2Body* bA = fA->GetBody();
-				b2Body* bB = fB->GetBody();
+		// Search all joints connect to this body.
+		for (b2JointEdge* je = b->m_jointList; je; je = je->next)
+		{
+			if (je->joint->m_islandFlag == true)
+			{
+				continue;
+			}
 
-				b2BodyType typeA = bA->m_type;
-				b2BodyType typeB = bB->m_type;
-				b2Assert(typeA == b2_dynamicBody || typeB == b2_dynamicBody);
+			b2Body* other = je->other;
 
-				bool activeA = bA->IsAwake() && typeA != b2_staticBody;
-				bool activeB = bB->IsAwake() && typeB != b2_staticBody;
+			// Don't simulate joints connected to inactive bodies.
+			if (other->IsActive() == false)
+			{
+				continue;
+			}
 
-				// Is at least one body active (awake and dynamic or kinematic)?
-				if (activeA == false && activeB == false)
-				{
-					continue;
-				}
+			island->Add(je->joint);
+			je->joint->m_islandFlag = true;
 
-				bool collideA = bA->IsBullet() || typeA != b2_dynamicBody;
-				bool collideB = bB->IsBullet() || typeB != b2_dynamicBody;
+			if (other->m_flags & b2Body::e_islandFlag)
+			{
+				continue;
+			}
 
-				// Are these two non-bullet dynamic bodies?
-				if (collideA == false && collideB == false)
-				{
-					continue;
-				}
+			b2Assert(other->GetType() == b2_staticBody);
+			island->Add(other);
+			other->m_flags |= b2Body::e_islandFlag;
+			other->SetAwake(true);
+		}
+	}
 
-				// Compute the TOI for this contact.
-				// Put the sweeps onto the same time interval.
-				float32 alpha0 = bA->m_sweep.alpha0;
+	return true;
+}
 
-				if (bA->m_sweep.alpha0 < bB->m_sweep.alpha0)
-				{
-					alpha0 = bB->m_sweep.alpha0;
-					bA->m_sweep.Advance(alpha0);
-				}
-				else if (bB->m_sweep.alpha0 < bA->m_sweep.alpha0)
-				{
-					alpha0 = bA->m_sweep.alpha0;
-					bB->m_sweep.Advance(alpha0);
-				}
+b2PersistentIsland* b2World::CreateIsland()
+{
+	void* mem = m_blockAllocator.Allocate(sizeof(b2PersistentIsland));
+	b2PersistentIsland* island = (b2PersistentIsland*)mem;
+	island->bodyList = NULL;
+	island->bodyCount = 0;
+	island->removedCount = 0;
 
-				b2Assert(alpha0 < 1.0f);
+	// Add to world doubly linked list.
+	island->prev = NULL;
+	island->next = m_islandList;
+	if (m_islandList)
+	{
+		m_islandList->prev = island;
+	}
+	m_islandList = island;
+	++m_islandCount;
 
-				int32 indexA = c->GetChildIndexA();
-				int32 indexB = c->GetChildIndexB();
+	return island;
+}
 
-				// Compute the time of impact in interval [0, minTOI]
-				b2TOIInput input;
-				input.proxyA.Set(fA->GetShape(), indexA);
-				input.proxyB.Set(fB->GetShape(), indexB);
-				input.sweepA = bA->m_sweep;
-				input.sweepB = bB->m_sweep;
-				input.tMax = 1.0f;
+void b2World::DestroyIsland(b2PersistentIsland* island)
+{
+	if (island->prev)
+	{
+		island->prev->next = island->next;
+	}
 
-				b2TOIOutput output;
-				b2TimeOfImpact(&output, &input);
+	if (island->next)
+	{
+		island->next->prev = island->prev;
+	}
 
-				// Beta is the fraction of the remaining portion of the .
-				float32 beta = output.t;
-				if (output.state == b2TOIOutput::e_touching)
-				{
-					alpha = b2Min(alpha0 + (1.0f - alpha0) * beta, 1.0f);
-				}
-				else
-				{
-					alpha = 1.0f;
-				}
+	if (island == m_islandList)
+	{
+		m_islandList = island->next;
+	}
 
-				c->m_toi = alpha;
-				c->m_flags |= b2Contact::e_toiFlag;
-			}
+	--m_islandCount;
+	m_blockAllocator.Free(island, sizeof(b2PersistentIsland));
+}
 
-			if (alpha < minAlpha)
-			{
-				// This is the minimum TOI found so far.
-				minContact = c;
-				minAlpha = alpha;
-			}
-		}
+void b2World::AddToIsland(b2PersistentIsland* island, b2Body* body)
+{
+	body->m_island = island;
+	body->m_islandPrev = NULL;
+	body->m_islandNext = island->bodyList;
+	if (island->bodyList)
+	{
+		island->bodyList->m_islandPrev = body;
+	}
+	island->bodyList = body;
+	++island->bodyCount;
+}
 
-		if (minContact == NULL || 1.0f - 10.0f * b2_epsilon < minAlpha)
-		{
-			// No more TOI events. Done!
-			m_stepComplete = true;
-			break;
-		}
+void b2World::RemoveFromIsland(b2Body* body)
+{
+	b2PersistentIsland* island = body->m_island;
+	b2Assert(island != NULL);
 
-		// Advance the bodies to the TOI.
-		b2Fixture* fA = minContact->GetFixtureA();
-		b2Fixture* fB = minContact->GetFixtureB();
-		b2Body* bA = fA->GetBody();
-		b2Body* bB = fB->GetBody();
+	if (body->m_islandPrev)
+	{
+		body->m_islandPrev->m_islandNext = body->m_islandNext;
+	}
 
-		b2Sweep backup1 = bA->m_sweep;
-		b2Sweep backup2 = bB->m_sweep;
+	if (body->m_islandNext)
+	{
+		body->m_islandNext->m_islandPrev = body->m_islandPrev;
+	}
 
-		bA->Advance(minAlpha);
-		bB->Advance(minAlpha);
+	if (body == island->bodyList)
+	{
+		island->bodyList = body->m_islandNext;
+	}
 
-		// The TOI contact likely has some new contact points.
-		minContact->Update(m_contactManager.m_contactListener);
-		minContact->m_flags &= ~b2Contact::e_toiFlag;
-		++minContact->m_toiCount;
+	body->m_island = NULL;
+	body->m_islandPrev = NULL;
+	body->m_islandNext = NULL;
 
-		// Is the contact solid?
-		if (minContact->IsEnabled() == false || minContact->IsTouching() == false)
-		{
-			// Restore the sweeps.
-			minContact->SetEnabled(false);
-			bA->m_sweep = backup1;
-			bB->m_sweep = backup2;
-			bA->SynchronizeTransform();
-			bB->SynchronizeTransform();
-			continue;
-		}
+	--island->bodyCount;
+	if (island->bodyCount == 0)
+	{
+		DestroyIsland(island);
+	}
+	else
+	{
+		// The body may have been all that held the island together.
+		++island->removedCount;
+	}
+}
 
-		bA->SetAwake(true);
-		bB->SetAwake(true);
+// Give body an island of its own, joined to the islands of the bodies it
+// has joints with, if it's simulated and doesn't have one yet. Remove it
+// from its island otherwise.
+void b2World::UpdateIsland(b2Body* body)
+{
+	bool simulated = body->GetType() != b2_staticBody && body->IsActive();
+	if (simulated == (body->m_island != NULL))
+	{
+		return;
+	}
 
-		// Build the island
-		island.Clear();
-		island.Add(bA);
-		island.Add(bB);
-		island.Add(minContact);
+	if (simulated == false)
+	{
+		RemoveFromIsland(body);
+		return;
+	}
 
-		bA->m_flags |= b2Body::e_islandFlag;
-		bB->m_flags |= b2Body::e_islandFlag;
-		minContact->m_flags |= b2Contact::e_islandFlag;
+	AddToIsland(CreateIsland(), body);
+	for (b2JointEdge* je = body->m_jointList; je; je = je->next)
+	{
+		LinkIslands(body, je->other);
+	}
+}
 
-		// Get contacts on bodyA and bodyB.
-		b2Body* bodies[2] = {bA, bB};
-		for (int32 i = 0; i < 2; ++i)
-		{
-			b2Body* body = bodies[i];
-			if (body->m_type == b2_dynamicBody)
-			{
-				for (b2ContactEdge* ce = body->m_contactList; ce; ce = ce->next)
-				{
-					if (island.m_bodyCount == island.m_bodyCapacity)
-					{
-						break;
-					}
+// Merge the islands of two bodies that were just connected. Static and
+// inactive bodies don't have islands, so they don't join anything.
+void b2World::LinkIslands(b2Body* bodyA, b2Body* bodyB)
+{
+	b2PersistentIsland* islandA = bodyA->m_island;
+	b2PersistentIsland* islandB = bodyB->m_island;
+	if (islandA == NULL || islandB == NULL || islandA == islandB)
+	{
+		return;
+	}
 
-					if (island.m_contactCount == island.m_contactCapacity)
-					{
-						break;
-					}
+	// Move the bodies of the smaller island.
+	if (islandA->bodyCount < islandB->bodyCount)
+	{
+		b2Swap(islandA, islandB);
+	}
 
-					b2Contact* contact = ce->contact;
+	b2Body* b = islandB->bodyList;
+	while (b)
+	{
+		b2Body* next = b->m_islandNext;
+		AddToIsland(islandA, b);
+		b = next;
+	}
+
+	islandA->removedCount += islandB->removedCount;
+	DestroyIsland(islandB);
+}
+
+// Note that two bodies were disconnected. Their island is split later.
+void b2World::UnlinkIslands(b2Body* bodyA, b2Body* bodyB)
+{
+	b2PersistentIsland* island = bodyA->m_island;
+	if (island == NULL || bodyB->m_island == NULL)
+	{
+		return;
+	}
+
+	b2Assert(island == bodyB->m_island);
+	++island->removedCount;
+}
+
+// Replace island with one island for each group of its bodies that are
+// still connected by touching contacts and joints.
+void b2World::SplitIsland(b2PersistentIsland* island)
+{
+	int32 bodyCount = island->bodyCount;
+	b2Body** bodies = (b2Body**)m_stackAllocator.Allocate(bodyCount * sizeof(b2Body*));
+	int32 i = 0;
+	for (b2Body* b = island->bodyList; b; b = b->m_islandNext)
+	{
+		bodies[i++] = b;
+		b->m_island = NULL;
+	}
+	DestroyIsland(island);
+
+	// Perform a depth first search (DFS) from each body that hasn't been
+	// reached yet. Bodies are added to an island as they are pushed.
+	b2Body** stack = (b2Body**)m_stackAllocator.Allocate(bodyCount * sizeof(b2Body*));
+	for (i = 0; i < bodyCount; ++i)
+	{
+		b2Body* seed = bodies[i];
+		if (seed->m_island)
+		{
+			continue;
+		}
+
+		b2PersistentIsland* part = CreateIsland();
+		int32 stackCount = 0;
+		stack[stackCount++] = seed;
+		AddToIsland(part, seed);
+
+		while (stackCount > 0)
+		{
+			b2Body* b = stack[--stackCount];
+
+			for (b2ContactEdge* ce = b->m_contactList; ce; ce = ce->next)
+			{
+				if ((ce->contact->m_flags & b2Contact::e_islandLinkFlag) == 0)
+				{
+					continue;
+				}
+
+				// Every other simulated body already has an island, so the
+				// bodies without one are from this island or static.
+				b2Body* other = ce->other;
+				if (other->m_island || other->GetType() == b2_staticBody)
+				{
+					continue;
+				}
+
+				b2Assert(stackCount < bodyCount);
+				stack[stackCount++] = other;
+				AddToIsland(part, other);
+			}
+
+			for (b2JointEdge* je = b->m_jointList; je; je = je->next)
+			{
+				b2Body* other = je->other;
+				if (other->m_island || other->GetType() == b2_staticBody ||
+					other->IsActive() == false)
+				{
+					continue;
+				}
+
+				b2Assert(stackCount < bodyCount);
+				stack[stackCount++] = other;
+				AddToIsland(part, other);
+			}
+		}
+	}
+
+	m_stackAllocator.Free(stack);
+	m_stackAllocator.Free(bodies);
+}
+
+// Get the time of impact of c within the step, computing it unless it's
+// cached. Returns 1 when c can't have a TOI event.
+float32 b2World::ComputeTOI(b2Contact* c)
+{
+	// Is this contact disabled?
+	if (c->IsEnabled() == false)
+	{
+		return 1.0f;
+	}
+
+	// Prevent excessive sub-stepping.
+	if (c->m_toiCount > b2_maxSubSteps)
+	{
+		return 1.0f;
+	}
+
+	if (c->m_flags & b2Contact::e_toiFlag)
+	{
+		// This contact has a valid cached TOI.
+		return c->m_toi;
+	}
+
+	b2Fixture* fA = c->GetFixtureA();
+	b2Fixture* fB = c->GetFixtureB();
+
+	// Is there a sensor?
+	if (fA->IsSensor() || fB->IsSensor())
+	{
+		return 1.0f;
+	}
+
+	b2Body* bA = fA->GetBody();
+	b2Body* bB = fB->GetBody();
+
+	b2BodyType typeA = bA->m_type;
+	b2BodyType typeB = bB->m_type;
+	b2Assert(typeA == b2_dynamicBody || typeB == b2_dynamicBody);
+
+	bool activeA = bA->IsAwake() && typeA != b2_staticBody;
+	bool activeB = bB->IsAwake() && typeB != b2_staticBody;
+
+	// Is at least one body active (awake and dynamic or kinematic)?
+	if (activeA == false && activeB == false)
+	{
+		return 1.0f;
+	}
+
+	bool collideA = bA->IsBullet() || typeA != b2_dynamicBody;
+	bool collideB = bB->IsBullet() || typeB != b2_dynamicBody;
+
+	// Are these two non-bullet dynamic bodies?
+	if (collideA == false && collideB == false)
+	{
+		return 1.0f;
+	}
+
+	// Compute the TOI for this contact.
+	// Put the sweeps onto the same time interval.
+	float32 alpha0 = bA->m_sweep.alpha0;
+
+	if (bA->m_sweep.alpha0 < bB->m_sweep.alpha0)
+	{
+		alpha0 = bB->m_sweep.alpha0;
+		bA->m_sweep.Advance(alpha0);
+	}
+	else if (bB->m_sweep.alpha0 < bA->m_sweep.alpha0)
+	{
+		alpha0 = bA->m_sweep.alpha0;
+		bB->m_sweep.Advance(alpha0);
+	}
+
+	b2Assert(alpha0 < 1.0f);
+
+	int32 indexA = c->GetChildIndexA();
+	int32 indexB = c->GetChildIndexB();
+
+	// Compute the time of impact in interval [0, minTOI]
+	b2TOIInput input;
+	input.proxyA.Set(fA->GetShape(), indexA);
+	input.proxyB.Set(fB->GetShape(), indexB);
+	input.sweepA = bA->m_sweep;
+	input.sweepB = bB->m_sweep;
+	input.tMax = 1.0f;
+
+	b2TOIOutput output;
+	if (fA->GetType() == b2Shape::e_chain &&
+		((b2ChainShape*)fA->GetShape())->IsSingleProxy())
+	{
+		ChainTimeOfImpact(&output, &input, (b2ChainShape*)fA->GetShape(),
+						  fB->GetShape(), indexB);
+	}
+	else
+	{
+		b2TimeOfImpact(&output, &input);
+	}
+
+	// Beta is the fraction of the remaining portion of the .
+	float32 beta = output.t;
+	float32 alpha;
+	if (output.state == b2TOIOutput::e_touching)
+	{
+		alpha = b2Min(alpha0 + (1.0f - alpha0) * beta, 1.0f);
+	}
+	else
+	{
+		alpha = 1.0f;
+	}
+
+	c->m_toi = alpha;
+	c->m_flags |= b2Contact::e_toiFlag;
+	return alpha;
+}
+
+// Recompute the TOIs of the pending contacts, and of the contacts of bodies
+// that were woken up, in buffer order.
+void b2World::RequeueTOIs(b2GrowableBuffer<b2TOIEvent>* events,
+						  b2GrowableBuffer<int32>* pending,
+						  const b2GrowableBuffer<b2Body*>& woken)
+{
+	for (int32 i = 0; i < woken.GetCount(); ++i)
+	{
+		b2Body* body = woken[i];
+		if (body->IsAwake() == false)
+		{
+			continue;
+		}
+
+		// Contacts that were skipped because both bodies were asleep.
+		for (b2ContactEdge* ce = body->m_contactList; ce; ce = ce->next)
+		{
+			if ((ce->contact->m_flags & b2Contact::e_toiFlag) == 0)
+			{
+				pending->Append() = ce->contact->m_bufferIndex;
+			}
+		}
+	}
+
+	std::sort(pending->Begin(), pending->End());
+	pending->Unique(std::equal_to<int32>());
+	for (int32 i = 0; i < pending->GetCount(); ++i)
+	{
+		int32 index = (*pending)[i];
+		b2Contact* c = m_contactManager.m_contactBuffer[index];
+		PushTOIEvent(events, ComputeTOI(c), index);
+	}
+}
+
+// Find TOI contacts and solve them.
+void b2World::SolveTOI(const b2TimeStep& step)
+{
+	b2Island island(2 * b2_maxTOIContacts, b2_maxTOIContacts, 0, &m_stackAllocator, m_contactManager.m_contactListener);
+
+	if (m_stepComplete)
+	{
+		for (b2Body* b = m_bodyList; b; b = b->m_next)
+		{
+			b->m_flags &= ~b2Body::e_islandFlag;
+			b->m_sweep.alpha0 = 0.0f;
+		}
+
+		for (int32 i = 0; i < m_contactManager.m_contactCount; ++i)
+		{
+			b2Contact* c = m_contactManager.m_contactBuffer[i];
+
+			// Invalidate TOI
+			c->m_flags &= ~(b2Contact::e_toiFlag | b2Contact::e_islandFlag);
+			c->m_toiCount = 0;
+			c->m_toi = 1.0f;
+		}
+	}
+
+	// Gather the TOI candidates into a min-heap. Contacts are evaluated in
+	// buffer order, because computing a TOI may advance the sweeps of the
+	// bodies of a contact.
+	b2GrowableBuffer<b2TOIEvent> events(m_blockAllocator);
+	b2GrowableBuffer<int32> pending(m_blockAllocator);
+	b2GrowableBuffer<b2Body*> woken(m_blockAllocator);
+	m_wokenBodies = &woken;
+	for (int32 i = 0; i < m_contactManager.m_contactCount; ++i)
+	{
+		PushTOIEvent(&events, ComputeTOI(m_contactManager.m_contactBuffer[i]), i);
+	}
+
+	// Find TOI events and solve them.
+	for (;;)
+	{
+		// Find the first TOI. Entries are not removed from the heap when a
+		// contact's TOI is invalidated, so skip the ones that are stale.
+		b2Contact* minContact = NULL;
+		float32 minAlpha = 1.0f;
+		while (events.GetCount() > 0)
+		{
+			const b2TOIEvent& event = events[0];
+			b2Contact* c = m_contactManager.m_contactBuffer[event.index];
+			if ((c->m_flags & b2Contact::e_toiFlag) && c->m_toi == event.alpha &&
+				c->IsEnabled() && c->m_toiCount <= b2_maxSubSteps)
+			{
+				minContact = c;
+				minAlpha = event.alpha;
+				break;
+			}
+			std::pop_heap(events.Begin(), events.End(), TOIEventGreater);
+			events.SetCount(events.GetCount() - 1);
+		}
+
+		if (minContact == NULL || 1.0f - 10.0f * b2_epsilon < minAlpha)
+		{
+			// No more TOI events. Done!
+			m_stepComplete = true;
+			break;
+		}
+
+		std::pop_heap(events.Begin(), events.End(), TOIEventGreater);
+		events.SetCount(events.GetCount() - 1);
+
+		// Advance the bodies to the TOI.
+		b2Fixture* fA = minContact->GetFixtureA();
+		b2Fixture* fB = minContact->GetFixtureB();
+		b2Body* bA = fA->GetBody();
+		b2Body* bB = fB->GetBody();
+
+		// Keep track of the bodies this event wakes up, and of the
+		// contacts whose TOIs it invalidates.
+		pending.SetCount(0);
+		woken.SetCount(0);
+
+		b2Sweep backup1 = bA->m_sweep;
+		b2Sweep backup2 = bB->m_sweep;
+
+		bA->Advance(minAlpha);
+		bB->Advance(minAlpha);
+
+		// The TOI contact likely has some new contact points.
+		minContact->Update(m_contactManager.m_contactListener);
+		minContact->m_flags &= ~b2Contact::e_toiFlag;
+		++minContact->m_toiCount;
+
+		// Is the contact solid?
+		if (minContact->IsEnabled() == false || minContact->IsTouching() == false)
+		{
+			// Restore the sweeps.
+			minContact->SetEnabled(false);
+			bA->m_sweep = backup1;
+			bB->m_sweep = backup2;
+			bA->SynchronizeTransform();
+			bB->SynchronizeTransform();
+			RequeueTOIs(&events, &pending, woken);
+			continue;
+		}
+
+		bA->SetAwake(true);
+		bB->SetAwake(true);
+
+		// Build the island
+		island.Clear();
+		island.Add(bA);
+		island.Add(bB);
+		island.Add(minContact);
+
+		bA->m_flags |= b2Body::e_islandFlag;
+		bB->m_flags |= b2Body::e_islandFlag;
+		minContact->m_flags |= b2Contact::e_islandFlag;
+
+		// Get contacts on bodyA and bodyB.
+		b2Body* bodies[2] = {bA, bB};
+		for (int32 i = 0; i < 2; ++i)
+		{
+			b2Body* body = bodies[i];
+			if (body->m_type == b2_dynamicBody)
+			{
+				for (b2ContactEdge* ce = body->m_contactList; ce; ce = ce->next)
+				{
+					if (island.m_bodyCount == island.m_bodyCapacity)
+					{
+						break;
+					}
+
+					if (island.m_contactCount == island.m_contactCapacity)
+					{
+						break;
+					}
+
+					b2Contact* contact = ce->contact;
 
 					// Has this contact already been added to the island?
 					if (contact->m_flags & b2Contact::e_islandFlag)
@@ -939,6 +1949,9 @@ void b2World::SolveTOI(const b2TimeStep& step)
 		subStep.velocityIterations = step.velocityIterations;
 		subStep.particleIterations = step.particleIterations;
 		subStep.warmStarting = false;
+		subStep.wideContactSolving = false;
+		subStep.wideJointSolving = false;
+		subStep.speculativeContacts = false;
 		island.SolveTOI(subStep, bA->m_islandIndex, bB->m_islandIndex);
 
 		// Reset island flags and synchronize broad-phase proxies.
@@ -958,19 +1971,29 @@ void b2World::SolveTOI(const b2TimeStep& step)
 			for (b2ContactEdge* ce = body->m_contactList; ce; ce = ce->next)
 			{
 				ce->contact->m_flags &= ~(b2Contact::e_toiFlag | b2Contact::e_islandFlag);
+				pending.Append() = ce->contact->m_bufferIndex;
 			}
 		}
 
 		// Commit fixture proxy movements to the broad-phase so that new contacts are created.
-		// Also, some contacts can be destroyed.
+		// Contacts are only added to the end of the buffer here.
+		int32 contactCount = m_contactManager.m_contactCount;
 		m_contactManager.FindNewContacts();
+		for (int32 i = contactCount; i < m_contactManager.m_contactCount; ++i)
+		{
+			pending.Append() = i;
+		}
 
 		if (m_subStepping)
 		{
 			m_stepComplete = false;
 			break;
 		}
+
+		RequeueTOIs(&events, &pending, woken);
 	}
+
+	m_wokenBodies = NULL;
 }
 
 void b2World::Step(
@@ -981,6 +2004,8 @@ void b2World::Step(
 {
 	b2Timer stepTimer;
 
+	m_contactManager.m_broadPhase.ResetCounters();
+
 	// If new fixtures were added, we need to find the new contacts.
 	if (m_flags & e_newFixture)
 	{
@@ -1007,10 +2032,14 @@ void b2World::Step(
 	step.dtRatio = m_inv_dt0 * dt;
 
 	step.warmStarting = m_warmStarting;
+	step.wideContactSolving = m_wideContactSolving;
+	step.wideJointSolving = m_wideJointSolving;
+	step.speculativeContacts = m_speculativeContacts;
 
 	// Update contacts. This is where some contacts are destroyed.
 	{
 		b2Timer timer;
+		m_contactManager.m_speculativeTimeStep = m_speculativeContacts ? dt : 0.0f;
 		m_contactManager.Collide();
 		m_profile.collide = timer.GetMilliseconds();
 	}
@@ -1019,16 +2048,25 @@ void b2World::Step(
 	if (m_stepComplete && step.dt > 0.0f)
 	{
 		b2Timer timer;
+		int32 particleSystemCount = 0;
 		for (b2ParticleSystem* p = m_particleSystemList; p; p = p->GetNext())
 		{
-			p->Solve(step); // Particle Simulation
+			++particleSystemCount;
 		}
-		Solve(step);
+		b2ParticleSystem** detached = (b2ParticleSystem**)m_stackAllocator.Allocate(
+			particleSystemCount * sizeof(b2ParticleSystem*));
+		int32 detachedCount = SolveParticleSystems(step, detached);
+		m_profile.solveParticle = timer.GetMilliseconds();
+
+		b2Timer rigidTimer;
+		Solve(step, detached, detachedCount);
+		m_stackAllocator.Free(detached);
+		m_profile.solveRigid = rigidTimer.GetMilliseconds();
 		m_profile.solve = timer.GetMilliseconds();
 	}
 
 	// Handle TOI events.
-	if (m_continuousPhysics && step.dt > 0.0f)
+	if (m_continuousPhysics && m_speculativeContacts == false && step.dt > 0.0f)
 	{
 		b2Timer timer;
 		SolveTOI(step);
@@ -1047,6 +2085,13 @@ void b2World::Step(
 
 	m_flags &= ~e_locked;
 
+	for (b2WorldSnapshotBuffer* buffer = m_snapshotBufferList; buffer;
+		 buffer = buffer->m_next)
+	{
+		buffer->Write(this);
+		buffer->Publish();
+	}
+
 	m_profile.step = stepTimer.GetMilliseconds();
 }
 
@@ -1138,25 +2183,263 @@ void b2World::RayCast(b2RayCastCallback* callback, const b2Vec2& point1, const b
 	}
 }
 
-void b2World::DrawShape(b2Fixture* fixture, const b2Transform& xf, const b2Color& color)
+namespace {
+
+// A query of a batch, ordered by the position of its center along a Morton
+// curve so that consecutive queries visit mostly the same tree nodes.
+struct BatchQuery
 {
-	switch (fixture->GetType())
-	{
-	case b2Shape::e_circle:
-		{
-			b2CircleShape* circle = (b2CircleShape*)fixture->GetShape();
+	b2Vec2 center;
+	uint32 key;
+	int32 index;
+};
 
-			b2Vec2 center = b2Mul(xf, circle->m_p);
-			float32 radius = circle->m_radius;
-			b2Vec2 axis = b2Mul(xf.q, b2Vec2(1.0f, 0.0f));
+bool BatchQueryLessThan(const BatchQuery& a, const BatchQuery& b)
+{
+	return a.key < b.key;
+}
 
-			m_debugDraw->DrawSolidCircle(center, radius, axis, color);
-		}
-		break;
+// Put a zero bit between each of the low 16 bits of x.
+uint32 SpreadBits(uint32 x)
+{
+	x &= 0x0000ffff;
+	x = (x | (x << 8)) & 0x00ff00ff;
+	x = (x | (x << 4)) & 0x0f0f0f0f;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
 
-	case b2Shape::e_edge:
-		{
-			b2EdgeShape* edge = (b2EdgeShape*)fixture->GetShape();
+void SortBatchQueries(BatchQuery* queries, int32 count)
+{
+	b2AABB bounds;
+	bounds.lowerBound = queries[0].center;
+	bounds.upperBound = queries[0].center;
+	for (int32 i = 1; i < count; ++i)
+	{
+		bounds.lowerBound = b2Min(bounds.lowerBound, queries[i].center);
+		bounds.upperBound = b2Max(bounds.upperBound, queries[i].center);
+	}
+
+	b2Vec2 extents = bounds.upperBound - bounds.lowerBound;
+	float32 scaleX = extents.x > 0.0f ? 65535.0f / extents.x : 0.0f;
+	float32 scaleY = extents.y > 0.0f ? 65535.0f / extents.y : 0.0f;
+	for (int32 i = 0; i < count; ++i)
+	{
+		b2Vec2 d = queries[i].center - bounds.lowerBound;
+		uint32 x = (uint32)(d.x * scaleX);
+		uint32 y = (uint32)(d.y * scaleY);
+		queries[i].key = SpreadBits(x) | (SpreadBits(y) << 1);
+	}
+
+	std::sort(queries, queries + count, BatchQueryLessThan);
+}
+
+// Collects the fixtures found by one query of a batch.
+struct BatchQueryWrapper
+{
+	bool QueryCallback(int32 proxyId)
+	{
+		if (count == capacity)
+		{
+			return false;
+		}
+
+		b2FixtureProxy* proxy = (b2FixtureProxy*)broadPhase->GetUserData(proxyId);
+		fixtures[count++] = proxy->fixture;
+		return count < capacity;
+	}
+
+	const b2BroadPhase* broadPhase;
+	b2Fixture** fixtures;
+	int32 count;
+	int32 capacity;
+};
+
+// Keeps the closest non-sensor fixture hit by one ray of a batch.
+struct BatchRayCastWrapper
+{
+	float32 RayCastCallback(const b2RayCastInput& input, int32 proxyId)
+	{
+		b2FixtureProxy* proxy = (b2FixtureProxy*)broadPhase->GetUserData(proxyId);
+		b2Fixture* fixture = proxy->fixture;
+		if (fixture->IsSensor())
+		{
+			return -1.0f;
+		}
+
+		b2RayCastOutput output;
+		if (fixture->RayCast(&output, input, proxy->childIndex) == false)
+		{
+			return -1.0f;
+		}
+
+		float32 fraction = output.fraction;
+		hit->fixture = fixture;
+		hit->point = (1.0f - fraction) * input.p1 + fraction * input.p2;
+		hit->normal = output.normal;
+		hit->fraction = fraction;
+		return fraction;
+	}
+
+	const b2BroadPhase* broadPhase;
+	b2RayCastHit* hit;
+};
+
+/// Runs a range of the queries of a batch given to b2World::QueryAABB.
+class BatchQueryTask : public b2Task
+{
+public:
+	virtual void Execute(int32 begin, int32 end, int32 threadIndex)
+	{
+		B2_NOT_USED(threadIndex);
+		for (int32 k = begin; k < end; ++k)
+		{
+			int32 i = m_queries[k].index;
+			BatchQueryWrapper wrapper;
+			wrapper.broadPhase = m_broadPhase;
+			wrapper.fixtures = m_fixtures + i * m_maxFixtures;
+			wrapper.count = 0;
+			wrapper.capacity = m_maxFixtures;
+			m_broadPhase->Query(&wrapper, m_aabbs[i]);
+			m_fixtureCounts[i] = wrapper.count;
+		}
+	}
+
+	const b2BroadPhase* m_broadPhase;
+	const BatchQuery* m_queries;
+	const b2AABB* m_aabbs;
+	int32 m_maxFixtures;
+	b2Fixture** m_fixtures;
+	int32* m_fixtureCounts;
+};
+
+/// Casts a range of the rays of a batch given to b2World::RayCast.
+class BatchRayCastTask : public b2Task
+{
+public:
+	virtual void Execute(int32 begin, int32 end, int32 threadIndex)
+	{
+		B2_NOT_USED(threadIndex);
+		for (int32 k = begin; k < end; ++k)
+		{
+			int32 i = m_queries[k].index;
+			const b2RayCastInput& input = m_inputs[i];
+			b2RayCastHit* hit = m_hits + i;
+			hit->fixture = NULL;
+			hit->point = input.p2;
+			hit->normal.SetZero();
+			hit->fraction = input.maxFraction;
+
+			// The trees can't cast rays of zero length.
+			if (input.p1 == input.p2 || input.maxFraction <= 0.0f)
+			{
+				continue;
+			}
+
+			BatchRayCastWrapper wrapper;
+			wrapper.broadPhase = m_broadPhase;
+			wrapper.hit = hit;
+			m_broadPhase->RayCast(&wrapper, input);
+		}
+	}
+
+	const b2BroadPhase* m_broadPhase;
+	const BatchQuery* m_queries;
+	const b2RayCastInput* m_inputs;
+	b2RayCastHit* m_hits;
+};
+
+} // namespace
+
+void b2World::QueryAABB(const b2AABB* aabbs, int32 count, int32 maxFixtures,
+						b2Fixture** fixtures, int32* fixtureCounts) const
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	BatchQuery* queries = (BatchQuery*)b2Alloc(count * sizeof(BatchQuery));
+	for (int32 i = 0; i < count; ++i)
+	{
+		queries[i].center = aabbs[i].GetCenter();
+		queries[i].index = i;
+	}
+	SortBatchQueries(queries, count);
+
+	BatchQueryTask task;
+	task.m_broadPhase = &m_contactManager.m_broadPhase;
+	task.m_queries = queries;
+	task.m_aabbs = aabbs;
+	task.m_maxFixtures = maxFixtures;
+	task.m_fixtures = fixtures;
+	task.m_fixtureCounts = fixtureCounts;
+	if (m_taskExecutor)
+	{
+		m_taskExecutor->Run(&task, count);
+	}
+	else
+	{
+		task.Execute(0, count, 0);
+	}
+
+	b2Free(queries);
+}
+
+void b2World::RayCast(const b2RayCastInput* inputs, int32 count,
+					  b2RayCastHit* hits) const
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	BatchQuery* queries = (BatchQuery*)b2Alloc(count * sizeof(BatchQuery));
+	for (int32 i = 0; i < count; ++i)
+	{
+		const b2RayCastInput& input = inputs[i];
+		queries[i].center = input.p1 + (0.5f * input.maxFraction) * (input.p2 - input.p1);
+		queries[i].index = i;
+	}
+	SortBatchQueries(queries, count);
+
+	BatchRayCastTask task;
+	task.m_broadPhase = &m_contactManager.m_broadPhase;
+	task.m_queries = queries;
+	task.m_inputs = inputs;
+	task.m_hits = hits;
+	if (m_taskExecutor)
+	{
+		m_taskExecutor->Run(&task, count);
+	}
+	else
+	{
+		task.Execute(0, count, 0);
+	}
+
+	b2Free(queries);
+}
+
+void b2World::DrawShape(b2Fixture* fixture, const b2Transform& xf, const b2Color& color)
+{
+	switch (fixture->GetType())
+	{
+	case b2Shape::e_circle:
+		{
+			b2CircleShape* circle = (b2CircleShape*)fixture->GetShape();
+
+			b2Vec2 center = b2Mul(xf, circle->m_p);
+			float32 radius = circle->m_radius;
+			b2Vec2 axis = b2Mul(xf.q, b2Vec2(1.0f, 0.0f));
+
+			m_debugDraw->DrawSolidCircle(center, radius, axis, color);
+		}
+		break;
+
+	case b2Shape::e_edge:
+		{
+			b2EdgeShape* edge = (b2EdgeShape*)fixture->GetShape();
 			b2Vec2 v1 = b2Mul(xf, edge->m_vertex1);
 			b2Vec2 v2 = b2Mul(xf, edge->m_vertex2);
 			m_debugDraw->DrawSegment(v1, v2, color);
@@ -1220,281 +2503,1548 @@ void b2World::DrawJoint(b2Joint* joint)
 		m_debugDraw->DrawSegment(p1, p2, color);
 		break;
 
-	case e_pulleyJoint:
+	case e_pulleyJoint:
+		{
+			b2PulleyJoint* pulley = (b2PulleyJoint*)joint;
+			b2Vec2 s1 = pulley->GetGroundAnchorA();
+			b2Vec2 s2 = pulley->GetGroundAnchorB();
+			m_debugDraw->DrawSegment(s1, p1, color);
+			m_debugDraw->DrawSegment(s2, p2, color);
+			m_debugDraw->DrawSegment(s1, s2, color);
+		}
+		break;
+
+	case e_mouseJoint:
+		// don't draw this
+		break;
+
+	default:
+		m_debugDraw->DrawSegment(x1, p1, color);
+		m_debugDraw->DrawSegment(p1, p2, color);
+		m_debugDraw->DrawSegment(x2, p2, color);
+	}
+}
+
+void b2World::DrawParticleSystem(const b2ParticleSystem& system)
+{
+	int32 particleCount = system.GetParticleCount();
+	if (particleCount)
+	{
+		float32 radius = system.GetRadius();
+		const b2Vec2* positionBuffer = system.GetPositionBuffer();
+		if (system.m_colorBuffer.data)
+		{
+			const b2ParticleColor* colorBuffer = system.GetColorBuffer();
+			m_debugDraw->DrawParticles(positionBuffer, radius, colorBuffer, particleCount);
+		}
+		else
+		{
+			m_debugDraw->DrawParticles(positionBuffer, radius, NULL, particleCount);
+		}
+	}
+}
+
+void b2World::DrawDebugData()
+{
+	if (m_debugDraw == NULL)
+	{
+		return;
+	}
+
+	uint32 flags = m_debugDraw->GetFlags();
+
+	if (flags & b2Draw::e_shapeBit)
+	{
+		for (b2Body* b = m_bodyList; b; b = b->GetNext())
+		{
+			const b2Transform& xf = b->GetTransform();
+			for (b2Fixture* f = b->GetFixtureList(); f; f = f->GetNext())
+			{
+				if (b->IsActive() == false)
+				{
+					DrawShape(f, xf, b2Color(0.5f, 0.5f, 0.3f));
+				}
+				else if (b->GetType() == b2_staticBody)
+				{
+					DrawShape(f, xf, b2Color(0.5f, 0.9f, 0.5f));
+				}
+				else if (b->GetType() == b2_kinematicBody)
+				{
+					DrawShape(f, xf, b2Color(0.5f, 0.5f, 0.9f));
+				}
+				else if (b->IsAwake() == false)
+				{
+					DrawShape(f, xf, b2Color(0.6f, 0.6f, 0.6f));
+				}
+				else
+				{
+					DrawShape(f, xf, b2Color(0.9f, 0.7f, 0.7f));
+				}
+			}
+		}
+	}
+
+	if (flags & b2Draw::e_particleBit)
+	{
+		for (b2ParticleSystem* p = m_particleSystemList; p; p = p->GetNext())
+		{
+			DrawParticleSystem(*p);
+		}
+	}
+
+	if (flags & b2Draw::e_jointBit)
+	{
+		for (b2Joint* j = m_jointList; j; j = j->GetNext())
+		{
+
+			DrawJoint(j);
+		}
+	}
+
+	if (flags & b2Draw::e_pairBit)
+	{
+		b2Color color(0.3f, 0.9f, 0.9f);
+		for (b2Contact* c = m_contactManager.m_contactList; c; c = c->GetNext())
+		{
+			//b2Fixture* fixtureA = c->GetFixtureA();
+			//b2Fixture* fixtureB = c->GetFixtureB();
+
+			//b2Vec2 cA = fixtureA->GetAABB().GetCenter();
+			//b2Vec2 cB = fixtureB->GetAABB().GetCenter();
+
+			//m_debugDraw->DrawSegment(cA, cB, color);
+		}
+	}
+
+	if (flags & b2Draw::e_aabbBit)
+	{
+		b2Color color(0.9f, 0.3f, 0.9f);
+		b2BroadPhase* bp = &m_contactManager.m_broadPhase;
+
+		for (b2Body* b = m_bodyList; b; b = b->GetNext())
+		{
+			if (b->IsActive() == false)
+			{
+				continue;
+			}
+
+			for (b2Fixture* f = b->GetFixtureList(); f; f = f->GetNext())
+			{
+				for (int32 i = 0; i < f->m_proxyCount; ++i)
+				{
+					b2FixtureProxy* proxy = f->m_proxies + i;
+					b2AABB aabb = bp->GetFatAABB(proxy->proxyId);
+					b2Vec2 vs[4];
+					vs[0].Set(aabb.lowerBound.x, aabb.lowerBound.y);
+					vs[1].Set(aabb.upperBound.x, aabb.lowerBound.y);
+					vs[2].Set(aabb.upperBound.x, aabb.upperBound.y);
+					vs[3].Set(aabb.lowerBound.x, aabb.upperBound.y);
+
+					m_debugDraw->DrawPolygon(vs, 4, color);
+				}
+			}
+		}
+	}
+
+	if (flags & b2Draw::e_centerOfMassBit)
+	{
+		for (b2Body* b = m_bodyList; b; b = b->GetNext())
+		{
+			b2Transform xf = b->GetTransform();
+			xf.p = b->GetWorldCenter();
+			m_debugDraw->DrawTransform(xf);
+		}
+	}
+}
+
+static float32 GetSmallestRadius(const b2World* world)
+{
+	float32 smallestRadius = b2_maxFloat;
+	for (const b2ParticleSystem* system = world->GetParticleSystemList();
+		 system != NULL;
+		 system = system->GetNext())
+	{
+		smallestRadius = b2Min(smallestRadius, system->GetRadius());
+	}
+	return smallestRadius;
+}
+
+int b2World::CalculateReasonableParticleIterations(float32 timeStep) const
+{
+	if (m_particleSystemList == NULL)
+		return 1;
+
+	// Use the smallest radius, since that represents the worst-case.
+	return b2CalculateParticleIterations(m_gravity.Length(),
+										 GetSmallestRadius(this),
+										 timeStep);
+}
+
+int32 b2World::GetProxyCount() const
+{
+	return m_contactManager.m_broadPhase.GetProxyCount();
+}
+
+int32 b2World::GetTreeHeight() const
+{
+	return m_contactManager.m_broadPhase.GetTreeHeight();
+}
+
+int32 b2World::GetTreeBalance() const
+{
+	return m_contactManager.m_broadPhase.GetTreeBalance();
+}
+
+float32 b2World::GetTreeQuality() const
+{
+	return m_contactManager.m_broadPhase.GetTreeQuality();
+}
+
+void b2World::RebuildTree()
+{
+	b2Assert(IsLocked() == false);
+	if (IsLocked())
+	{
+		return;
+	}
+
+	m_contactManager.m_broadPhase.RebuildTrees();
+}
+
+void b2World::SetTreeRebuildBudget(int32 proxyCount)
+{
+	m_contactManager.m_broadPhase.SetRebuildBudget(proxyCount);
+}
+
+int32 b2World::GetTreeRebuildBudget() const
+{
+	return m_contactManager.m_broadPhase.GetRebuildBudget();
+}
+
+void b2World::SetTreeRefitMode(bool flag)
+{
+	m_contactManager.m_broadPhase.SetRefitMode(flag);
+}
+
+bool b2World::GetTreeRefitMode() const
+{
+	return m_contactManager.m_broadPhase.GetRefitMode();
+}
+
+void b2World::SetWideTreeQueries(bool flag)
+{
+	m_contactManager.m_broadPhase.SetWideQueries(flag);
+}
+
+bool b2World::GetWideTreeQueries() const
+{
+	return m_contactManager.m_broadPhase.GetWideQueries();
+}
+
+void b2World::SetAdaptiveProxyMargins(bool flag)
+{
+	m_contactManager.m_broadPhase.SetAdaptiveMargins(flag);
+}
+
+bool b2World::GetAdaptiveProxyMargins() const
+{
+	return m_contactManager.m_broadPhase.GetAdaptiveMargins();
+}
+
+int32 b2World::GetProxyReinsertCount() const
+{
+	return m_contactManager.m_broadPhase.GetReinsertCount();
+}
+
+int32 b2World::GetProxyPairCount() const
+{
+	return m_contactManager.m_broadPhase.GetReportedPairCount();
+}
+
+void b2World::ShiftOrigin(const b2Vec2& newOrigin)
+{
+	b2Assert((m_flags & e_locked) == 0);
+	if ((m_flags & e_locked) == e_locked)
+	{
+		return;
+	}
+
+	for (b2Body* b = m_bodyList; b; b = b->m_next)
+	{
+		b->m_xf.p -= newOrigin;
+		b->m_sweep.c0 -= newOrigin;
+		b->m_sweep.c -= newOrigin;
+	}
+
+	for (b2Joint* j = m_jointList; j; j = j->m_next)
+	{
+		j->ShiftOrigin(newOrigin);
+	}
+
+	m_contactManager.m_broadPhase.ShiftOrigin(newOrigin);
+}
+
+void b2World::Dump()
+{
+	if ((m_flags & e_locked) == e_locked)
+	{
+		return;
+	}
+
+	b2Log("b2Vec2 g(%.15lef, %.15lef);\n", m_gravity.x, m_gravity.y);
+	b2Log("m_world->SetGravity(g);\n");
+
+	b2Log("b2Body** bodies = (b2Body**)b2Alloc(%d * sizeof(b2Body*));\n", m_bodyCount);
+	b2Log("b2Joint** joints = (b2Joint**)b2Alloc(%d * sizeof(b2Joint*));\n", m_jointCount);
+	int32 i = 0;
+	for (b2Body* b = m_bodyList; b; b = b->m_next)
+	{
+		b->m_islandIndex = i;
+		b->Dump();
+		++i;
+	}
+
+	i = 0;
+	for (b2Joint* j = m_jointList; j; j = j->m_next)
+	{
+		j->m_index = i;
+		++i;
+	}
+
+	// First pass on joints, skip gear joints.
+	for (b2Joint* j = m_jointList; j; j = j->m_next)
+	{
+		if (j->m_type == e_gearJoint)
+		{
+			continue;
+		}
+
+		b2Log("{\n");
+		j->Dump();
+		b2Log("}\n");
+	}
+
+	// Second pass on joints, only gear joints.
+	for (b2Joint* j = m_jointList; j; j = j->m_next)
+	{
+		if (j->m_type != e_gearJoint)
+		{
+			continue;
+		}
+
+		b2Log("{\n");
+		j->Dump();
+		b2Log("}\n");
+	}
+
+	b2Log("b2Free(joints);\n");
+	b2Log("b2Free(bodies);\n");
+	b2Log("joints = NULL;\n");
+	b2Log("bodies = NULL;\n");
+}
+
+namespace {
+
+// Marks the start of the data written by b2World::Serialize, "B2WS".
+const uint32 b2_worldDataMagic = 0x53573242;
+// Changed whenever the layout of the data changes.
+const int32 b2_worldDataVersion = 1;
+
+// The position of a fixture in the data written by b2World::Serialize.
+struct FixtureRef
+{
+	const b2Fixture* fixture;
+	int32 index;
+};
+
+inline bool FixtureRefLessThan(const FixtureRef& a, const FixtureRef& b)
+{
+	return a.fixture < b.fixture;
+}
+
+// The shapes a fixture can be read into.
+struct ShapeStorage
+{
+	b2CircleShape circle;
+	b2EdgeShape edge;
+	b2PolygonShape polygon;
+	b2ChainShape chain;
+};
+
+void WriteShape(b2BinaryWriter* writer, const b2Shape* shape)
+{
+	writer->Write((int32)shape->m_type);
+	writer->Write(shape->m_radius);
+	switch (shape->m_type)
+	{
+	case b2Shape::e_circle:
+		{
+			const b2CircleShape* circle = (const b2CircleShape*)shape;
+			writer->Write(circle->m_p);
+		}
+		break;
+
+	case b2Shape::e_edge:
+		{
+			const b2EdgeShape* edge = (const b2EdgeShape*)shape;
+			writer->Write(edge->m_vertex0);
+			writer->Write(edge->m_vertex1);
+			writer->Write(edge->m_vertex2);
+			writer->Write(edge->m_vertex3);
+			writer->Write(edge->m_hasVertex0);
+			writer->Write(edge->m_hasVertex3);
+		}
+		break;
+
+	case b2Shape::e_polygon:
+		{
+			const b2PolygonShape* polygon = (const b2PolygonShape*)shape;
+			writer->Write(polygon->m_centroid);
+			writer->Write(polygon->m_count);
+			writer->WriteArray(polygon->m_vertices, polygon->m_count);
+			writer->WriteArray(polygon->m_normals, polygon->m_count);
+		}
+		break;
+
+	case b2Shape::e_chain:
+		{
+			const b2ChainShape* chain = (const b2ChainShape*)shape;
+			writer->Write(chain->IsSingleProxy());
+			writer->Write(chain->m_count);
+			writer->WriteArray(chain->m_vertices, chain->m_count);
+			writer->Write(chain->m_prevVertex);
+			writer->Write(chain->m_nextVertex);
+			writer->Write(chain->m_hasPrevVertex);
+			writer->Write(chain->m_hasNextVertex);
+		}
+		break;
+
+	default:
+		b2Assert(false);
+		break;
+	}
+}
+
+// Read a shape written by WriteShape into storage.
+// @return the shape, or NULL if it isn't valid.
+const b2Shape* ReadShape(b2BinaryReader* reader, b2StackAllocator* allocator,
+						 ShapeStorage* storage)
+{
+	int32 type = b2Shape::e_typeCount;
+	float32 radius = 0.0f;
+	reader->Read(&type);
+	reader->Read(&radius);
+
+	b2Shape* shape = NULL;
+	switch (type)
+	{
+	case b2Shape::e_circle:
+		{
+			b2CircleShape* circle = &storage->circle;
+			reader->Read(&circle->m_p);
+			shape = circle;
+		}
+		break;
+
+	case b2Shape::e_edge:
+		{
+			b2EdgeShape* edge = &storage->edge;
+			reader->Read(&edge->m_vertex0);
+			reader->Read(&edge->m_vertex1);
+			reader->Read(&edge->m_vertex2);
+			reader->Read(&edge->m_vertex3);
+			reader->Read(&edge->m_hasVertex0);
+			reader->Read(&edge->m_hasVertex3);
+			shape = edge;
+		}
+		break;
+
+	case b2Shape::e_polygon:
+		{
+			b2PolygonShape* polygon = &storage->polygon;
+			reader->Read(&polygon->m_centroid);
+			reader->Read(&polygon->m_count);
+			if (polygon->m_count < 3 ||
+				polygon->m_count > b2_maxPolygonVertices)
+			{
+				return NULL;
+			}
+			reader->ReadArray(polygon->m_vertices, polygon->m_count);
+			reader->ReadArray(polygon->m_normals, polygon->m_count);
+			shape = polygon;
+		}
+		break;
+
+	case b2Shape::e_chain:
+		{
+			b2ChainShape* chain = &storage->chain;
+			bool singleProxy = false;
+			reader->Read(&singleProxy);
+			int32 count = reader->ReadCount(sizeof(b2Vec2));
+			if (count < 2)
+			{
+				return NULL;
+			}
+			b2Vec2* vertices = (b2Vec2*)allocator->Allocate(
+				count * sizeof(b2Vec2));
+			reader->ReadArray(vertices, count);
+			chain->SetSingleProxy(singleProxy);
+			chain->CreateChain(vertices, count);
+			allocator->Free(vertices);
+			reader->Read(&chain->m_prevVertex);
+			reader->Read(&chain->m_nextVertex);
+			reader->Read(&chain->m_hasPrevVertex);
+			reader->Read(&chain->m_hasNextVertex);
+			shape = chain;
+		}
+		break;
+
+	default:
+		return NULL;
+	}
+
+	shape->m_radius = radius;
+	return reader->HasFailed() ? NULL : shape;
+}
+
+template <typename T>
+b2Joint* CreateDefaultJoint(b2World* world, T* def, const b2JointDef& common)
+{
+	def->bodyA = common.bodyA;
+	def->bodyB = common.bodyB;
+	def->collideConnected = common.collideConnected;
+	return world->CreateJoint(def);
+}
+
+// Create a joint of a type other than gear from its default definition,
+// to be overwritten by b2Joint::Deserialize.
+b2Joint* CreateDefaultJoint(b2World* world, int32 type,
+							const b2JointDef& common)
+{
+	switch (type)
+	{
+	case e_revoluteJoint:
+		{
+			b2RevoluteJointDef def;
+			return CreateDefaultJoint(world, &def, common);
+		}
+
+	case e_prismaticJoint:
+		{
+			b2PrismaticJointDef def;
+			return CreateDefaultJoint(world, &def, common);
+		}
+
+	case e_distanceJoint:
+		{
+			b2DistanceJointDef def;
+			return CreateDefaultJoint(world, &def, common);
+		}
+
+	case e_pulleyJoint:
+		{
+			b2PulleyJointDef def;
+			return CreateDefaultJoint(world, &def, common);
+		}
+
+	case e_mouseJoint:
+		{
+			b2MouseJointDef def;
+			return CreateDefaultJoint(world, &def, common);
+		}
+
+	case e_wheelJoint:
+		{
+			b2WheelJointDef def;
+			return CreateDefaultJoint(world, &def, common);
+		}
+
+	case e_weldJoint:
+		{
+			b2WeldJointDef def;
+			return CreateDefaultJoint(world, &def, common);
+		}
+
+	case e_frictionJoint:
+		{
+			b2FrictionJointDef def;
+			return CreateDefaultJoint(world, &def, common);
+		}
+
+	case e_ropeJoint:
+		{
+			b2RopeJointDef def;
+			return CreateDefaultJoint(world, &def, common);
+		}
+
+	case e_motorJoint:
+		{
+			b2MotorJointDef def;
+			return CreateDefaultJoint(world, &def, common);
+		}
+
+	default:
+		return NULL;
+	}
+}
+
+// Particle system definitions are written by field, since they have
+// padding.
+void WriteParticleSystemDef(b2BinaryWriter* writer,
+							const b2ParticleSystemDef& def)
+{
+	writer->Write(def.strictContactCheck);
+	writer->Write(def.density);
+	writer->Write(def.gravityScale);
+	writer->Write(def.radius);
+	writer->Write(def.maxCount);
+	writer->Write(def.pressureStrength);
+	writer->Write(def.dampingStrength);
+	writer->Write(def.elasticStrength);
+	writer->Write(def.springStrength);
+	writer->Write(def.viscousStrength);
+	writer->Write(def.surfaceTensionPressureStrength);
+	writer->Write(def.surfaceTensionNormalStrength);
+	writer->Write(def.repulsiveStrength);
+	writer->Write(def.powderStrength);
+	writer->Write(def.ejectionStrength);
+	writer->Write(def.staticPressureStrength);
+	writer->Write(def.staticPressureRelaxation);
+	writer->Write(def.staticPressureIterations);
+	writer->Write(def.colorMixingStrength);
+	writer->Write(def.destroyByAge);
+	writer->Write(def.lifetimeGranularity);
+	writer->Write(def.largeWorld);
+}
+
+void ReadParticleSystemDef(b2BinaryReader* reader, b2ParticleSystemDef* def)
+{
+	reader->Read(&def->strictContactCheck);
+	reader->Read(&def->density);
+	reader->Read(&def->gravityScale);
+	reader->Read(&def->radius);
+	reader->Read(&def->maxCount);
+	reader->Read(&def->pressureStrength);
+	reader->Read(&def->dampingStrength);
+	reader->Read(&def->elasticStrength);
+	reader->Read(&def->springStrength);
+	reader->Read(&def->viscousStrength);
+	reader->Read(&def->surfaceTensionPressureStrength);
+	reader->Read(&def->surfaceTensionNormalStrength);
+	reader->Read(&def->repulsiveStrength);
+	reader->Read(&def->powderStrength);
+	reader->Read(&def->ejectionStrength);
+	reader->Read(&def->staticPressureStrength);
+	reader->Read(&def->staticPressureRelaxation);
+	reader->Read(&def->staticPressureIterations);
+	reader->Read(&def->colorMixingStrength);
+	reader->Read(&def->destroyByAge);
+	reader->Read(&def->lifetimeGranularity);
+	reader->Read(&def->largeWorld);
+}
+
+} // namespace
+
+int32 b2World::Serialize(void* data, int32 capacity)
+{
+	b2Assert(IsLocked() == false);
+
+	b2BinaryWriter writer(data, capacity);
+	writer.Write(b2_worldDataMagic);
+	writer.Write(b2_worldDataVersion);
+
+	writer.Write(m_gravity);
+	writer.Write(m_allowSleep);
+	writer.Write(m_warmStarting);
+	writer.Write(m_wideContactSolving);
+	writer.Write(m_wideJointSolving);
+	writer.Write(m_continuousPhysics);
+	writer.Write(m_speculativeContacts);
+	writer.Write(m_subStepping);
+	writer.Write(GetAutoClearForces());
+	writer.Write(m_stepComplete);
+	writer.Write(m_inv_dt0);
+	writer.Write(GetTreeRebuildBudget());
+	writer.Write(GetWideTreeQueries());
+	writer.Write(GetAdaptiveProxyMargins());
+
+	// Lists are written from their end, since items are added to the front
+	// of the lists when they're read back. Bodies are numbered by their
+	// island index and fixtures by a sorted table, in the order they're
+	// written, for the joints and contacts that refer to them.
+	b2GrowableBuffer<FixtureRef> fixtureRefs(m_blockAllocator);
+	b2GrowableBuffer<b2Fixture*> fixtures(m_blockAllocator);
+	b2Body* lastBody = m_bodyList;
+	while (lastBody && lastBody->m_next)
+	{
+		lastBody = lastBody->m_next;
+	}
+	writer.Write(m_bodyCount);
+	int32 bodyIndex = 0;
+	for (b2Body* b = lastBody; b; b = b->m_prev)
+	{
+		b->m_islandIndex = bodyIndex++;
+		writer.Write((int32)b->m_type);
+		writer.Write((uint16)(b->m_flags & ~b2Body::e_islandFlag));
+		writer.Write(b->m_xf);
+		writer.Write(b->m_xf0);
+		writer.Write(b->m_sweep);
+		writer.Write(b->m_linearVelocity);
+		writer.Write(b->m_angularVelocity);
+		writer.Write(b->m_force);
+		writer.Write(b->m_torque);
+		writer.Write(b->m_mass);
+		writer.Write(b->m_invMass);
+		writer.Write(b->m_I);
+		writer.Write(b->m_invI);
+		writer.Write(b->m_linearDamping);
+		writer.Write(b->m_angularDamping);
+		writer.Write(b->m_gravityScale);
+		writer.Write(b->m_sleepTime);
+
+		// Fixtures are only linked forwards.
+		fixtures.SetCount(0);
+		for (b2Fixture* f = b->m_fixtureList; f; f = f->m_next)
+		{
+			fixtures.Append() = f;
+		}
+		writer.Write(fixtures.GetCount());
+		for (int32 i = fixtures.GetCount() - 1; i >= 0; --i)
+		{
+			const b2Fixture* f = fixtures[i];
+			FixtureRef& ref = fixtureRefs.Append();
+			ref.fixture = f;
+			ref.index = fixtureRefs.GetCount() - 1;
+			writer.Write(f->m_density);
+			writer.Write(f->m_friction);
+			writer.Write(f->m_restitution);
+			writer.Write(f->m_filter);
+			writer.Write(f->m_isSensor);
+			WriteShape(&writer, f->m_shape);
+		}
+	}
+	std::sort(fixtureRefs.Begin(), fixtureRefs.End(), FixtureRefLessThan);
+
+	// Gear joints refer to other joints, so they're written last.
+	b2Joint* lastJoint = m_jointList;
+	while (lastJoint && lastJoint->m_next)
+	{
+		lastJoint = lastJoint->m_next;
+	}
+	writer.Write(m_jointCount);
+	int32 jointIndex = 0;
+	for (int32 pass = 0; pass < 2; ++pass)
+	{
+		bool gears = pass == 1;
+		for (b2Joint* j = lastJoint; j; j = j->m_prev)
+		{
+			if ((j->m_type == e_gearJoint) != gears)
+			{
+				continue;
+			}
+			j->m_index = jointIndex++;
+			writer.Write((int32)j->m_type);
+			writer.Write(j->m_bodyA->m_islandIndex);
+			writer.Write(j->m_bodyB->m_islandIndex);
+			writer.Write(j->m_collideConnected);
+			if (gears)
+			{
+				b2GearJoint* gear = (b2GearJoint*)j;
+				writer.Write(gear->GetJoint1()->m_index);
+				writer.Write(gear->GetJoint2()->m_index);
+			}
+			j->Serialize(&writer);
+		}
+	}
+
+	b2Contact* lastContact = m_contactManager.m_contactList;
+	while (lastContact && lastContact->m_next)
+	{
+		lastContact = lastContact->m_next;
+	}
+	writer.Write(m_contactManager.m_contactCount);
+	for (b2Contact* c = lastContact; c; c = c->m_prev)
+	{
+		FixtureRef key;
+		key.fixture = c->m_fixtureA;
+		writer.Write(std::lower_bound(fixtureRefs.Begin(), fixtureRefs.End(),
+									  key, FixtureRefLessThan)->index);
+		writer.Write(c->m_indexA);
+		key.fixture = c->m_fixtureB;
+		writer.Write(std::lower_bound(fixtureRefs.Begin(), fixtureRefs.End(),
+									  key, FixtureRefLessThan)->index);
+		writer.Write(c->m_indexB);
+		writer.Write(c->m_flags & ~b2Contact::e_islandFlag);
+		writer.Write(c->m_friction);
+		writer.Write(c->m_restitution);
+		writer.Write(c->m_tangentSpeed);
+		writer.Write(c->m_manifold);
+		writer.Write(c->m_toiCount);
+		writer.Write(c->m_toi);
+	}
+
+	int32 particleSystemCount = 0;
+	b2ParticleSystem* lastParticleSystem = m_particleSystemList;
+	for (b2ParticleSystem* p = m_particleSystemList; p; p = p->m_next)
+	{
+		lastParticleSystem = p;
+		++particleSystemCount;
+	}
+	writer.Write(particleSystemCount);
+	for (b2ParticleSystem* p = lastParticleSystem; p; p = p->m_prev)
+	{
+		b2ParticleSystemDef def = p->m_def;
+		def.radius = p->GetRadius();
+		WriteParticleSystemDef(&writer, def);
+		p->Serialize(&writer);
+	}
+
+	return writer.GetSize();
+}
+
+bool b2World::Deserialize(const void* data, int32 size)
+{
+	b2Assert(IsLocked() == false);
+	b2Assert(m_bodyCount == 0 && m_particleSystemList == NULL);
+	if (IsLocked() || m_bodyCount || m_particleSystemList)
+	{
+		return false;
+	}
+
+	b2BinaryReader reader(data, size);
+	uint32 magic = 0;
+	int32 version = 0;
+	reader.Read(&magic);
+	reader.Read(&version);
+	if (magic != b2_worldDataMagic || version != b2_worldDataVersion)
+	{
+		return false;
+	}
+
+	bool autoClearForces = true;
+	int32 treeRebuildBudget = 0;
+	bool wideTreeQueries = false;
+	bool adaptiveProxyMargins = false;
+	reader.Read(&m_gravity);
+	reader.Read(&m_allowSleep);
+	reader.Read(&m_warmStarting);
+	reader.Read(&m_wideContactSolving);
+	reader.Read(&m_wideJointSolving);
+	reader.Read(&m_continuousPhysics);
+	reader.Read(&m_speculativeContacts);
+	reader.Read(&m_subStepping);
+	reader.Read(&autoClearForces);
+	reader.Read(&m_stepComplete);
+	reader.Read(&m_inv_dt0);
+	reader.Read(&treeRebuildBudget);
+	reader.Read(&wideTreeQueries);
+	reader.Read(&adaptiveProxyMargins);
+	SetAutoClearForces(autoClearForces);
+	SetTreeRebuildBudget(treeRebuildBudget);
+	SetWideTreeQueries(wideTreeQueries);
+	SetAdaptiveProxyMargins(adaptiveProxyMargins);
+
+	if (DeserializeObjects(&reader))
+	{
+		return true;
+	}
+
+	// Destroy what was read, without telling the listeners about objects
+	// they were never given. Gear joints are read last, so they're
+	// destroyed before the joints they refer to.
+	b2DestructionListener* destructionListener = m_destructionListener;
+	b2ContactListener* contactListener = m_contactManager.m_contactListener;
+	m_destructionListener = NULL;
+	m_contactManager.m_contactListener = NULL;
+	while (m_particleSystemList)
+	{
+		DestroyParticleSystem(m_particleSystemList);
+	}
+	while (m_jointList)
+	{
+		DestroyJoint(m_jointList);
+	}
+	while (m_bodyList)
+	{
+		DestroyBody(m_bodyList);
+	}
+	m_destructionListener = destructionListener;
+	m_contactManager.m_contactListener = contactListener;
+	return false;
+}
+
+bool b2World::DeserializeObjects(b2BinaryReader* reader)
+{
+	b2GrowableBuffer<b2Body*> bodies(m_blockAllocator);
+	b2GrowableBuffer<b2Fixture*> fixtures(m_blockAllocator);
+	int32 bodyCount = reader->ReadCount(sizeof(b2Sweep));
+	for (int32 i = 0; i < bodyCount; ++i)
+	{
+		int32 type = 0;
+		uint16 flags = 0;
+		reader->Read(&type);
+		reader->Read(&flags);
+		if (reader->HasFailed() || type < b2_staticBody || type > b2_dynamicBody)
+		{
+			return false;
+		}
+
+		// Create the body where it was, so that its proxies start there,
+		// then overwrite its state.
+		b2Transform xf, xf0;
+		b2Sweep sweep;
+		reader->Read(&xf);
+		reader->Read(&xf0);
+		reader->Read(&sweep);
+		b2BodyDef bd;
+		bd.type = (b2BodyType)type;
+		bd.position = xf.p;
+		bd.angle = sweep.a;
+		bd.awake = (flags & b2Body::e_awakeFlag) != 0;
+		bd.allowSleep = (flags & b2Body::e_autoSleepFlag) != 0;
+		bd.bullet = (flags & b2Body::e_bulletFlag) != 0;
+		bd.fixedRotation = (flags & b2Body::e_fixedRotationFlag) != 0;
+		bd.active = (flags & b2Body::e_activeFlag) != 0;
+		b2Body* b = CreateBody(&bd);
+		bodies.Append() = b;
+		b->m_xf = xf;
+		b->m_xf0 = xf0;
+		b2Vec2 linearVelocity;
+		float32 angularVelocity;
+		reader->Read(&linearVelocity);
+		reader->Read(&angularVelocity);
+		reader->Read(&b->m_force);
+		reader->Read(&b->m_torque);
+		float32 mass, invMass, I, invI;
+		reader->Read(&mass);
+		reader->Read(&invMass);
+		reader->Read(&I);
+		reader->Read(&invI);
+		reader->Read(&b->m_linearDamping);
+		reader->Read(&b->m_angularDamping);
+		reader->Read(&b->m_gravityScale);
+		reader->Read(&b->m_sleepTime);
+
+		int32 fixtureCount = reader->ReadCount(sizeof(float32));
+		for (int32 k = 0; k < fixtureCount; ++k)
+		{
+			b2FixtureDef fd;
+			reader->Read(&fd.density);
+			reader->Read(&fd.friction);
+			reader->Read(&fd.restitution);
+			reader->Read(&fd.filter);
+			reader->Read(&fd.isSensor);
+			ShapeStorage storage;
+			fd.shape = ReadShape(reader, &m_stackAllocator, &storage);
+			if (fd.shape == NULL)
+			{
+				return false;
+			}
+			fixtures.Append() = b->CreateFixture(&fd);
+		}
+
+		// Creating fixtures resets the mass, which moves the sweep and
+		// changes the velocity.
+		b->m_sweep = sweep;
+		b->m_linearVelocity = linearVelocity;
+		b->m_angularVelocity = angularVelocity;
+		b->m_mass = mass;
+		b->m_invMass = invMass;
+		b->m_I = I;
+		b->m_invI = invI;
+		b->m_flags = flags & ~b2Body::e_islandFlag;
+	}
+
+	int32 jointCount = reader->ReadCount(4 * sizeof(int32));
+	b2GrowableBuffer<b2Joint*> joints(m_blockAllocator);
+	for (int32 i = 0; i < jointCount && reader->HasFailed() == false; ++i)
+	{
+		int32 type = e_unknownJoint;
+		int32 indexA = -1;
+		int32 indexB = -1;
+		b2JointDef common;
+		reader->Read(&type);
+		reader->Read(&indexA);
+		reader->Read(&indexB);
+		reader->Read(&common.collideConnected);
+		if (indexA < 0 || indexA >= bodyCount || indexB < 0 ||
+			indexB >= bodyCount || indexA == indexB)
+		{
+			return false;
+		}
+		common.bodyA = bodies[indexA];
+		common.bodyB = bodies[indexB];
+
+		b2Joint* j = NULL;
+		if (type == e_gearJoint)
+		{
+			int32 index1 = -1;
+			int32 index2 = -1;
+			reader->Read(&index1);
+			reader->Read(&index2);
+			if (index1 < 0 || index1 >= i || index2 < 0 || index2 >= i)
+			{
+				return false;
+			}
+			b2GearJointDef def;
+			def.joint1 = joints[index1];
+			def.joint2 = joints[index2];
+			b2JointType type1 = def.joint1->GetType();
+			b2JointType type2 = def.joint2->GetType();
+			if ((type1 != e_revoluteJoint && type1 != e_prismaticJoint) ||
+				(type2 != e_revoluteJoint && type2 != e_prismaticJoint))
+			{
+				return false;
+			}
+			j = CreateDefaultJoint(this, &def, common);
+		}
+		else
+		{
+			j = CreateDefaultJoint(this, type, common);
+		}
+		if (j == NULL)
+		{
+			return false;
+		}
+		j->Deserialize(reader);
+		joints.Append() = j;
+	}
+
+	int32 contactCount = reader->ReadCount(4 * sizeof(int32));
+	int32 fixtureCount = fixtures.GetCount();
+	for (int32 i = 0; i < contactCount && reader->HasFailed() == false; ++i)
+	{
+		int32 fixtureIndexA = -1;
+		int32 indexA = -1;
+		int32 fixtureIndexB = -1;
+		int32 indexB = -1;
+		reader->Read(&fixtureIndexA);
+		reader->Read(&indexA);
+		reader->Read(&fixtureIndexB);
+		reader->Read(&indexB);
+		if (fixtureIndexA < 0 || fixtureIndexA >= fixtureCount ||
+			fixtureIndexB < 0 || fixtureIndexB >= fixtureCount)
+		{
+			return false;
+		}
+		b2Fixture* fixtureA = fixtures[fixtureIndexA];
+		b2Fixture* fixtureB = fixtures[fixtureIndexB];
+		if (indexA < 0 || indexA >= fixtureA->m_proxyCount ||
+			indexB < 0 || indexB >= fixtureB->m_proxyCount ||
+			fixtureA->m_body == fixtureB->m_body)
+		{
+			return false;
+		}
+
+		b2Contact* c = m_contactManager.Create(fixtureA, indexA,
+											   fixtureB, indexB);
+		if (c == NULL)
+		{
+			return false;
+		}
+		reader->Read(&c->m_flags);
+		reader->Read(&c->m_friction);
+		reader->Read(&c->m_restitution);
+		reader->Read(&c->m_tangentSpeed);
+		reader->Read(&c->m_manifold);
+		reader->Read(&c->m_toiCount);
+		reader->Read(&c->m_toi);
+		c->m_flags &= ~b2Contact::e_islandFlag;
+		if (c->m_flags & b2Contact::e_islandLinkFlag)
+		{
+			LinkIslands(fixtureA->m_body, fixtureB->m_body);
+		}
+	}
+
+	int32 particleSystemCount = reader->ReadCount(sizeof(int32));
+	for (int32 i = 0; i < particleSystemCount; ++i)
+	{
+		b2ParticleSystemDef def;
+		ReadParticleSystemDef(reader, &def);
+		if (reader->HasFailed())
+		{
+			return false;
+		}
+		b2ParticleSystem* p = CreateParticleSystem(&def);
+		if (p->Deserialize(reader, NULL) == false)
+		{
+			return false;
+		}
+	}
+
+	return reader->HasFailed() == false;
+}
+
+void b2World::CaptureState(b2WorldState* state) const
+{
+	b2Assert(IsLocked() == false);
+
+	for (;;)
+	{
+		b2BinaryWriter writer(state->m_data, state->m_capacity);
+
+		// The structure comes first, so that RestoreState can check it
+		// before it changes anything.
+		writer.Write(m_bodyCount);
+		for (const b2Body* b = m_bodyList; b; b = b->m_next)
+		{
+			writer.Write(b);
+			writer.Write(b->m_serial);
+			writer.Write(b->m_fixtureCount);
+			for (const b2Fixture* f = b->m_fixtureList; f; f = f->m_next)
+			{
+				writer.Write(f);
+				writer.Write(f->m_serial);
+				writer.Write(f->m_shape->GetChildCount());
+				writer.Write(f->m_proxyCount);
+			}
+		}
+		writer.Write(m_jointCount);
+		for (const b2Joint* j = m_jointList; j; j = j->m_next)
+		{
+			writer.Write(j);
+			writer.Write(j->m_serial);
+		}
+		int32 particleSystemCount = 0;
+		for (const b2ParticleSystem* p = m_particleSystemList; p;
+			 p = p->m_next)
+		{
+			++particleSystemCount;
+		}
+		writer.Write(particleSystemCount);
+		for (const b2ParticleSystem* p = m_particleSystemList; p;
+			 p = p->m_next)
+		{
+			writer.Write(p);
+			writer.Write(p->m_serial);
+		}
+
+		writer.Write(m_flags & e_newFixture);
+		writer.Write(m_inv_dt0);
+		writer.Write(m_stepComplete);
+
+		m_contactManager.CaptureState(&writer);
+
+		for (const b2Body* b = m_bodyList; b; b = b->m_next)
+		{
+			writer.Write(b->m_type);
+			writer.Write(b->m_flags);
+			writer.Write(b->m_islandIndex);
+			writer.Write(b->m_xf);
+			writer.Write(b->m_xf0);
+			writer.Write(b->m_sweep);
+			writer.Write(b->m_linearVelocity);
+			writer.Write(b->m_angularVelocity);
+			writer.Write(b->m_force);
+			writer.Write(b->m_torque);
+			writer.Write(b->m_mass);
+			writer.Write(b->m_invMass);
+			writer.Write(b->m_I);
+			writer.Write(b->m_invI);
+			writer.Write(b->m_sleepTime);
+			for (const b2Fixture* f = b->m_fixtureList; f; f = f->m_next)
+			{
+				for (int32 i = 0; i < f->m_proxyCount; ++i)
+				{
+					writer.Write(f->m_proxies[i].aabb);
+					writer.Write(f->m_proxies[i].proxyId);
+				}
+			}
+		}
+
+		for (const b2Joint* j = m_jointList; j; j = j->m_next)
 		{
-			b2PulleyJoint* pulley = (b2PulleyJoint*)joint;
-			b2Vec2 s1 = pulley->GetGroundAnchorA();
-			b2Vec2 s2 = pulley->GetGroundAnchorB();
-			m_debugDraw->DrawSegment(s1, p1, color);
-			m_debugDraw->DrawSegment(s2, p2, color);
-			m_debugDraw->DrawSegment(s1, s2, color);
+			j->Serialize(&writer);
 		}
-		break;
-
-	case e_mouseJoint:
-		// don't draw this
-		break;
 
-	default:
-		m_debugDraw->DrawSegment(x1, p1, color);
-		m_debugDraw->DrawSegment(p1, p2, color);
-		m_debugDraw->DrawSegment(x2, p2, color);
-	}
-}
+		// Islands are written from the end of their lists, since
+		// RestoreState adds them to the front.
+		writer.Write(m_islandCount);
+		const b2PersistentIsland* lastIsland = m_islandList;
+		while (lastIsland && lastIsland->next)
+		{
+			lastIsland = lastIsland->next;
+		}
+		for (const b2PersistentIsland* island = lastIsland; island;
+			 island = island->prev)
+		{
+			writer.Write(island->removedCount);
+			writer.Write(island->bodyCount);
+			const b2Body* lastBody = island->bodyList;
+			while (lastBody && lastBody->m_islandNext)
+			{
+				lastBody = lastBody->m_islandNext;
+			}
+			for (const b2Body* b = lastBody; b; b = b->m_islandPrev)
+			{
+				writer.Write(b);
+			}
+		}
 
-void b2World::DrawParticleSystem(const b2ParticleSystem& system)
-{
-	int32 particleCount = system.GetParticleCount();
-	if (particleCount)
-	{
-		float32 radius = system.GetRadius();
-		const b2Vec2* positionBuffer = system.GetPositionBuffer();
-		if (system.m_colorBuffer.data)
+		for (const b2ParticleSystem* p = m_particleSystemList; p;
+			 p = p->m_next)
 		{
-			const b2ParticleColor* colorBuffer = system.GetColorBuffer();
-			m_debugDraw->DrawParticles(positionBuffer, radius, colorBuffer, particleCount);
+			p->CaptureState(&writer);
 		}
-		else
+
+		if (writer.HasOverflowed() == false)
 		{
-			m_debugDraw->DrawParticles(positionBuffer, radius, NULL, particleCount);
+			state->m_size = writer.GetSize();
+			return;
 		}
+
+		// Grow the state and write it again.
+		b2Free(state->m_data);
+		state->m_capacity = b2Max(writer.GetSize(), 2 * state->m_capacity);
+		state->m_data = b2Alloc(state->m_capacity);
 	}
 }
 
-void b2World::DrawDebugData()
+bool b2World::RestoreState(const b2WorldState* state)
 {
-	if (m_debugDraw == NULL)
+	b2Assert(IsLocked() == false);
+	if (IsLocked() || state->m_size == 0)
 	{
-		return;
+		return false;
 	}
 
-	uint32 flags = m_debugDraw->GetFlags();
-
-	if (flags & b2Draw::e_shapeBit)
+	// Check the structure before anything is changed. Addresses may be
+	// reused by new objects, so serial numbers are compared as well.
+	b2BinaryReader reader(state->m_data, state->m_size);
+	const void* item = NULL;
+	uint32 serial = 0;
+	int32 count = reader.ReadCount(sizeof(b2Body*));
+	if (count != m_bodyCount)
 	{
-		for (b2Body* b = m_bodyList; b; b = b->GetNext())
+		return false;
+	}
+	for (b2Body* b = m_bodyList; b; b = b->m_next)
+	{
+		reader.Read(&item);
+		reader.Read(&serial);
+		count = reader.ReadCount(sizeof(b2Fixture*));
+		if (item != b || serial != b->m_serial ||
+			count != b->m_fixtureCount)
 		{
-			const b2Transform& xf = b->GetTransform();
-			for (b2Fixture* f = b->GetFixtureList(); f; f = f->GetNext())
+			return false;
+		}
+		for (b2Fixture* f = b->m_fixtureList; f; f = f->m_next)
+		{
+			int32 childCount = 0;
+			int32 proxyCount = 0;
+			reader.Read(&item);
+			reader.Read(&serial);
+			reader.Read(&childCount);
+			reader.Read(&proxyCount);
+			if (item != f || serial != f->m_serial ||
+				childCount != f->m_shape->GetChildCount() ||
+				proxyCount < 0 || proxyCount > childCount)
 			{
-				if (b->IsActive() == false)
-				{
-					DrawShape(f, xf, b2Color(0.5f, 0.5f, 0.3f));
-				}
-				else if (b->GetType() == b2_staticBody)
-				{
-					DrawShape(f, xf, b2Color(0.5f, 0.9f, 0.5f));
-				}
-				else if (b->GetType() == b2_kinematicBody)
-				{
-					DrawShape(f, xf, b2Color(0.5f, 0.5f, 0.9f));
-				}
-				else if (b->IsAwake() == false)
-				{
-					DrawShape(f, xf, b2Color(0.6f, 0.6f, 0.6f));
-				}
-				else
-				{
-					DrawShape(f, xf, b2Color(0.9f, 0.7f, 0.7f));
-				}
+				return false;
 			}
 		}
 	}
-
-	if (flags & b2Draw::e_particleBit)
+	count = reader.ReadCount(sizeof(b2Joint*));
+	if (count != m_jointCount)
 	{
-		for (b2ParticleSystem* p = m_particleSystemList; p; p = p->GetNext())
+		return false;
+	}
+	for (b2Joint* j = m_jointList; j; j = j->m_next)
+	{
+		reader.Read(&item);
+		reader.Read(&serial);
+		if (item != j || serial != j->m_serial)
 		{
-			DrawParticleSystem(*p);
+			return false;
 		}
 	}
-
-	if (flags & b2Draw::e_jointBit)
+	count = reader.ReadCount(sizeof(b2ParticleSystem*));
+	for (b2ParticleSystem* p = m_particleSystemList; p; p = p->m_next)
 	{
-		for (b2Joint* j = m_jointList; j; j = j->GetNext())
+		reader.Read(&item);
+		reader.Read(&serial);
+		if (item != p || serial != p->m_serial || count-- == 0)
 		{
-
-			DrawJoint(j);
+			return false;
 		}
 	}
-
-	if (flags & b2Draw::e_pairBit)
+	if (count != 0 || reader.HasFailed())
 	{
-		b2Color color(0.3f, 0.9f, 0.9f);
-		for (b2Contact* c = m_contactManager.m_contactList; c; c = c->GetNext())
-		{
-			//b2Fixture* fixtureA = c->GetFixtureA();
-			//b2Fixture* fixtureB = c->GetFixtureB();
+		return false;
+	}
 
-			//b2Vec2 cA = fixtureA->GetAABB().GetCenter();
-			//b2Vec2 cB = fixtureB->GetAABB().GetCenter();
+	int32 flags = 0;
+	reader.Read(&flags);
+	m_flags = (m_flags & ~e_newFixture) | (flags & e_newFixture);
+	reader.Read(&m_inv_dt0);
+	reader.Read(&m_stepComplete);
 
-			//m_debugDraw->DrawSegment(cA, cB, color);
-		}
-	}
+	// Destroying contacts wakes their bodies, so this comes before the
+	// bodies are read.
+	m_contactManager.RestoreState(&reader);
 
-	if (flags & b2Draw::e_aabbBit)
-	{
-		b2Color color(0.9f, 0.3f, 0.9f);
-		b2BroadPhase* bp = &m_contactManager.m_broadPhase;
+	// The checked proxy counts are read again alongside the bodies.
+	b2BinaryReader structure(state->m_data, state->m_size);
+	structure.ReadCount(sizeof(b2Body*));
 
-		for (b2Body* b = m_bodyList; b; b = b->GetNext())
+	for (b2Body* b = m_bodyList; b; b = b->m_next)
+	{
+		reader.Read(&b->m_type);
+		reader.Read(&b->m_flags);
+		reader.Read(&b->m_islandIndex);
+		reader.Read(&b->m_xf);
+		reader.Read(&b->m_xf0);
+		reader.Read(&b->m_sweep);
+		reader.Read(&b->m_linearVelocity);
+		reader.Read(&b->m_angularVelocity);
+		reader.Read(&b->m_force);
+		reader.Read(&b->m_torque);
+		reader.Read(&b->m_mass);
+		reader.Read(&b->m_invMass);
+		reader.Read(&b->m_I);
+		reader.Read(&b->m_invI);
+		reader.Read(&b->m_sleepTime);
+		structure.Read(&item);
+		structure.Read(&serial);
+		structure.ReadCount(sizeof(b2Fixture*));
+		for (b2Fixture* f = b->m_fixtureList; f; f = f->m_next)
 		{
-			if (b->IsActive() == false)
+			int32 childCount = 0;
+			structure.Read(&item);
+			structure.Read(&serial);
+			structure.Read(&childCount);
+			structure.Read(&f->m_proxyCount);
+			for (int32 i = 0; i < f->m_proxyCount; ++i)
 			{
-				continue;
+				reader.Read(&f->m_proxies[i].aabb);
+				reader.Read(&f->m_proxies[i].proxyId);
 			}
+		}
 
-			for (b2Fixture* f = b->GetFixtureList(); f; f = f->GetNext())
-			{
-				for (int32 i = 0; i < f->m_proxyCount; ++i)
-				{
-					b2FixtureProxy* proxy = f->m_proxies + i;
-					b2AABB aabb = bp->GetFatAABB(proxy->proxyId);
-					b2Vec2 vs[4];
-					vs[0].Set(aabb.lowerBound.x, aabb.lowerBound.y);
-					vs[1].Set(aabb.upperBound.x, aabb.lowerBound.y);
-					vs[2].Set(aabb.upperBound.x, aabb.upperBound.y);
-					vs[3].Set(aabb.lowerBound.x, aabb.upperBound.y);
+		b->m_island = NULL;
+		b->m_islandPrev = NULL;
+		b->m_islandNext = NULL;
+	}
 
-					m_debugDraw->DrawPolygon(vs, 4, color);
-				}
-			}
-		}
+	for (b2Joint* j = m_jointList; j; j = j->m_next)
+	{
+		j->Deserialize(&reader);
 	}
 
-	if (flags & b2Draw::e_centerOfMassBit)
+	while (m_islandList)
 	{
-		for (b2Body* b = m_bodyList; b; b = b->GetNext())
+		DestroyIsland(m_islandList);
+	}
+	int32 islandCount = reader.ReadCount(2 * sizeof(int32));
+	for (int32 i = 0; i < islandCount; ++i)
+	{
+		b2PersistentIsland* island = CreateIsland();
+		reader.Read(&island->removedCount);
+		int32 bodyCount = reader.ReadCount(sizeof(b2Body*));
+		for (int32 k = 0; k < bodyCount; ++k)
 		{
-			b2Transform xf = b->GetTransform();
-			xf.p = b->GetWorldCenter();
-			m_debugDraw->DrawTransform(xf);
+			b2Body* b = NULL;
+			reader.Read(&b);
+			b2Assert(b && b->m_world == this);
+			AddToIsland(island, b);
 		}
 	}
-}
 
-static float32 GetSmallestRadius(const b2World* world)
-{
-	float32 smallestRadius = b2_maxFloat;
-	for (const b2ParticleSystem* system = world->GetParticleSystemList();
-		 system != NULL;
-		 system = system->GetNext())
+	for (b2ParticleSystem* p = m_particleSystemList; p; p = p->m_next)
 	{
-		smallestRadius = b2Min(smallestRadius, system->GetRadius());
+		p->RestoreState(&reader);
 	}
-	return smallestRadius;
-}
-
-int b2World::CalculateReasonableParticleIterations(float32 timeStep) const
-{
-	if (m_particleSystemList == NULL)
-		return 1;
 
-	// Use the smallest radius, since that represents the worst-case.
-	return b2CalculateParticleIterations(m_gravity.Length(),
-										 GetSmallestRadius(this),
-										 timeStep);
+	b2Assert(reader.HasFailed() == false &&
+			 reader.GetPosition() == state->m_size);
+	return true;
 }
 
-int32 b2World::GetProxyCount() const
+b2WorldSnapshotBuffer::b2WorldSnapshotBuffer() :
+	m_back(0), m_front(1), m_middle(2), m_sequence(0),
+	m_world(NULL), m_next(NULL)
 {
-	return m_contactManager.m_broadPhase.GetProxyCount();
+	for (int32 i = 0; i < 3; ++i)
+	{
+		memset(&m_snapshots[i], 0, sizeof(b2WorldSnapshot));
+		m_memory[i] = NULL;
+		m_capacity[i] = 0;
+	}
 }
 
-int32 b2World::GetTreeHeight() const
+b2WorldSnapshotBuffer::~b2WorldSnapshotBuffer()
 {
-	return m_contactManager.m_broadPhase.GetTreeHeight();
+	if (m_world)
+	{
+		m_world->RemoveSnapshotBuffer(this);
+	}
+	for (int32 i = 0; i < 3; ++i)
+	{
+		b2Free(m_memory[i]);
+	}
 }
 
-int32 b2World::GetTreeBalance() const
+const b2WorldSnapshot* b2WorldSnapshotBuffer::Acquire()
 {
-	return m_contactManager.m_broadPhase.GetTreeBalance();
+	if (m_middle.load(std::memory_order_relaxed) & e_fresh)
+	{
+		// Hand the slot we were reading back to the world for writing.
+		int32 middle = m_middle.exchange(m_front, std::memory_order_acq_rel);
+		m_front = middle & e_slotMask;
+	}
+	const b2WorldSnapshot* snapshot = &m_snapshots[m_front];
+	return snapshot->sequence > 0 ? snapshot : NULL;
 }
 
-float32 b2World::GetTreeQuality() const
+// Copy the bodies and particles of world to the back slot. Slot memory
+// only grows, so a world of steady size doesn't allocate.
+void b2WorldSnapshotBuffer::Write(const b2World* world)
 {
-	return m_contactManager.m_broadPhase.GetTreeQuality();
-}
+	int32 particleSystemCount = 0;
+	int32 vectorCount = 0;
+	int32 colorCount = 0;
+	for (const b2ParticleSystem* p = world->GetParticleSystemList(); p;
+		 p = p->GetNext())
+	{
+		++particleSystemCount;
+		vectorCount += 2 * p->GetParticleCount();
+		if (p->m_colorBuffer.data)
+		{
+			colorCount += p->GetParticleCount();
+		}
+	}
 
-void b2World::ShiftOrigin(const b2Vec2& newOrigin)
-{
-	b2Assert((m_flags & e_locked) == 0);
-	if ((m_flags & e_locked) == e_locked)
+	int32 bodyCount = world->GetBodyCount();
+	int32 bodySize = bodyCount * sizeof(b2BodySnapshot);
+	int32 particleSystemSize =
+		particleSystemCount * sizeof(b2ParticleSystemSnapshot);
+	int32 size = bodySize + particleSystemSize +
+		vectorCount * sizeof(b2Vec2) + colorCount * sizeof(b2ParticleColor);
+
+	if (size > m_capacity[m_back])
 	{
-		return;
+		b2Free(m_memory[m_back]);
+		m_capacity[m_back] = b2Max(size, 2 * m_capacity[m_back]);
+		m_memory[m_back] = b2Alloc(m_capacity[m_back]);
 	}
 
-	for (b2Body* b = m_bodyList; b; b = b->m_next)
+	// Bodies and particle systems come first, since they hold pointers.
+	char* memory = (char*)m_memory[m_back];
+	b2BodySnapshot* bodies = (b2BodySnapshot*)memory;
+	b2ParticleSystemSnapshot* particleSystems =
+		(b2ParticleSystemSnapshot*)(memory + bodySize);
+	b2Vec2* vectors = (b2Vec2*)(memory + bodySize + particleSystemSize);
+	b2ParticleColor* colors = (b2ParticleColor*)(vectors + vectorCount);
+
+	int32 i = 0;
+	for (const b2Body* b = world->GetBodyList(); b; b = b->GetNext())
 	{
-		b->m_xf.p -= newOrigin;
-		b->m_sweep.c0 -= newOrigin;
-		b->m_sweep.c -= newOrigin;
+		b2BodySnapshot& body = bodies[i++];
+		body.body = b;
+		body.userData = b->GetUserData();
+		body.transform = b->GetTransform();
+		body.linearVelocity = b->GetLinearVelocity();
+		body.angularVelocity = b->GetAngularVelocity();
+		body.awake = b->IsAwake();
 	}
 
-	for (b2Joint* j = m_jointList; j; j = j->m_next)
-	{
-		j->ShiftOrigin(newOrigin);
+	i = 0;
+	for (const b2ParticleSystem* p = world->GetParticleSystemList(); p;
+		 p = p->GetNext())
+	{
+		int32 count = p->GetParticleCount();
+		b2ParticleSystemSnapshot& system = particleSystems[i++];
+		system.system = p;
+		system.particleCount = count;
+
+		memcpy(vectors, p->m_positionBuffer.data, count * sizeof(b2Vec2));
+		system.positions = vectors;
+		vectors += count;
+		memcpy(vectors, p->m_velocityBuffer.data, count * sizeof(b2Vec2));
+		system.velocities = vectors;
+		vectors += count;
+
+		system.colors = NULL;
+		if (p->m_colorBuffer.data)
+		{
+			std::copy(p->m_colorBuffer.data, p->m_colorBuffer.data + count,
+					  colors);
+			system.colors = colors;
+			colors += count;
+		}
 	}
 
-	m_contactManager.m_broadPhase.ShiftOrigin(newOrigin);
+	b2WorldSnapshot& snapshot = m_snapshots[m_back];
+	snapshot.sequence = ++m_sequence;
+	snapshot.bodies = bodies;
+	snapshot.bodyCount = bodyCount;
+	snapshot.particleSystems = particleSystems;
+	snapshot.particleSystemCount = particleSystemCount;
 }
 
-void b2World::Dump()
+// Make the back slot the latest snapshot and take the previous one, which
+// the reader never took or has let go of, as the next back slot.
+void b2WorldSnapshotBuffer::Publish()
 {
-	if ((m_flags & e_locked) == e_locked)
-	{
-		return;
-	}
+	int32 middle = m_middle.exchange(m_back | e_fresh,
+									 std::memory_order_acq_rel);
+	m_back = middle & e_slotMask;
+}
 
-	b2Log("b2Vec2 g(%.15lef, %.15lef);\n", m_gravity.x, m_gravity.y);
-	b2Log("m_world->SetGravity(g);\n");
+b2WorldState::b2WorldState() :
+	m_data(NULL), m_size(0), m_capacity(0)
+{
+}
 
-	b2Log("b2Body** bodies = (b2Body**)b2Alloc(%d * sizeof(b2Body*));\n", m_bodyCount);
-	b2Log("b2Joint** joints = (b2Joint**)b2Alloc(%d * sizeof(b2Joint*));\n", m_jointCount);
-	int32 i = 0;
-	for (b2Body* b = m_bodyList; b; b = b->m_next)
+b2WorldState::~b2WorldState()
+{
+	b2Free(m_data);
+}
+
+b2WorldStateRing::b2WorldStateRing(int32 capacity) :
+	m_capacity(capacity), m_newest(capacity - 1), m_count(0)
+{
+	b2Assert(capacity > 0);
+	m_states = (b2WorldState*)b2Alloc(capacity * sizeof(b2WorldState));
+	for (int32 i = 0; i < capacity; ++i)
 	{
-		b->m_islandIndex = i;
-		b->Dump();
-		++i;
+		new (&m_states[i]) b2WorldState();
 	}
+}
 
-	i = 0;
-	for (b2Joint* j = m_jointList; j; j = j->m_next)
+b2WorldStateRing::~b2WorldStateRing()
+{
+	for (int32 i = 0; i < m_capacity; ++i)
 	{
-		j->m_index = i;
-		++i;
+		m_states[i].~b2WorldState();
 	}
+	b2Free(m_states);
+}
 
-	// First pass on joints, skip gear joints.
-	for (b2Joint* j = m_jointList; j; j = j->m_next)
-	{
-		if (j->m_type == e_gearJoint)
-		{
-			continue;
-		}
+void b2WorldStateRing::Capture(const b2World* world)
+{
+	m_newest = (m_newest + 1) % m_capacity;
+	m_count = b2Min(m_count + 1, m_capacity);
+	world->CaptureState(&m_states[m_newest]);
+}
 
-		b2Log("{\n");
-		j->Dump();
-		b2Log("}\n");
+bool b2WorldStateRing::Rewind(b2World* world, int32 stepsBack)
+{
+	if (stepsBack < 0 || stepsBack >= m_count)
+	{
+		return false;
 	}
-
-	// Second pass on joints, only gear joints.
-	for (b2Joint* j = m_jointList; j; j = j->m_next)
+	int32 index = (m_newest - stepsBack + m_capacity) % m_capacity;
+	if (world->RestoreState(&m_states[index]) == false)
 	{
-		if (j->m_type != e_gearJoint)
-		{
-			continue;
-		}
-
-		b2Log("{\n");
-		j->Dump();
-		b2Log("}\n");
+		return false;
 	}
+	m_newest = index;
+	m_count -= stepsBack;
+	return true;
+}
 
-	b2Log("b2Free(joints);\n");
-	b2Log("b2Free(bodies);\n");
-	b2Log("joints = NULL;\n");
-	b2Log("bodies = NULL;\n");
+void b2WorldStateRing::Clear()
+{
+	m_count = 0;
 }
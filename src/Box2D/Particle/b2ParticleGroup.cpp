@@ -41,6 +41,9 @@ b2ParticleGroup::b2ParticleGroup()
 	m_linearVelocity = b2Vec2_zero;
 	m_angularVelocity = 0;
 	m_transform.SetIdentity();
+	m_unitInertia = 0;
+	m_needsUpdateMass = true;
+	m_positionTimestamp = 0;
 
 	m_userData = NULL;
 
@@ -63,10 +66,22 @@ void b2ParticleGroup::SetGroupFlags(uint32 flags)
 	m_system->SetGroupFlags(this, flags);
 }
 
+void b2ParticleGroup::ResetMassData()
+{
+	m_needsUpdateMass = true;
+	m_timestamp = -1;
+}
+
 void b2ParticleGroup::UpdateStatistics() const
 {
 	if (m_timestamp != m_system->m_timestamp)
 	{
+		if (m_groupFlags & b2_rigidParticleGroup)
+		{
+			UpdateRigidStatistics();
+			m_timestamp = m_system->m_timestamp;
+			return;
+		}
 		float32 m = m_system->GetParticleMass();
 		m_mass = 0;
 		m_center.SetZero();
@@ -99,6 +114,73 @@ void b2ParticleGroup::UpdateStatistics() const
 	}
 }
 
+// Particles of a rigid group are only ever moved by the rigid transform
+// computed in b2ParticleSystem::SolveRigid, so the spread of the particles
+// around the center doesn't change until particles join or leave the group.
+// That lets the statistics be gathered in a single pass: positions are
+// accumulated relative to the previous center to keep the sums small.
+void b2ParticleGroup::UpdateRigidStatistics() const
+{
+	const int32 count = m_lastIndex - m_firstIndex;
+	const float32 m = m_system->GetParticleMass();
+	const b2Vec2* positions = m_system->m_positionBuffer.data;
+	const b2Vec2* velocities = m_system->m_velocityBuffer.data;
+	if (m_positionTimestamp != m_system->m_positionTimestamp)
+	{
+		m_positionTimestamp = m_system->m_positionTimestamp;
+		m_needsUpdateMass = true;
+	}
+	m_mass = m * count;
+	if (count == 0)
+	{
+		m_inertia = 0;
+		m_linearVelocity.SetZero();
+		m_angularVelocity = 0;
+		return;
+	}
+	if (m_needsUpdateMass)
+	{
+		// Membership changed so the previous center may be far away.
+		m_center.SetZero();
+		for (int32 i = m_firstIndex; i < m_lastIndex; i++)
+		{
+			m_center += positions[i];
+		}
+		m_center *= 1.0f / count;
+	}
+	const b2Vec2 origin = m_center;
+	b2Vec2 sumPosition = b2Vec2_zero;
+	b2Vec2 sumVelocity = b2Vec2_zero;
+	float32 sumCross = 0;
+	float32 sumDot = 0;
+	for (int32 i = m_firstIndex; i < m_lastIndex; i++)
+	{
+		b2Vec2 p = positions[i] - origin;
+		b2Vec2 v = velocities[i];
+		sumPosition += p;
+		sumVelocity += v;
+		sumCross += b2Cross(p, v);
+		sumDot += b2Dot(p, p);
+	}
+	const float32 invCount = 1.0f / count;
+	const b2Vec2 offset = invCount * sumPosition;
+	m_center = origin + offset;
+	m_linearVelocity = invCount * sumVelocity;
+	if (m_needsUpdateMass)
+	{
+		m_unitInertia = b2Max(sumDot - count * b2Dot(offset, offset), 0.0f);
+		m_needsUpdateMass = false;
+	}
+	m_inertia = m * m_unitInertia;
+	m_angularVelocity = 0;
+	if (m_unitInertia > 0)
+	{
+		m_angularVelocity =
+			(sumCross - count * b2Cross(offset, m_linearVelocity)) /
+			m_unitInertia;
+	}
+}
+
 void b2ParticleGroup::ApplyForce(const b2Vec2& force)
 {
 	m_system->ApplyForce(m_firstIndex, m_lastIndex, force);
@@ -19,6 +19,7 @@
 #include <Box2D/Particle/b2ParticleGroup.h>
 #include <Box2D/Particle/b2VoronoiDiagram.h>
 #include <Box2D/Particle/b2ParticleAssembly.h>
+#include <Box2D/Common/b2BinaryStream.h>
 #include <Box2D/Common/b2BlockAllocator.h>
 #include <Box2D/Dynamics/b2World.h>
 #include <Box2D/Dynamics/b2WorldCallbacks.h>
@@ -56,6 +57,19 @@ static const uint32 relativeTagBottomLeft = (uint32)((1 << yShift) +
 
 static const uint32 relativeTagBottomRight = (1u << yShift) + (1u << xShift);
 
+// Layout of the 64-bit tags used by b2ParticleSystemDef::largeWorld systems.
+// Same as above with 28 bits for each axis.
+static const uint32 wideXTruncBits = 28;
+static const uint32 wideYTruncBits = 28;
+static const uint32 wideTagBits = 8u * sizeof(uint64);
+static const uint64 wideYOffset = 1ull << (wideYTruncBits - 1u);
+static const uint32 wideYShift = wideTagBits - wideYTruncBits;
+static const uint32 wideXShift = wideTagBits - wideYTruncBits - wideXTruncBits;
+static const uint64 wideXScale = 1ull << wideXShift;
+static const uint64 wideXOffset = wideXScale * (1ull << (wideXTruncBits - 1u));
+static const uint64 wideYMask = ((1ull << wideYTruncBits) - 1u) << wideYShift;
+static const uint64 wideXMask = ~wideYMask;
+
 // This functor is passed to std::remove_if in RemoveSpuriousBodyContacts
 // to implement the algorithm described there.  It was hoisted out and friended
 // as it would not compile with g++ 4.6.3 as a local class.  It is only used in
@@ -352,6 +366,41 @@ static inline uint32 computeRelativeTag(uint32 tag, int32 x, int32 y)
 	return tag + (y << yShift) + (x << xShift);
 }
 
+// The offsets can't be represented exactly by float32 so the 64-bit tag is
+// computed with double precision.
+static inline uint64 computeWideTag(float32 x, float32 y)
+{
+	return ((uint64)((float64)y + wideYOffset) << wideYShift) +
+		(uint64)((float64)wideXScale * x + wideXOffset);
+}
+
+static inline uint64 computeRelativeTag(uint64 tag, int32 x, int32 y)
+{
+	return tag + ((uint64)(int64)y << wideYShift) +
+		((uint64)(int64)x << wideXShift);
+}
+
+// Selects the tag layout by tag type so the proxy functions can be shared by
+// 32-bit and 64-bit tags.
+template <typename T> struct b2ProxyTag;
+
+template <> struct b2ProxyTag<uint32>
+{
+	static uint32 Compute(float32 x, float32 y) { return computeTag(x, y); }
+	static uint64 XMask() { return xMask; }
+	static uint64 YMask() { return yMask; }
+};
+
+template <> struct b2ProxyTag<uint64>
+{
+	static uint64 Compute(float32 x, float32 y)
+	{
+		return computeWideTag(x, y);
+	}
+	static uint64 XMask() { return wideXMask; }
+	static uint64 YMask() { return wideYMask; }
+};
+
 b2ParticleSystem::InsideBoundsEnumerator::InsideBoundsEnumerator(
 	uint32 lower, uint32 upper, const Proxy* first, const Proxy* last)
 {
@@ -361,24 +410,48 @@ b2ParticleSystem::InsideBoundsEnumerator::InsideBoundsEnumerator(
 	m_yUpper = upper & yMask;
 	m_first = first;
 	m_last = last;
+	m_wideFirst = NULL;
+	m_wideLast = NULL;
 	b2Assert(m_first <= m_last);
 }
 
+b2ParticleSystem::InsideBoundsEnumerator::InsideBoundsEnumerator(
+	uint64 lower, uint64 upper, const WideProxy* first, const WideProxy* last)
+{
+	m_xLower = lower & wideXMask;
+	m_xUpper = upper & wideXMask;
+	m_yLower = lower & wideYMask;
+	m_yUpper = upper & wideYMask;
+	m_first = NULL;
+	m_last = NULL;
+	m_wideFirst = first;
+	m_wideLast = last;
+	b2Assert(m_wideFirst <= m_wideLast);
+}
+
 int32 b2ParticleSystem::InsideBoundsEnumerator::GetNext()
 {
-	while (m_first < m_last)
+	return m_wideFirst ? GetNext(&m_wideFirst, m_wideLast) :
+		GetNext(&m_first, m_last);
+}
+
+template <typename T>
+int32 b2ParticleSystem::InsideBoundsEnumerator::GetNext(
+	const TaggedProxy<T>** first, const TaggedProxy<T>* last)
+{
+	while (*first < last)
 	{
-		uint32 xTag = m_first->tag & xMask;
+		uint64 xTag = (*first)->tag & b2ProxyTag<T>::XMask();
 #if B2_ASSERT_ENABLED
-		uint32 yTag = m_first->tag & yMask;
+		uint64 yTag = (*first)->tag & b2ProxyTag<T>::YMask();
 		b2Assert(yTag >= m_yLower);
 		b2Assert(yTag <= m_yUpper);
 #endif
 		if (xTag >= m_xLower && xTag <= m_xUpper)
 		{
-			return (m_first++)->index;
+			return ((*first)++)->index;
 		}
-		m_first++;
+		(*first)++;
 	}
 	return b2_invalidParticleIndex;
 }
@@ -386,12 +459,14 @@ int32 b2ParticleSystem::InsideBoundsEnumerator::GetNext()
 b2ParticleSystem::b2ParticleSystem(const b2ParticleSystemDef* def,
 								   b2World* world) :
 	m_handleAllocator(b2_minParticleSystemBufferCapacity),
-	m_stuckParticleBuffer(world->m_blockAllocator),
-	m_proxyBuffer(world->m_blockAllocator),
-	m_contactBuffer(world->m_blockAllocator),
-	m_bodyContactBuffer(world->m_blockAllocator),
-	m_pairBuffer(world->m_blockAllocator),
-	m_triadBuffer(world->m_blockAllocator)
+	m_stuckParticleBuffer(m_blockAllocator),
+	m_proxyBuffer(m_blockAllocator),
+	m_wideProxyBuffer(m_blockAllocator),
+	m_contactBuffer(m_blockAllocator),
+	m_bodyContactBuffer(m_blockAllocator),
+	m_pairBuffer(m_blockAllocator),
+	m_triadBuffer(m_blockAllocator),
+	m_idSlotBuffer(m_blockAllocator)
 {
 	b2Assert(def);
 	m_paused = false;
@@ -400,6 +475,7 @@ b2ParticleSystem::b2ParticleSystem(const b2ParticleSystemDef* def,
 	m_needsUpdateAllParticleFlags = false;
 	m_allGroupFlags = 0;
 	m_needsUpdateAllGroupFlags = false;
+	m_positionTimestamp = 0;
 	m_hasForce = false;
 	m_iterationIndex = 0;
 
@@ -418,6 +494,8 @@ b2ParticleSystem::b2ParticleSystem(const b2ParticleSystemDef* def,
 	m_accumulation2Buffer = NULL;
 	m_depthBuffer = NULL;
 	m_groupBuffer = NULL;
+	m_idSlotIndexBuffer = NULL;
+	m_freeIdSlot = b2_invalidParticleIndex;
 
 	m_groupCount = 0;
 	m_groupList = NULL;
@@ -426,6 +504,7 @@ b2ParticleSystem::b2ParticleSystem(const b2ParticleSystemDef* def,
 	m_def = *def;
 
 	m_world = world;
+	m_stackAllocator = &world->m_stackAllocator;
 
 	m_stuckThreshold = 0;
 
@@ -460,6 +539,7 @@ b2ParticleSystem::~b2ParticleSystem()
 	FreeBuffer(&m_accumulation2Buffer, m_internalAllocatedCapacity);
 	FreeBuffer(&m_depthBuffer, m_internalAllocatedCapacity);
 	FreeBuffer(&m_groupBuffer, m_internalAllocatedCapacity);
+	FreeBuffer(&m_idSlotIndexBuffer, m_internalAllocatedCapacity);
 }
 
 template <typename T> void b2ParticleSystem::FreeBuffer(T** b, int capacity)
@@ -467,11 +547,11 @@ template <typename T> void b2ParticleSystem::FreeBuffer(T** b, int capacity)
 	if (*b == NULL)
 		return;
 
-	m_world->m_blockAllocator.Free(*b, sizeof(**b) * capacity);
+	m_blockAllocator.Free(*b, sizeof(**b) * capacity);
 	*b = NULL;
 }
 
-// Free buffer, if it was allocated with b2World's block allocator
+// Free buffer, if it was allocated with the block allocator
 template <typename T> void b2ParticleSystem::FreeUserOverridableBuffer(
 	UserOverridableBuffer<T>* b)
 {
@@ -486,12 +566,12 @@ template <typename T> T* b2ParticleSystem::ReallocateBuffer(
 	T* oldBuffer, int32 oldCapacity, int32 newCapacity)
 {
 	b2Assert(newCapacity > oldCapacity);
-	T* newBuffer = (T*) m_world->m_blockAllocator.Allocate(
+	T* newBuffer = (T*) m_blockAllocator.Allocate(
 		sizeof(T) * newCapacity);
 	if (oldBuffer)
 	{
 		memcpy(newBuffer, oldBuffer, sizeof(T) * oldCapacity);
-		m_world->m_blockAllocator.Free(oldBuffer, sizeof(T) * oldCapacity);
+		m_blockAllocator.Free(oldBuffer, sizeof(T) * oldCapacity);
 	}
 	return newBuffer;
 }
@@ -533,6 +613,9 @@ void b2ParticleSystem::ReallocateHandleBuffers(int32 newCapacity)
 	m_handleIndexBuffer.data = ReallocateBuffer(
 		&m_handleIndexBuffer, m_internalAllocatedCapacity, newCapacity,
 		true);
+	m_idSlotIndexBuffer = ReallocateBuffer(
+		m_idSlotIndexBuffer, 0, m_internalAllocatedCapacity, newCapacity,
+		true);
 	// Set the size of the next handle allocation.
 	m_handleAllocator.SetItemsPerSlab(newCapacity -
 									  m_internalAllocatedCapacity);
@@ -547,7 +630,7 @@ template <typename T> T* b2ParticleSystem::RequestBuffer(T* buffer)
 			ReallocateInternalAllocatedBuffers(
 				b2_minParticleSystemBufferCapacity);
 		}
-		buffer = (T*) (m_world->m_blockAllocator.Allocate(
+		buffer = (T*) (m_blockAllocator.Allocate(
 						   sizeof(T) * m_internalAllocatedCapacity));
 		b2Assert(buffer);
 		memset(buffer, 0, sizeof(T) * m_internalAllocatedCapacity);
@@ -704,8 +787,10 @@ int32 b2ParticleSystem::CreateParticle(const b2ParticleDef& def)
 	{
 		m_handleIndexBuffer.data[index] = NULL;
 	}
-	Proxy& proxy = m_proxyBuffer.Append();
-
+	if (m_idSlotIndexBuffer)
+	{
+		m_idSlotIndexBuffer[index] = b2_invalidParticleIndex;
+	}
 	// If particle lifetimes are enabled or the lifetime is set in the particle
 	// definition, initialize the lifetime.
 	const bool finiteLifetime = def.lifetime > 0;
@@ -719,7 +804,14 @@ int32 b2ParticleSystem::CreateParticle(const b2ParticleDef& def)
 		m_indexByExpirationTimeBuffer.data[index] = index;
 	}
 
-	proxy.index = index;
+	if (m_def.largeWorld)
+	{
+		m_wideProxyBuffer.Append().index = index;
+	}
+	else
+	{
+		m_proxyBuffer.Append().index = index;
+	}
 	b2ParticleGroup* group = def.group;
 	m_groupBuffer[index] = group;
 	if (group)
@@ -739,6 +831,7 @@ int32 b2ParticleSystem::CreateParticle(const b2ParticleDef& def)
 			group->m_firstIndex = index;
 			group->m_lastIndex = index + 1;
 		}
+		group->m_needsUpdateMass = true;
 	}
 	SetParticleFlags(index, def.flags);
 	return index;
@@ -764,6 +857,85 @@ const b2ParticleHandle* b2ParticleSystem::GetParticleHandleFromIndex(
 	return handle;
 }
 
+/// Retrieve the id of the particle at the specified index.
+b2ParticleId b2ParticleSystem::GetParticleIdFromIndex(int32 index)
+{
+	b2Assert(index >= 0 && index < GetParticleCount() &&
+			 index != b2_invalidParticleIndex);
+	if (!m_idSlotIndexBuffer)
+	{
+		m_idSlotIndexBuffer = RequestBuffer(m_idSlotIndexBuffer);
+		for (int32 i = 0; i < m_count; i++)
+		{
+			m_idSlotIndexBuffer[i] = b2_invalidParticleIndex;
+		}
+	}
+	int32 slot = m_idSlotIndexBuffer[index];
+	if (slot == b2_invalidParticleIndex)
+	{
+		if (m_freeIdSlot != b2_invalidParticleIndex)
+		{
+			slot = m_freeIdSlot;
+			m_freeIdSlot = m_idSlotBuffer[slot].index;
+		}
+		else
+		{
+			// The last slot is never used so that no id equals
+			// b2_invalidParticleId.
+			b2Assert(m_idSlotBuffer.GetCount() < b2_particleIdSlotMask);
+			slot = m_idSlotBuffer.GetCount();
+			m_idSlotBuffer.Append().generation = 0;
+		}
+		m_idSlotBuffer[slot].index = index;
+		m_idSlotIndexBuffer[index] = slot;
+	}
+	return (m_idSlotBuffer[slot].generation << b2_particleIdSlotBits) |
+		(uint32) slot;
+}
+
+int32 b2ParticleSystem::GetParticleIndexFromId(b2ParticleId id) const
+{
+	const int32 slot = (int32) (id & b2_particleIdSlotMask);
+	if (id == b2_invalidParticleId || slot >= m_idSlotBuffer.GetCount())
+	{
+		return b2_invalidParticleIndex;
+	}
+	const IdSlot& idSlot = m_idSlotBuffer[slot];
+	// Only the low bits of the generation are stored in the id.
+	if ((idSlot.generation << b2_particleIdSlotBits) !=
+		(id & ~(uint32) b2_particleIdSlotMask))
+	{
+		return b2_invalidParticleIndex;
+	}
+	return idSlot.index;
+}
+
+void b2ParticleSystem::FreeParticleId(int32 index)
+{
+	const int32 slot = m_idSlotIndexBuffer[index];
+	if (slot != b2_invalidParticleIndex)
+	{
+		// Bumping the generation invalidates all outstanding ids of the slot.
+		IdSlot& idSlot = m_idSlotBuffer[slot];
+		idSlot.generation++;
+		idSlot.index = m_freeIdSlot;
+		m_freeIdSlot = slot;
+		m_idSlotIndexBuffer[index] = b2_invalidParticleIndex;
+	}
+}
+
+void b2ParticleSystem::UpdateParticleIdSlots(int32 start, int32 end)
+{
+	for (int32 i = start; i < end; i++)
+	{
+		const int32 slot = m_idSlotIndexBuffer[i];
+		if (slot != b2_invalidParticleIndex)
+		{
+			m_idSlotBuffer[slot].index = i;
+		}
+	}
+}
+
 
 void b2ParticleSystem::DestroyParticle(
 	int32 index, bool callDestructionListener)
@@ -881,8 +1053,10 @@ void b2ParticleSystem::CreateParticlesStrokeShapeForGroup(
 		stride = GetParticleStride();
 	}
 	float32 positionOnEdge = 0;
-	int32 childCount = shape->GetChildCount();
-	for (int32 childIndex = 0; childIndex < childCount; childIndex++)
+	// A chain that uses a single proxy has one child for all of its edges.
+	int32 edgeCount = shape->GetType() == b2Shape::e_chain ?
+		((b2ChainShape*) shape)->GetEdgeCount() : shape->GetChildCount();
+	for (int32 edgeIndex = 0; edgeIndex < edgeCount; edgeIndex++)
 	{
 		b2EdgeShape edge;
 		if (shape->GetType() == b2Shape::e_edge)
@@ -892,7 +1066,7 @@ void b2ParticleSystem::CreateParticlesStrokeShapeForGroup(
 		else
 		{
 			b2Assert(shape->GetType() == b2Shape::e_chain);
-			((b2ChainShape*) shape)->GetChildEdge(&edge, childIndex);
+			((b2ChainShape*) shape)->GetChildEdge(&edge, edgeIndex);
 		}
 		b2Vec2 d = edge.m_vertex2 - edge.m_vertex1;
 		float32 edgeLength = d.Length();
@@ -1072,7 +1246,7 @@ b2ParticleGroup* b2ParticleSystem::CreateParticleGroup(
 	}
 	int32 lastIndex = m_count;
 
-	void* mem = m_world->m_blockAllocator.Allocate(sizeof(b2ParticleGroup));
+	void* mem = m_blockAllocator.Allocate(sizeof(b2ParticleGroup));
 	b2ParticleGroup* group = new (mem) b2ParticleGroup();
 	group->m_system = this;
 	group->m_firstIndex = firstIndex;
@@ -1156,6 +1330,7 @@ void b2ParticleSystem::JoinParticleGroups(b2ParticleGroup* groupA,
 	uint32 groupFlags = groupA->m_groupFlags | groupB->m_groupFlags;
 	SetGroupFlags(groupA, groupFlags);
 	groupA->m_lastIndex = groupB->m_lastIndex;
+	groupA->m_needsUpdateMass = true;
 	groupB->m_firstIndex = groupB->m_lastIndex;
 	DestroyParticleGroup(groupB);
 }
@@ -1167,7 +1342,7 @@ void b2ParticleSystem::SplitParticleGroup(b2ParticleGroup* group)
 	// We create several linked lists. Each list represents a set of connected
 	// particles.
 	ParticleListNode* nodeBuffer =
-		(ParticleListNode*) m_world->m_stackAllocator.Allocate(
+		(ParticleListNode*) m_stackAllocator->Allocate(
 									sizeof(ParticleListNode) * particleCount);
 	InitializeParticleLists(group, nodeBuffer);
 	MergeParticleListsInContact(group, nodeBuffer);
@@ -1176,7 +1351,7 @@ void b2ParticleSystem::SplitParticleGroup(b2ParticleGroup* group)
 	MergeZombieParticleListNodes(group, nodeBuffer, survivingList);
 	CreateParticleGroupsFromParticleList(group, nodeBuffer, survivingList);
 	UpdatePairsAndTriadsWithParticleList(group, nodeBuffer);
-	m_world->m_stackAllocator.Free(nodeBuffer);
+	m_stackAllocator->Free(nodeBuffer);
 }
 
 void b2ParticleSystem::InitializeParticleLists(
@@ -1397,6 +1572,12 @@ int32 b2ParticleSystem::CloneParticle(int32 oldIndex, b2ParticleGroup* group)
 		m_handleIndexBuffer.data[newIndex] = handle;
 		m_handleIndexBuffer.data[oldIndex] = NULL;
 	}
+	if (m_idSlotIndexBuffer)
+	{
+		m_idSlotIndexBuffer[newIndex] = m_idSlotIndexBuffer[oldIndex];
+		m_idSlotIndexBuffer[oldIndex] = b2_invalidParticleIndex;
+		UpdateParticleIdSlots(newIndex, newIndex + 1);
+	}
 	if (m_lastBodyContactStepBuffer.data)
 	{
 		m_lastBodyContactStepBuffer.data[newIndex] =
@@ -1520,7 +1701,7 @@ void b2ParticleSystem::UpdatePairsAndTriads(
 	if (particleFlags & k_triadFlags)
 	{
 		b2VoronoiDiagram diagram(
-			&m_world->m_stackAllocator, lastIndex - firstIndex);
+			m_stackAllocator, lastIndex - firstIndex);
 		for (int32 i = firstIndex; i < lastIndex; i++)
 		{
 			uint32 flags = m_flagsBuffer.data[i];
@@ -1659,7 +1840,7 @@ void b2ParticleSystem::DestroyParticleGroup(b2ParticleGroup* group)
 
 	--m_groupCount;
 	group->~b2ParticleGroup();
-	m_world->m_blockAllocator.Free(group, sizeof(b2ParticleGroup));
+	m_blockAllocator.Free(group, sizeof(b2ParticleGroup));
 }
 
 void b2ParticleSystem::ComputeWeight()
@@ -1687,8 +1868,8 @@ void b2ParticleSystem::ComputeWeight()
 
 void b2ParticleSystem::ComputeDepth()
 {
-	b2ParticleContact* contactGroups = (b2ParticleContact*) m_world->
-		m_stackAllocator.Allocate(sizeof(b2ParticleContact) * m_contactBuffer.GetCount());
+	b2ParticleContact* contactGroups = (b2ParticleContact*) m_stackAllocator->
+		Allocate(sizeof(b2ParticleContact) * m_contactBuffer.GetCount());
 	int32 contactGroupsCount = 0;
 	for (int32 k = 0; k < m_contactBuffer.GetCount(); k++)
 	{
@@ -1703,8 +1884,8 @@ void b2ParticleSystem::ComputeDepth()
 			contactGroups[contactGroupsCount++] = contact;
 		}
 	}
-	b2ParticleGroup** groupsToUpdate = (b2ParticleGroup**) m_world->
-		m_stackAllocator.Allocate(sizeof(b2ParticleGroup*) * m_groupCount);
+	b2ParticleGroup** groupsToUpdate = (b2ParticleGroup**) m_stackAllocator->
+		Allocate(sizeof(b2ParticleGroup*) * m_groupCount);
 	int32 groupsToUpdateCount = 0;
 	for (b2ParticleGroup* group = m_groupList; group; group = group->GetNext())
 	{
@@ -1789,24 +1970,47 @@ void b2ParticleSystem::ComputeDepth()
 			}
 		}
 	}
-	m_world->m_stackAllocator.Free(groupsToUpdate);
-	m_world->m_stackAllocator.Free(contactGroups);
+	m_stackAllocator->Free(groupsToUpdate);
+	m_stackAllocator->Free(contactGroups);
 }
 
 b2ParticleSystem::InsideBoundsEnumerator
 b2ParticleSystem::GetInsideBoundsEnumerator(const b2AABB& aabb) const
 {
-	uint32 lowerTag = computeTag(m_inverseDiameter * aabb.lowerBound.x - 1,
-								 m_inverseDiameter * aabb.lowerBound.y - 1);
-	uint32 upperTag = computeTag(m_inverseDiameter * aabb.upperBound.x + 1,
-								 m_inverseDiameter * aabb.upperBound.y + 1);
-	const Proxy* beginProxy = m_proxyBuffer.Begin();
-	const Proxy* endProxy = m_proxyBuffer.End();
-	const Proxy* firstProxy = std::lower_bound(beginProxy, endProxy, lowerTag);
-	const Proxy* lastProxy = std::upper_bound(firstProxy, endProxy, upperTag);
+	if (m_def.largeWorld)
+	{
+		uint64 lowerTag, upperTag;
+		const WideProxy *firstProxy, *lastProxy;
+		GetInsideBoundsProxies(m_wideProxyBuffer, aabb, &lowerTag, &upperTag,
+							   &firstProxy, &lastProxy);
+		return InsideBoundsEnumerator(lowerTag, upperTag, firstProxy,
+									  lastProxy);
+	}
+	uint32 lowerTag, upperTag;
+	const Proxy *firstProxy, *lastProxy;
+	GetInsideBoundsProxies(m_proxyBuffer, aabb, &lowerTag, &upperTag,
+						   &firstProxy, &lastProxy);
 	return InsideBoundsEnumerator(lowerTag, upperTag, firstProxy, lastProxy);
 }
 
+template <typename T>
+void b2ParticleSystem::GetInsideBoundsProxies(
+	const b2GrowableBuffer<TaggedProxy<T> >& proxies, const b2AABB& aabb,
+	T* lowerTag, T* upperTag, const TaggedProxy<T>** first,
+	const TaggedProxy<T>** last) const
+{
+	*lowerTag = b2ProxyTag<T>::Compute(
+		m_inverseDiameter * aabb.lowerBound.x - 1,
+		m_inverseDiameter * aabb.lowerBound.y - 1);
+	*upperTag = b2ProxyTag<T>::Compute(
+		m_inverseDiameter * aabb.upperBound.x + 1,
+		m_inverseDiameter * aabb.upperBound.y + 1);
+	const TaggedProxy<T>* beginProxy = proxies.Begin();
+	const TaggedProxy<T>* endProxy = proxies.End();
+	*first = std::lower_bound(beginProxy, endProxy, *lowerTag);
+	*last = std::upper_bound(*first, endProxy, *upperTag);
+}
+
 inline void b2ParticleSystem::AddContact(int32 a, int32 b,
 	b2GrowableBuffer<b2ParticleContact>& contacts) const
 {
@@ -1816,6 +2020,9 @@ inline void b2ParticleSystem::AddContact(int32 a, int32 b,
 	{
 		float32 invD = b2InvSqrt(distBtParticlesSq);
 		b2ParticleContact& contact = contacts.Append();
+		// SetIndices and SetFlags share the flags word with 16-bit
+		// indices, so it must start out cleared.
+		contact = b2ParticleContact();
 		contact.SetIndices(a, b);
 		contact.SetFlags(m_flagsBuffer.data[a] | m_flagsBuffer.data[b]);
 		// 1 - distBtParticles / diameter
@@ -1827,25 +2034,41 @@ inline void b2ParticleSystem::AddContact(int32 a, int32 b,
 void b2ParticleSystem::FindContacts_Reference(
 	b2GrowableBuffer<b2ParticleContact>& contacts) const
 {
-	const Proxy* beginProxy = m_proxyBuffer.Begin();
-	const Proxy* endProxy = m_proxyBuffer.End();
+	if (m_def.largeWorld)
+	{
+		FindContactsInProxies(m_wideProxyBuffer, contacts);
+	}
+	else
+	{
+		FindContactsInProxies(m_proxyBuffer, contacts);
+	}
+}
+
+template <typename T>
+void b2ParticleSystem::FindContactsInProxies(
+	const b2GrowableBuffer<TaggedProxy<T> >& proxies,
+	b2GrowableBuffer<b2ParticleContact>& contacts) const
+{
+	const TaggedProxy<T>* beginProxy = proxies.Begin();
+	const TaggedProxy<T>* endProxy = proxies.End();
 
 	contacts.SetCount(0);
-	for (const Proxy *a = beginProxy, *c = beginProxy; a < endProxy; a++)
+	for (const TaggedProxy<T> *a = beginProxy, *c = beginProxy; a < endProxy;
+		 a++)
 	{
-		uint32 rightTag = computeRelativeTag(a->tag, 1, 0);
-		for (const Proxy* b = a + 1; b < endProxy; b++)
+		T rightTag = computeRelativeTag(a->tag, 1, 0);
+		for (const TaggedProxy<T>* b = a + 1; b < endProxy; b++)
 		{
 			if (rightTag < b->tag) break;
 			AddContact(a->index, b->index, contacts);
 		}
-		uint32 bottomLeftTag = computeRelativeTag(a->tag, -1, 1);
+		T bottomLeftTag = computeRelativeTag(a->tag, -1, 1);
 		for (; c < endProxy; c++)
 		{
 			if (bottomLeftTag <= c->tag) break;
 		}
-		uint32 bottomRightTag = computeRelativeTag(a->tag, 1, 1);
-		for (const Proxy* b = c; b < endProxy; b++)
+		T bottomRightTag = computeRelativeTag(a->tag, 1, 1);
+		for (const TaggedProxy<T>* b = c; b < endProxy; b++)
 		{
 			if (bottomRightTag < b->tag) break;
 			AddContact(a->index, b->index, contacts);
@@ -1955,7 +2178,7 @@ void b2ParticleSystem::FindContacts_Simd(
 
 	const int alignedCount = m_count + NUM_V32_SLOTS;
 	FindContactInput* reordered = (FindContactInput*)
-		m_world->m_stackAllocator.Allocate(
+		m_stackAllocator->Allocate(
 			sizeof(FindContactInput) * alignedCount);
 
 	// Put positions and indices into proxy-order.
@@ -1966,7 +2189,7 @@ void b2ParticleSystem::FindContacts_Simd(
 	// positions. This reduces the number of narrow-band contact checks
 	// that use actual positions.
 	static const int MAX_EXPECTED_CHECKS_PER_PARTICLE = 3;
-	b2GrowableBuffer<FindContactCheck> checks(m_world->m_blockAllocator);
+	b2GrowableBuffer<FindContactCheck> checks(m_blockAllocator);
 	checks.Reserve(MAX_EXPECTED_CHECKS_PER_PARTICLE * m_count);
 	GatherChecks(checks);
 
@@ -1977,7 +2200,7 @@ void b2ParticleSystem::FindContacts_Simd(
 								m_squaredDiameter, m_inverseDiameter,
 								m_flagsBuffer.data, contacts);
 
-	m_world->m_stackAllocator.Free(reordered);
+	m_stackAllocator->Free(reordered);
 }
 #endif // defined(LIQUIDFUN_SIMD_NEON)
 
@@ -1986,6 +2209,13 @@ void b2ParticleSystem::FindContacts(
 	b2GrowableBuffer<b2ParticleContact>& contacts) const
 {
 	#if defined(LIQUIDFUN_SIMD_NEON)
+		// The SIMD path only supports 32-bit tags and FindContactCheck holds
+		// 16-bit proxy positions.
+		if (m_def.largeWorld || m_count > 0x10000)
+		{
+			FindContacts_Reference(contacts);
+			return;
+		}
 		FindContacts_Simd(contacts);
 	#else
 		FindContacts_Reference(contacts);
@@ -1993,7 +2223,7 @@ void b2ParticleSystem::FindContacts(
 
 	#if defined(LIQUIDFUN_SIMD_TEST_VS_REFERENCE)
 		b2GrowableBuffer<b2ParticleContact>
-			reference(m_world->m_blockAllocator);
+			reference(m_blockAllocator);
 		FindContacts_Reference(reference);
 
 		b2Assert(contacts.GetCount() == reference.GetCount());
@@ -2027,16 +2257,17 @@ inline b2ContactListener* b2ParticleSystem::GetParticleContactListener() const
 
 // Recalculate 'tag' in proxies using m_positionBuffer.
 // The 'tag' is an approximation of position, in left-right, top-bottom order.
+template <typename T>
 void b2ParticleSystem::UpdateProxies_Reference(
-	b2GrowableBuffer<Proxy>& proxies) const
+	b2GrowableBuffer<TaggedProxy<T> >& proxies) const
 {
-	const Proxy* const endProxy = proxies.End();
-	for (Proxy* proxy = proxies.Begin(); proxy < endProxy; ++proxy)
+	const TaggedProxy<T>* const endProxy = proxies.End();
+	for (TaggedProxy<T>* proxy = proxies.Begin(); proxy < endProxy; ++proxy)
 	{
 		int32 i = proxy->index;
 		b2Vec2 p = m_positionBuffer.data[i];
-		proxy->tag = computeTag(m_inverseDiameter * p.x,
-								m_inverseDiameter * p.y);
+		proxy->tag = b2ProxyTag<T>::Compute(m_inverseDiameter * p.x,
+											m_inverseDiameter * p.y);
 	}
 }
 
@@ -2057,7 +2288,7 @@ void b2ParticleSystem::UpdateProxies_Simd(
 	b2GrowableBuffer<Proxy>& proxies) const
 {
 	uint32* tags = (uint32*)
-		m_world->m_stackAllocator.Allocate(m_count * sizeof(uint32));
+		m_stackAllocator->Allocate(m_count * sizeof(uint32));
 
 	// Calculate tag for every position.
 	// 'tags' array is in position-order.
@@ -2067,7 +2298,7 @@ void b2ParticleSystem::UpdateProxies_Simd(
 	// Update 'tag' element in the 'proxies' array to the new values.
 	UpdateProxyTags(tags, proxies);
 
-	m_world->m_stackAllocator.Free(tags);
+	m_stackAllocator->Free(tags);
 }
 #endif // defined(LIQUIDFUN_SIMD_NEON)
 
@@ -2147,6 +2378,12 @@ void b2ParticleSystem::UpdateProxies(
 	#endif
 }
 
+void b2ParticleSystem::UpdateProxies(
+	b2GrowableBuffer<WideProxy>& proxies) const
+{
+	UpdateProxies_Reference(proxies);
+}
+
 
 // Sort the proxy array by 'tag'. This orders the particles into rows that
 // run left-to-right, top-to-bottom. The rows are spaced m_particleDiameter
@@ -2157,11 +2394,25 @@ void b2ParticleSystem::UpdateProxies(
 // TODO OPT: The sort is a hot spot on the profiles. We could use SIMD to
 // speed this up. See http://www.vldb.org/pvldb/1/1454171.pdf for an excellent
 // explanation of a SIMD mergesort algorithm.
-void b2ParticleSystem::SortProxies(b2GrowableBuffer<Proxy>& proxies) const
+template <typename T>
+void b2ParticleSystem::SortProxies(
+	b2GrowableBuffer<TaggedProxy<T> >& proxies) const
 {
 	std::sort(proxies.Begin(), proxies.End());
 }
 
+// static
+template <typename T, typename IndexMap>
+void b2ParticleSystem::RemapProxies(
+	b2GrowableBuffer<TaggedProxy<T> >& proxies, const IndexMap& newIndices)
+{
+	TaggedProxy<T>* const endProxy = proxies.End();
+	for (TaggedProxy<T>* proxy = proxies.Begin(); proxy < endProxy; ++proxy)
+	{
+		proxy->index = newIndices[proxy->index];
+	}
+}
+
 class b2ParticleContactRemovePredicate
 {
 public:
@@ -2258,10 +2509,18 @@ void b2ParticleSystem::NotifyContactListenerPostContact(
 
 void b2ParticleSystem::UpdateContacts(bool exceptZombie)
 {
-	UpdateProxies(m_proxyBuffer);
-	SortProxies(m_proxyBuffer);
+	if (m_def.largeWorld)
+	{
+		UpdateProxies(m_wideProxyBuffer);
+		SortProxies(m_wideProxyBuffer);
+	}
+	else
+	{
+		UpdateProxies(m_proxyBuffer);
+		SortProxies(m_proxyBuffer);
+	}
 
-	b2ParticlePairSet particlePairs(&m_world->m_stackAllocator);
+	b2ParticlePairSet particlePairs(m_stackAllocator);
 	NotifyContactListenerPreContact(&particlePairs);
 
 	FindContacts(m_contactBuffer);
@@ -2330,6 +2589,24 @@ inline b2ContactFilter* b2ParticleSystem::GetFixtureContactFilter() const
 		m_world->m_contactManager.m_contactFilter : NULL;
 }
 
+bool b2ParticleSystem::CallsListeners()
+{
+	if (m_needsUpdateAllParticleFlags)
+	{
+		UpdateAllParticleFlags();
+	}
+	if (GetParticleContactFilter() || GetParticleContactListener() ||
+		GetFixtureContactFilter() || GetFixtureContactListener())
+	{
+		return true;
+	}
+	// Particles and groups destroyed during the step say goodbye to the
+	// destruction listener.
+	return m_world->m_destructionListener &&
+		(m_expirationTimeBuffer.data ||
+		 (m_allParticleFlags & b2_zombieParticle));
+}
+
 /// Compute the axis-aligned bounding box for all particles contained
 /// within this particle system.
 /// @param aabb Returns the axis-aligned bounding box of the system.
@@ -2610,7 +2887,7 @@ void b2ParticleSystem::UpdateBodyContacts()
 {
 	// If the particle contact listener is enabled, generate a set of
 	// fixture / particle contacts.
-	FixtureParticleSet fixtureSet(&m_world->m_stackAllocator);
+	FixtureParticleSet fixtureSet(m_stackAllocator);
 	NotifyBodyContactListenerPreContact(&fixtureSet);
 
 	if (m_stuckThreshold > 0)
@@ -3515,30 +3792,103 @@ void b2ParticleSystem::SolveWall()
 	}
 }
 
+/// Solves a range of the rigid groups gathered by
+/// b2ParticleSystem::SolveRigid.
+class b2RigidGroupSolveTask : public b2Task
+{
+public:
+	b2RigidGroupSolveTask(b2ParticleSystem* system, b2ParticleGroup** groups,
+						  const b2TimeStep& step) :
+		m_system(system), m_groups(groups), m_step(step)
+	{
+	}
+
+	virtual void Execute(int32 begin, int32 end, int32 threadIndex)
+	{
+		B2_NOT_USED(threadIndex);
+		for (int32 k = begin; k < end; ++k)
+		{
+			m_system->SolveRigidGroup(m_groups[k], m_step);
+		}
+	}
+
+	b2ParticleSystem* m_system;
+	b2ParticleGroup** m_groups;
+	const b2TimeStep& m_step;
+};
+
 void b2ParticleSystem::SolveRigid(const b2TimeStep& step)
 {
-	for (b2ParticleGroup* group = m_groupList; group; group = group->GetNext())
+	// Each rigid group only reads and writes its own range of particles so
+	// the groups can be solved independently of each other. Systems solved
+	// on an executor thread already run inside b2TaskExecutor::Run, which
+	// isn't reentrant, so only the world's thread hands groups out.
+	b2TaskExecutor* executor = m_world->m_taskExecutor;
+	int32 rigidCount = 0;
+	if (executor && m_stackAllocator == &m_world->m_stackAllocator)
 	{
-		if (group->m_groupFlags & b2_rigidParticleGroup)
+		for (b2ParticleGroup* group = m_groupList; group;
+			 group = group->GetNext())
 		{
-			group->UpdateStatistics();
-			b2Rot rotation(step.dt * group->m_angularVelocity);
-			b2Transform transform(
-				group->m_center + step.dt * group->m_linearVelocity -
-				b2Mul(rotation, group->m_center), rotation);
-			group->m_transform = b2Mul(transform, group->m_transform);
-			b2Transform velocityTransform;
-			velocityTransform.p.x = step.inv_dt * transform.p.x;
-			velocityTransform.p.y = step.inv_dt * transform.p.y;
-			velocityTransform.q.s = step.inv_dt * transform.q.s;
-			velocityTransform.q.c = step.inv_dt * (transform.q.c - 1);
-			for (int32 i = group->m_firstIndex; i < group->m_lastIndex; i++)
+			if (group->m_groupFlags & b2_rigidParticleGroup)
 			{
-				m_velocityBuffer.data[i] = b2Mul(velocityTransform,
-												 m_positionBuffer.data[i]);
+				++rigidCount;
 			}
 		}
 	}
+
+	if (rigidCount < 2)
+	{
+		for (b2ParticleGroup* group = m_groupList; group;
+			 group = group->GetNext())
+		{
+			if (group->m_groupFlags & b2_rigidParticleGroup)
+			{
+				SolveRigidGroup(group, step);
+			}
+		}
+		return;
+	}
+
+	b2ParticleGroup** groups = (b2ParticleGroup**)m_stackAllocator->
+		Allocate(rigidCount * sizeof(b2ParticleGroup*));
+	int32 index = 0;
+	for (b2ParticleGroup* group = m_groupList; group; group = group->GetNext())
+	{
+		if (group->m_groupFlags & b2_rigidParticleGroup)
+		{
+			groups[index++] = group;
+		}
+	}
+	b2RigidGroupSolveTask task(this, groups, step);
+	executor->Run(&task, rigidCount);
+	m_stackAllocator->Free(groups);
+}
+
+// Gather the statistics of a rigid group and write the velocities of its
+// particles back to back, while they are in cache. The velocities depend on
+// sums over the whole group, so the two can't share a pass.
+void b2ParticleSystem::SolveRigidGroup(b2ParticleGroup* group,
+									   const b2TimeStep& step)
+{
+	// Usually a single pass as the mass properties of the group are
+	// cached, see b2ParticleGroup::UpdateRigidStatistics().
+	group->UpdateStatistics();
+	b2Rot rotation(step.dt * group->m_angularVelocity);
+	b2Transform transform(
+		group->m_center + step.dt * group->m_linearVelocity -
+		b2Mul(rotation, group->m_center), rotation);
+	group->m_transform = b2Mul(transform, group->m_transform);
+	b2Transform velocityTransform;
+	velocityTransform.p.x = step.inv_dt * transform.p.x;
+	velocityTransform.p.y = step.inv_dt * transform.p.y;
+	velocityTransform.q.s = step.inv_dt * transform.q.s;
+	velocityTransform.q.c = step.inv_dt * (transform.q.c - 1);
+	for (int32 i = group->m_firstIndex; i < group->m_lastIndex; i++)
+	{
+		m_velocityBuffer.data[i] = b2Mul(velocityTransform,
+										 m_positionBuffer.data[i]);
+	}
 }
 
 void b2ParticleSystem::SolveElastic(const b2TimeStep& step)
@@ -3800,7 +4150,7 @@ void b2ParticleSystem::SolveZombie()
 {
 	// removes particles with zombie flag
 	int32 newCount = 0;
-	int32* newIndices = (int32*) m_world->m_stackAllocator.Allocate(
+	int32* newIndices = (int32*) m_stackAllocator->Allocate(
 		sizeof(int32) * m_count);
 	uint32 allParticleFlags = 0;
 	for (int32 i = 0; i < m_count; i++)
@@ -3826,6 +4176,10 @@ void b2ParticleSystem::SolveZombie()
 					m_handleAllocator.Free(handle);
 				}
 			}
+			if (m_idSlotIndexBuffer)
+			{
+				FreeParticleId(i);
+			}
 			newIndices[i] = b2_invalidParticleIndex;
 		}
 		else
@@ -3841,6 +4195,10 @@ void b2ParticleSystem::SolveZombie()
 					if (handle) handle->SetIndex(newCount);
 					m_handleIndexBuffer.data[newCount] = handle;
 				}
+				if (m_idSlotIndexBuffer)
+				{
+					m_idSlotIndexBuffer[newCount] = m_idSlotIndexBuffer[i];
+				}
 				m_flagsBuffer.data[newCount] = m_flagsBuffer.data[i];
 				if (m_lastBodyContactStepBuffer.data)
 				{
@@ -3899,6 +4257,10 @@ void b2ParticleSystem::SolveZombie()
 		{
 			return proxy.index < 0;
 		}
+		static bool IsWideProxyInvalid(const WideProxy& proxy)
+		{
+			return proxy.index < 0;
+		}
 		static bool IsContactInvalid(const b2ParticleContact& contact)
 		{
 			return contact.GetIndexA() < 0 || contact.GetIndexB() < 0;
@@ -3918,12 +4280,10 @@ void b2ParticleSystem::SolveZombie()
 	};
 
 	// update proxies
-	for (int32 k = 0; k < m_proxyBuffer.GetCount(); k++)
-	{
-		Proxy& proxy = m_proxyBuffer.Begin()[k];
-		proxy.index = newIndices[proxy.index];
-	}
+	RemapProxies(m_proxyBuffer, newIndices);
 	m_proxyBuffer.RemoveIf(Test::IsProxyInvalid);
+	RemapProxies(m_wideProxyBuffer, newIndices);
+	m_wideProxyBuffer.RemoveIf(Test::IsWideProxyInvalid);
 
 	// update contacts
 	for (int32 k = 0; k < m_contactBuffer.GetCount(); k++)
@@ -3961,6 +4321,12 @@ void b2ParticleSystem::SolveZombie()
 	}
 	m_triadBuffer.RemoveIf(Test::IsTriadInvalid);
 
+	// update particle ids
+	if (m_idSlotIndexBuffer)
+	{
+		UpdateParticleIdSlots(0, newCount);
+	}
+
 	// Update lifetime indices.
 	if (m_indexByExpirationTimeBuffer.data)
 	{
@@ -3998,6 +4364,7 @@ void b2ParticleSystem::SolveZombie()
 			group->m_lastIndex = lastIndex;
 			if (modified)
 			{
+				group->m_needsUpdateMass = true;
 				if (group->m_groupFlags & b2_solidParticleGroup)
 				{
 					SetGroupFlags(group,
@@ -4020,7 +4387,7 @@ void b2ParticleSystem::SolveZombie()
 
 	// update particle count
 	m_count = newCount;
-	m_world->m_stackAllocator.Free(newIndices);
+	m_stackAllocator->Free(newIndices);
 	m_allParticleFlags = allParticleFlags;
 	m_needsUpdateAllParticleFlags = false;
 
@@ -4176,6 +4543,12 @@ void b2ParticleSystem::RotateBuffer(int32 start, int32 mid, int32 end)
 			if (handle) handle->SetIndex(newIndices[handle->GetIndex()]);
 		}
 	}
+	if (m_idSlotIndexBuffer)
+	{
+		std::rotate(m_idSlotIndexBuffer + start, m_idSlotIndexBuffer + mid,
+					m_idSlotIndexBuffer + end);
+		UpdateParticleIdSlots(start, end);
+	}
 
 	if (m_expirationTimeBuffer.data)
 	{
@@ -4193,11 +4566,8 @@ void b2ParticleSystem::RotateBuffer(int32 start, int32 mid, int32 end)
 	}
 
 	// update proxies
-	for (int32 k = 0; k < m_proxyBuffer.GetCount(); k++)
-	{
-		Proxy& proxy = m_proxyBuffer.Begin()[k];
-		proxy.index = newIndices[proxy.index];
-	}
+	RemapProxies(m_proxyBuffer, newIndices);
+	RemapProxies(m_wideProxyBuffer, newIndices);
 
 	// update contacts
 	for (int32 k = 0; k < m_contactBuffer.GetCount(); k++)
@@ -4350,7 +4720,7 @@ template <typename T> void b2ParticleSystem::SetUserOverridableBuffer(
 	b2Assert((newData && newCapacity) || (!newData && !newCapacity));
 	if (!buffer->userSuppliedCapacity && buffer->data)
 	{
-		m_world->m_blockAllocator.Free(
+		m_blockAllocator.Free(
 			buffer->data, sizeof(T) * m_internalAllocatedCapacity);
 	}
 	buffer->data = newData;
@@ -4366,6 +4736,7 @@ void b2ParticleSystem::SetPositionBuffer(b2Vec2* buffer,
 												 int32 capacity)
 {
 	SetUserOverridableBuffer(&m_positionBuffer, buffer, capacity);
+	++m_positionTimestamp;
 }
 
 void b2ParticleSystem::SetVelocityBuffer(b2Vec2* buffer,
@@ -4419,6 +4790,12 @@ void b2ParticleSystem::SetGroupFlags(
 		// If the b2_solidParticleGroup flag changed schedule depth update.
 		newFlags |= b2_particleGroupNeedsUpdateDepth;
 	}
+	if ((*oldFlags ^ newFlags) & b2_rigidParticleGroup)
+	{
+		// Particles of a group that wasn't rigid may have moved relative to
+		// each other so the cached mass properties are stale.
+		group->m_needsUpdateMass = true;
+	}
 	if (*oldFlags & ~newFlags)
 	{
 		// If any flags might be removed
@@ -4508,23 +4885,38 @@ void b2ParticleSystem::ApplyLinearImpulse(int32 firstIndex, int32 lastIndex,
 void b2ParticleSystem::QueryAABB(b2QueryCallback* callback,
 								 const b2AABB& aabb) const
 {
-	if (m_proxyBuffer.GetCount() == 0)
+	if (m_def.largeWorld)
+	{
+		QueryProxies(m_wideProxyBuffer, callback, aabb);
+	}
+	else
+	{
+		QueryProxies(m_proxyBuffer, callback, aabb);
+	}
+}
+
+template <typename T>
+void b2ParticleSystem::QueryProxies(
+	const b2GrowableBuffer<TaggedProxy<T> >& proxies,
+	b2QueryCallback* callback, const b2AABB& aabb) const
+{
+	if (proxies.GetCount() == 0)
 	{
 		return;
 	}
-	const Proxy* beginProxy = m_proxyBuffer.Begin();
-	const Proxy* endProxy = m_proxyBuffer.End();
-	const Proxy* firstProxy = std::lower_bound(
+	const TaggedProxy<T>* beginProxy = proxies.Begin();
+	const TaggedProxy<T>* endProxy = proxies.End();
+	const TaggedProxy<T>* firstProxy = std::lower_bound(
 		beginProxy, endProxy,
-		computeTag(
+		b2ProxyTag<T>::Compute(
 			m_inverseDiameter * aabb.lowerBound.x,
 			m_inverseDiameter * aabb.lowerBound.y));
-	const Proxy* lastProxy = std::upper_bound(
+	const TaggedProxy<T>* lastProxy = std::upper_bound(
 		firstProxy, endProxy,
-		computeTag(
+		b2ProxyTag<T>::Compute(
 			m_inverseDiameter * aabb.upperBound.x,
 			m_inverseDiameter * aabb.upperBound.y));
-	for (const Proxy* proxy = firstProxy; proxy < lastProxy; ++proxy)
+	for (const TaggedProxy<T>* proxy = firstProxy; proxy < lastProxy; ++proxy)
 	{
 		int32 i = proxy->index;
 		const b2Vec2& p = m_positionBuffer.data[i];
@@ -4552,7 +4944,7 @@ void b2ParticleSystem::RayCast(b2RayCastCallback* callback,
 							   const b2Vec2& point1,
 							   const b2Vec2& point2) const
 {
-	if (m_proxyBuffer.GetCount() == 0)
+	if (m_count == 0)
 	{
 		return;
 	}
@@ -4668,3 +5060,440 @@ b2ParticleSystem::b2ExceptionType b2ParticleSystem::IsBufCopyValid(
 }
 
 #endif // LIQUIDFUN_EXTERNAL_LANGUAGE_API
+
+// Optional buffers written by b2ParticleSystem::Serialize.
+enum
+{
+	b2_serializeForceBuffer			= 0x0001,
+	b2_serializeColorBuffer			= 0x0002,
+	b2_serializeDepthBuffer			= 0x0004,
+	b2_serializeStuckBuffers		= 0x0008,
+	b2_serializeExpirationBuffers	= 0x0010,
+	b2_serializeIdSlotIndexBuffer	= 0x0020
+};
+
+void b2ParticleSystem::Serialize(b2BinaryWriter* writer) const
+{
+	uint32 buffers = 0;
+	if (m_hasForce)
+	{
+		buffers |= b2_serializeForceBuffer;
+	}
+	if (m_colorBuffer.data)
+	{
+		buffers |= b2_serializeColorBuffer;
+	}
+	if (m_depthBuffer)
+	{
+		buffers |= b2_serializeDepthBuffer;
+	}
+	if (m_lastBodyContactStepBuffer.data && m_bodyContactCountBuffer.data &&
+		m_consecutiveContactStepsBuffer.data)
+	{
+		buffers |= b2_serializeStuckBuffers;
+	}
+	if (m_expirationTimeBuffer.data && m_indexByExpirationTimeBuffer.data)
+	{
+		buffers |= b2_serializeExpirationBuffers;
+	}
+	if (m_idSlotIndexBuffer)
+	{
+		buffers |= b2_serializeIdSlotIndexBuffer;
+	}
+	writer->Write(buffers);
+
+	writer->Write(m_paused);
+	writer->Write(m_timestamp);
+	writer->Write(m_iterationIndex);
+	writer->Write(m_stuckThreshold);
+	writer->Write(m_timeElapsed);
+	writer->Write(m_expirationTimeBufferRequiresSorting);
+
+	writer->Write(m_count);
+	writer->WriteArray(m_flagsBuffer.data, m_count);
+	writer->WriteArray(m_positionBuffer.data, m_count);
+	writer->WriteArray(m_velocityBuffer.data, m_count);
+	if (buffers & b2_serializeForceBuffer)
+	{
+		writer->WriteArray(m_forceBuffer, m_count);
+	}
+	if (buffers & b2_serializeColorBuffer)
+	{
+		writer->WriteArray(m_colorBuffer.data, m_count);
+	}
+	if (buffers & b2_serializeDepthBuffer)
+	{
+		writer->WriteArray(m_depthBuffer, m_count);
+	}
+	if (buffers & b2_serializeStuckBuffers)
+	{
+		writer->WriteArray(m_lastBodyContactStepBuffer.data, m_count);
+		writer->WriteArray(m_bodyContactCountBuffer.data, m_count);
+		writer->WriteArray(m_consecutiveContactStepsBuffer.data, m_count);
+	}
+	if (buffers & b2_serializeExpirationBuffers)
+	{
+		writer->WriteArray(m_expirationTimeBuffer.data, m_count);
+		writer->WriteArray(m_indexByExpirationTimeBuffer.data, m_count);
+	}
+	if (buffers & b2_serializeIdSlotIndexBuffer)
+	{
+		writer->WriteArray(m_idSlotIndexBuffer, m_count);
+	}
+	writer->Write(m_idSlotBuffer.GetCount());
+	writer->WriteArray(m_idSlotBuffer.Data(), m_idSlotBuffer.GetCount());
+	writer->Write(m_freeIdSlot);
+
+	// Groups are written from the end of the list, so that the list is in
+	// the same order once they're read back. The group of each particle is
+	// written as its position in that order.
+	writer->Write(m_groupCount);
+	int32* groupIndices = (int32*)m_stackAllocator->Allocate(
+		m_count * sizeof(int32));
+	for (int32 i = 0; i < m_count; i++)
+	{
+		groupIndices[i] = b2_invalidParticleIndex;
+	}
+	const b2ParticleGroup* last = m_groupList;
+	while (last && last->m_next)
+	{
+		last = last->m_next;
+	}
+	int32 groupIndex = 0;
+	for (const b2ParticleGroup* group = last; group; group = group->m_prev)
+	{
+		writer->Write(group->m_firstIndex);
+		writer->Write(group->m_lastIndex);
+		writer->Write(group->m_groupFlags);
+		writer->Write(group->m_strength);
+		writer->Write(group->m_timestamp);
+		writer->Write(group->m_mass);
+		writer->Write(group->m_inertia);
+		writer->Write(group->m_center);
+		writer->Write(group->m_linearVelocity);
+		writer->Write(group->m_angularVelocity);
+		writer->Write(group->m_transform);
+		writer->Write(group->m_unitInertia);
+		writer->Write(group->m_needsUpdateMass ||
+					  group->m_positionTimestamp != m_positionTimestamp);
+		for (int32 i = group->m_firstIndex; i < group->m_lastIndex; i++)
+		{
+			if (m_groupBuffer[i] == group)
+			{
+				groupIndices[i] = groupIndex;
+			}
+		}
+		++groupIndex;
+	}
+	writer->WriteArray(groupIndices, m_count);
+	m_stackAllocator->Free(groupIndices);
+
+	writer->Write(m_pairBuffer.GetCount());
+	writer->WriteArray(m_pairBuffer.Data(), m_pairBuffer.GetCount());
+	writer->Write(m_triadBuffer.GetCount());
+	writer->WriteArray(m_triadBuffer.Data(), m_triadBuffer.GetCount());
+}
+
+bool b2ParticleSystem::Deserialize(b2BinaryReader* reader,
+								   b2ParticleGroup** reusableGroups)
+{
+	b2Assert(m_count == 0 && m_groupCount == 0);
+	if (m_count || m_groupCount)
+	{
+		return false;
+	}
+
+	uint32 buffers;
+	reader->Read(&buffers);
+	reader->Read(&m_paused);
+	reader->Read(&m_timestamp);
+	reader->Read(&m_iterationIndex);
+	reader->Read(&m_stuckThreshold);
+	reader->Read(&m_timeElapsed);
+	reader->Read(&m_expirationTimeBufferRequiresSorting);
+
+	int32 count = reader->ReadCount(
+		sizeof(uint32) + 2 * sizeof(b2Vec2) + sizeof(int32));
+	if (count > 0)
+	{
+		ReallocateInternalAllocatedBuffers(
+			b2Max(count, (int32)b2_minParticleSystemBufferCapacity));
+	}
+	if (reader->HasFailed() || count > m_internalAllocatedCapacity)
+	{
+		return false;
+	}
+
+	m_count = count;
+	reader->ReadArray(m_flagsBuffer.data, count);
+	reader->ReadArray(m_positionBuffer.data, count);
+	reader->ReadArray(m_velocityBuffer.data, count);
+	m_hasForce = (buffers & b2_serializeForceBuffer) != 0;
+	if (m_hasForce)
+	{
+		reader->ReadArray(m_forceBuffer, count);
+	}
+	else if (count > 0)
+	{
+		std::fill(m_forceBuffer, m_forceBuffer + count, b2Vec2_zero);
+	}
+	if (count > 0)
+	{
+		memset(m_weightBuffer, 0, count * sizeof(float32));
+	}
+	if (buffers & b2_serializeColorBuffer)
+	{
+		m_colorBuffer.data = RequestBuffer(m_colorBuffer.data);
+		reader->ReadArray(m_colorBuffer.data, count);
+	}
+	if (buffers & b2_serializeDepthBuffer)
+	{
+		m_depthBuffer = RequestBuffer(m_depthBuffer);
+		reader->ReadArray(m_depthBuffer, count);
+	}
+	if (buffers & b2_serializeStuckBuffers)
+	{
+		m_lastBodyContactStepBuffer.data = RequestBuffer(
+			m_lastBodyContactStepBuffer.data);
+		m_bodyContactCountBuffer.data = RequestBuffer(
+			m_bodyContactCountBuffer.data);
+		m_consecutiveContactStepsBuffer.data = RequestBuffer(
+			m_consecutiveContactStepsBuffer.data);
+		reader->ReadArray(m_lastBodyContactStepBuffer.data, count);
+		reader->ReadArray(m_bodyContactCountBuffer.data, count);
+		reader->ReadArray(m_consecutiveContactStepsBuffer.data, count);
+	}
+	if (buffers & b2_serializeExpirationBuffers)
+	{
+		m_expirationTimeBuffer.data = RequestBuffer(
+			m_expirationTimeBuffer.data);
+		m_indexByExpirationTimeBuffer.data = RequestBuffer(
+			m_indexByExpirationTimeBuffer.data);
+		reader->ReadArray(m_expirationTimeBuffer.data, count);
+		reader->ReadArray(m_indexByExpirationTimeBuffer.data, count);
+	}
+	if (buffers & b2_serializeIdSlotIndexBuffer)
+	{
+		m_idSlotIndexBuffer = RequestBuffer(m_idSlotIndexBuffer);
+		reader->ReadArray(m_idSlotIndexBuffer, count);
+	}
+	int32 idSlotCount = reader->ReadCount(sizeof(IdSlot));
+	m_idSlotBuffer.Reserve(idSlotCount);
+	m_idSlotBuffer.SetCount(idSlotCount);
+	reader->ReadArray(m_idSlotBuffer.Data(), idSlotCount);
+	reader->Read(&m_freeIdSlot);
+
+	for (int32 i = 0; i < count; i++)
+	{
+		if (m_def.largeWorld)
+		{
+			m_wideProxyBuffer.Append().index = i;
+		}
+		else
+		{
+			m_proxyBuffer.Append().index = i;
+		}
+	}
+
+	int32 groupCount = reader->ReadCount(2 * sizeof(int32));
+	bool validGroups = true;
+	b2ParticleGroup** groups = (b2ParticleGroup**)m_stackAllocator->Allocate(
+		groupCount * sizeof(b2ParticleGroup*));
+	for (int32 k = 0; k < groupCount; k++)
+	{
+		b2ParticleGroup* group = reusableGroups ? *reusableGroups : NULL;
+		if (group)
+		{
+			*reusableGroups = group->m_next;
+		}
+		else
+		{
+			void* mem = m_blockAllocator.Allocate(sizeof(b2ParticleGroup));
+			group = new (mem) b2ParticleGroup();
+		}
+		group->m_system = this;
+		reader->Read(&group->m_firstIndex);
+		reader->Read(&group->m_lastIndex);
+		reader->Read(&group->m_groupFlags);
+		reader->Read(&group->m_strength);
+		reader->Read(&group->m_timestamp);
+		reader->Read(&group->m_mass);
+		reader->Read(&group->m_inertia);
+		reader->Read(&group->m_center);
+		reader->Read(&group->m_linearVelocity);
+		reader->Read(&group->m_angularVelocity);
+		reader->Read(&group->m_transform);
+		reader->Read(&group->m_unitInertia);
+		reader->Read(&group->m_needsUpdateMass);
+		group->m_positionTimestamp = m_positionTimestamp;
+		if (group->m_firstIndex < 0 || group->m_firstIndex > group->m_lastIndex ||
+			group->m_lastIndex > count)
+		{
+			// Keep the group valid, so that it can be destroyed.
+			group->m_firstIndex = 0;
+			group->m_lastIndex = 0;
+			validGroups = false;
+		}
+		group->m_prev = NULL;
+		group->m_next = m_groupList;
+		if (m_groupList)
+		{
+			m_groupList->m_prev = group;
+		}
+		m_groupList = group;
+		++m_groupCount;
+		groups[k] = group;
+	}
+	for (int32 i = 0; i < count; i++)
+	{
+		int32 groupIndex;
+		reader->Read(&groupIndex);
+		m_groupBuffer[i] = 0 <= groupIndex && groupIndex < groupCount ?
+			groups[groupIndex] : NULL;
+	}
+	m_stackAllocator->Free(groups);
+
+	int32 pairCount = reader->ReadCount(sizeof(b2ParticlePair));
+	m_pairBuffer.Reserve(pairCount);
+	m_pairBuffer.SetCount(pairCount);
+	reader->ReadArray(m_pairBuffer.Data(), pairCount);
+	int32 triadCount = reader->ReadCount(sizeof(b2ParticleTriad));
+	m_triadBuffer.Reserve(triadCount);
+	m_triadBuffer.SetCount(triadCount);
+	reader->ReadArray(m_triadBuffer.Data(), triadCount);
+
+	m_needsUpdateAllParticleFlags = true;
+	m_needsUpdateAllGroupFlags = true;
+	UpdateAllParticleFlags();
+	UpdateAllGroupFlags();
+	return validGroups && reader->HasFailed() == false;
+}
+
+void b2ParticleSystem::CaptureState(b2BinaryWriter* writer) const
+{
+	Serialize(writer);
+
+	writer->Write(m_allParticleFlags);
+	writer->Write(m_needsUpdateAllParticleFlags);
+	writer->Write(m_allGroupFlags);
+	writer->Write(m_needsUpdateAllGroupFlags);
+
+	// Proxies are sorted by tag, and contacts are found, in the order the
+	// proxies were left in by the last step.
+	if (m_def.largeWorld)
+	{
+		writer->Write(m_wideProxyBuffer.GetCount());
+		writer->WriteArray(m_wideProxyBuffer.Data(),
+						   m_wideProxyBuffer.GetCount());
+	}
+	else
+	{
+		writer->Write(m_proxyBuffer.GetCount());
+		writer->WriteArray(m_proxyBuffer.Data(), m_proxyBuffer.GetCount());
+	}
+	writer->Write(m_contactBuffer.GetCount());
+	writer->WriteArray(m_contactBuffer.Data(), m_contactBuffer.GetCount());
+	writer->Write(m_bodyContactBuffer.GetCount());
+	writer->WriteArray(m_bodyContactBuffer.Data(),
+					   m_bodyContactBuffer.GetCount());
+	writer->WriteArray(m_weightBuffer, m_count);
+
+	// Static pressure is solved starting from the last step's.
+	bool staticPressure = m_staticPressureBuffer != NULL;
+	writer->Write(staticPressure);
+	if (staticPressure)
+	{
+		writer->WriteArray(m_staticPressureBuffer, m_count);
+	}
+}
+
+void b2ParticleSystem::RestoreState(b2BinaryReader* reader)
+{
+	// Handles refer to particles that may have moved or been destroyed.
+	if (m_handleIndexBuffer.data)
+	{
+		for (int32 i = 0; i < m_count; i++)
+		{
+			b2ParticleHandle * const handle = m_handleIndexBuffer.data[i];
+			if (handle)
+			{
+				handle->SetIndex(b2_invalidParticleIndex);
+				m_handleIndexBuffer.data[i] = NULL;
+				m_handleAllocator.Free(handle);
+			}
+		}
+	}
+
+	// Serialize writes the groups from the end of the list, so they're
+	// reused in that order.
+	b2ParticleGroup* reusableGroups = NULL;
+	for (b2ParticleGroup* group = m_groupList; group;)
+	{
+		b2ParticleGroup* next = group->m_next;
+		group->m_next = reusableGroups;
+		reusableGroups = group;
+		group = next;
+	}
+	m_groupList = NULL;
+	m_groupCount = 0;
+	m_count = 0;
+	m_proxyBuffer.SetCount(0);
+	m_wideProxyBuffer.SetCount(0);
+	m_pairBuffer.SetCount(0);
+	m_triadBuffer.SetCount(0);
+	m_idSlotBuffer.SetCount(0);
+	m_stuckParticleBuffer.SetCount(0);
+
+	bool restored = Deserialize(reader, &reusableGroups);
+	b2Assert(restored);
+	B2_NOT_USED(restored);
+
+	// Destroy the groups that were created after the state was captured.
+	while (reusableGroups)
+	{
+		b2ParticleGroup* group = reusableGroups;
+		reusableGroups = group->m_next;
+		if (m_world->m_destructionListener)
+		{
+			m_world->m_destructionListener->SayGoodbye(group);
+		}
+		group->~b2ParticleGroup();
+		m_blockAllocator.Free(group, sizeof(b2ParticleGroup));
+	}
+
+	reader->Read(&m_allParticleFlags);
+	reader->Read(&m_needsUpdateAllParticleFlags);
+	reader->Read(&m_allGroupFlags);
+	reader->Read(&m_needsUpdateAllGroupFlags);
+
+	int32 proxyCount = reader->ReadCount(sizeof(int32));
+	if (m_def.largeWorld)
+	{
+		m_wideProxyBuffer.Reserve(proxyCount);
+		m_wideProxyBuffer.SetCount(proxyCount);
+		reader->ReadArray(m_wideProxyBuffer.Data(), proxyCount);
+	}
+	else
+	{
+		m_proxyBuffer.Reserve(proxyCount);
+		m_proxyBuffer.SetCount(proxyCount);
+		reader->ReadArray(m_proxyBuffer.Data(), proxyCount);
+	}
+	int32 contactCount = reader->ReadCount(sizeof(b2ParticleContact));
+	m_contactBuffer.Reserve(contactCount);
+	m_contactBuffer.SetCount(contactCount);
+	reader->ReadArray(m_contactBuffer.Data(), contactCount);
+	int32 bodyContactCount = reader->ReadCount(sizeof(b2ParticleBodyContact));
+	m_bodyContactBuffer.Reserve(bodyContactCount);
+	m_bodyContactBuffer.SetCount(bodyContactCount);
+	reader->ReadArray(m_bodyContactBuffer.Data(), bodyContactCount);
+	reader->ReadArray(m_weightBuffer, m_count);
+
+	bool staticPressure = false;
+	reader->Read(&staticPressure);
+	if (staticPressure)
+	{
+		m_staticPressureBuffer = RequestBuffer(m_staticPressureBuffer);
+		reader->ReadArray(m_staticPressureBuffer, m_count);
+	}
+}